@@ -0,0 +1,282 @@
+/*
+ * cq-bench -- Callout queue benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * This runs the same timer workload against a callout queue using the
+ * sorted hash list (cq_make) and one using the timing wheel (cq_make_wheel):
+ * a set of pending events is inserted, rescheduled, then the queue is run
+ * for a number of periods, each fired event being re-armed, and finally all
+ * the remaining events are cancelled.
+ *
+ * The time spent in each phase is reported per operation, and the events
+ * are checked for never being triggered too early.
+ */
+
+#include "common.h"
+
+#include "lib/cq.h"
+#include "lib/misc.h"
+#include "lib/path.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#include "lib/override.h"
+
+struct timer {
+	cevent_t *ev;			/**< Pending event */
+	cq_time_t due;			/**< Expected trigger time */
+	uint32 seed;			/**< Re-arming delay generator */
+};
+
+static const char *progname;
+static struct timer *timers;
+static cq_time_t now;			/**< Current virtual time */
+static int max_delay = 60000;
+static size_t fired, early;
+static cq_time_t max_late;
+
+static void G_GNUC_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-h] [-c count] [-d delay] [-p period] [-t ticks] "
+			"[-R seed]\n"
+		"  -c : amount of pending events (default 100000)\n"
+		"  -d : maximum event delay in ms (default 60000)\n"
+		"  -h : prints this help message\n"
+		"  -p : heartbeat period in ms (default 25)\n"
+		"  -t : amount of heartbeats to run (default 10000)\n"
+		"  -R : seed for repeatable random delays\n"
+		, progname);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Compute next delay for a re-armed timer.
+ *
+ * This does not use rand31() so that both queues see the very same
+ * sequence of events regardless of the order in which they fire them.
+ */
+static int
+timer_delay(struct timer *t)
+{
+	t->seed = t->seed * 1103515245U + 12345U;
+	return 1 + (t->seed >> 8) % max_delay;
+}
+
+static void
+timer_fire(cqueue_t *cq, void *arg)
+{
+	struct timer *t = arg;
+	int delay;
+
+	cq_zero(cq, &t->ev);
+	fired++;
+
+	if (now < t->due)
+		early++;
+	else
+		max_late = MAX(max_late, now - t->due);
+
+	delay = timer_delay(t);
+	t->due = now + delay;
+	t->ev = cq_insert(cq, delay, timer_fire, t);
+}
+
+static double
+per_op(double elapsed, size_t ops)
+{
+	return 0 == ops ? 0.0 : elapsed * 1e9 / ops;
+}
+
+/**
+ * Run the workload on the given queue.
+ */
+static void
+run(const char *what, cqueue_t *cq,
+	const int *delays, size_t count, int period, uint ticks)
+{
+	tm_nano_t start, end;
+	double elapsed;
+	size_t i;
+	uint n;
+
+	now = 0;
+	fired = early = 0;
+	max_late = 0;
+
+	/*
+	 * Run the queue once so that it records our thread as the one running
+	 * it, or inserted events would be created as "extended" ones.
+	 */
+
+	cq_advance(cq, 0);
+
+	printf("%s:\n", what);
+
+	tm_precise_time(&start);
+	for (i = 0; i < count; i++) {
+		struct timer *t = &timers[i];
+
+		t->due = delays[i];
+		t->seed = i;
+		t->ev = cq_insert(cq, delays[i], timer_fire, t);
+	}
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+	printf("  insert:  %.0f ns per event\n", per_op(elapsed, count));
+
+	tm_precise_time(&start);
+	for (i = 0; i < count; i++) {
+		struct timer *t = &timers[i];
+		int delay = delays[count - 1 - i];
+
+		t->due = delay;
+		cq_resched(t->ev, delay);
+	}
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+	printf("  resched: %.0f ns per event\n", per_op(elapsed, count));
+
+	tm_precise_time(&start);
+	for (n = 0; n < ticks; n++) {
+		now += period;
+		cq_advance(cq, period);
+	}
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+	printf("  ticks:   %.0f ns per tick, %zu event%s fired "
+		"(%.0f ns per event)\n",
+		per_op(elapsed, ticks), fired, plural(fired), per_op(elapsed, fired));
+
+	g_assert(cq_count(cq) == (int) count);
+
+	tm_precise_time(&start);
+	for (i = 0; i < count; i++)
+		cq_cancel(&timers[i].ev);
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+	printf("  cancel:  %.0f ns per event\n", per_op(elapsed, count));
+
+	printf("  late:    at most %s ms\n", uint64_to_string(max_late));
+
+	if (early != 0) {
+		fprintf(stderr, "%s: %s queue fired %zu event%s too early\n",
+			progname, what, early, plural(early));
+		exit(EXIT_FAILURE);
+	}
+
+	g_assert(0 == cq_count(cq));
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 100000;
+	int period = 25;
+	uint ticks = 10000;
+	unsigned rseed = 0;
+	int *delays;
+	size_t i, hash_fired;
+	cqueue_t *cq;
+	int c;
+
+	mingw_early_init();
+	progname = filepath_basename(argv[0]);
+
+	while ((c = getopt(argc, argv, "c:d:hp:t:R:")) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of pending events */
+			count = atol(optarg);
+			break;
+		case 'd':			/* maximum delay */
+			max_delay = atoi(optarg);
+			break;
+		case 'p':			/* heartbeat period */
+			period = atoi(optarg);
+			break;
+		case 't':			/* amount of heartbeats */
+			ticks = atoi(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count || max_delay <= 0 || period <= 0)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	XMALLOC0_ARRAY(timers, count);
+	XMALLOC_ARRAY(delays, count);
+
+	for (i = 0; i < count; i++)
+		delays[i] = 1 + rand31_value(max_delay - 1);
+
+	printf("%zu pending events, delays up to %d ms, %u ticks of %d ms, "
+		"seed %u\n", count, max_delay, ticks, period, rand31_initial_seed());
+
+	cq = cq_make("hash", 0, period);
+	run("hash list", cq, delays, count, period, ticks);
+	cq_free_null(&cq);
+	hash_fired = fired;
+
+	cq = cq_make_wheel("wheel", 0, period);
+	run("timing wheel", cq, delays, count, period, ticks);
+	cq_free_null(&cq);
+
+	if (hash_fired != fired) {
+		fprintf(stderr, "%s: hash list fired %zu event%s, wheel fired %zu\n",
+			progname, hash_fired, plural(hash_fired), fired);
+		exit(EXIT_FAILURE);
+	}
+
+	xfree(delays);
+	xfree(timers);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,323 @@
+/*
+ * header-bench -- HTTP header parsing benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * This parses typical Gnutella HTTP and handshaking headers with the
+ * header_append() routine used by core/http.c and core/ioheader.c, then
+ * looks up the fields the core usually asks for, both known ones, which
+ * are stored in fixed slots, and other ones, which are kept in a hash
+ * table.
+ *
+ * The time spent parsing and looking up is reported per operation, and
+ * the retrieved values are checked against the parsed text.
+ */
+
+#include "common.h"
+
+#include "lib/header.h"
+#include "lib/misc.h"
+#include "lib/path.h"
+#include "lib/tm.h"
+
+#include "lib/override.h"
+
+static const char *progname;
+
+/*
+ * Header lines, without their trailing "\r\n".  Each header ends with
+ * an empty line.
+ */
+static const char *lines[] = {
+	/* Upload request */
+	"Host: 10.0.0.1:6346",
+	"User-Agent: gtk-gnutella/1.1.0 (2014-03-09; GTK2; Linux x86_64)",
+	"X-Token: 1ZSfLmDpJ0VAF0oSh3dMyrDDFD0=; gtk-gnutella/1.1.0",
+	"Range: bytes=0-524287",
+	"X-Queue: 0.1",
+	"X-Gnutella-Content-URN: urn:sha1:PLSTHIPQGSSZTS5FJUPAKUZWUGYQYPFB",
+	"X-Alt: 10.0.0.2:6346, 10.0.0.3:6348, 10.0.0.4, 10.0.0.5:7000,",
+	"  10.0.0.6:6346, 10.0.0.7:6346",
+	"X-Nalt: 10.0.0.8:6346",
+	"X-Features: browse/1.0, fwalt/0.1, tls/1.0, g2/1.0",
+	"X-Node: 10.0.0.9:6346",
+	"X-Downloaded: 4194304",
+	"Connection: Keep-Alive",
+	"",
+	/* Download reply */
+	"HTTP/1.1 206 Partial Content",
+	"Server: gtk-gnutella/1.1.0 (2014-03-09; GTK2; Linux x86_64)",
+	"Content-Type: application/octet-stream",
+	"Content-Length: 524288",
+	"Content-Range: bytes 0-524287/7340032",
+	"Last-Modified: Sun, 09 Mar 2014 10:33:41 GMT",
+	"X-Available-Ranges: bytes 0-7340031",
+	"X-Gnutella-Content-URN: urn:sha1:PLSTHIPQGSSZTS5FJUPAKUZWUGYQYPFB",
+	"X-Thex-URI: /uri-res/N2X?urn:sha1:PLSTHIPQGSSZTS5FJUPAKUZWUGYQYPFB;"
+		"VC3NKFKR6P6T47EVVM33Q43VXN2I5KD3ISQLGWI",
+	"X-Alt: 10.0.0.10:6346",
+	"X-Alt: 10.0.0.11:6346",
+	"X-Queued: position=3; length=12; limit=4; pollMin=45; pollMax=120",
+	"X-Hostname: gnutella.example.com",
+	"Retry-After: 120",
+	"",
+	/* Handshaking reply */
+	"GNUTELLA/0.6 200 OK",
+	"User-Agent: gtk-gnutella/1.1.0 (2014-03-09; GTK2; Linux x86_64)",
+	"Remote-IP: 10.0.0.12",
+	"Listen-IP: 10.0.0.13:6346",
+	"X-Ultrapeer: True",
+	"X-Ultrapeer-Needed: False",
+	"X-Query-Routing: 0.2",
+	"X-Ultrapeer-Query-Routing: 0.1",
+	"X-Degree: 32",
+	"X-Dynamic-Querying: 0.1",
+	"X-Max-TTL: 4",
+	"X-Ext-Probes: 0.1",
+	"X-Guess: 0.2",
+	"Pong-Caching: 0.1",
+	"GGEP: 0.5",
+	"Vendor-Message: 0.2",
+	"Bye-Packet: 0.1",
+	"Accept-Encoding: deflate",
+	"X-Live-Since: 2014-03-09 10:33:41Z",
+	"",
+};
+
+/*
+ * Fields looked up after each header was parsed, with the value we expect
+ * to get back, NULL when it should be missing.
+ */
+static const struct lookup {
+	const char *field;
+	const char *value;
+} lookups[] = {
+	{ "Host",				"10.0.0.1:6346" },
+	{ "X-Token",			"1ZSfLmDpJ0VAF0oSh3dMyrDDFD0=; "
+								"gtk-gnutella/1.1.0" },
+	{ "Range",				"bytes=0-524287" },
+	{ "X-Queue",			"0.1" },
+	{ "X-Gnutella-Content-Urn",
+		"urn:sha1:PLSTHIPQGSSZTS5FJUPAKUZWUGYQYPFB" },
+	{ "X-Alt",				"10.0.0.2:6346, 10.0.0.3:6348, 10.0.0.4, "
+								"10.0.0.5:7000, 10.0.0.6:6346, 10.0.0.7:6346" },
+	{ "X-Features",			"browse/1.0, fwalt/0.1, tls/1.0, g2/1.0" },
+	{ "Content-URN",		NULL },
+	{ "X-Push-Proxies",		NULL },
+	{ NULL, NULL },
+	{ "Content-Length",		"524288" },
+	{ "Last-Modified",		"Sun, 09 Mar 2014 10:33:41 GMT" },
+	{ "X-Alt",				"10.0.0.10:6346, 10.0.0.11:6346" },
+	{ "x-queued",			"position=3; length=12; limit=4; pollMin=45; "
+								"pollMax=120" },
+	{ "X-Queue",			NULL },
+	{ "X-Falt",				NULL },
+	{ "X-Content-URN",		NULL },
+	{ NULL, NULL },
+	{ "Remote-IP",			"10.0.0.12" },
+	{ "Listen-Ip",			"10.0.0.13:6346" },
+	{ "X-Ultrapeer",		"True" },
+	{ "X-Ultrapeer-Query-Routing",	"0.1" },
+	{ "GGEP",				"0.5" },
+	{ "X-Try-Hubs",			NULL },
+	{ "Crawler",			NULL },
+	{ NULL, NULL },
+};
+
+static void G_GNUC_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-h] [-c count]\n"
+		"  -c : amount of times each header is parsed (default 100000)\n"
+		"  -h : prints this help message\n"
+		, progname);
+	exit(EXIT_FAILURE);
+}
+
+static double
+per_op(double elapsed, size_t ops)
+{
+	return 0 == ops ? 0.0 : elapsed * 1e9 / ops;
+}
+
+/**
+ * Parse header whose lines start at index `first' in lines[].
+ *
+ * @return index of the line following the end of the header.
+ */
+static size_t
+parse(header_t *h, size_t first)
+{
+	size_t i;
+	int error;
+
+	header_reset(h);
+
+	for (i = first; /* empty */; i++) {
+		const char *line = lines[i];
+
+		/*
+		 * Status lines are not part of the header, as in core/http.c
+		 */
+
+		if (i == first && is_strprefix(line, "HTTP/"))
+			continue;
+		if (i == first && is_strprefix(line, "GNUTELLA/"))
+			continue;
+
+		error = header_append(h, line, strlen(line));
+		if (HEAD_EOH == error)
+			break;
+		if (HEAD_OK != error) {
+			fprintf(stderr, "%s: cannot parse \"%s\": %s\n",
+				progname, line, header_strerror(error));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return i + 1;
+}
+
+/**
+ * Lookup fields for the header, starting at index `first' in lookups[].
+ *
+ * @return index of the lookup following the last one for the header.
+ */
+static size_t
+lookup(const header_t *h, size_t first, bool check)
+{
+	size_t i;
+
+	for (i = first; lookups[i].field != NULL; i++) {
+		const struct lookup *l = &lookups[i];
+		const char *v = header_get(h, l->field);
+
+		if (!check)
+			continue;
+
+		if (
+			(NULL == v) != (NULL == l->value) ||
+			(v != NULL && 0 != strcmp(v, l->value))
+		) {
+			fprintf(stderr, "%s: got %s%s%s for \"%s\", expected %s%s%s\n",
+				progname, NULL == v ? "" : "\"", NULL_STRING(v),
+				NULL == v ? "" : "\"", l->field,
+				NULL == l->value ? "" : "\"", NULL_STRING(l->value),
+				NULL == l->value ? "" : "\"");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return i + 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 100000;
+	size_t i, j, n, headers, fields, gets;
+	size_t next = 0;
+	tm_nano_t start, end;
+	double parsing, looking;
+	header_t *h;
+	int c;
+
+	mingw_early_init();
+	progname = filepath_basename(argv[0]);
+
+	while ((c = getopt(argc, argv, "c:h")) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of parsing rounds */
+			count = atol(optarg);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count)
+		usage();
+
+	h = header_make();
+
+	/*
+	 * Check the values we get back once, before timing anything.
+	 */
+
+	for (i = n = headers = 0; i < G_N_ELEMENTS(lines); headers++) {
+		i = parse(h, i);
+		n = lookup(h, n, TRUE);
+	}
+	g_assert(G_N_ELEMENTS(lookups) == n);
+
+	fields = G_N_ELEMENTS(lines) - headers;
+	gets = G_N_ELEMENTS(lookups) - headers;
+
+	printf("%zu headers, %zu lines, %zu lookups, %zu rounds\n",
+		headers, fields, gets, count);
+
+	tm_precise_time(&start);
+	for (n = 0; n < count; n++) {
+		for (i = 0; i < G_N_ELEMENTS(lines); /* empty */)
+			i = parse(h, i);
+	}
+	tm_precise_time(&end);
+	parsing = tm_precise_elapsed_f(&end, &start);
+
+	looking = 0.0;
+
+	for (i = j = 0; i < G_N_ELEMENTS(lines); j = next) {
+		i = parse(h, i);
+		tm_precise_time(&start);
+		for (n = 0; n < count; n++)
+			next = lookup(h, j, FALSE);
+		tm_precise_time(&end);
+		looking += tm_precise_elapsed_f(&end, &start);
+	}
+
+	header_free_null(&h);
+
+	printf("  parse:   %.0f ns per header, %.0f ns per line\n",
+		per_op(parsing, headers * count), per_op(parsing, fields * count));
+	printf("  lookup:  %.0f ns per field\n", per_op(looking, gets * count));
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
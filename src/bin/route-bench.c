@@ -0,0 +1,1280 @@
+/*
+ * route-bench -- Gnutella routing table benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * This replays a stream of Gnutella messages (queries, query hits and
+ * pushes) through the routing table of core/routing.c and the QRP query
+ * routing of core/qrp.c, using stub nodes, in order to evaluate them
+ * offline.
+ *
+ * One stub node in four is an ultrapeer, the others are leaves which
+ * supplied a QRP table listing words taken from a synthetic vocabulary.
+ * New queries are dispatched to the nodes selected by the QRP layer.
+ *
+ * The stream is either synthetic, with a realistic reuse of GUIDs, or read
+ * from a file holding one message per line:
+ *
+ *    Q <muid> <node> <ttl> <query>   query received from node
+ *    H <muid> <servent> <node>       query hit from servent, received from node
+ *    P <servent> <node>              push targeted to servent, from node
+ *
+ * GUIDs are given as 32 hexadecimal digits.  A synthetic stream can be
+ * saved in that format with -o, to be replayed later.
+ *
+ * With -O, the same stream is replayed through a copy of the former routing
+ * table of core/routing.c, which kept messages in cycled chunks indexed by
+ * a hash set, with linked lists of routes.
+ */
+
+#include "common.h"
+
+#define CORE_SOURCES
+
+#include "core/gnutella.h"
+#include "core/nodes.h"
+#include "core/qrp.h"
+#include "core/routing.h"
+
+#include "if/core/main.h"
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/base16.h"
+#include "lib/endian.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hset.h"
+#include "lib/misc.h"
+#include "lib/path.h"
+#include "lib/pow2.h"
+#include "lib/pslist.h"
+#include "lib/rand31.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/wordvec.h"
+#include "lib/xmalloc.h"
+#include "lib/xsort.h"
+
+#include "lib/override.h"
+
+#define FN_QUERY_HIT_ROUTE	0x00	/**< Same as QUERY_HIT_ROUTE_SAVE */
+
+#define RECENT_QUERIES		4096	/**< Recent queries, for dups and hits */
+#define SAMPLE_RATE			16		/**< Time one operation every that many */
+#define MAX_NODES			65536	/**< Nodes are numbered on 16 bits */
+
+#define QUERY_HOPS			1		/**< Hop count of queries we route */
+#define REPLY_TTL			5		/**< TTL of query hits and pushes */
+
+#define VOCABULARY			4096	/**< Amount of words in vocabulary */
+#define WORD_MIN			3		/**< Minimum word length */
+#define WORD_MAX			10		/**< Maximum word length */
+#define QUERY_WORDS			3		/**< Maximum amount of words in query */
+#define LEAF_WORDS			512		/**< Words shared by each leaf */
+
+#define QRT_SLOTS			65536	/**< Slots in the leaf QRP tables */
+#define QRT_INFINITY		7		/**< Infinity value of the leaf tables */
+
+enum event_type {
+	EV_QUERY = 'Q',
+	EV_HIT = 'H',
+	EV_PUSH = 'P'
+};
+
+struct bench_event {
+	guid_t muid;				/**< Query MUID (queries and hits) */
+	guid_t servent;				/**< Servent GUID (hits and pushes) */
+	const char *query;			/**< Query text, atom (queries) */
+	uint16 node;				/**< Stub node from which we got message */
+	uint8 ttl;					/**< Message TTL */
+	uint8 type;					/**< Event type */
+};
+
+/*
+ * The former routing table of core/routing.c.
+ *
+ * Messages were allocated in chunks of slots that were cycled over, the
+ * message in the slot being reused being discarded, and indexed by a hash
+ * set.  Each message kept its routes and their TTL in linked lists.
+ */
+
+#define CHUNK_BITS			14	/**< log2 of # messages stored in a chunk */
+#define MAX_CHUNKS			64	/**< Max # of chunks */
+#define TABLE_MIN_CYCLE		3600	/**< 1 hour at least */
+
+#define CHUNK_MESSAGES		(1 << CHUNK_BITS)
+#define CHUNK_INDEX(x)		(((x) & ~(CHUNK_MESSAGES - 1)) >> CHUNK_BITS)
+#define ENTRY_INDEX(x)		((x) & (CHUNK_MESSAGES - 1))
+
+struct old_route_data {
+	gnutella_node_t *node;		/**< Node, NULL when gone */
+	int32 saved_messages;		/**< # msg from this node in routing table */
+};
+
+struct old_message {
+	guid_t muid;				/**< Message UID */
+	struct old_message **slot;	/**< Place where we're referenced from */
+	pslist_t *routes;			/**< old_route_data from where message came */
+	pslist_t *ttls;				/**< For broadcasted messages: TTL by route */
+	uint8 function;				/**< Type of the message */
+	uint8 ttl;					/**< Max TTL we saw for this message */
+	uint8 chunk_idx;			/**< Index of chunk holding the slot */
+};
+
+static struct {
+	struct old_message **chunks[MAX_CHUNKS];
+	uint next_idx;				/**< Next slot to use */
+	uint capacity;				/**< Capacity in terms of messages */
+	uint count;					/**< Amount really stored */
+	uint nchunks;				/**< Amount of allocated chunks */
+	size_t routes;				/**< Amount of routes recorded */
+	size_t links;				/**< Amount of list cells allocated */
+	hset_t *messages_hashed;	/**< All messages */
+	time_t last_rotation;		/**< Last time we restarted from idx=0 */
+	struct old_route_data *rd;	/**< Route data, indexed by node number */
+} old;
+
+static const char *progname;
+static bool old_table;
+
+static char vocabulary[VOCABULARY][WORD_MAX + 1];
+static gnutella_node_t **stub_nodes;
+static uint stub_count;
+static pslist_t *candidates;	/**< All stub nodes, for QRP routing */
+static query_hashvec_t *qhvec;
+
+static size_t n_dups;			/**< Duplicate queries */
+static size_t n_routed;			/**< Hits and pushes with a route */
+static size_t n_lost;			/**< Hits and pushes without a route */
+static size_t n_leaf_targets;	/**< Leaves selected by QRP */
+static size_t n_ultra_targets;	/**< Ultrapeers selected by QRP */
+static size_t n_queries;		/**< New queries routed */
+
+static void G_GNUC_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hO] [-c count] [-d dup%%] [-f file] [-g servents]\n"
+		"       [-n nodes] [-o file] [-R seed]\n"
+		"  -c : amount of synthetic messages (default 1000000)\n"
+		"  -d : percentage of queries received again from another node\n"
+		"  -f : replay messages from file instead of synthetic stream\n"
+		"  -g : size of the servent GUID pool (default 10000)\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of stub nodes, at most %u (default 32)\n"
+		"  -o : save synthetic stream to file\n"
+		"  -O : use the former routing table (chunks and route lists)\n"
+		"  -R : seed for repeatable random stream\n"
+		, progname, MAX_NODES - 1);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Routines normally supplied by the main program, which the core needs.
+ */
+
+/**
+ * Are we debugging anything at a level greater than ``t''?
+ */
+bool
+debugging(uint t)
+{
+	(void) t;
+	return FALSE;
+}
+
+/**
+ * Request a shutdown, which does not happen during a benchmark.
+ */
+void
+gtk_gnutella_request_shutdown(enum shutdown_mode mode, unsigned flags)
+{
+	(void) mode;
+	(void) flags;
+}
+
+/**
+ * Exit program.
+ */
+void
+gtk_gnutella_exit(int code)
+{
+	exit(code);
+}
+
+/**
+ * @return the command line, as an halloc()'ed string.
+ */
+char *
+main_command_line(void)
+{
+	return h_strdup(progname);
+}
+
+/**
+ * @return the GTK version string, NULL since we have no GUI.
+ */
+const char *
+gtk_version_string(void)
+{
+	return NULL;
+}
+
+/**
+ * Compute QRP hash of ASCII word on ``bits'' bits, as defined by the QRP
+ * specifications and implemented by core/qrp.c.
+ */
+static uint
+qrp_word_hash(const char *s, int bits)
+{
+	uint32 x = 0;
+	uint j;
+
+	for (j = 0; '\0' != *s; s++, j = (j + 8) & 24)
+		x ^= (uint32) (uchar) *s << j;
+
+	return (uint32) (x * GOLDEN_RATIO_31) >> (32 - bits);
+}
+
+/**
+ * Fill vocabulary with random lowercase words.
+ */
+static void
+vocabulary_init(void)
+{
+	size_t i;
+
+	/* Same checks as qrp_init() */
+	g_assert(qrp_word_hash("ebcklmenq", 13) == 3527);
+	g_assert(qrp_word_hash("ndflalem", 16) == 37658);
+	g_assert(qrp_word_hash("7777a88a8a8a8", 10) == 342);
+
+	for (i = 0; i < VOCABULARY; i++) {
+		char *w = vocabulary[i];
+		int j, len = WORD_MIN + rand31_value(WORD_MAX - WORD_MIN);
+
+		for (j = 0; j < len; j++)
+			w[j] = 'a' + rand31_value(25);
+		w[len] = '\0';
+	}
+}
+
+/**
+ * Pick a word from the vocabulary, a few words being far more popular.
+ */
+static const char *
+pick_word(void)
+{
+	double r = rand31_double();
+
+	return vocabulary[(size_t) (r * r * VOCABULARY)];
+}
+
+/**
+ * Have stub leaf node send us its QRP table, via a RESET and a PATCH.
+ */
+static void
+stub_node_send_qrt(gnutella_node_t *n)
+{
+	struct qrt_receive *qr;
+	size_t len = sizeof(gnutella_qrp_patch_t) + QRT_SLOTS / 2;
+	char *msg, *patch;
+	bool done;
+	uint i;
+
+	msg = xmalloc0(len);
+	gnutella_header_set_function(&n->header, GTA_MSG_QRP);
+	n->data = msg;
+
+	msg[0] = GTA_MSGV_QRP_RESET;
+	poke_le32(&msg[1], QRT_SLOTS);
+	msg[5] = QRT_INFINITY;
+	n->size = sizeof(gnutella_qrp_reset_t);
+
+	qr = qrt_receive_create(n, NULL);
+	if (!qrt_receive_next(qr, &done))
+		g_error("QRP RESET rejected");
+
+	/*
+	 * Uncompressed 4-bit patch: -1 in the slots of the words we share,
+	 * the first slot being held in the upper quartet.
+	 */
+
+	msg[0] = GTA_MSGV_QRP_PATCH;
+	msg[1] = 1;				/* Sequence number */
+	msg[2] = 1;				/* Sequence size */
+	msg[3] = 0;				/* No compression */
+	msg[4] = 4;				/* Entry bits */
+	patch = &msg[sizeof(gnutella_qrp_patch_t)];
+
+	for (i = 0; i < LEAF_WORDS; i++) {
+		uint slot = qrp_word_hash(pick_word(), highest_bit_set(QRT_SLOTS));
+		patch[slot / 2] |= (slot & 0x1) ? 0x0f : 0xf0;
+	}
+
+	n->size = len;
+
+	if (!qrt_receive_next(qr, &done) || !done)
+		g_error("QRP PATCH rejected");
+
+	qrt_receive_free(qr);
+	n->data = NULL;
+	n->size = 0;
+	xfree(msg);
+}
+
+/**
+ * Create stub nodes.
+ */
+static void
+stub_nodes_init(uint count)
+{
+	uint i;
+
+	stub_count = count;
+	XMALLOC_ARRAY(stub_nodes, count);
+
+	for (i = 0; i < count; i++) {
+		gnutella_node_t *n;
+
+		WALLOC0(n);
+		n->magic = NODE_MAGIC;
+		n->peermode = 0 == i % 4 ? NODE_P_ULTRA : NODE_P_LEAF;
+		n->flags = NODE_F_ESTABLISHED | NODE_F_READABLE | NODE_F_WRITABLE;
+		n->hops_flow = MAX_INT_VAL(uint8);
+		stub_nodes[i] = n;
+		candidates = pslist_prepend(candidates, n);
+
+		if (NODE_IS_LEAF(n))
+			stub_node_send_qrt(n);
+	}
+
+	qhvec = qhvec_alloc(QRP_HVEC_MAX);
+}
+
+/**
+ * Dispose of stub nodes, once the routing table is gone.
+ */
+static void
+stub_nodes_close(void)
+{
+	uint i;
+
+	for (i = 0; i < stub_count; i++) {
+		gnutella_node_t *n = stub_nodes[i];
+
+		if (n->recv_query_table != NULL)
+			node_qrt_discard(n);
+		WFREE(n);
+	}
+
+	pslist_free_null(&candidates);
+	qhvec_free(qhvec);
+	XFREE_NULL(stub_nodes);
+}
+
+/**
+ * Compute hash of old message.
+ */
+static uint
+old_message_hash(const void *key)
+{
+	const struct old_message *msg = key;
+
+	return integer_hash(msg->function) ^
+		universal_hash(&msg->muid, GUID_RAW_SIZE);
+}
+
+/**
+ * Compute secondary hash of old message.
+ */
+static uint
+old_message_hash2(const void *key)
+{
+	const struct old_message *msg = key;
+
+	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
+}
+
+/**
+ * Are two old messages equal?
+ */
+static int
+old_message_eq(const void *p, const void *q)
+{
+	const struct old_message *a = p, *b = q;
+
+	return a->function == b->function && guid_eq(&a->muid, &b->muid);
+}
+
+/**
+ * Dispose of the route lists of old message.
+ */
+static void
+old_free_route_list(struct old_message *m)
+{
+	pslist_t *sl;
+
+	PSLIST_FOREACH(m->routes, sl) {
+		struct old_route_data *rd = sl->data;
+
+		g_assert(rd->saved_messages > 0);
+		rd->saved_messages--;
+		old.routes--;
+		old.links--;
+	}
+
+	old.links -= pslist_length(m->ttls);
+	pslist_free_null(&m->routes);
+	pslist_free_null(&m->ttls);
+}
+
+/**
+ * Clean old message whose slot is about to be reused.
+ */
+static void
+old_clean_entry(struct old_message *m)
+{
+	hset_remove(old.messages_hashed, m);
+	old_free_route_list(m);
+	m->ttl = 0;
+}
+
+/**
+ * Free all chunks starting with specified chunk index.
+ */
+static void
+old_routing_clear(uint idx)
+{
+	uint i;
+
+	for (i = idx; i < old.nchunks; i++) {
+		struct old_message **rchunk = old.chunks[i];
+		uint j;
+
+		for (j = 0; j < CHUNK_MESSAGES; j++) {
+			struct old_message *m = rchunk[j];
+
+			if (m != NULL) {
+				old_clean_entry(m);
+				WFREE(m);
+				old.count--;
+			}
+		}
+
+		old.capacity -= CHUNK_MESSAGES;
+		HFREE_NULL(old.chunks[i]);
+	}
+
+	old.nchunks = idx;
+}
+
+/**
+ * Advance slot index.
+ */
+static void
+old_advance_slot(void)
+{
+	old.next_idx++;
+
+	if (CHUNK_INDEX(old.next_idx) >= MAX_CHUNKS)
+		old.next_idx = 0;		/* Will force cycling over next time */
+}
+
+/**
+ * Fetch next slot of the old routing table, cycling over the table or
+ * allocating a new chunk as needed.
+ */
+static struct old_message **
+old_get_next_slot(uint *cidx)
+{
+	uint idx = old.next_idx;
+	uint chunk_idx = CHUNK_INDEX(idx);
+	struct old_message **chunk = old.chunks[chunk_idx];
+	struct old_message **slot;
+	time_t now = tm_time();
+	time_delta_t elapsed = delta_time(now, old.last_rotation);
+
+	if G_UNLIKELY(0 == idx && NULL != chunk) {
+		old.last_rotation = now;	/* Just cycled over */
+		elapsed = 0;
+	}
+
+	if G_UNLIKELY(elapsed > TABLE_MIN_CYCLE) {
+		if (chunk != NULL && 0 == ENTRY_INDEX(idx)) {
+			old_routing_clear(chunk_idx);
+			chunk = NULL;
+		}
+	}
+
+	if (NULL == chunk) {
+		if (idx > 0 && elapsed > TABLE_MIN_CYCLE) {
+			chunk_idx = 0;
+			idx = old.next_idx = 0;
+			old.last_rotation = now;
+			slot = old.chunks[0];
+		} else {
+			g_assert(chunk_idx == old.nchunks);
+
+			old.nchunks++;
+			old.capacity += CHUNK_MESSAGES;
+			old.chunks[chunk_idx] =
+				halloc0(CHUNK_MESSAGES * sizeof(struct old_message *));
+			slot = old.chunks[chunk_idx];
+		}
+	} else {
+		if (0 == idx && MAX_CHUNKS == old.nchunks)
+			old.last_rotation = now;	/* Forced cycling */
+
+		slot = &chunk[ENTRY_INDEX(idx)];
+	}
+
+	old_advance_slot();
+	*cidx = chunk_idx;
+
+	return slot;
+}
+
+/**
+ * Fetch next entry of the old routing table, discarding the message held
+ * in the slot if we cycled over.
+ */
+static struct old_message *
+old_get_next_entry(void)
+{
+	struct old_message **slot;
+	struct old_message *m;
+	uint chunk_idx;
+
+	slot = old_get_next_slot(&chunk_idx);
+	m = *slot;
+
+	if (NULL == m) {
+		WALLOC0(m);
+		*slot = m;
+		old.count++;
+	} else {
+		old_clean_entry(m);
+	}
+
+	m->slot = slot;
+	m->chunk_idx = chunk_idx;
+
+	return m;
+}
+
+/**
+ * Look for message in the old routing table, purging routes to nodes
+ * that are gone.
+ */
+static struct old_message *
+old_find_message(const guid_t *muid, uint8 function)
+{
+	struct old_message dummy;
+	struct old_message *m;
+	pslist_t *sl, *t;
+
+	dummy.muid = *muid;
+	dummy.function = function;
+
+	m = hset_lookup(old.messages_hashed, &dummy);
+
+	if (NULL == m)
+		return NULL;
+
+	for (sl = m->routes, t = m->ttls; sl != NULL; /* empty */) {
+		struct old_route_data *rd = sl->data;
+
+		if (NULL == rd->node) {
+			pslist_t *next = pslist_next(sl);
+			m->routes = pslist_remove_link(m->routes, sl);
+			rd->saved_messages--;
+			old.routes--;
+			old.links--;
+			pslist_free_1(sl);
+			sl = next;
+
+			if (t != NULL) {
+				next = pslist_next(t);
+				m->ttls = pslist_remove_link(m->ttls, t);
+				old.links--;
+				pslist_free_1(t);
+				t = next;
+			}
+		} else {
+			sl = pslist_next(sl);
+			if (t != NULL)
+				t = pslist_next(t);
+		}
+	}
+
+	return m;
+}
+
+/**
+ * Record message in the old routing table, as message_add() used to.
+ */
+static void
+old_message_add(const guid_t *muid, uint8 function, uint node)
+{
+	struct old_route_data *route = &old.rd[node];
+	struct old_message *m;
+	uint8 ttl = gnutella_header_get_ttl(&route->node->header);
+
+	m = old_find_message(muid, function);
+
+	if (m != NULL && NULL != pslist_find(m->routes, route))
+		return;
+
+	if (NULL == m) {
+		m = old_get_next_entry();
+		m->muid = *muid;
+		m->function = function;
+		m->ttl = ttl;
+		hset_insert(old.messages_hashed, m);
+	}
+
+	route->saved_messages++;
+	m->routes = pslist_append(m->routes, route);
+	old.routes++;
+	old.links++;
+
+	switch (function) {
+	case GTA_MSG_PUSH_REQUEST:
+	case GTA_MSG_SEARCH:
+		m->ttls = pslist_append(m->ttls, uint_to_pointer(ttl));
+		old.links++;
+		break;
+	}
+}
+
+/**
+ * Check whether the old routing table has a route for the reply of the
+ * message, as route_exists_for_reply() does.
+ */
+static bool
+old_route_exists_for_reply(const guid_t *muid, uint8 function)
+{
+	struct old_message *m = old_find_message(muid, function & ~0x01);
+
+	return m != NULL && m->routes != NULL;
+}
+
+/**
+ * Create the old routing table.
+ */
+static void
+old_routing_init(void)
+{
+	uint i;
+
+	old.messages_hashed = hset_create_any(old_message_hash,
+		old_message_hash2, old_message_eq);
+	old.last_rotation = tm_time();
+	XMALLOC0_ARRAY(old.rd, stub_count);
+
+	for (i = 0; i < stub_count; i++)
+		old.rd[i].node = stub_nodes[i];
+}
+
+/**
+ * Destroy the old routing table.
+ */
+static void
+old_routing_close(void)
+{
+	old_routing_clear(0);
+	hset_free_null(&old.messages_hashed);
+	XFREE_NULL(old.rd);
+}
+
+/**
+ * Compute the amount of memory used by the old routing table.
+ *
+ * @param messages	written with the amount of messages held
+ * @param routes	written with the amount of routes recorded
+ *
+ * @return amount of bytes used by the chunks, the hash set, the messages
+ * and their lists, the hash set arena being sized at its minimum.
+ */
+static size_t
+old_routing_usage(size_t *messages, size_t *routes)
+{
+	*messages = old.count;
+	*routes = old.routes;
+
+	return old.nchunks * CHUNK_MESSAGES * sizeof(struct old_message *) +
+		next_pow2(old.count) * (sizeof(void *) + sizeof(unsigned)) +
+		old.count * sizeof(struct old_message) +
+		old.links * sizeof(pslist_t);
+}
+
+/**
+ * Record message from node in the routing table.
+ */
+static void
+route_record(const guid_t *muid, uint8 function, uint node)
+{
+	if (old_table)
+		old_message_add(muid, function, node);
+	else
+		message_add(muid, function, stub_nodes[node]);
+}
+
+/**
+ * @return whether we have a route for the reply to the message.
+ */
+static bool
+route_lookup(const guid_t *muid, uint8 function)
+{
+	return old_table ?
+		old_route_exists_for_reply(muid, function) :
+		route_exists_for_reply(muid, function);
+}
+
+/**
+ * Select nodes to which a new query is forwarded, through QRP.
+ */
+static void
+route_query_targets(const struct bench_event *ev)
+{
+	word_vec_t *wovec;
+	pslist_t *targets, *sl;
+	uint i, wocnt;
+
+	qhvec_reset(qhvec);
+	wocnt = word_vec_make(ev->query, &wovec);
+
+	for (i = 0; i < wocnt; i++) {
+		if (wovec[i].len >= QRP_MIN_WORD_LENGTH)
+			qhvec_add(qhvec, wovec[i].word, QUERY_H_WORD);
+	}
+
+	if (wocnt != 0)
+		word_vec_free(wovec, wocnt);
+
+	targets = qrt_build_query_target_from(candidates, qhvec,
+		QUERY_HOPS, ev->ttl, TRUE, stub_nodes[ev->node]);
+
+	PSLIST_FOREACH(targets, sl) {
+		const gnutella_node_t *n = sl->data;
+
+		if (NODE_IS_LEAF(n))
+			n_leaf_targets++;
+		else
+			n_ultra_targets++;
+	}
+
+	pslist_free(targets);
+	n_queries++;
+}
+
+/**
+ * Route one message through the table.
+ */
+static void
+route_event(const struct bench_event *ev)
+{
+	gnutella_header_set_ttl(&stub_nodes[ev->node]->header, ev->ttl);
+
+	switch (ev->type) {
+	case EV_QUERY:
+		if (route_lookup(&ev->muid, GTA_MSG_SEARCH)) {
+			route_record(&ev->muid, GTA_MSG_SEARCH, ev->node);
+			n_dups++;
+		} else {
+			route_record(&ev->muid, GTA_MSG_SEARCH, ev->node);
+			route_query_targets(ev);
+		}
+		break;
+	case EV_HIT:
+		route_record(&ev->servent, FN_QUERY_HIT_ROUTE, ev->node);
+		if (route_lookup(&ev->muid, GTA_MSG_SEARCH_RESULTS))
+			n_routed++;
+		else
+			n_lost++;
+		break;
+	case EV_PUSH:
+		if (route_lookup(&ev->servent, FN_QUERY_HIT_ROUTE))
+			n_routed++;
+		else
+			n_lost++;
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+/**
+ * Pick a servent from the pool, with a skewed distribution since a few
+ * servents generate most of the hits.
+ */
+static const guid_t *
+pick_servent(const guid_t *pool, size_t n)
+{
+	double r = rand31_double();
+
+	return &pool[(size_t) (r * r * r * n)];
+}
+
+/**
+ * Build query text from a few vocabulary words.
+ *
+ * @return query text as a string atom.
+ */
+static const char *
+pick_query(void)
+{
+	char buf[QUERY_WORDS * (WORD_MAX + 1)];
+	size_t pos = 0;
+	int i, n = 1 + rand31_value(QUERY_WORDS - 1);
+
+	for (i = 0; i < n; i++) {
+		pos += str_bprintf(&buf[pos], sizeof buf - pos, "%s%s",
+			0 == i ? "" : " ", pick_word());
+	}
+
+	return atom_str_get(buf);
+}
+
+/**
+ * Generate synthetic stream of `count' messages.
+ */
+static struct bench_event *
+generate(size_t count, uint nodes, uint dup_pct, size_t servents)
+{
+	struct bench_event *events;
+	guid_t *pool;
+	struct bench_event *recent[RECENT_QUERIES];
+	size_t i, nrecent = 0;
+
+	XMALLOC_ARRAY(events, count);
+	XMALLOC_ARRAY(pool, servents);
+	rand31_bytes(pool, servents * sizeof pool[0]);
+
+	for (i = 0; i < count; i++) {
+		struct bench_event *ev = &events[i];
+		int r = rand31_value(99);
+
+		ZERO(ev);
+		ev->node = rand31_value(nodes - 1);
+		ev->ttl = REPLY_TTL;
+
+		if (0 == nrecent || r < 55) {
+			ev->type = EV_QUERY;
+
+			/*
+			 * Duplicate queries come back through another route, new
+			 * ones replace a random recent query.
+			 */
+
+			if (nrecent != 0 && rand31_value(99) < (int) dup_pct) {
+				const struct bench_event *q =
+					recent[rand31_value(nrecent - 1)];
+				ev->muid = q->muid;
+				ev->query = atom_str_get(q->query);
+				ev->ttl = q->ttl;
+				if (nodes > 1 && ev->node == q->node)
+					ev->node = (ev->node + 1) % nodes;
+			} else {
+				rand31_bytes(&ev->muid, sizeof ev->muid);
+				ev->query = pick_query();
+				ev->ttl = 1 + rand31_value(2);
+				if (nrecent < RECENT_QUERIES)
+					recent[nrecent++] = ev;
+				else
+					recent[rand31_value(RECENT_QUERIES - 1)] = ev;
+			}
+		} else if (r < 95) {
+			ev->type = EV_HIT;
+			ev->muid = recent[rand31_value(nrecent - 1)]->muid;
+			ev->servent = *pick_servent(pool, servents);
+		} else {
+			ev->type = EV_PUSH;
+			ev->servent = *pick_servent(pool, servents);
+		}
+	}
+
+	xfree(pool);
+	return events;
+}
+
+/**
+ * Parse GUID in hexadecimal form.
+ */
+static bool
+parse_guid(const char *hex, guid_t *guid)
+{
+	if (NULL == hex || strlen(hex) != 2 * GUID_RAW_SIZE)
+		return FALSE;
+
+	return GUID_RAW_SIZE ==
+		base16_decode(guid->v, sizeof guid->v, hex, 2 * GUID_RAW_SIZE);
+}
+
+/**
+ * Parse node number, which must be less than ``nodes''.
+ */
+static bool
+parse_node(const char *s, uint nodes, uint16 *node)
+{
+	int n;
+
+	if (NULL == s)
+		return FALSE;
+
+	n = atoi(s);
+	if (n < 0 || UNSIGNED(n) >= nodes)
+		return FALSE;
+
+	*node = n;
+	return TRUE;
+}
+
+/**
+ * Load message stream from file.
+ */
+static struct bench_event *
+load(const char *file, uint nodes, size_t *count)
+{
+	FILE *f;
+	char line[1024];
+	struct bench_event *events = NULL;
+	size_t n = 0, size = 0, lineno = 0;
+
+	f = fopen(file, "r");
+	if (NULL == f) {
+		fprintf(stderr, "%s: cannot open %s: %s\n", progname, file,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		struct bench_event ev;
+		const char *type, *ttl, *query;
+		bool ok;
+
+		lineno++;
+		ZERO(&ev);
+		ev.ttl = REPLY_TTL;
+
+		type = strtok(line, " \t\n");
+		if (NULL == type || '#' == type[0])
+			continue;
+
+		switch (type[0]) {
+		case EV_QUERY:
+			ok = parse_guid(strtok(NULL, " \t\n"), &ev.muid) &&
+				parse_node(strtok(NULL, " \t\n"), nodes, &ev.node);
+			ttl = strtok(NULL, " \t\n");
+			query = strtok(NULL, "\n");
+			if (ok && ttl != NULL && query != NULL) {
+				ev.ttl = atoi(ttl);
+				ev.query = atom_str_get(query);
+			} else {
+				ok = FALSE;
+			}
+			break;
+		case EV_HIT:
+			ok = parse_guid(strtok(NULL, " \t\n"), &ev.muid) &&
+				parse_guid(strtok(NULL, " \t\n"), &ev.servent) &&
+				parse_node(strtok(NULL, " \t\n"), nodes, &ev.node);
+			break;
+		case EV_PUSH:
+			ok = parse_guid(strtok(NULL, " \t\n"), &ev.servent) &&
+				parse_node(strtok(NULL, " \t\n"), nodes, &ev.node);
+			break;
+		default:
+			ok = FALSE;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "%s: %s, line %zu: malformed message\n",
+				progname, file, lineno);
+			exit(EXIT_FAILURE);
+		}
+
+		ev.type = type[0];
+
+		if (n == size) {
+			size = MAX(1024, size * 2);
+			XREALLOC_ARRAY(events, size);
+		}
+		events[n++] = ev;
+	}
+
+	fclose(f);
+	*count = n;
+	return events;
+}
+
+/**
+ * Save message stream to file.
+ */
+static void
+save(const char *file, const struct bench_event *events, size_t count)
+{
+	FILE *f;
+	size_t i;
+
+	f = fopen(file, "w");
+	if (NULL == f) {
+		fprintf(stderr, "%s: cannot create %s: %s\n", progname, file,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct bench_event *ev = &events[i];
+		char muid[2 * GUID_RAW_SIZE + 1], servent[2 * GUID_RAW_SIZE + 1];
+
+		base16_encode(muid, sizeof muid, &ev->muid, GUID_RAW_SIZE);
+		base16_encode(servent, sizeof servent, &ev->servent, GUID_RAW_SIZE);
+		muid[2 * GUID_RAW_SIZE] = servent[2 * GUID_RAW_SIZE] = '\0';
+
+		switch (ev->type) {
+		case EV_QUERY:
+			fprintf(f, "Q %s %u %u %s\n", muid, ev->node, ev->ttl, ev->query);
+			break;
+		case EV_HIT:
+			fprintf(f, "H %s %s %u\n", muid, servent, ev->node);
+			break;
+		case EV_PUSH:
+			fprintf(f, "P %s %u\n", servent, ev->node);
+			break;
+		}
+	}
+
+	fclose(f);
+}
+
+/**
+ * Free message stream.
+ */
+static void
+events_free(struct bench_event *events, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		atom_str_free_null(&events[i].query);
+
+	xfree(events);
+}
+
+static int
+uint32_cmp(const void *a, const void *b)
+{
+	const uint32 *x = a, *y = b;
+
+	return CMP(*x, *y);
+}
+
+static double
+percentile(const uint32 *sorted, size_t n, double p)
+{
+	return 0 == n ? 0.0 : sorted[(size_t) (p * (n - 1))];
+}
+
+/**
+ * Replay the stream and report statistics.
+ */
+static void
+run(const struct bench_event *events, size_t count)
+{
+	uint32 *samples;
+	size_t i, nsamples = 0, messages, routes, memory;
+	tm_nano_t start, end;
+	double elapsed;
+
+	XMALLOC_ARRAY(samples, count / SAMPLE_RATE + 1);
+
+	tm_precise_time(&start);
+
+	for (i = 0; i < count; i++) {
+		if G_UNLIKELY(0 == i % SAMPLE_RATE) {
+			tm_nano_t t0, t1;
+
+			tm_precise_time(&t0);
+			route_event(&events[i]);
+			tm_precise_time(&t1);
+			samples[nsamples++] = tm_precise_elapsed_f(&t1, &t0) * 1e9;
+		} else {
+			route_event(&events[i]);
+		}
+	}
+
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+
+	xqsort(samples, nsamples, sizeof samples[0], uint32_cmp);
+
+	memory = old_table ?
+		old_routing_usage(&messages, &routes) :
+		routing_table_usage(&messages, &routes);
+
+	printf("%s routing table, %u node%s\n", old_table ? "old" : "new",
+		stub_count, plural(stub_count));
+	printf("messages: %zu in %.3f secs, %.0f msg/s\n",
+		count, elapsed, elapsed > 0.0 ? count / elapsed : 0.0);
+	printf("duplicates: %zu, routed replies: %zu, lost: %zu\n",
+		n_dups, n_routed, n_lost);
+	printf("QRP: %zu quer%s, %.1f leaves and %.1f ultrapeers per query\n",
+		n_queries, plural_y(n_queries),
+		0 == n_queries ? 0.0 : (double) n_leaf_targets / n_queries,
+		0 == n_queries ? 0.0 : (double) n_ultra_targets / n_queries);
+	printf("latency (ns): p50=%.0f p90=%.0f p99=%.0f p99.9=%.0f max=%.0f\n",
+		percentile(samples, nsamples, 0.50),
+		percentile(samples, nsamples, 0.90),
+		percentile(samples, nsamples, 0.99),
+		percentile(samples, nsamples, 0.999),
+		percentile(samples, nsamples, 1.0));
+	printf("table: %zu message%s, %zu route%s\n",
+		messages, plural(messages), routes, plural(routes));
+	printf("memory: %s, %.1f bytes per route\n",
+		short_size(memory, FALSE),
+		0 == routes ? 0.0 : (double) memory / routes);
+
+	xfree(samples);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 1000000;
+	size_t servents = 10000;
+	long nodes = 32;
+	uint dup_pct = 30;
+	const char *infile = NULL, *outfile = NULL;
+	unsigned rseed = 0;
+	struct bench_event *events;
+	guid_t guid;
+	uint i;
+	int c;
+
+	mingw_early_init();
+	progname = filepath_basename(argv[0]);
+
+	while ((c = getopt(argc, argv, "c:d:f:g:hn:o:OR:")) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of messages */
+			count = atol(optarg);
+			break;
+		case 'd':			/* duplicate percentage */
+			dup_pct = atoi(optarg);
+			break;
+		case 'f':			/* replay from file */
+			infile = optarg;
+			break;
+		case 'g':			/* servent pool size */
+			servents = atol(optarg);
+			break;
+		case 'n':			/* amount of stub nodes */
+			nodes = atol(optarg);
+			break;
+		case 'o':			/* save stream to file */
+			outfile = optarg;
+			break;
+		case 'O':			/* use old routing table */
+			old_table = TRUE;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (nodes <= 0 || nodes >= MAX_NODES || 0 == servents || 0 == count ||
+		dup_pct > 100
+	)
+		usage();
+
+	rand31_set_seed(rseed);
+	vocabulary_init();
+
+	if (infile != NULL) {
+		events = load(infile, nodes, &count);
+	} else {
+		events = generate(count, nodes, dup_pct, servents);
+		printf("generated %zu messages with seed %u\n",
+			count, rand31_initial_seed());
+	}
+
+	if (outfile != NULL)
+		save(outfile, events, count);
+
+	/*
+	 * Use a non-blank sticky servent GUID, so that the routing layer
+	 * does not need the GUID database to create one.
+	 */
+
+	gnet_prop_init();
+	rand31_bytes(&guid, sizeof guid);
+	gnet_prop_set_storage(PROP_SERVENT_GUID, &guid, sizeof guid);
+	gnet_prop_set_boolean_val(PROP_STICKY_GUID, TRUE);
+
+	stub_nodes_init(nodes);
+	routing_init();
+
+	if (old_table)
+		old_routing_init();
+
+	run(events, count);
+
+	if (old_table)
+		old_routing_close();
+
+	for (i = 0; i < stub_count; i++) {
+		if (stub_nodes[i]->routing_data != NULL)
+			routing_node_remove(stub_nodes[i]);
+	}
+
+	routing_close();
+	stub_nodes_close();
+	events_free(events, count);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,456 @@
+/*
+ * spam-bench -- Spam filename rules benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * This loads the NAME and SIZE rules of a spam.txt file, as core/spam.c
+ * does, and checks a corpus of query hits against them, both with the
+ * compiled regex set now used by core/spam.c and with the former loop
+ * running each rule in turn, to make sure they agree and compare speed.
+ *
+ * The corpus is either synthetic or read from a file holding one hit
+ * per line:
+ *
+ *    <size> <filename>
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/parse.h"
+#include "lib/path.h"
+#include "lib/rand31.h"
+#include "lib/regset.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#include "lib/override.h"
+
+#define HIT_NAME_MAX	256		/**< Max filename length in corpus */
+
+/**
+ * A NAME rule, as formerly kept by core/spam.c.
+ */
+struct rule {
+	regex_t pattern;
+	uint64 min_size;
+	uint64 max_size;
+};
+
+struct hit {
+	char *name;
+	uint64 size;
+};
+
+static const char *progname;
+static struct rule *rules;
+static size_t n_rules;
+static regset_t *set;
+
+static void G_GNUC_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-h] [-c count] [-f file] [-n loops] [-R seed] spam.txt\n"
+		"  -c : amount of synthetic hits (default 100000)\n"
+		"  -f : read hits from file instead of synthetic corpus\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of passes over the corpus (default 10)\n"
+		"  -R : seed for repeatable random corpus\n"
+		, progname);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Record a NAME rule in both the old list and the new set.
+ */
+static void
+rule_add(const char *file, uint lineno,
+	const char *name, uint64 min_size, uint64 max_size)
+{
+	struct rule *r;
+	char buf[1024];
+	int error;
+
+	XREALLOC_ARRAY(rules, n_rules + 1);
+	r = &rules[n_rules];
+
+	error = regcomp(&r->pattern, name, REG_EXTENDED | REG_NOSUB);
+	if (error != 0) {
+		regerror(error, &r->pattern, buf, sizeof buf);
+		fprintf(stderr, "%s: %s, line %u: skipping rule: %s\n",
+			progname, file, lineno, buf);
+		regfree(&r->pattern);
+		return;
+	}
+
+	if (!regset_add(set, name, min_size, max_size, buf, sizeof buf)) {
+		fprintf(stderr, "%s: %s, line %u: regset_add() failed: %s\n",
+			progname, file, lineno, buf);
+		exit(EXIT_FAILURE);
+	}
+
+	r->min_size = min_size;
+	r->max_size = max_size;
+	n_rules++;
+}
+
+/**
+ * Load NAME rules from a spam.txt file, ignoring SHA1-only entries.
+ */
+static void
+load_rules(const char *file)
+{
+	FILE *f;
+	char line[4096];
+	char *name = NULL;
+	uint64 min_size = 0, max_size = MAX_INT_VAL(uint64);
+	uint lineno = 0;
+
+	f = fopen(file, "r");
+	if (NULL == f) {
+		fprintf(stderr, "%s: cannot open %s: %s\n", progname, file,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	set = regset_make(REG_EXTENDED | REG_NOSUB);
+
+	while (fgets(line, sizeof line, f)) {
+		char *value;
+
+		lineno++;
+		value = strchr(line, '\n');
+		if (value != NULL)
+			*value = '\0';
+
+		if ('#' == line[0] || '\0' == line[0])
+			continue;
+
+		value = strchr(line, ' ');
+		if (value != NULL)
+			*value++ = '\0';
+
+		if (0 == strcmp(line, "NAME") && value != NULL) {
+			XFREE_NULL(name);
+			name = xstrdup(value);
+		} else if (0 == strcmp(line, "SIZE") && value != NULL) {
+			const char *endptr;
+			int error;
+
+			min_size = max_size = parse_uint64(value, &endptr, 10, &error);
+			if (!error && '-' == endptr[0])
+				max_size = parse_uint64(&endptr[1], &endptr, 10, &error);
+			if (error || max_size < min_size) {
+				fprintf(stderr, "%s: %s, line %u: cannot parse SIZE\n",
+					progname, file, lineno);
+				exit(EXIT_FAILURE);
+			}
+		} else if (0 == strcmp(line, "END")) {
+			if (name != NULL)
+				rule_add(file, lineno, name, min_size, max_size);
+			XFREE_NULL(name);
+			min_size = 0;
+			max_size = MAX_INT_VAL(uint64);
+		}
+	}
+
+	fclose(f);
+	XFREE_NULL(name);
+	regset_compile(set);
+}
+
+/**
+ * Load query hits from file.
+ */
+static struct hit *
+load_hits(const char *file, size_t *count)
+{
+	FILE *f;
+	char line[HIT_NAME_MAX + 32];
+	struct hit *hits = NULL;
+	size_t n = 0, size = 0, lineno = 0;
+
+	f = fopen(file, "r");
+	if (NULL == f) {
+		fprintf(stderr, "%s: cannot open %s: %s\n", progname, file,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		const char *endptr;
+		char *nl;
+		uint64 hsize;
+		int error;
+
+		lineno++;
+		nl = strchr(line, '\n');
+		if (nl != NULL)
+			*nl = '\0';
+
+		if ('#' == line[0] || '\0' == line[0])
+			continue;
+
+		hsize = parse_uint64(line, &endptr, 10, &error);
+		if (error || ' ' != endptr[0]) {
+			fprintf(stderr, "%s: %s, line %zu: malformed hit\n",
+				progname, file, lineno);
+			exit(EXIT_FAILURE);
+		}
+
+		if (n == size) {
+			size = MAX(1024, size * 2);
+			XREALLOC_ARRAY(hits, size);
+		}
+		hits[n].size = hsize;
+		hits[n].name = xstrdup(&endptr[1]);
+		n++;
+	}
+
+	fclose(f);
+	*count = n;
+	return hits;
+}
+
+/**
+ * Generate a synthetic corpus of query hits.
+ *
+ * Most names are made of random words, as legitimate hits would be, with
+ * a few of them mimicking the shape of known spam.
+ */
+static struct hit *
+generate(size_t count)
+{
+	static const char *words[] = {
+		"the", "best", "of", "live", "remix", "love", "night", "song",
+		"album", "club", "mix", "feat", "vol", "part", "original",
+		"summer", "dance", "radio", "edit", "version", "greatest", "hits",
+	};
+	static const char *exts[] = {
+		"mp3", "ogg", "avi", "mkv", "zip", "rar", "wma", "pdf", "flac",
+	};
+	static const char *spams[] = {
+		"*Hot song by request.wma",
+		"Download Now With New Secured Codec.zip",
+		"FREE Movies-------------------------------.avi",
+		"dvd.zip",
+	};
+	struct hit *hits;
+	size_t i;
+
+	XMALLOC_ARRAY(hits, count);
+
+	for (i = 0; i < count; i++) {
+		char name[HIT_NAME_MAX];
+		size_t len = 0;
+		uint j, nw = 2 + rand31_value(5);
+
+		if (0 == rand31_value(19)) {
+			uint k = rand31_value(G_N_ELEMENTS(spams) - 1);
+
+			hits[i].name = xstrdup(spams[k]);
+			hits[i].size = rand31_value(20000000);
+			continue;
+		}
+
+		for (j = 0; j < nw; j++) {
+			len += str_bprintf(&name[len], sizeof name - len, "%s%s",
+				0 == j ? "" : (rand31_value(1) ? " " : "_"),
+				words[rand31_value(G_N_ELEMENTS(words) - 1)]);
+		}
+		str_bprintf(&name[len], sizeof name - len, ".%s",
+			exts[rand31_value(G_N_ELEMENTS(exts) - 1)]);
+
+		hits[i].name = xstrdup(name);
+		hits[i].size = rand31_u32();
+	}
+
+	return hits;
+}
+
+/**
+ * The former spam_check_filename_size(): try each rule in turn.
+ */
+static bool
+old_match(const char *name, uint64 size)
+{
+	size_t i;
+
+	for (i = 0; i < n_rules; i++) {
+		const struct rule *r = &rules[i];
+
+		if (
+			size >= r->min_size && size <= r->max_size &&
+			0 == regexec(&r->pattern, name, 0, NULL, 0)
+		)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Run all hits through both matchers and report timings.
+ */
+static void
+run(const struct hit *hits, size_t count, uint loops)
+{
+	size_t i, old_hits = 0, new_hits = 0, lookups;
+	tm_nano_t start, end;
+	double old_elapsed, new_elapsed;
+	uint n;
+
+	for (i = 0; i < count; i++) {
+		bool o = old_match(hits[i].name, hits[i].size);
+		bool r = regset_match(set, hits[i].name, hits[i].size);
+
+		if (o != r) {
+			fprintf(stderr, "%s: mismatch on \"%s\" (%s bytes): "
+				"old=%s, new=%s\n", progname, hits[i].name,
+				uint64_to_string(hits[i].size),
+				o ? "spam" : "clean", r ? "spam" : "clean");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	tm_precise_time(&start);
+	for (n = 0; n < loops; n++) {
+		for (i = 0; i < count; i++) {
+			if (old_match(hits[i].name, hits[i].size))
+				old_hits++;
+		}
+	}
+	tm_precise_time(&end);
+	old_elapsed = tm_precise_elapsed_f(&end, &start);
+
+	tm_precise_time(&start);
+	for (n = 0; n < loops; n++) {
+		for (i = 0; i < count; i++) {
+			if (regset_match(set, hits[i].name, hits[i].size))
+				new_hits++;
+		}
+	}
+	tm_precise_time(&end);
+	new_elapsed = tm_precise_elapsed_f(&end, &start);
+
+	g_assert(old_hits == new_hits);
+
+	lookups = count * loops;
+
+	printf("rules: %zu, regex%s: %zu, size bucket%s: %zu\n",
+		regset_count(set),
+		plural_es(regset_regex_count(set)), regset_regex_count(set),
+		plural(regset_bucket_count(set)), regset_bucket_count(set));
+	printf("hits: %zu, spam: %zu (%.2f%%)\n",
+		count, old_hits / loops,
+		0 == count ? 0.0 : 100.0 * (old_hits / loops) / count);
+	printf("old: %.3f secs, %.0f ns per hit\n",
+		old_elapsed, 0 == lookups ? 0.0 : old_elapsed * 1e9 / lookups);
+	printf("new: %.3f secs, %.0f ns per hit\n",
+		new_elapsed, 0 == lookups ? 0.0 : new_elapsed * 1e9 / lookups);
+	printf("speedup: %.2fx\n",
+		new_elapsed > 0.0 ? old_elapsed / new_elapsed : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 100000;
+	uint loops = 10;
+	const char *infile = NULL;
+	unsigned rseed = 0;
+	struct hit *hits;
+	size_t i;
+	int c;
+
+	mingw_early_init();
+	progname = filepath_basename(argv[0]);
+
+	while ((c = getopt(argc, argv, "c:f:hn:R:")) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of hits */
+			count = atol(optarg);
+			break;
+		case 'f':			/* read hits from file */
+			infile = optarg;
+			break;
+		case 'n':			/* amount of passes */
+			loops = atoi(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 1)
+		usage();
+
+	argv += optind;
+
+	if (0 == loops)
+		usage();
+
+	rand31_set_seed(rseed);
+	load_rules(argv[0]);
+
+	if (infile != NULL) {
+		hits = load_hits(infile, &count);
+	} else {
+		hits = generate(count);
+		printf("generated %zu hits with seed %u\n",
+			count, rand31_initial_seed());
+	}
+
+	run(hits, count, loops);
+
+	for (i = 0; i < count; i++)
+		xfree(hits[i].name);
+	xfree(hits);
+
+	for (i = 0; i < n_rules; i++)
+		regfree(&rules[i].pattern);
+	XFREE_NULL(rules);
+	regset_free_null(&set);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -34,6 +34,7 @@
 #include "common.h"
 
 #include "bogons.h"
+#include "ipclass.h"
 #include "settings.h"
 
 #include "lib/ascii.h"
@@ -119,6 +120,7 @@ bogons_load(FILE *f)
 	}
 
 	iprange_sync(bogons_db);
+	ipclass_invalidate();
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u bogus IP ranges (%u hosts)",
@@ -220,6 +222,17 @@ void
 bogons_close(void)
 {
 	iprange_free(&bogons_db);
+	ipclass_invalidate();
+}
+
+/**
+ * Add the bogus networks to the IP classification map.
+ */
+void
+bogons_classify(struct iprange_map *map)
+{
+	if (bogons_db != NULL)
+		iprange_map_add_db(map, bogons_db, IPCLASS_BOGON_SHIFT);
 }
 
 /**
@@ -243,7 +256,7 @@ bogons_check(const host_addr_t ha)
 	if (delta_time(tm_time(), bogons_mtime) > 15552000)	/* ~6 months */
 		return !host_addr_is_routable(ha);
 
-	return 0 != iprange_get_addr(bogons_db, ha);
+	return 0 != (ipclass_get(ha) & IPCLASS_BOGON);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
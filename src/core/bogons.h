@@ -41,6 +41,9 @@ bool bogons_check(const host_addr_t addr);
 void bogons_init(void);
 void bogons_close(void);
 
+struct iprange_map;
+void bogons_classify(struct iprange_map *map);
+
 #endif /* _core_bogons_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
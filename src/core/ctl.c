@@ -35,7 +35,7 @@
 
 #include "ctl.h"
 #include "geo_ip.h"
-#include "whitelist.h"
+#include "ipclass.h"
 
 #include "lib/ascii.h"
 #include "lib/halloc.h"
@@ -595,9 +595,10 @@ ctl_limit(const host_addr_t ha, unsigned flags)
 {
 	uint16 code;
 	unsigned cflags;
+	ipclass_t ipc;
 
 	/*
-	 * Early optimization to avoid paying the price of gip_country_safe():
+	 * Early optimization to avoid paying the price of ipclass_get():
 	 * If no flags are given, or the set of flags requested is not a subset
 	 * of all the flags ever specified for all countries, we can return.
 	 */
@@ -608,7 +609,13 @@ ctl_limit(const host_addr_t ha, unsigned flags)
 	if ((flags & ctl_all_flags) != flags)
 		return FALSE;
 
-	code = gip_country_safe(ha);
+	/*
+	 * A single lookup gives us both the country and whether the address
+	 * is whitelisted.
+	 */
+
+	ipc = ipclass_get(ha);
+	code = gip_class_country_safe(ipc);
 
 	if (ISO3166_INVALID == code)
 		return FALSE;
@@ -622,7 +629,7 @@ ctl_limit(const host_addr_t ha, unsigned flags)
 	if ((cflags & flags) != flags)
 		return FALSE;
 
-	if ((cflags & CTL_D_WHITELIST) && whitelist_check(ha))
+	if ((cflags & CTL_D_WHITELIST) && (ipc & IPCLASS_WHITELIST))
 		return FALSE;
 
 	return TRUE;
@@ -529,8 +529,7 @@ dh_route(gnutella_node_t *src, gnutella_node_t *dest, int count)
 			if (gnutella_header_get_ttl(pmsg_start(mb)) & GTA_UDP_DEFLATED)
 				gnet_stats_inc_general(GNR_UDP_TX_COMPRESSED);
 		} else {
-			mb = gmsg_split_to_pmsg(&src->header, src->data,
-					src->size + GTA_HEADER_SIZE);
+			mb = gmsg_node_to_pmsg(src);
 		}
 
 		mbe = pmsg_clone_extend(mb, dh_pmsg_free, pmi);
@@ -541,8 +540,7 @@ dh_route(gnutella_node_t *src, gnutella_node_t *dest, int count)
 
 		mq_udp_putq(mq, mbe, &to);
 	} else {
-		mb = gmsg_split_to_pmsg_extend(&src->header, src->data,
-				src->size + GTA_HEADER_SIZE, dh_pmsg_free, pmi);
+		mb = gmsg_node_to_pmsg_extend(src, dh_pmsg_free, pmi);
 		mq_tcp_putq(mq, mb, src);
 
 		if (GNET_PROPERTY(dh_debug) > 19) {
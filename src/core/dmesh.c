@@ -58,6 +58,7 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
@@ -71,9 +72,12 @@
 #include "lib/hikset.h"
 #include "lib/htable.h"
 #include "lib/parse.h"
+#include "lib/pmsg.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/strtok.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
@@ -90,13 +94,30 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  * The download mesh records all the known sources for a given SHA1.
  * It is implemented as a big hash table, where SHA1 are keys, each value
  * being a struct dmesh pointer.
+ *
+ * Each mesh bucket holds its entries in a ring buffer, ordered by insertion
+ * time (oldest first, at the head), along with an open-addressed index
+ * locating entries by host (IP:port) or by GUID for firewalled entries.
+ * The index stores the entry slot plus one, 0 marking a free slot.  When
+ * the bucket is full, evicting the oldest entry moves nothing.
+ *
+ * The compact X-Alt forms of the entries are cached per bucket, in an array
+ * parallel to the ring buffer, allocated the first time X-Alt headers are
+ * generated for the SHA1.  The cached form of a slot is invalidated when an
+ * entry is inserted there or when its URL changes.  Which cached values are
+ * emitted still depends on the recipient and on the time of the last alt-locs
+ * sent, so the header itself cannot be cached.
  */
 static hikset_t *mesh = NULL;
 
 struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
-	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
-	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
+	struct dmesh_entry *entries;	/**< Ring buffer of mesh entries */
+	char (*alt)[HOST_ADDR_PORT_BUFLEN];	/**< Cached X-Alt forms, per slot */
+	uint16 *index;			/**< Open-addressed index on entries[] */
+	uint16 head;			/**< Slot of the oldest entry */
+	uint16 count;			/**< Amount of entries held */
+	uint16 capacity;		/**< Allocated length of entries[] (power of 2) */
+	uint16 index_size;		/**< Amount of index slots (power of 2) */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
 	const sha1_t *sha1;		/**< The SHA1 of this mesh */
 };
@@ -116,6 +137,7 @@ struct dmesh_entry {
 #define MAX_LIFETIME	43200		/**< half a day */
 #define MAX_LIBLIFETIME	3600		/**< 1 hour for shared/seeded files */
 #define MAX_ENTRIES		256			/**< Max amount of entries kept per SHA1 */
+#define MIN_ENTRIES		4			/**< Initial capacity of a mesh bucket */
 
 #define MIN_BAD_REPORT	3			/**< Don't ban before that many X-Nalt */
 #define DMESH_CALLOUT	5000		/**< Callout heartbeat every 5 seconds */
@@ -125,6 +147,22 @@ struct dmesh_entry {
 #define FW_MAX_PROXIES	4			/**< At most 4 push-proxies */
 
 static const char dmesh_file[] = "dmesh";
+
+/*
+ * The download mesh is persisted in binary form: the file starts with
+ * the magic string, followed by the format version byte.  Each mesh bucket
+ * is then stored as a record made of a 32-bit big-endian length followed
+ * by the SHA1, the 16-bit amount of entries and the serialized entries.
+ */
+static const char dmesh_magic[] = "GTKG-DMESH\n";
+
+#define DMESH_FILE_VERSION	1				/**< Binary format version */
+#define DMESH_RECORD_MAX	(1024 * 1024)	/**< Sanity limit on record size */
+
+enum dmesh_entry_kind {
+	DMESH_ENTRY_URL = 0,				/**< Regular URL entry */
+	DMESH_ENTRY_FW = 1					/**< Firewalled entry */
+};
 static cqueue_t *dmesh_cq;			/**< Download mesh callout queue */
 
 /**
@@ -215,10 +253,13 @@ dmesh_init(void)
 }
 
 /**
- * Free download mesh entry.
+ * Release the data held by a download mesh entry.
+ *
+ * The entry itself lives in the entries[] array of its mesh bucket and
+ * is not freed.
  */
 static void
-dmesh_entry_free(struct dmesh_entry *dme)
+dmesh_entry_clear(struct dmesh_entry *dme)
 {
 	g_assert(dme);
 
@@ -230,7 +271,6 @@ dmesh_entry_free(struct dmesh_entry *dme)
 			atom_str_free(dme->e.url.name);
 	}
 	hash_list_free_all(&dme->bad, wfree_host_addr1);
-	WFREE(dme);
 }
 
 /**
@@ -398,7 +438,7 @@ dmesh_ban_add(const struct sha1 *sha1,
 
 			if (!existed) {
 				htable_insert_const(ban_mesh_by_sha1,
-					atom_sha1_get(sha1), by_addr);
+					atom_sha1_ref(dmb->sha1), by_addr);
 			}
 		}
 	}
@@ -577,6 +617,266 @@ dmesh_url_parse(const char *url, dmesh_urlinfo_t *info)
 	return TRUE;
 }
 
+/**
+ * Hash a host for the mesh bucket index.
+ */
+static inline uint
+dm_host_hash(const host_addr_t addr, uint16 port)
+{
+	return host_addr_hash(addr) ^ port_hash(port);
+}
+
+/**
+ * Hash mesh entry for the mesh bucket index.
+ */
+static uint
+dm_entry_hash(const struct dmesh_entry *dme)
+{
+	return dme->fw_entry ?
+		guid_hash(dme->e.fwh.guid) :
+		dm_host_hash(dme->e.url.addr, dme->e.url.port);
+}
+
+/**
+ * @return the n-th entry of the mesh bucket, 0 being the oldest one.
+ */
+static inline struct dmesh_entry *
+dm_entry(const struct dmesh *dm, uint n)
+{
+	g_assert(n < dm->count);
+
+	return &dm->entries[(dm->head + n) & (dm->capacity - 1)];
+}
+
+/**
+ * @return the slot of the entry in the ring buffer of the mesh bucket.
+ */
+static inline uint
+dm_slot(const struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	g_assert(dme >= dm->entries && dme < &dm->entries[dm->capacity]);
+
+	return dme - dm->entries;
+}
+
+/**
+ * Record entry, which must be part of the entries[] array, in the index.
+ */
+static void
+dm_index_add(struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	uint mask = dm->index_size - 1;
+	uint h = dm_entry_hash(dme) & mask;
+
+	while (0 != dm->index[h])
+		h = (h + 1) & mask;
+
+	dm->index[h] = dm_slot(dm, dme) + 1;
+}
+
+/**
+ * @return the index slot referencing the entry, which must be indexed.
+ */
+static uint
+dm_index_find(const struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	uint mask = dm->index_size - 1;
+	uint h = dm_entry_hash(dme) & mask;
+	uint n = dm_slot(dm, dme) + 1;
+
+	while (n != dm->index[h]) {
+		g_assert(0 != dm->index[h]);
+		h = (h + 1) & mask;
+	}
+
+	return h;
+}
+
+/**
+ * Remove entry from the index, shifting back the index slots that follow
+ * so that no tombstone is needed.
+ */
+static void
+dm_index_remove(struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	uint mask = dm->index_size - 1;
+	uint i = dm_index_find(dm, dme);
+	uint j = i;
+
+	for (;;) {
+		uint h;
+
+		j = (j + 1) & mask;
+		if (0 == dm->index[j])
+			break;
+
+		/*
+		 * The entry in slot j can fill the hole at i unless its hashed
+		 * position lies cyclically within (i, j].
+		 */
+
+		h = dm_entry_hash(&dm->entries[dm->index[j] - 1]) & mask;
+
+		if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+			continue;
+
+		dm->index[i] = dm->index[j];
+		i = j;
+	}
+
+	dm->index[i] = 0;
+}
+
+/**
+ * Rebuild the whole index of the mesh bucket.
+ */
+static void
+dm_index_rebuild(struct dmesh *dm)
+{
+	uint i;
+
+	memset(dm->index, 0, dm->index_size * sizeof dm->index[0]);
+
+	for (i = 0; i < dm->count; i++)
+		dm_index_add(dm, dm_entry(dm, i));
+}
+
+/**
+ * Drop the cached X-Alt forms of the mesh bucket.
+ */
+static inline void
+dm_alt_drop(struct dmesh *dm)
+{
+	WFREE_ARRAY_NULL(dm->alt, dm->capacity);
+}
+
+/**
+ * Invalidate the cached X-Alt form of the entry, if any.
+ */
+static inline void
+dm_alt_invalidate(struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	if (dm->alt != NULL)
+		dm->alt[dm_slot(dm, dme)][0] = '\0';
+}
+
+/**
+ * Resize the entries[] ring buffer of the mesh bucket, moving the oldest
+ * entry to the first slot, and rebuild its index, which is kept at most
+ * half full.
+ */
+static void
+dm_resize(struct dmesh *dm, uint capacity)
+{
+	struct dmesh_entry *entries;
+	uint i;
+
+	g_assert(IS_POWER_OF_2(capacity));
+	g_assert(capacity >= dm->count);
+	g_assert(capacity <= MAX_ENTRIES);
+
+	WALLOC_ARRAY(entries, capacity);
+
+	for (i = 0; i < dm->count; i++)
+		entries[i] = *dm_entry(dm, i);
+
+	dm_alt_drop(dm);
+	WFREE_ARRAY_NULL(dm->entries, dm->capacity);
+	WFREE_ARRAY_NULL(dm->index, dm->index_size);
+	dm->entries = entries;
+	dm->head = 0;
+	dm->capacity = capacity;
+	dm->index_size = 2 * capacity;
+	WALLOC_ARRAY(dm->index, dm->index_size);
+	dm_index_rebuild(dm);
+}
+
+/**
+ * Called after entries were removed from the mesh bucket, to shrink
+ * the ring buffer if it became too sparse.
+ */
+static void
+dm_shrink(struct dmesh *dm)
+{
+	uint capacity = dm->capacity;
+
+	while (capacity > MIN_ENTRIES && dm->count <= capacity / 4)
+		capacity /= 2;
+
+	if (capacity != dm->capacity)
+		dm_resize(dm, capacity);
+}
+
+/**
+ * Move the n-th entry of the mesh bucket to the m-th position, whose entry
+ * must have been removed from the index, along with its cached X-Alt form.
+ */
+static void
+dm_move(struct dmesh *dm, uint n, uint m)
+{
+	struct dmesh_entry *from = dm_entry(dm, n);
+	struct dmesh_entry *to = dm_entry(dm, m);
+
+	dm->index[dm_index_find(dm, from)] = dm_slot(dm, to) + 1;
+	*to = *from;
+
+	if (dm->alt != NULL) {
+		memcpy(dm->alt[dm_slot(dm, to)], dm->alt[dm_slot(dm, from)],
+			sizeof dm->alt[0]);
+	}
+}
+
+/**
+ * Lookup entry by host in the mesh bucket.
+ *
+ * @return the entry for addr:port, NULL if not found.
+ */
+static struct dmesh_entry *
+dm_lookup_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	uint mask = dm->index_size - 1;
+	uint h = dm_host_hash(addr, port) & mask;
+	uint n;
+
+	while (0 != (n = dm->index[h])) {
+		struct dmesh_entry *dme = &dm->entries[n - 1];
+
+		if (
+			!dme->fw_entry && dme->e.url.port == port &&
+			host_addr_equiv(dme->e.url.addr, addr)
+		)
+			return dme;
+
+		h = (h + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * Lookup firewalled entry by GUID in the mesh bucket.
+ *
+ * @return the entry for the servent GUID, NULL if not found.
+ */
+static struct dmesh_entry *
+dm_lookup_guid(const struct dmesh *dm, const guid_t *guid)
+{
+	uint mask = dm->index_size - 1;
+	uint h = guid_hash(guid) & mask;
+	uint n;
+
+	while (0 != (n = dm->index[h])) {
+		struct dmesh_entry *dme = &dm->entries[n - 1];
+
+		if (dme->fw_entry && guid_eq(dme->e.fwh.guid, guid))
+			return dme;
+
+		h = (h + 1) & mask;
+	}
+
+	return NULL;
+}
+
 /**
  * Allocate a new download mesh structure (there is one per SHA1).
  */
@@ -585,13 +885,13 @@ dm_alloc(const struct sha1 *sha1)
 {
 	struct dmesh *dm;
 
-	WALLOC(dm);
+	WALLOC0(dm);
 	dm->last_update = 0;
-	dm->entries = list_new();
 	dm->sha1 = atom_sha1_get(sha1);
-	dm->by_host = htable_create_any(packed_host_hash_func,
-		packed_host_hash_func2, packed_host_eq_func);
-	dm->by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
+	dm->capacity = MIN_ENTRIES;
+	dm->index_size = 2 * MIN_ENTRIES;
+	WALLOC_ARRAY(dm->entries, dm->capacity);
+	WALLOC0_ARRAY(dm->index, dm->index_size);
 
 	return dm;
 }
@@ -602,37 +902,59 @@ dm_alloc(const struct sha1 *sha1)
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
+	uint i;
 
-	/*
-	 * Values in the dme->by_host table were the dmesh_entry structures
-	 * we just disposed of above, so we only need to get rid of the keys.
-	 */
-	
-	htable_foreach_key(dm->by_host, wfree_packed_host, NULL);
-	htable_free_null(&dm->by_host);
-
-	/* Keys were GUID in the dmesh_entry, no need to free them */
-	htable_free_null(&dm->by_guid);
+	for (i = 0; i < dm->count; i++)
+		dmesh_entry_clear(dm_entry(dm, i));
 
+	dm_alt_drop(dm);
+	WFREE_ARRAY_NULL(dm->entries, dm->capacity);
+	WFREE_ARRAY_NULL(dm->index, dm->index_size);
 	atom_sha1_free_null(&dm->sha1);
 	WFREE(dm);
 }
 
+/**
+ * Append a new zeroed entry to the mesh bucket.
+ *
+ * The entry must be recorded in the index via dm_index_add() once its
+ * host or GUID has been filled.
+ *
+ * @return the new entry, valid until the next change to the bucket.
+ */
+static struct dmesh_entry *
+dm_append(struct dmesh *dm)
+{
+	struct dmesh_entry *dme;
+
+	if (dm->count == dm->capacity)
+		dm_resize(dm, 2 * dm->capacity);
+
+	dm->count++;
+	dme = dm_entry(dm, dm->count - 1);
+	ZERO(dme);
+	dm_alt_invalidate(dm, dme);
+
+	return dme;
+}
+
 /**
  * Remove specified entry from mesh bucket and reclaim it.
+ *
+ * The older entries are moved one slot forward to close the gap, hence
+ * removing the oldest entry does not move anything.
  */
 static void
 dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 {
-	struct packed_host packed;
-	const void *key;
-	void *value;
-	bool found;
+	uint i, n;
 
 	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(dm->count > 0);
+
+	n = (dm_slot(dm, dme) - dm->head) & (dm->capacity - 1);
+
+	g_assert(n < dm->count);
 
 	if (GNET_PROPERTY(dmesh_debug)) {
 		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
@@ -642,32 +964,16 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 				host_addr_port_to_string(dme->e.url.addr, dme->e.url.port));
 	}
 
-	if (dme->fw_entry) {
-		found = htable_lookup_extended(dm->by_guid,
-					dme->e.fwh.guid, &key, &value);
-	} else {
-		packed = host_pack(dme->e.url.addr, dme->e.url.port);
-		found = htable_lookup_extended(dm->by_host,
-					&packed, &key, &value);
-	}
-
-	g_assert(found);
-	g_assert(value == (void *) dme);
-
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
-
-	g_assert(found);
+	dm_index_remove(dm, dme);
+	dmesh_entry_clear(dme);
 
-	/* ...and from the proper hash table */
+	for (i = n; i != 0; i--)
+		dm_move(dm, i - 1, i);
 
-	if (dme->fw_entry) {
-		htable_remove(dm->by_guid, dme->e.fwh.guid);
-	} else {
-		htable_remove(dm->by_host, &packed);
-		wfree_packed_host(deconstify_pointer(key), NULL);
-	}
+	dm->head = (dm->head + 1) & (dm->capacity - 1);
+	dm->count--;
 
-	dmesh_entry_free(dme);
+	dm_shrink(dm);
 }
 
 /**
@@ -676,35 +982,14 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 static void
 dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
 {
-	struct packed_host packed;
 	struct dmesh_entry *dme;
-	const void *key;
-	void *value;
-	bool found;
 
 	g_assert(dm);
 
-	packed = host_pack(addr, port);
-	found = htable_lookup_extended(dm->by_host, &packed, &key, &value);
+	dme = dm_lookup_host(dm, addr, port);
 
-	if (!found)
-		return;
-
-	if (GNET_PROPERTY(dmesh_debug)) {
-		g_debug("dmesh entry removed for urn:sha1:%s at %s",
-			sha1_base32(dm->sha1), host_addr_port_to_string(addr, port));
-	}
-
-	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
-
-	g_assert(found);
-	g_assert(!dme->fw_entry);
-
-	htable_remove(dm->by_host, &packed);	/* And from hash table */
-	wfree_packed_host(deconstify_pointer(key), NULL);
-
-	dmesh_entry_free(dme);
+	if (dme != NULL)
+		dm_remove_entry(dm, dme);
 }
 
 /**
@@ -745,50 +1030,56 @@ dm_lifetime(const struct dmesh *dm)
 static void
 dm_expire(struct dmesh *dm)
 {
-	pslist_t *expired = NULL;
-	pslist_t *sl;
 	time_t now = tm_time();
 	long agemax;
-	list_iter_t *iter;
+	uint i, j;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
+	/*
+	 * Compact the ring buffer in place towards its newest entry, keeping the
+	 * insertion order of the surviving entries: entries newer than all the
+	 * expired ones do not move.
+	 */
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (i = j = dm->count; i != 0; i--) {
+		struct dmesh_entry *dme = dm_entry(dm, i - 1);
 
-		if (delta_time(now, dme->stamp) <= agemax)
-			continue;
+		if (delta_time(now, dme->stamp) > agemax) {
+			/*
+			 * Remove the entry.
+			 *
+			 * XXX instead of removing, maybe we can schedule a HEAD refresh
+			 * XXX to see whether the entry is still valid?
+			 */
 
-		/*
-		 * Remove the entry.
-		 *
-		 * XXX instead of removing, maybe we can schedule a HEAD refresh
-		 * XXX to see whether the entry is still valid?
-		 */
+			if (GNET_PROPERTY(dmesh_debug) > 4)
+				g_debug("MESH %s: EXPIRED \"%s\", age=%u",
+					sha1_base32(dm->sha1),
+					dme->fw_entry ?
+						dmesh_fwinfo_to_string(&dme->e.fwh) :
+						dmesh_urlinfo_to_string(&dme->e.url),
+					(unsigned) delta_time(now, dme->stamp));
 
-		if (GNET_PROPERTY(dmesh_debug) > 4)
-			g_debug("MESH %s: EXPIRED \"%s\", age=%u",
-				sha1_base32(dm->sha1),
-				dme->fw_entry ?
-					dmesh_fwinfo_to_string(&dme->e.fwh) :
-					dmesh_urlinfo_to_string(&dme->e.url),
-				(unsigned) delta_time(now, dme->stamp));
+			dm_index_remove(dm, dme);
+			dmesh_entry_clear(dme);
+			continue;
+		}
 
-		expired = pslist_prepend(expired, dme);
+		if (--j != i - 1)
+			dm_move(dm, i - 1, j);
 	}
 
-	list_iter_free(&iter);
-
-	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
+	/*
+	 * The `j' oldest slots are now free.
+	 */
 
-		dm_remove_entry(dm, dme);
+	if (j != 0) {
+		dm->head = (dm->head + j) & (dm->capacity - 1);
+		dm->count -= j;
+		dm_shrink(dm);
 	}
 
-	pslist_free(expired);
-
 	dm->last_update = tm_time();
 }
 
@@ -806,7 +1097,7 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(dm->count == 0);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
@@ -847,7 +1138,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (dm->count == 0)
 		dmesh_dispose(sha1);
 
     return TRUE;
@@ -876,13 +1167,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (dm->count == 0) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? dm->count : 0;
 }
 
 /**
@@ -935,7 +1226,6 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	uint16 port = info->port;
 	uint idx = info->idx;
 	const char *name = info->name;
-	struct packed_host packed;
 	const char *reason = NULL;
 
 	g_return_val_if_fail(sha1, FALSE);
@@ -998,8 +1288,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme) {
 		/*
@@ -1016,6 +1305,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		if (dme->e.url.idx != idx && idx == URN_INDEX) {
 			dme->e.url.idx = idx;
 			atom_str_change(&dme->e.url.name, name);
+			dm_alt_invalidate(dm, dme);			/* Compact form changed */
 		}
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
@@ -1029,7 +1319,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		 * Allocate new entry.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1049,19 +1339,15 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by host.
+		 * New entries are appended at the tail of the array, and we
+		 * record them into the index by host.
 		 */
 
-		list_append(dm->entries, dme);
+		dm_index_add(dm, dme);
 		dm->last_update = now;
 
-		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		if (dm->count == MAX_ENTRIES)
+			dm_remove_entry(dm, dm_entry(dm, 0));	/* Oldest entry */
 	}
 
 	/*
@@ -1133,7 +1419,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	dme = htable_lookup(dm->by_guid, info->guid);
+	dme = dm_lookup_guid(dm, info->guid);
 
 	if (dme) {
 		/*
@@ -1165,7 +1451,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		 * Allocate new entry.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1183,19 +1469,15 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 				sha1_base32(sha1), guid_hex_str(info->guid));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by GUID.
+		 * New entries are appended at the tail of the array, and we
+		 * record them into the index by GUID.
 		 */
 
-		list_append(dm->entries, dme);
+		dm_index_add(dm, dme);
 		dm->last_update = now;
 
-		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		if (dm->count == MAX_ENTRIES)
+			dm_remove_entry(dm, dm_entry(dm, 0));	/* Oldest entry */
 	}
 
 	/*
@@ -1309,7 +1591,6 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	host_addr_t addr, uint16 port)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	host_addr_t net;
 
@@ -1322,8 +1603,7 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return;
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL)
 		return;
@@ -1368,7 +1648,6 @@ dmesh_good_mark(const struct sha1 *sha1,
 	host_addr_t addr, uint16 port, bool good)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	bool retried = FALSE;
 
@@ -1376,10 +1655,8 @@ dmesh_good_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	packed = host_pack(addr, port);
-
 retry:
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL) {
 		/*
@@ -1449,7 +1726,7 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	dme = htable_lookup(dm->by_guid, guid);
+	dme = dm_lookup_guid(dm, guid);
 
 	if (dme == NULL)
 		return;
@@ -1671,106 +1948,31 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 }
 
 /**
- * Format dmesh_entry in the provided buffer, as an URL with an appended
- * timestamp in ISO format, GMT time.
+ * Get the compact addr:port form of a mesh entry, as emitted in X-Alt.
  *
- * @return length of formatted entry, -1 if the URL would be larger than
- * the buffer.
- */
-static size_t
-dmesh_entry_url_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
-{
-	size_t rw;
-	bool quoting;
-
-	g_assert(!dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the URL info first.
-	 */
-
-	rw = dmesh_urlinfo_to_string_buf(&dme->e.url, buf, size, &quoting);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * If quoting is required, we need to surround the already formatted
-	 * string into "quotes".
-	 */
-
-	if (quoting) {
-		if (rw + 2 >= size)		/* Not enough room for 2 quotes */
-			return (size_t) -1;
-
-		g_memmove(buf + 1, buf, rw);
-		buf[0] = '"';
-		buf[++rw] = '"';
-		buf[++rw] = '\0';
-	}
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			" ", timestamp_utc_to_string(dme->stamp), (void *) 0);
-
-	return rw < size ? rw : (size_t) -1;
-}
-
-/**
- * Format dmesh_entry in the provided buffer, as a firewalled location
- * with an appended timestamp in ISO format, GMT time.
+ * The form is computed the first time it is needed and then cached in the
+ * mesh bucket, until the slot is reused or the URL info of the entry changes.
  *
- * @return length of formatted entry, -1 if the entry would be larger than
- * the buffer.
+ * @return the compact form, NULL if the entry has none (not an URN_INDEX).
  */
-static size_t
-dmesh_entry_fw_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
+static const char *
+dmesh_entry_alt(struct dmesh *dm, const struct dmesh_entry *dme)
 {
-	size_t rw;
-
-	g_assert(dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the firewalled host info first.
-	 */
-
-	rw = dmesh_fwinfo_to_string_buf(&dme->e.fwh, buf, size);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			";", timestamp_utc_to_string(dme->stamp), (void *) 0);
+	char *alt;
 
-	return rw < size ? rw : (size_t) -1;
-}
+	if G_UNLIKELY(NULL == dm->alt)
+		WALLOC0_ARRAY(dm->alt, dm->capacity);
 
-/**
- * Format the `dme' mesh entry as "URL timestamp" or as FW host info.
- *
- * @return pointer to static string.
- */
-static const char *
-dmesh_entry_to_string(const struct dmesh_entry *dme)
-{
-	static char str[1024];
+	alt = dm->alt[dm_slot(dm, dme)];
 
-	if (dme->fw_entry) {
-		dmesh_entry_fw_stamp(dme, str, sizeof str);
-	} else {
-		dmesh_entry_url_stamp(dme, str, sizeof str);
+	if G_UNLIKELY('\0' == alt[0]) {
+		if ((size_t) -1 == dmesh_entry_compact(dme, alt, sizeof dm->alt[0])) {
+			alt[0] = '\0';
+			return NULL;
+		}
 	}
 
-	return str;
+	return alt;
 }
 
 /**
@@ -1785,10 +1987,10 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	struct dmesh *dm;
 	struct dmesh_entry *selected[MAX_ENTRIES];
 	int nselected;
+	uint n;
 	int i;
 	int j;
 	bool complete_file;
-	list_iter_t *iter;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
@@ -1804,10 +2006,9 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 
 	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (n = 0; n < dm->count; n++) {
+		struct dmesh_entry *dme = dm_entry(dm, n);
 
 		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
 			continue;
@@ -1840,12 +2041,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		return 0;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass: choose at most `hcnt' entries at random.
@@ -1974,7 +2174,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	uint n;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2140,7 +2340,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (dm->count == 0) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2159,11 +2359,10 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (n = 0; n < dm->count; n++) {
+		struct dmesh_entry *dme = dm_entry(dm, n);
 
 		if (dme->fw_entry)
 			continue;
@@ -2206,12 +2405,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass.
@@ -2221,16 +2419,15 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	for (i = 0; i < nselected; i++) {
 		struct dmesh_entry *dme = selected[i];
-		size_t url_len;
+		const char *alt;
 
 		g_assert(delta_time(dme->inserted, last_sent) > 0);
 
-		url_len = dmesh_entry_compact(dme, url, sizeof url);
+		alt = dmesh_entry_alt(dm, dme);
 
-		/* Buffer was large enough */
-		g_assert((size_t) -1 != url_len && url_len < sizeof url);
+		g_assert(alt != NULL);		/* Only URN_INDEX entries selected */
 
-		if (header_fmt_append_value(fmt, url))
+		if (header_fmt_append_value(fmt, alt))
 			added = TRUE;
 	}
 
@@ -2293,10 +2490,8 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (n = 0; n < dm->count; n++) {
+		struct dmesh_entry *dme = dm_entry(dm, n);
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2368,8 +2563,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2827,7 +3020,7 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	uint n;
 	int i;
 
 	g_assert(sha1);
@@ -2839,10 +3032,9 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (n = 0; n < dm->count && i < count; n++) {
+		struct dmesh_entry *dme = dm_entry(dm, n);
 		dmesh_urlinfo_t *from;
 
 		if (dme->fw_entry)
@@ -2854,8 +3046,6 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		buf[i++] = *from;
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3110,27 +3300,108 @@ dmesh_multiple_downloads(const struct sha1 *sha1,
 }
 
 /**
- * Store key/value pair in file.
+ * Compute upper bound of the serialized size of a mesh entry.
+ */
+static size_t
+dmesh_entry_serial_size(const struct dmesh_entry *dme)
+{
+	size_t size = 1 + 4;	/* Entry kind, timestamp */
+
+	if (dme->fw_entry) {
+		size += GUID_RAW_SIZE + 1;
+		if (dme->e.fwh.proxies != NULL) {
+			size += (17 + 2) *
+				MIN(hash_list_length(dme->e.fwh.proxies), MAX_INT_VAL(uint8));
+		}
+	} else {
+		size += 17 + 2 + 4;	/* Address, port, index */
+		if (dme->e.url.idx != URN_INDEX)
+			size += 10 + strlen(dme->e.url.name);
+	}
+
+	return size;
+}
+
+/**
+ * Serialize mesh entry into message.
+ *
+ * The name of URN_INDEX entries is not stored since it is derived from
+ * the SHA1 of the bucket, and at most 255 push-proxies are stored for
+ * firewalled entries.
+ */
+static void
+dmesh_entry_serialize(pmsg_t *mb, const struct dmesh_entry *dme)
+{
+	pmsg_write_u8(mb, dme->fw_entry ? DMESH_ENTRY_FW : DMESH_ENTRY_URL);
+	pmsg_write_time(mb, dme->stamp);
+
+	if (dme->fw_entry) {
+		const dmesh_fwinfo_t *info = &dme->e.fwh;
+		size_t n = 0;
+
+		pmsg_write(mb, info->guid, GUID_RAW_SIZE);
+
+		if (info->proxies != NULL) {
+			n = MIN(hash_list_length(info->proxies), MAX_INT_VAL(uint8));
+		}
+
+		pmsg_write_u8(mb, n);
+
+		if (n != 0) {
+			hash_list_iter_t *iter = hash_list_iterator(info->proxies);
+
+			while (n-- != 0) {
+				const gnet_host_t *host = hash_list_iter_next(iter);
+
+				pmsg_write_ipv4_or_ipv6_addr(mb, gnet_host_get_addr(host));
+				pmsg_write_be16(mb, gnet_host_get_port(host));
+			}
+			hash_list_iter_release(&iter);
+		}
+	} else {
+		const dmesh_urlinfo_t *info = &dme->e.url;
+
+		pmsg_write_ipv4_or_ipv6_addr(mb, info->addr);
+		pmsg_write_be16(mb, info->port);
+		pmsg_write_be32(mb, info->idx);
+
+		if (info->idx != URN_INDEX)
+			pmsg_write_string(mb, info->name, (size_t) -1);
+	}
+}
+
+/**
+ * Store key/value pair in file, as a binary record.
  */
 static void
 dmesh_store_kv(void *value, void *udata)
 {
 	const struct dmesh *dm = value;
 	FILE *out = udata;
-	list_iter_t *iter;
+	size_t size = SHA1_RAW_SIZE + 2;
+	char len[4];
+	pmsg_t *mb;
+	uint i;
 
-	fprintf(out, "%s\n", sha1_base32(dm->sha1));
+	if (0 == dm->count)
+		return;
 
-	iter = list_iter_before_head(dm->entries);
+	for (i = 0; i < dm->count; i++)
+		size += dmesh_entry_serial_size(dm_entry(dm, i));
 
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
-		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
-	}
+	mb = pmsg_new(PMSG_P_DATA, NULL, size);
 
-	list_iter_free(&iter);
+	pmsg_write(mb, dm->sha1, SHA1_RAW_SIZE);
+	pmsg_write_be16(mb, dm->count);
 
-	fputs("\n", out);
+	for (i = 0; i < dm->count; i++)
+		dmesh_entry_serialize(mb, dm_entry(dm, i));
+
+	poke_be32(len, pmsg_size(mb));
+	fwrite(len, sizeof len, 1, out);
+	fwrite(pmsg_start(mb), pmsg_size(mb), 1, out);
+
+	pmsg_free(mb);
 }
 
 /* XXX add dmesh_store_if_dirty() and export that only */
@@ -3162,21 +3433,14 @@ dmesh_store_hikset(const char *what, hikset_t *hash, const char *file,
 }
 
 /**
- * Prints header to dmesh store file.
+ * Prints header to dmesh store file: the magic string and the version
+ * of the binary format.
  */
 static void
 dmesh_header_print(FILE *out)
 {
-	file_config_preamble(out, "Download mesh");
-
-	fputs(	"#\n# Format is:\n"
-			"#   SHA1\n"
-			"#   URL1 timestamp1\n"
-			"#   URL2 timestamp2\n"
-			"#   FWALT timestamp\n"
-			"#   <blank line>\n"
-			"#\n\n",
-			out);
+	fputs(dmesh_magic, out);
+	fputc(DMESH_FILE_VERSION, out);
 }
 
 /**
@@ -3191,24 +3455,203 @@ dmesh_store(void)
 }
 
 /**
- * Retrieve download mesh and add entries that have not expired yet.
- * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ * Retrieve a serialized URL entry and add it to the mesh.
+ *
+ * @return FALSE on deserialization error.
+ */
+static bool
+dmesh_retrieve_url(bstr_t *bs, const struct sha1 *sha1, time_t stamp)
+{
+	dmesh_urlinfo_t info;
+	host_addr_t addr;
+	uint16 port;
+	uint32 idx;
+	char *name = NULL;
+
+	if (
+		!bstr_read_packed_ipv4_or_ipv6_addr(bs, &addr) ||
+		!bstr_read_be16(bs, &port) ||
+		!bstr_read_be32(bs, &idx)
+	)
+		return FALSE;
+
+	if (idx != URN_INDEX && !bstr_read_string(bs, NULL, &name))
+		return FALSE;
+
+	dmesh_fill_info(&info, URN_INDEX == idx ? sha1 : NULL,
+		addr, port, idx, name);
+	(void) dmesh_raw_add(sha1, &info, stamp, TRUE);
+
+	HFREE_NULL(name);
+	return TRUE;
+}
+
+/**
+ * Retrieve a serialized firewalled entry and add it to the mesh.
+ *
+ * @return FALSE on deserialization error.
+ */
+static bool
+dmesh_retrieve_fw(bstr_t *bs, const struct sha1 *sha1, time_t stamp)
+{
+	struct guid guid;
+	dmesh_fwinfo_t info;
+	uint8 n;
+
+	if (
+		!bstr_read(bs, &guid, GUID_RAW_SIZE) ||
+		!bstr_read_u8(bs, &n)
+	)
+		return FALSE;
+
+	info.proxies = NULL;
+
+	while (n-- != 0) {
+		host_addr_t addr;
+		uint16 port;
+		gnet_host_t host;
+
+		if (
+			!bstr_read_packed_ipv4_or_ipv6_addr(bs, &addr) ||
+			!bstr_read_be16(bs, &port)
+		) {
+			hash_list_free_all(&info.proxies, gnet_host_free);
+			return FALSE;
+		}
+
+		if (is_private_addr(addr) || !host_is_valid(addr, port))
+			continue;
+
+		if (info.proxies == NULL)
+			info.proxies = hash_list_new(gnet_host_hash, gnet_host_equal);
+
+		gnet_host_set(&host, addr, port);
+		if (!hash_list_contains(info.proxies, &host)) {
+			hash_list_append(info.proxies, gnet_host_dup(&host));
+		}
+	}
+
+	info.guid = atom_guid_get(&guid);
+
+	if (!dmesh_raw_fw_add(sha1, &info, stamp, TRUE)) {
+		hash_list_free_all(&info.proxies, gnet_host_free);
+	}
+	atom_guid_free_null(&info.guid);
+
+	return TRUE;
+}
+
+/**
+ * Retrieve a binary record holding all the entries of a mesh bucket.
+ *
+ * @return FALSE on deserialization error.
+ */
+static bool
+dmesh_retrieve_record(bstr_t *bs)
+{
+	struct sha1 sha1;
+	uint16 count;
+	uint i;
+
+	if (
+		!bstr_read(bs, sha1.data, SHA1_RAW_SIZE) ||
+		!bstr_read_be16(bs, &count)
+	)
+		return FALSE;
+
+	for (i = 0; i < count; i++) {
+		uint8 kind;
+		time_t stamp;
+		bool ok;
+
+		if (!bstr_read_u8(bs, &kind) || !bstr_read_time(bs, &stamp))
+			return FALSE;
+
+		switch (kind) {
+		case DMESH_ENTRY_URL:
+			ok = dmesh_retrieve_url(bs, &sha1, stamp);
+			break;
+		case DMESH_ENTRY_FW:
+			ok = dmesh_retrieve_fw(bs, &sha1, stamp);
+			break;
+		default:
+			g_warning("%s(): unknown entry kind %u for urn:sha1:%s",
+				G_STRFUNC, kind, sha1_base32(&sha1));
+			return TRUE;		/* Skip rest of record */
+		}
+
+		if (!ok)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Retrieve download mesh from binary file, positioned after the magic.
  */
 static G_GNUC_COLD void
-dmesh_retrieve(void)
+dmesh_retrieve_binary(FILE *f)
+{
+	char lenbuf[4];
+	char *buf = NULL;
+	size_t size = 0;
+	bstr_t *bs;
+	int version;
+
+	version = fgetc(f);
+
+	if (version != DMESH_FILE_VERSION) {
+		g_warning("%s(): unknown download mesh format version %d, ignoring",
+			G_STRFUNC, version);
+		return;
+	}
+
+	bs = bstr_create();
+
+	while (sizeof lenbuf == fread(lenbuf, 1, sizeof lenbuf, f)) {
+		uint32 len = peek_be32(lenbuf);
+
+		if (len > DMESH_RECORD_MAX) {
+			g_warning("%s(): record too large (%u bytes), stopping",
+				G_STRFUNC, (uint) len);
+			break;
+		}
+
+		if (len > size) {
+			buf = hrealloc(buf, len);
+			size = len;
+		}
+
+		if (len != fread(buf, 1, len, f)) {
+			g_warning("%s(): truncated record (%u bytes), stopping",
+				G_STRFUNC, (uint) len);
+			break;
+		}
+
+		bstr_reset(bs, buf, len, BSTR_F_ERROR);
+
+		if (!dmesh_retrieve_record(bs)) {
+			g_warning("%s(): skipping corrupted record: %s",
+				G_STRFUNC, bstr_error(bs));
+		}
+	}
+
+	bstr_free(&bs);
+	HFREE_NULL(buf);
+}
+
+/**
+ * Retrieve download mesh from the older text format.
+ */
+static G_GNUC_COLD void
+dmesh_retrieve_text(FILE *f)
 {
-	FILE *f;
 	char tmp[4096];
 	struct sha1 sha1;
 	bool has_sha1 = FALSE;
 	bool skip = FALSE, truncated = FALSE;
 	int line = 0;
-	file_path_t fp[1];
-
-	file_path_set(fp, settings_config_dir(), dmesh_file);
-	f = file_config_open_read("download mesh", fp, G_N_ELEMENTS(fp));
-	if (!f)
-		return;
 
 	/*
 	 * Retrieval algorithm:
@@ -3265,6 +3708,37 @@ dmesh_retrieve(void)
 		}
 	}
 
+}
+
+/**
+ * Retrieve download mesh and add entries that have not expired yet.
+ * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ *
+ * Files saved in the older text format are still understood, and get
+ * rewritten in binary form once loaded.
+ */
+static G_GNUC_COLD void
+dmesh_retrieve(void)
+{
+	FILE *f;
+	char magic[CONST_STRLEN(dmesh_magic)];
+	file_path_t fp[1];
+
+	file_path_set(fp, settings_config_dir(), dmesh_file);
+	f = file_config_open_read("download mesh", fp, G_N_ELEMENTS(fp));
+	if (!f)
+		return;
+
+	if (
+		sizeof magic == fread(magic, 1, sizeof magic, f) &&
+		0 == memcmp(magic, dmesh_magic, sizeof magic)
+	) {
+		dmesh_retrieve_binary(f);
+	} else {
+		rewind(f);
+		dmesh_retrieve_text(f);
+	}
+
 	fclose(f);
 	dmesh_store();			/* Persist what we have retrieved */
 }
@@ -3907,9 +3907,9 @@ download_clone(struct download *d)
 		socket_change_owner(cd->socket, cd);	/* Takes ownership of socket */
 
 	cd->list_idx = DL_LIST_INVALID;
-	cd->sha1 = d->sha1 ? atom_sha1_get(d->sha1) : NULL;
+	cd->sha1 = d->sha1 ? atom_sha1_ref(d->sha1) : NULL;
 	cd->file_name = atom_str_get(d->file_name);
-	cd->id = atom_guid_get(d->id);
+	cd->id = atom_guid_ref(d->id);
 	cd->uri = d->uri ? atom_str_get(d->uri) : NULL;
 	cd->flags &= ~(DL_F_MUST_IGNORE | DL_F_SWITCHED |
 		DL_F_FROM_PLAIN | DL_F_FROM_ERROR | DL_F_CLONED | DL_F_NO_PIPELINE);
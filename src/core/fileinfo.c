@@ -67,9 +67,9 @@
 #include "lib/atoms.h"
 #include "lib/base32.h"
 #include "lib/concat.h"
-#include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
@@ -139,6 +139,8 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in fi->chunktree */
+	rbnode_t hole;					/**< Embedded node in fi->holes, if EMPTY */
 };
 
 static inline void
@@ -641,6 +643,149 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Comparison routine for chunks, ordered by starting offset.
+ *
+ * Chunks in the list are contiguous, hence adjusting the boundaries of a
+ * chunk in place never changes the ordering of the chunks in the trees.
+ */
+static int
+dl_file_chunk_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	return CMP(ca->from, cb->from);
+}
+
+/**
+ * Index chunk, just linked in the chunklist.
+ *
+ * When loading an inconsistent chunklist, a chunk starting at the same
+ * offset as another may not be indexed, which file_info_check_chunklist()
+ * will detect.
+ */
+static void
+fi_chunk_index(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	erbtree_insert(&fi->chunktree, &fc->node);
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_insert(&fi->holes, &fc->hole);
+}
+
+/**
+ * Remove chunk from the indices, prior to its removal from the chunklist.
+ */
+static void
+fi_chunk_unindex(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	erbtree_remove(&fi->chunktree, &fc->node);
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_remove(&fi->holes, &fc->hole);
+}
+
+/**
+ * Change status of an indexed chunk.
+ */
+static void
+fi_chunk_set_status(fileinfo_t *fi, struct dl_file_chunk *fc,
+	enum dl_chunk_status status)
+{
+	if (DL_CHUNK_EMPTY == fc->status && DL_CHUNK_EMPTY != status)
+		erbtree_remove(&fi->holes, &fc->hole);
+	else if (DL_CHUNK_EMPTY != fc->status && DL_CHUNK_EMPTY == status)
+		erbtree_insert(&fi->holes, &fc->hole);
+
+	fc->status = status;
+}
+
+/**
+ * Append chunk at the tail of the chunklist.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	fi_chunk_index(fi, fc);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the chunklist.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	fi_chunk_index(fi, nfc);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *nfc;
+
+	nfc = eslist_remove_after(&fi->chunklist, fc);
+	fi_chunk_unindex(fi, nfc);
+	return nfc;
+}
+
+/**
+ * @return the chunk holding the byte at offset `pos', NULL if none.
+ */
+static struct dl_file_chunk *
+fi_chunk_at(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key, *fc;
+
+	key.from = pos;
+	fc = erbtree_lookup_floor(&fi->chunktree, &key);
+
+	return (fc != NULL && pos < fc->to) ? fc : NULL;
+}
+
+/**
+ * @return the chunk preceding `fc' in the chunklist, NULL if none.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return erbtree_data(&fi->chunktree, erbtree_prev(&fc->node));
+}
+
+/**
+ * @return the first EMPTY chunk holding bytes at or after offset `pos',
+ * NULL if there is none.
+ */
+static struct dl_file_chunk *
+fi_hole_from(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key, *fc;
+
+	key.from = pos;
+	fc = erbtree_lookup_floor(&fi->holes, &key);
+
+	if (fc != NULL && pos < fc->to)
+		return fc;
+
+	return erbtree_lookup_ceil(&fi->holes, &key);
+}
+
+/**
+ * @return the EMPTY chunk following `fc', NULL if none.
+ */
+static struct dl_file_chunk *
+fi_hole_next(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	g_assert(DL_CHUNK_EMPTY == fc->status);
+
+	return erbtree_data(&fi->holes, erbtree_next(&fc->hole));
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -698,6 +843,7 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 {
 	const struct dl_file_chunk *fc;
 	filesize_t last = 0;
+	size_t holes = 0;
 
 	/*
 	 * This routine ends up being a CPU hog when all the asserts using it
@@ -714,6 +860,9 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 		if (last != fc->from || fc->from >= fc->to)
 			return FALSE;
 
+		if (DL_CHUNK_EMPTY == fc->status)
+			holes++;
+
 		last = fc->to;
 		if (!fi->file_size_known || 0 == fi->size)
 			continue;
@@ -722,6 +871,16 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 			return FALSE;
 	}
 
+	/*
+	 * All the chunks must also be indexed.
+	 */
+
+	if (erbtree_count(&fi->chunktree) != eslist_count(&fi->chunklist))
+		return FALSE;
+
+	if (erbtree_count(&fi->holes) != holes)
+		return FALSE;
+
 	return TRUE;
 }
 
@@ -1022,6 +1181,8 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunktree);
+	erbtree_clear(&fi->holes);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
@@ -1182,7 +1343,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1766,6 +1927,10 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunktree, dl_file_chunk_cmp,
+		offsetof(struct dl_file_chunk, node));
+	erbtree_init(&fi->holes, dl_file_chunk_cmp,
+		offsetof(struct dl_file_chunk, hole));
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2027,7 +2192,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2940,7 +3105,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -2955,6 +3120,7 @@ static void
 fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 {
 	const struct dl_file_chunk *fc;
+	struct dl_file_chunk *nfc;
 
 	file_info_check(fi);
 	file_info_check(trailer);
@@ -2969,7 +3135,10 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		nfc = WCOPY(fc);
+		ZERO(&nfc->node);		/* Copied nodes belong to the trailer trees */
+		ZERO(&nfc->hole);
+		fi_chunk_append(fi, nfc);
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
@@ -3499,7 +3668,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3650,7 +3819,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4044,7 +4213,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4115,7 +4284,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4126,7 +4295,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4145,7 +4314,7 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4251,8 +4420,15 @@ again:
 	 *		--RAM, 04/11/2002
 	 */
 
+	/*
+	 * Start with the chunk holding `from', located through the index.
+	 */
+
+	fc = fi_chunk_at(fi, from);
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
+		n = 0, prevfc = NULL == fc ? NULL : fi_chunk_prev(fi, fc),
+			sl = NULL == fc ? NULL : &fc->lk;
 		sl != NULL;
 		n++, prevfc = fc, sl = eslist_next(sl)
 	) {
@@ -4272,7 +4448,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4287,7 +4463,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			from = fc->to;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4318,9 +4494,9 @@ again:
 				nfc->download = fc->download;
 
 				fc->to = to;
-				fc->status = status;
+				fi_chunk_set_status(fi, fc, status);
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4345,7 +4521,7 @@ again:
 				nfc->to = fc->to;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4354,7 +4530,7 @@ again:
 					 * Make it free so that the source owning the original
 					 * chunk is not suddenly seen as reserving two chunks!
 					 */
-					nfc->status = DL_CHUNK_EMPTY;
+					fi_chunk_set_status(fi, nfc, DL_CHUNK_EMPTY);
 					nfc->download = NULL;
 				}
 			}
@@ -4364,7 +4540,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			fc->to = from;
 
@@ -4387,7 +4563,7 @@ again:
 			nfc->to = fc->to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			tmp = fc->to;
 			fc->to = from;
@@ -4467,7 +4643,7 @@ file_info_clear_download(struct download *d, bool lifecount)
 		if (fc->download == d) {
 		    fc->download = NULL;
 		    if (DL_CHUNK_BUSY == fc->status)
-				fc->status = DL_CHUNK_EMPTY;
+				fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 		}
 	}
 	file_info_merge_adjacent(fi);
@@ -4522,7 +4698,7 @@ restart:
 	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 		g_assert(NULL == fc->download);
-		fc->status = DL_CHUNK_EMPTY;
+		fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 	}
 
 	file_info_merge_adjacent(fi);
@@ -4542,10 +4718,12 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_at(fi, from);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (from >= fc->from && to <= fc->to)
+		if (to <= fc->to)
 			return fc->status;
 	}
 
@@ -4573,6 +4751,7 @@ file_info_new_chunk_owner(const struct download *d,
 	filesize_t from, filesize_t to)
 {
 	fileinfo_t *fi;
+	struct dl_file_chunk *fc;
 	const struct download *old = NULL;
 	const slink_t *sl;
 
@@ -4581,42 +4760,35 @@ file_info_new_chunk_owner(const struct download *d,
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 */
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	fc = fi_chunk_at(fi, from);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_at(fi, to);
 
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
 	}
 
 	if (old != NULL) {
-		for (sl = eslist_next(sl); sl != NULL; sl = eslist_next(sl)) {
-			struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+		for (sl = eslist_next(&fc->lk); sl != NULL; sl = eslist_next(sl)) {
+			struct dl_file_chunk *fcn = eslist_data(&fi->chunklist, sl);
 
-			dl_file_chunk_check(fc);
+			dl_file_chunk_check(fcn);
 
-			if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
-				fc->status = DL_CHUNK_EMPTY;
-				fc->download = NULL;
+			if (DL_CHUNK_BUSY == fcn->status && fcn->download == old) {
+				fi_chunk_set_status(fi, fcn, DL_CHUNK_EMPTY);
+				fcn->download = NULL;
 			}
 		}
 	}
@@ -4634,10 +4806,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_at(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -4712,23 +4885,6 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 	return count;
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Select a chunk randomly among the rarest chunks offered on the network.
  *
@@ -4748,7 +4904,6 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -4769,41 +4924,29 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		 * See whether chunks up to ``pfsp_first_chunk'' bytes are free.
 		 */
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			if (fc->from >= GNET_PROPERTY(pfsp_first_chunk))
-				break;
-
-			if (DL_CHUNK_EMPTY == fc->status) {
-				if (GNET_PROPERTY(download_debug)) {
-					g_debug("%s(): less than %u bytes, using first chunk",
-						G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
-				}
+		fc = erbtree_head(&fi->holes);
 
-				candidate = first;
-				goto done;
+		if (fc != NULL && fc->from < GNET_PROPERTY(pfsp_first_chunk)) {
+			if (GNET_PROPERTY(download_debug)) {
+				g_debug("%s(): less than %u bytes, using first chunk",
+					G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
 			}
+
+			candidate = first;
+			goto done;
 		}
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
+	 * The `fi->holes' tree contains the file chunks that are still
 	 * empty and need to be downloaded.
 	 *
 	 * The `offered' set contains the HTTP ranges offered by the source,
 	 * if any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
 	offered = NULL == d ? NULL : d->ranges;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -4812,7 +4955,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 
 	ESLIST_FOREACH_DATA(&fi->available, fa) {
 		struct dl_file_chunk *dfc;
-		struct dl_file_chunk crange;
 
 		dl_avail_chunk_check(fa);
 
@@ -4830,12 +4972,9 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		)
 			continue;		/* Range not offered */
 
-		crange.from = fa->from;
-		crange.to = fa->to;
-
-		dfc = rbtree_lookup(missing, &crange);
+		dfc = fi_hole_from(fi, fa->from);
 
-		if (dfc != NULL) {
+		if (dfc != NULL && dfc->from < fa->to) {
 			/* Rare range overlaps with missing range */
 
 			if (
@@ -4945,7 +5084,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -4967,8 +5106,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
@@ -4994,14 +5131,13 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0;
+	struct dl_file_chunk *fc;
 	slink_t *sl;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
-
 		/*
 		 * Check whether first chunk is at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
@@ -5018,7 +5154,6 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
@@ -5031,15 +5166,20 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		fc = fi_chunk_at(fi, last_chunk_offset);
+
+		for (
+			sl = NULL == fc ? NULL : &fc->lk;
+			sl != NULL;
+			sl = eslist_next(sl)
+		) {
+			fc = eslist_data(&fi->chunklist, sl);
+
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_DONE == fc->status)
 				continue;
 
-			if (fc->from < last_chunk_offset && fc->to <= last_chunk_offset)
-				continue;
-
 			offset = fc->from < last_chunk_offset
 				? last_chunk_offset
 				: fc->from;
@@ -5058,41 +5198,28 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	/*
-	 * Pick the first chunk whose start is after the offset.
+	 * Pick the first chunk whose start is after the offset, starting with
+	 * the chunk holding the offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	fc = fi_chunk_at(fi, offset);
 
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (fc->from >= offset)
+		if (fc->from == offset)
 			return fc;
 
 		/*
-		 * If offset lies within a free chunk, it will get split below.
-		 * So exit without selecting anything yet.
+		 * If we have encountered a big chunk and the selected offset lies
+		 * within that chunk, be smarter and break-up the chunk into two at
+		 * the selected offset if it is free.
 		 */
 
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset)
-			break;
-	}
-
-	/*
-	 * If we have not picked anything, it means we have encountered a big chunk
-	 * and the selected offset lies within that chunk.
-	 * Be smarter and break-up any free chunk into two at the selected offset.
-	 */
-
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
 		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
 			struct dl_file_chunk *nfc;
 
-			g_assert(fc->from < offset);	/* Or we'd have cloned above */
+			g_assert(fc->from < offset);	/* Or we'd have returned above */
 			g_assert(fc->download == NULL);	/* Chunk is empty */
 
 			/*
@@ -5106,9 +5233,13 @@ fi_pick_chunk(fileinfo_t *fi)
 			nfc->status = DL_CHUNK_EMPTY;
 			fc->to = nfc->from;
 
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 			return nfc;
 		}
+
+		sl = eslist_next(&fc->lk);
+		if (sl != NULL)
+			return eslist_data(&fi->chunklist, sl);
 	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -5184,7 +5315,7 @@ fi_missing_coverage(const struct download *d)
 	fileinfo_t *fi;
 	filesize_t missing_size = 0;
 	filesize_t covered_size = 0;
-	const struct dl_file_chunk *fc;
+	rbnode_t *rn;
 
 	download_check(d);
 	fi = d->file_info;
@@ -5208,11 +5339,11 @@ fi_missing_coverage(const struct download *d)
 		return available ? (available * 1.0) / (fi->size * 1.0) : 1.0;
 	}
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	ERBTREE_FOREACH(&fi->holes, rn) {
+		const struct dl_file_chunk *fc = erbtree_data(&fi->holes, rn);
 		const http_range_t *r;
 
-		if (DL_CHUNK_EMPTY != fc->status)
-			continue;
+		g_assert(DL_CHUNK_EMPTY == fc->status);
 
 		missing_size += fc->to - fc->from;
 
@@ -5561,8 +5692,7 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	unsigned busy = 0;
 	unsigned pipelined = 0;
 	int reserved;
-	eclist_t cklist;
-	const struct dl_file_chunk *chunk = NULL;
+	const struct dl_file_chunk *chunk = NULL, *fc;
 
 	file_info_check(fi);
 	g_assert(fi->refcount > 0);
@@ -5656,27 +5786,18 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * Take the first empty chunk starting from the picked one, wrapping
+	 * around to the first empty chunk of the file if needed.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
+	fc = NULL == chunk ? NULL : fi_hole_from(fi, chunk->from);
+	if (NULL == fc)
+		fc = erbtree_head(&fi->holes);
 	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
-
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (fc->download != d && download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
-		}
+		g_assert(DL_CHUNK_EMPTY == fc->status);
 
 		*from = fc->from;
 		*to = fc->to;
@@ -5685,6 +5806,19 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 		goto selected;
 	}
 
+	ESLIST_FOREACH(&fi->chunklist, sl) {
+		fc = eslist_data(&fi->chunklist, sl);
+
+		dl_file_chunk_check(fc);
+
+		if (DL_CHUNK_BUSY == fc->status) {
+			g_assert(fc->download != NULL);
+			download_check(fc->download);
+			if (fc->download != d && download_pipelining(fc->download))
+				pipelined++;
+		}
+	}
+
 	busy -= pipelined;
 	g_assert(fi->lifecount > (int32) busy); /* Or we'd found a chunk before */
 
@@ -5724,13 +5858,11 @@ file_info_find_available_hole(
 	const struct download *d, http_rangeset_t *ranges,
 	filesize_t *from, filesize_t *to)
 {
-	slink_t *sl;
 	fileinfo_t *fi;
 	filesize_t chunksize = 0;
-	eclist_t cklist;
 	uint busy = 0;
 	uint pipelined = 0;
-	const struct dl_file_chunk *chunk = NULL;
+	const struct dl_file_chunk *chunk = NULL, *first, *fc;
 
 	download_check(d);
 	g_assert(ranges != NULL);
@@ -5772,27 +5904,20 @@ file_info_find_available_hole(
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * Iterate on the empty chunks starting from the picked one, wrapping
+	 * around to the first empty chunk of the file as if the list of empty
+	 * chunks was circular.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
+	first = NULL == chunk ? NULL : fi_hole_from(fi, chunk->from);
+	if (NULL == first)
+		first = erbtree_head(&fi->holes);
 	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
+	for (fc = first; fc != NULL; /* empty */) {
 		const http_range_t *r;
 
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				busy++;		/* Will be used by aggresive code below */
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
-		}
+		dl_file_chunk_check(fc);
 
 		/*
 		 * Look whether this empty chunk intersects with one of the
@@ -5821,6 +5946,26 @@ file_info_find_available_hole(
 			*to = end;
 			goto found;
 		}
+
+		fc = fi_hole_next(fi, fc);
+		if (NULL == fc)
+			fc = erbtree_head(&fi->holes);
+		if (fc == first)
+			break;
+	}
+
+	/*
+	 * Count busy chunks, which will be used by the aggressive code below.
+	 */
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		if (DL_CHUNK_BUSY == fc->status) {
+			busy++;
+			g_assert(fc->download != NULL);
+			download_check(fc->download);
+			if (download_pipelining(fc->download))
+				pipelined++;
+		}
 	}
 
 	busy -= pipelined;
@@ -6140,7 +6285,7 @@ fi_get_info(gnet_fi_t fih)
 
     WALLOC(info);
 
-    info->guid = atom_guid_get(fi->guid);
+    info->guid = atom_guid_ref(fi->guid);
     info->filename = atom_str_get(filepath_basename(fi->pathname));
 	sha1 = fi->sha1 ? fi->sha1 : fi->cha1;
     info->sha1 = sha1 ? atom_sha1_get(sha1) : NULL;
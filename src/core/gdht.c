@@ -601,7 +601,7 @@ gdht_find_sha1(fileinfo_t *fi)
 	WALLOC(slk);
 	slk->magic = SHA1_LOOKUP_MAGIC;
 	slk->id = gdht_kuid_from_sha1(fi->sha1);
-	slk->fi_guid = atom_guid_get(fi->guid);
+	slk->fi_guid = atom_guid_ref(fi->guid);
 
 	/*
 	 * If we have so many queued searches that we did not manage to get
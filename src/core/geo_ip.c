@@ -349,6 +349,7 @@ gip_load(FILE *f, unsigned idx)
 	}
 
 	iprange_sync(geo_db);
+	ipclass_invalidate();
 
 	if (GNET_PROPERTY(reload_debug)) {
 		if (GIP_IPV4 == idx) {
@@ -462,6 +463,50 @@ void
 gip_close(void)
 {
 	iprange_free(&geo_db);
+	ipclass_invalidate();
+}
+
+/**
+ * Add the geographic mappings to the IP classification map.
+ */
+void
+gip_classify(struct iprange_map *map)
+{
+	if (geo_db != NULL)
+		iprange_map_add_db(map, geo_db, IPCLASS_COUNTRY_SHIFT);
+}
+
+/**
+ * Retrieves the country of an address, given its classification.
+ *
+ * @param c the classification of the address, from ipclass_get().
+ * @return the country mapped to the address as a numerically-encoded
+ *         country code, or ISO3166_INVALID when unknown.
+ */
+uint16
+gip_class_country(const ipclass_t c)
+{
+	uint16 code = (c & IPCLASS_COUNTRY_MASK) >> IPCLASS_COUNTRY_SHIFT;
+
+	return 0 == code ? ISO3166_INVALID : (code >> 1) - 1;
+}
+
+/**
+ * Same as gip_class_country() only returns ISO3166_INVALID if the geo_ip
+ * file is too ancient: the risk of having a wrong mapping is too high.
+ */
+uint16
+gip_class_country_safe(const ipclass_t c)
+{
+	/* We allow them to be ~6 months behind */
+
+	if (
+		delta_time(tm_time(), gip_source[GIP_IPV4].mtime) > 15552000 ||
+		delta_time(tm_time(), gip_source[GIP_IPV6].mtime) > 15552000
+	)
+		return ISO3166_INVALID;
+
+	return gip_class_country(c);
 }
 
 /**
@@ -474,14 +519,10 @@ gip_close(void)
 uint16
 gip_country(const host_addr_t ha)
 {
-	uint16 code;
-
 	if G_UNLIKELY(NULL == geo_db)
 		return ISO3166_INVALID;
-		
-	code = iprange_get_addr(geo_db, ha);
 
-	return 0 == code ? ISO3166_INVALID : (code >> 1) - 1;
+	return gip_class_country(ipclass_get(ha));
 }
 
 /**
@@ -491,15 +532,10 @@ gip_country(const host_addr_t ha)
 uint16
 gip_country_safe(const host_addr_t ha)
 {
-	/* We allow them to be ~6 months behind */
-
-	if (
-		delta_time(tm_time(), gip_source[GIP_IPV4].mtime) > 15552000 ||
-		delta_time(tm_time(), gip_source[GIP_IPV6].mtime) > 15552000
-	)
+	if G_UNLIKELY(NULL == geo_db)
 		return ISO3166_INVALID;
 
-	return gip_country(ha);
+	return gip_class_country_safe(ipclass_get(ha));
 }
 
 /**
@@ -35,13 +35,17 @@
 #define _core_geo_ip_h_
 
 #include "common.h"
+#include "ipclass.h"
 #include "lib/host_addr.h"
 
 void gip_init(void);
 void gip_close(void);
+void gip_classify(struct iprange_map *map);
 
 uint16 gip_country(const host_addr_t addr);
 uint16 gip_country_safe(const host_addr_t ha);
+uint16 gip_class_country(const ipclass_t c);
+uint16 gip_class_country_safe(const ipclass_t c);
 
 const char *gip_country_cc(const host_addr_t ha);
 const char *gip_country_name(const host_addr_t ha);
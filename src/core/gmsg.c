@@ -72,6 +72,13 @@ static uint8 kmsg_weight[256];	/**< For gmsg_cmp() */
 
 static zlib_deflater_t *gmsg_deflater;
 
+/*
+ * A message parsed in the RX buffer is only relayed by referencing that
+ * buffer when it covers at least 1/GMSG_SLICE_RATIO of it, so that small
+ * messages lingering in TX queues do not keep whole RX buffers alive.
+ */
+#define GMSG_SLICE_RATIO	8
+
 /**
  * Ensure that the gnutella message header has the correct size,
  * a TTL greater than zero and that size is at least 23 (GTA_HEADER_SIZE).
@@ -459,6 +466,85 @@ gmsg_split_to_pmsg_extend(const void *head, const void *data,
 	return mb;
 }
 
+/**
+ * Construct PDU referencing the RX buffer where the node's current message
+ * was parsed, if possible.
+ *
+ * @return the new PDU, NULL if the message needs to be copied.
+ */
+static pmsg_t *
+gmsg_node_slice(const gnutella_node_t *n)
+{
+	pdata_t *db = n->rx_data;
+	uint32 size = n->size + GTA_HEADER_SIZE;
+	char *start;
+
+	if (NULL == db || size * GMSG_SLICE_RATIO < pdata_len(db))
+		return NULL;
+
+	start = n->data - GTA_HEADER_SIZE;
+
+	g_assert(ptr_cmp(start, pdata_start(db)) >= 0);
+	g_assert(ptr_diff(start, pdata_start(db)) + size <= pdata_len(db));
+
+	/*
+	 * The header we have may have been updated (hops, TTL) since we read
+	 * it: the header present in the RX buffer is no longer needed.
+	 */
+
+	memcpy(start, n->header, GTA_HEADER_SIZE);
+
+	db = pdata_slice(db, ptr_diff(start, pdata_start(db)), size);
+	return pmsg_alloc(PMSG_P_DATA, db, 0, size);
+}
+
+/**
+ * Construct PDU from the Gnutella message held in the node, for relaying.
+ *
+ * When the message was parsed directly in the RX buffer, the PDU references
+ * that buffer instead of copying the message.
+ */
+pmsg_t *
+gmsg_node_to_pmsg(const gnutella_node_t *n)
+{
+	pmsg_t *mb;
+
+	gmsg_header_check(&n->header, n->size + GTA_HEADER_SIZE);
+
+	mb = gmsg_node_slice(n);
+	if (NULL == mb)
+		return gmsg_split_to_pmsg(&n->header, n->data,
+			n->size + GTA_HEADER_SIZE);
+
+	gmsg_install_presend(mb);
+	return mb;
+}
+
+/**
+ * Construct extended PDU (with free routine) from the Gnutella message held
+ * in the node, for relaying.
+ */
+pmsg_t *
+gmsg_node_to_pmsg_extend(const gnutella_node_t *n,
+	pmsg_free_t free_cb, void *arg)
+{
+	pmsg_t *mb, *mbe;
+
+	gmsg_header_check(&n->header, n->size + GTA_HEADER_SIZE);
+
+	mb = gmsg_node_slice(n);
+	if (NULL == mb) {
+		return gmsg_split_to_pmsg_extend(&n->header, n->data,
+			n->size + GTA_HEADER_SIZE, free_cb, arg);
+	}
+
+	gmsg_install_presend(mb);
+	mbe = pmsg_clone_extend(mb, free_cb, arg);
+	pmsg_free(mb);
+
+	return mbe;
+}
+
 /***
  *** Sending of Gnutella messages.
  ***
@@ -658,13 +744,25 @@ gmsg_split_sendto_one(gnutella_node_t *n,
 }
 
 /**
- * Route message consisting of header and data to one node.
+ * Route message PDU to one node.
+ *
+ * The supplied mb is NOT cloned, it is now owned by this routine.
  */
 static void
-gmsg_split_routeto_one(gnutella_node_t *from, gnutella_node_t *to,
-	const void *head, const void *data, uint32 size)
+gmsg_mb_relay_to(gnutella_node_t *from, gnutella_node_t *to, pmsg_t *mb)
 {
-	gmsg_split_send_from_to(from, to, head, data, size);
+	g_assert(!NODE_TALKS_G2(to));
+	g_soft_assert(!NODE_IS_UDP(to));
+
+	if (NODE_IS_UDP(to) || !NODE_IS_WRITABLE(to)) {
+		pmsg_free(mb);
+		return;
+	}
+
+	if (GNET_PROPERTY(gmsg_debug) > 6)
+		gmsg_dump(stdout, pmsg_start(mb), pmsg_size(mb));
+
+	mq_tcp_putq(to->outq, mb, from);
 }
 
 /**
@@ -723,17 +821,18 @@ gmsg_search_sendto_all(
 }
 
 /**
- * Route message from ``from'' consisting of header and data to all nodes in
- * the list but one node ``n''.
+ * Route message PDU from ``from'' to all nodes in the list but one node ``n''.
+ *
+ * The supplied mb is cloned for each node to which it is sent. It is up
+ * to the caller to free that mb.
  *
  * We never broadcast anything to a leaf node.  Those are handled specially.
  */
 static void
-gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
-	const pslist_t *sl, const gnutella_node_t *n,
-	const void *head, const void *data, uint32 size)
+gmsg_mb_routeto_all_but_one(const gnutella_node_t *from,
+	const pslist_t *sl, const gnutella_node_t *n, const pmsg_t *mb)
 {
-	pmsg_t *mb = gmsg_split_to_pmsg(head, data, size);
+	const void *head = pmsg_start(mb);
 	bool skip_up_with_qrp = FALSE;
 
 	/*
@@ -747,8 +846,6 @@ gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
 	)
 		skip_up_with_qrp = TRUE;
 
-	gmsg_header_check(head, size);
-
 	/* relayed broadcasted message, cannot be sent with hops=0 */
 
 	for (/* empty */; sl; sl = pslist_next(sl)) {
@@ -763,22 +860,15 @@ gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
 			continue;
 		mq_tcp_putq(dn->outq, pmsg_clone(mb), from);
 	}
-
-	pmsg_free(mb);
 }
 
 /**
- * Route message consisting of header and data to all the nodes in the list.
+ * Route the Gnutella message held in the node to all the nodes in the list.
  */
 void
-gmsg_split_routeto_all(
-	const pslist_t *sl,
-	const gnutella_node_t *from,
-	const void *head, const void *data, uint32 size)
+gmsg_node_routeto_all(const pslist_t *sl, const gnutella_node_t *from)
 {
-	pmsg_t *mb = gmsg_split_to_pmsg(head, data, size);
-
-	gmsg_header_check(head, size);
+	pmsg_t *mb = gmsg_node_to_pmsg(from);
 
 	/* relayed broadcasted message, cannot be sent with hops=0 */
 
@@ -806,6 +896,7 @@ gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 {
 	gnutella_node_t *rt_node = rt->ur.u_node;
 	const pslist_t *sl;
+	pmsg_t *mb;
 
 	/*
 	 * If during processing (e.g. in search_request_preprocess()) after
@@ -848,15 +939,16 @@ gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 			return;
 		}
 
-		gmsg_split_routeto_one(n, rt_node, &n->header,
-				n->data, n->size + GTA_HEADER_SIZE);
+		gmsg_mb_relay_to(n, rt_node, gmsg_node_to_pmsg(n));
 		return;
 	case ROUTE_ALL_BUT_ONE:
 		g_assert(n == rt_node);
-		gmsg_split_routeto_all_but_one(n, node_all_ultranodes(), rt_node,
-			&n->header, n->data, n->size + GTA_HEADER_SIZE);
+		mb = gmsg_node_to_pmsg(n);
+		gmsg_mb_routeto_all_but_one(n, node_all_ultranodes(), rt_node, mb);
+		pmsg_free(mb);
 		return;
 	case ROUTE_MULTI:
+		mb = gmsg_node_to_pmsg(n);
 		PSLIST_FOREACH(rt->ur.u_nodes, sl) {
 			rt_node = sl->data;
 			node_check(rt_node);
@@ -864,9 +956,9 @@ gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 				continue;
 			if (n->header_flags && !NODE_CAN_SFLAG(rt_node))
 				continue;
-			gmsg_split_routeto_one(n, rt_node,
-				&n->header, n->data, n->size + GTA_HEADER_SIZE);
+			gmsg_mb_relay_to(n, rt_node, pmsg_clone(mb));
 		}
+		pmsg_free(mb);
 		return;
 	}
 
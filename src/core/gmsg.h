@@ -111,6 +111,9 @@ pmsg_t *gmsg_split_to_pmsg(const void *head, const void *data,
 			uint32 size);
 pmsg_t * gmsg_split_to_pmsg_extend(const void *head, const void *data,
 			uint32 size, pmsg_free_t free_cb, void *arg);
+pmsg_t *gmsg_node_to_pmsg(const struct gnutella_node *n);
+pmsg_t *gmsg_node_to_pmsg_extend(const struct gnutella_node *n,
+			pmsg_free_t free_cb, void *arg);
 
 struct pslist;
 
@@ -125,9 +128,8 @@ void gmsg_ctrl_sendto_one(struct gnutella_node *n,
 void gmsg_split_sendto_one(struct gnutella_node *n,
 		const void *head, const void *data, uint32 size);
 void gmsg_sendto_all(const struct pslist *l, const void *msg, uint32 size);
-void gmsg_split_routeto_all(const struct pslist *l,
-		const struct gnutella_node *from,
-		const void *head, const void *data, uint32 size);
+void gmsg_node_routeto_all(const struct pslist *l,
+		const struct gnutella_node *from);
 void gmsg_sendto_route(struct gnutella_node *n, struct route_dest *rt);
 
 bool gmsg_can_drop(const void *pdu, int size);
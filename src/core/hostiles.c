@@ -39,6 +39,7 @@
 #include "common.h"
 
 #include "hostiles.h"
+#include "ipclass.h"
 #include "settings.h"
 #include "nodes.h"
 #include "gnet_stats.h"
@@ -273,6 +274,7 @@ hostiles_close_one(hostiles_t which)
 	
 	g_assert(i < NUM_HOSTILES);
 	iprange_free(&hostile_db[i]);
+	ipclass_invalidate();
 }
 
 /**
@@ -334,6 +336,7 @@ hostiles_load(FILE *f, hostiles_t which)
 	}
 
 	iprange_sync(hostile_db[which]);
+	ipclass_invalidate();
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u addresses/netmasks from %s (%u hosts)",
@@ -681,27 +684,29 @@ hostiles_dynamic_add_ipv6(const uint8 *ipv6, hostiles_flags_t flags)
 	return entry->he6_flags;
 }
 
-static hostiles_flags_t
-hostiles_static_check_ipv4(uint32 ipv4)
+/**
+ * Add the static hostile networks to the IP classification map.
+ */
+void
+hostiles_classify(struct iprange_map *map)
 {
 	int i;
 
 	for (i = 0; i < NUM_HOSTILES; i++) {
-		if (i == HOSTILE_GLOBAL && !GNET_PROPERTY(use_global_hostiles_txt))
-			continue;
-
-		if (NULL != hostile_db[i] && 0 != iprange_get(hostile_db[i], ipv4))
-			return HSTL_STATIC;
+		if (hostile_db[i] != NULL)
+			iprange_map_add_db(map, hostile_db[i], IPCLASS_HOSTILE_SHIFT + i);
 	}
-	return HSTL_CLEAN;
 }
 
 static hostiles_flags_t
-hostiles_static_check_ipv6(const uint8 *ipv6)
+hostiles_static_check(const host_addr_t ha)
 {
-	(void) ipv6;
+	ipclass_t mask = IPCLASS_HOSTILE_PRIVATE;
+
+	if (GNET_PROPERTY(use_global_hostiles_txt))
+		mask |= IPCLASS_HOSTILE_GLOBAL;
 
-	return HSTL_CLEAN;	/* static IPv6 hostiles not supported yet */
+	return 0 != (ipclass_get(ha) & mask) ? HSTL_STATIC : HSTL_CLEAN;
 }
 
 static void
@@ -740,7 +745,7 @@ hostiles_dynamic_add(const host_addr_t addr, const char *reason,
 	) {
 		uint32 ip = host_addr_ipv4(ipv4_addr);
 
-		if (!hostiles_static_check_ipv4(ip)) {
+		if (!hostiles_static_check(ipv4_addr)) {
 			hostiles_flags_t nflags = hostiles_dynamic_add_ipv4(ip, flags);
 
 			if (GNET_PROPERTY(spam_debug) > 1) {
@@ -752,7 +757,7 @@ hostiles_dynamic_add(const host_addr_t addr, const char *reason,
 
 		ip = host_addr_ipv6(&addr);
 
-		if (!hostiles_static_check_ipv6(ip)) {
+		if (!hostiles_static_check(addr)) {
 			hostiles_flags_t nflags = hostiles_dynamic_add_ipv6(ip, flags);
 
 			if (GNET_PROPERTY(spam_debug) > 1) {
@@ -817,7 +822,7 @@ hostiles_check(const host_addr_t ha)
 
 		flags = hostiles_dynamic_check_ipv4(ip);
 		if (!hostiles_flags_are_bad(flags))
-			flags |= hostiles_static_check_ipv4(ip);
+			flags |= hostiles_static_check(to);
 	} else if (host_addr_is_ipv6(ha)) {
 		const uint8 *ip;
 
@@ -825,7 +830,7 @@ hostiles_check(const host_addr_t ha)
 
 		flags = hostiles_dynamic_check_ipv6(ip);
 		if (!hostiles_flags_are_bad(flags))
-			flags |= hostiles_static_check_ipv6(ip);
+			flags |= hostiles_static_check(ha);
 	}
 
 	return flags;
@@ -78,6 +78,9 @@ const char *hostiles_flags_to_string(const hostiles_flags_t flags);
 void hostiles_init(void);
 void hostiles_close(void);
 
+struct iprange_map;
+void hostiles_classify(struct iprange_map *map);
+
 hostiles_flags_t hostiles_check(const host_addr_t addr);
 bool hostiles_spam_check(const host_addr_t addr, uint16 port);
 
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Unified classification of IP addresses.
+ *
+ * The static hostile lists, the bogons, the geographic mappings and the
+ * whitelist are merged into a single compiled map, so that a single lookup
+ * returns all the attributes of an address.
+ *
+ * Each source calls ipclass_invalidate() when its list changes, and the
+ * map is rebuilt from all the sources at the next lookup.  The new map
+ * only replaces the old one once fully built.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "ipclass.h"
+#include "bogons.h"
+#include "geo_ip.h"
+#include "hostiles.h"
+#include "whitelist.h"
+
+#include "lib/iprange.h"
+#include "lib/tm.h"
+
+#include "if/gnet_property_priv.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+static struct iprange_map *ipclass_map;	/**< Compiled classification */
+static bool ipclass_stale;				/**< Whether map must be rebuilt */
+
+/**
+ * Rebuild the classification map from all the sources.
+ */
+static void
+ipclass_rebuild(void)
+{
+	struct iprange_map *map;
+	tm_t start, end;
+
+	if (GNET_PROPERTY(reload_debug))
+		tm_now_exact(&start);
+
+	map = iprange_map_new();
+
+	hostiles_classify(map);
+	bogons_classify(map);
+	gip_classify(map);
+	whitelist_classify(map);
+
+	iprange_map_compile(map);
+
+	iprange_map_free(&ipclass_map);
+	ipclass_map = map;
+	ipclass_stale = FALSE;
+
+	if (GNET_PROPERTY(reload_debug)) {
+		tm_now_exact(&end);
+		g_debug("IPCLASS rebuilt with %zu IPv4 and %zu IPv6 ranges "
+			"in %u ms",
+			iprange_map_range_count4(map), iprange_map_range_count6(map),
+			(uint) tm_elapsed_ms(&end, &start));
+	}
+}
+
+/**
+ * Classify an IP address.
+ *
+ * @param ha	the address to classify
+ *
+ * @return the attributes of the address, 0 if it is not listed anywhere.
+ */
+ipclass_t
+ipclass_get(const host_addr_t ha)
+{
+	if G_UNLIKELY(ipclass_stale || NULL == ipclass_map)
+		ipclass_rebuild();
+
+	return iprange_map_get_addr(ipclass_map, ha);
+}
+
+/**
+ * Signal that one of the sources changed, requiring a rebuild.
+ */
+void
+ipclass_invalidate(void)
+{
+	ipclass_stale = TRUE;
+}
+
+/**
+ * Shutdown.
+ */
+void
+ipclass_close(void)
+{
+	iprange_map_free(&ipclass_map);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Unified classification of IP addresses.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_ipclass_h_
+#define _core_ipclass_h_
+
+#include "common.h"
+#include "lib/host_addr.h"
+
+struct iprange_map;
+
+/**
+ * Classification of an IP address, packing the attributes it gets from
+ * all the static address lists we load.
+ */
+typedef uint32 ipclass_t;
+
+#define IPCLASS_COUNTRY_SHIFT	0	/**< 16 bits: geo_ip country value */
+#define IPCLASS_BOGON_SHIFT		16	/**< 1 bit: listed in bogons.txt */
+#define IPCLASS_HOSTILE_SHIFT	17	/**< 2 bits: one per hostiles.txt */
+#define IPCLASS_WHITELIST_SHIFT	19	/**< 1 bit: listed in whitelist */
+
+#define IPCLASS_COUNTRY_MASK	(0xffffU << IPCLASS_COUNTRY_SHIFT)
+#define IPCLASS_BOGON			(1U << IPCLASS_BOGON_SHIFT)
+#define IPCLASS_HOSTILE_GLOBAL	(1U << IPCLASS_HOSTILE_SHIFT)
+#define IPCLASS_HOSTILE_PRIVATE	(1U << (IPCLASS_HOSTILE_SHIFT + 1))
+#define IPCLASS_WHITELIST		(1U << IPCLASS_WHITELIST_SHIFT)
+
+/*
+ * Public interface.
+ */
+
+ipclass_t ipclass_get(const host_addr_t ha);
+void ipclass_invalidate(void);
+void ipclass_close(void);
+
+#endif /* _core_ipclass_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
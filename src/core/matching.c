@@ -32,12 +32,12 @@
 
 #include "lib/ascii.h"
 #include "lib/atomic.h"
-#include "lib/atoms.h"
 #include "lib/halloc.h"
-#include "lib/hset.h"
-#include "lib/pattern.h"
+#include "lib/htable.h"
+#include "lib/mpattern.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
+#include "lib/tm.h"
 #include "lib/utf8.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
@@ -78,19 +78,24 @@
  *    bin["rc"] has 1
  *
  * Therefore we'll look for "arc" in the bin["rc"] list.
+ *
+ * To keep the table compact with large libraries, entries are not allocated
+ * individually: they are stored in columns, i.e. parallel arrays indexed by
+ * the entry number, and bins only hold 32-bit entry numbers.  The names are
+ * copied in a single heap where identical names are stored only once, each
+ * entry recording the offset of its name in the heap.
+ *
+ * Scanning a bin only touches the mask and length columns until we find an
+ * entry that can possibly match, at which point the name is looked at.
  */
 
 #define ST_MIN_BIN_SIZE		4
-
-struct st_entry {
-	const char *string;				/* atom */
-	shared_file_t *sf;
-	uint32 mask;
-};
+#define ST_MIN_ENTRIES		64
+#define ST_MIN_HEAP_SIZE	1024
 
 struct st_bin {
 	int nslots, nvals;
-	struct st_entry **vals;
+	uint32 *vals;					/* Entry numbers */
 };
 
 enum search_table_magic { SEARCH_TABLE_MAGIC = 0x0cf66242 };
@@ -98,8 +103,16 @@ enum search_table_magic { SEARCH_TABLE_MAGIC = 0x0cf66242 };
 struct search_table {
 	enum search_table_magic magic;
 	int nentries, nchars, nbins;
+	int nslots;						/* Allocated slots in entry columns */
 	struct st_bin **bins;
-	struct st_bin all_entries;
+	uint32 *mask;					/* Column: character mask of names */
+	uint32 *name_off;				/* Column: name offset within heap */
+	uint32 *name_len;				/* Column: name length */
+	shared_file_t **sf;				/* Column: shared file (referenced) */
+	char *names;					/* Heap of NUL-terminated names */
+	size_t heap_len;				/* Used bytes in name heap */
+	size_t heap_size;				/* Allocated bytes in name heap */
+	htable_t *heap_names;			/* Name -> offset + 1, whilst building */
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
 	int refcnt;
@@ -112,16 +125,6 @@ search_table_check(const struct search_table * const st)
 	g_assert(SEARCH_TABLE_MAGIC == st->magic);
 }
 
-static void
-destroy_entry(struct st_entry *entry)
-{
-	g_assert(entry != NULL);
-
-	atom_str_free_null(&entry->string);
-	shared_file_unref(&entry->sf);
-	WFREE(entry);
-}
-
 /**
  * Initialize a bin.
  */
@@ -135,7 +138,7 @@ bin_initialize(struct st_bin *bin, int size)
 
 	HALLOC_ARRAY(bin->vals, bin->nslots);
 	for (i = 0; i < bin->nslots; i++)
-		bin->vals[i] = NULL;
+		bin->vals[i] = 0;
 }
 
 /**
@@ -168,13 +171,13 @@ bin_destroy(struct st_bin *bin)
  * Inserts an item into a bin.
  */
 static void
-bin_insert_item(struct st_bin *bin, struct st_entry *entry)
+bin_insert_item(struct st_bin *bin, uint32 idx)
 {
 	if (bin->nvals == bin->nslots) {
 		bin->nslots *= 2;
 		HREALLOC_ARRAY(bin->vals, bin->nslots);
 	}
-	bin->vals[bin->nvals++] = entry;
+	bin->vals[bin->nvals++] = idx;
 }
 
 /**
@@ -256,7 +259,6 @@ st_initialize(search_table_t *table)
 	table->nchars = cur_char;
 	table->nbins = table->nchars * table->nchars;
 	table->bins = NULL;
-	table->all_entries.vals = 0;
 
 	if (GNET_PROPERTY(matching_debug)) {
 		static bool done;
@@ -284,7 +286,16 @@ st_recreate(search_table_t *table)
 	for (i = 0; i < table->nbins; i++)
 		table->bins[i] = NULL;
 
-    bin_initialize(&table->all_entries, ST_MIN_BIN_SIZE);
+	table->nslots = ST_MIN_ENTRIES;
+	HALLOC_ARRAY(table->mask, table->nslots);
+	HALLOC_ARRAY(table->name_off, table->nslots);
+	HALLOC_ARRAY(table->name_len, table->nslots);
+	HALLOC_ARRAY(table->sf, table->nslots);
+
+	table->heap_size = ST_MIN_HEAP_SIZE;
+	table->heap_len = 0;
+	table->names = halloc(table->heap_size);
+	table->heap_names = htable_create(HASH_KEY_STRING, 0);
 }
 
 /**
@@ -316,13 +327,16 @@ st_destroy(search_table_t *table)
 		HFREE_NULL(table->bins);
 	}
 
-	if (table->all_entries.vals) {
-		for (i = 0; i < table->all_entries.nvals; i++) {
-			destroy_entry(table->all_entries.vals[i]);
-			table->all_entries.vals[i] = NULL;
-		}
-		bin_destroy(&table->all_entries);
-	}
+	for (i = 0; i < table->nentries; i++)
+		shared_file_unref(&table->sf[i]);
+
+	HFREE_NULL(table->mask);
+	HFREE_NULL(table->name_off);
+	HFREE_NULL(table->name_len);
+	HFREE_NULL(table->sf);
+	HFREE_NULL(table->names);
+	htable_free_null(&table->heap_names);
+	table->nentries = table->nslots = 0;
 
 	return TRUE;
 }
@@ -385,7 +399,37 @@ st_count(const search_table_t *table)
 {
 	search_table_check(table);
 
-	return table->all_entries.nvals;
+	return table->nentries;
+}
+
+/**
+ * @return amount of memory used by the table, in bytes.
+ */
+size_t
+st_memory(const search_table_t *table)
+{
+	size_t bytes;
+	int i;
+
+	search_table_check(table);
+
+	bytes = sizeof *table;
+	bytes += table->nbins * sizeof table->bins[0];
+	bytes += table->nslots * (sizeof table->mask[0] +
+		sizeof table->name_off[0] + sizeof table->name_len[0] +
+		sizeof table->sf[0]);
+	bytes += table->heap_size;
+
+	if (table->bins != NULL) {
+		for (i = 0; i < table->nbins; i++) {
+			const struct st_bin *bin = table->bins[i];
+
+			if (bin != NULL)
+				bytes += sizeof *bin + bin->nslots * sizeof bin->vals[0];
+		}
+	}
+
+	return bytes;
 }
 
 /**
@@ -422,18 +466,55 @@ st_key(search_table_t *table, const char k[2])
 		table->index_map[(uchar) k[1]];
 }
 
+/**
+ * Record name in the name heap, unless already present.
+ *
+ * @return the offset of the name within the heap.
+ */
+static uint32
+st_heap_name(search_table_t *table, const char *s, size_t len)
+{
+	void *val;
+	size_t off;
+
+	if (
+		table->heap_names != NULL &&
+		NULL != (val = htable_lookup(table->heap_names, s))
+	)
+		return pointer_to_uint(val) - 1;
+
+	if (table->heap_len + len + 1 > table->heap_size) {
+		table->heap_size = MAX(table->heap_size * 2, table->heap_len + len + 1);
+		table->names = hrealloc(table->names, table->heap_size);
+	}
+
+	off = table->heap_len;
+	g_assert(off < MAX_INT_VAL(uint32));
+
+	memcpy(&table->names[off], s, len + 1);
+	table->heap_len += len + 1;
+
+	if (table->heap_names != NULL)
+		htable_insert(table->heap_names, s, uint_to_pointer(off + 1));
+
+	return off;
+}
+
 /**
  * Insert an item into the search_table
  * one-char strings are silently ignored.
  *
+ * The string is copied in the table but must remain valid until
+ * st_compact() is called, since it is used to spot duplicate names.
+ *
  * @return TRUE if the item was inserted; FALSE otherwise.
  */
 bool
 st_insert_item(search_table_t *table, const char *s, const shared_file_t *sf)
 {
 	size_t i, len;
-	struct st_entry *entry;
-	hset_t *seen_keys;
+	uint32 idx;
+	const char *string;
 
 	search_table_check(table);
 
@@ -441,33 +522,43 @@ st_insert_item(search_table_t *table, const char *s, const shared_file_t *sf)
 	if (len < 2)
 		return FALSE;
 
-	seen_keys = hset_create(HASH_KEY_SELF, 0);
-
-	WALLOC(entry);
-	entry->string = atom_str_get(s);
-	entry->sf = shared_file_ref(sf);
-	entry->mask = mask_hash(entry->string);
+	if (table->nentries == table->nslots) {
+		table->nslots *= 2;
+		HREALLOC_ARRAY(table->mask, table->nslots);
+		HREALLOC_ARRAY(table->name_off, table->nslots);
+		HREALLOC_ARRAY(table->name_len, table->nslots);
+		HREALLOC_ARRAY(table->sf, table->nslots);
+	}
 
-	len = strlen(entry->string);
-	for (i = 0; i < len - 1; i++) {
-		int key = st_key(table, &entry->string[i]);
+	len = strlen(s);
+	idx = table->nentries++;
+	table->mask[idx] = mask_hash(s);
+	table->name_off[idx] = st_heap_name(table, s, len);
+	table->name_len[idx] = len;
+	table->sf[idx] = shared_file_ref(sf);
 
-		/* don't insert item into same bin twice */
-		if (hset_contains(seen_keys, int_to_pointer(key)))
-			continue;
+	string = &table->names[table->name_off[idx]];
 
-		hset_insert(seen_keys, int_to_pointer(key));
+	for (i = 0; i < len - 1; i++) {
+		int key = st_key(table, &string[i]);
+		struct st_bin *bin;
 
 		g_assert(key < table->nbins);
 		if (table->bins[key] == NULL)
 			table->bins[key] = bin_allocate();
 
-		bin_insert_item(table->bins[key], entry);
+		/*
+		 * Don't insert item into same bin twice: since we're adding the
+		 * last entry, it can only be found at the tail of the bin.
+		 */
+
+		bin = table->bins[key];
+		if (bin->nvals != 0 && idx == bin->vals[bin->nvals - 1])
+			continue;
+
+		bin_insert_item(bin, idx);
 	}
-	bin_insert_item(&table->all_entries, entry);
-	table->nentries++;
 
-	hset_free_null(&seen_keys);
 	return TRUE;
 }
 
@@ -481,10 +572,20 @@ st_compact(search_table_t *table)
 
 	search_table_check(table);
 
-	if (!table->all_entries.nvals)
+	htable_free_null(&table->heap_names);
+
+	if (0 == table->nentries)
 		return;			/* Nothing in table */
 
-	bin_compact(&table->all_entries);
+	table->nslots = table->nentries;
+	HREALLOC_ARRAY(table->mask, table->nslots);
+	HREALLOC_ARRAY(table->name_off, table->nslots);
+	HREALLOC_ARRAY(table->name_len, table->nslots);
+	HREALLOC_ARRAY(table->sf, table->nslots);
+
+	table->heap_size = table->heap_len;
+	table->names = hrealloc(table->names, table->heap_size);
+
 	for (i = 0; i < table->nbins; i++)
 		if (table->bins[i])
 			bin_compact(table->bins[i]);
@@ -492,34 +593,26 @@ st_compact(search_table_t *table)
 
 /**
  * Apply pattern matching on text, matching at the *beginning* of words.
- * Patterns are lazily compiled as needed, using pattern_compile_fast().
+ *
+ * All the query words are looked for in a single pass over the text, using
+ * a multi-pattern matcher which is lazily compiled on the first call.
  */
 static bool
 entry_match(const char *text, size_t tlen,
-	cpattern_t **pw, word_vec_t *wovec, size_t wn)
+	mpattern_t **mp_ptr, word_vec_t *wovec, size_t wn)
 {
-	size_t i;
-
-	for (i = 0; i < wn; i++) {
-		size_t j, offset = 0, amount = wovec[i].amount;
+	if G_UNLIKELY(NULL == *mp_ptr) {
+		mpattern_t *mp = mpattern_make(wn);
+		size_t i;
 
-		if (pw[i] == NULL)
-			pw[i] = pattern_compile_fast(wovec[i].word, wovec[i].len);
+		for (i = 0; i < wn; i++)
+			mpattern_add(mp, wovec[i].word, wovec[i].len, wovec[i].amount);
 
-		for (j = 0; j < amount; j++) {
-			const char *pos;
-
-			pos = pattern_qsearch(pw[i], text, tlen, offset, qs_begin);
-			if (pos)
-				offset = (pos - text) + pattern_len(pw[i]);
-			else
-				break;
-		}
-		if (j != amount)	/* Word does not occur as many time as we want */
-			return FALSE;
+		mpattern_compile(mp);
+		*mp_ptr = mp;
 	}
 
-	return TRUE;
+	return mpattern_match_all(*mp_ptr, text, tlen, qs_begin);
 }
 
 /**
@@ -541,7 +634,7 @@ st_fill_qhv(const char *search_term, query_hashvec_t *qhv)
 	if (NULL == qhv)
 		return;
 
-	search = UNICODE_CANONIZE(search_term);
+	search = UNICODE_CANONIZE_CACHED(search_term);
 	wocnt = word_vec_make(search, &wovec);
 
 	for (i = 0; i < wocnt; i++) {
@@ -584,9 +677,10 @@ st_search(
 	int best_bin_size = INT_MAX;
 	word_vec_t *wovec;
 	uint wocnt;
-	cpattern_t **pattern;
-	struct st_entry **vals;
+	mpattern_t *matcher = NULL;
+	const uint32 *vals;
 	uint vcnt;
+	tm_t start;
 	int scanned = 0;		/* measure search mask efficiency */
 	uint32 search_mask;
 	size_t minlen;
@@ -594,7 +688,11 @@ st_search(
 
 	search_table_check(table);
 
-	search = UNICODE_CANONIZE(search_term);
+	ZERO(&start);
+	if (GNET_PROPERTY(matching_debug) > 3)
+		tm_now_exact(&start);
+
+	search = UNICODE_CANONIZE_CACHED(search_term);
 
 	if (GNET_PROPERTY(query_debug) > 4 && 0 != strcmp(search, search_term)) {
 		char *safe_search = hex_escape(search, FALSE);
@@ -677,8 +775,6 @@ st_search(
 
 	g_assert(best_bin_size > 0);	/* Allocated bin, it must hold something */
 
-	WALLOC0_ARRAY(pattern, wocnt);
-
 	/*
 	 * Prepare matching optimization, an idea from Mike Green.
 	 *
@@ -718,7 +814,7 @@ st_search(
 
 	nres = 0;
 	for (i = 0; i < vcnt; i++) {
-		const struct st_entry *e = vals[i];
+		uint32 idx = vals[i];
 		const shared_file_t *sf;
 		size_t canonic_len;
 
@@ -731,21 +827,24 @@ st_search(
 		 * when they repeat the search over time.
 		 */
 
-		if ((e->mask & search_mask) != search_mask)
+		if ((table->mask[idx] & search_mask) != search_mask)
 			continue;		/* Can't match */
 
-		sf = e->sf;
+		canonic_len = table->name_len[idx];
+		if (canonic_len < minlen)
+			continue;		/* Can't match */
+
+		sf = table->sf[idx];
 
 		if (!shared_file_is_shareable(sf))
 			continue;		/* Cannot be shared */
 
-		canonic_len = shared_file_name_canonic_len(sf);
-		if (canonic_len < minlen)
-			continue;		/* Can't match */
-
 		scanned++;
 
-		if (entry_match(e->string, canonic_len, pattern, wovec, wocnt)) {
+		if (
+			entry_match(&table->names[table->name_off[idx]], canonic_len,
+				&matcher, wovec, wocnt)
+		) {
 			if (GNET_PROPERTY(matching_debug) > 4) {
 				g_debug("MATCH \"%s\" matches %s",
 					search, shared_file_name_nfc(sf));
@@ -757,10 +856,14 @@ st_search(
 	}
 
 	if (GNET_PROPERTY(matching_debug) > 3) {
+		tm_t end;
+
+		tm_now_exact(&end);
 		g_debug("MATCH %s(): "
-			"scanned %d entr%s from the %d in bin, got %d match%s",
+			"scanned %d entr%s from the %d in bin, got %d match%s in %ld usecs",
 			G_STRFUNC, scanned, plural_y(scanned),
-			best_bin_size, nres, plural_es(nres));
+			best_bin_size, nres, plural_es(nres),
+			(long) tm_elapsed_us(&end, &start));
 	}
 
 	/*
@@ -784,11 +887,7 @@ st_search(
 		pslist_free_null(&result);
 	}
 
-	for (i = 0; i < wocnt; i++)
-		if (pattern[i])					/* Lazily compiled by entry_match() */
-			pattern_free(pattern[i]);
-
-	WFREE_ARRAY(pattern, wocnt);
+	mpattern_free_null(&matcher);		/* Lazily compiled by entry_match() */
 	word_vec_free(wovec, wocnt);
 
 finish:
@@ -75,6 +75,7 @@ bool st_insert_item(search_table_t *, const char *key,
 	const struct shared_file *sf);
 void st_compact(search_table_t *);
 int st_count(const search_table_t *st);
+size_t st_memory(const search_table_t *st);
 search_table_t *st_refcnt_inc(search_table_t *st);
 
 /**
@@ -2081,6 +2081,20 @@ node_real_remove(gnutella_node_t *n)
 	WFREE(n);
 }
 
+/**
+ * Stop referring to the RX buffer where node_read() parsed the current
+ * message, restoring our own data buffer.
+ */
+static void
+node_rx_release(gnutella_node_t *n)
+{
+	if (n->rx_data != NULL) {
+		n->data = n->rx_saved;
+		n->rx_saved = NULL;
+		n->rx_data = NULL;
+	}
+}
+
 /**
  * A node is removed, decrement counters.
  */
@@ -2208,6 +2222,8 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 	/* n->io_opaque will be freed by node_real_remove() */
 	/* n->vendor will be freed by node_real_remove() */
 
+	node_rx_release(n);
+
 	if (n->allocated) {
 		HFREE_NULL(n->data);
 		n->allocated = 0;
@@ -10109,6 +10125,20 @@ node_grow_data(gnutella_node_t *n, size_t len)
 		n->data = &n->socket->buf[0];
 		/* There should be enough room in the buffer! */
 		g_assert(len <= n->socket->buf_size);
+	} else if (n->rx_data != NULL) {
+		/* Message parsed in the RX buffer by node_read(), move it to ours */
+		const char *end = pdata_start(n->rx_data) + pdata_len(n->rx_data);
+		size_t avail = ptr_diff(end, n->data);
+		char *p = n->data;
+
+		node_rx_release(n);
+
+		if (n->allocated < len) {
+			n->data = hrealloc(n->data, len);
+			n->allocated = len;
+		}
+
+		memcpy(n->data, p, MIN(len, avail));
 	} else {
 		/* This is a node where we go through node_read() -- TCP connection */
 		g_assert(0 != n->allocated);
@@ -10129,10 +10159,12 @@ static bool
 node_read(gnutella_node_t *n, pmsg_t *mb)
 {
 	int r;
+	bool inplace = FALSE;
 
 	if (!n->have_header) {		/* We haven't got the header yet */
 		char *w = (char *) &n->header;
 		bool kick = FALSE;
+		bool whole = 0 == n->pos;
 
 		r = pmsg_read(mb, &w[n->pos], GTA_HEADER_SIZE - n->pos);
 		n->pos += r;
@@ -10247,7 +10279,14 @@ node_read(gnutella_node_t *n, pmsg_t *mb)
 
 		n->pos = 0;
 
-		if (n->size > n->allocated) {
+		/*
+		 * If the whole message, header included, lies in the RX buffer
+		 * we can parse it there instead of copying it to our own buffer.
+		 */
+
+		inplace = whole && pmsg_size(mb) >= n->size;
+
+		if (!inplace && n->size > n->allocated) {
 			/*
 			 * We need to grow the allocated data buffer
 			 * Since maximum could change dynamically one day, compute it.
@@ -10277,6 +10316,23 @@ node_read(gnutella_node_t *n, pmsg_t *mb)
 		/* FALL THROUGH */
 	}
 
+	if (inplace) {
+		n->rx_data = pmsg_pdata(mb);
+		n->rx_saved = n->data;
+		n->data = deconstify_char(pmsg_read_base(mb));
+
+		r = pmsg_discard(mb, n->size);
+		g_assert(r == n->size);
+		node_add_rx_read(n, r);
+
+		gnet_stats_count_received_payload(n, n->data);
+
+		node_parse(n);
+		node_rx_release(n);
+
+		return TRUE;		/* There may be more data */
+	}
+
 	/* Reading of the message data */
 
 	r = pmsg_read(mb, n->data + n->pos, n->size - n->pos);
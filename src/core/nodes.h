@@ -175,6 +175,8 @@ typedef struct gnutella_node {
 
 	uint32 allocated;			/**< Size of allocated buffer data, 0 for none */
 	bool have_header;			/**< TRUE if we have got a full message header */
+	pdata_t *rx_data;			/**< RX buffer holding data, if parsed in it */
+	char *rx_saved;				/**< Our own data buffer, whilst in rx_data */
 
 	time_t last_update;			/**< Last update of the node */
 	time_t last_tx;				/**< Last time we transmitted to the node */
@@ -72,6 +72,7 @@
 #include "lib/hevset.h"
 #include "lib/hikset.h"
 #include "lib/htable.h"
+#include "lib/ostree.h"
 #include "lib/parse.h"
 #include "lib/plist.h"
 #include "lib/pslist.h"
@@ -162,7 +163,6 @@ struct parq_banned {
 	time_t expire;
 };
 
-static bool parq_shutdown;
 static time_t parq_start;					/**< Init time */
 static uint64 parq_slots_removed = 0;		/**< Amount of slots removed */
 
@@ -175,11 +175,15 @@ enum parq_ul_queue_magic {
  */
 struct parq_ul_queue {
 	enum parq_ul_queue_magic magic;
-	plist_t *by_position;		/**< Queued items sorted on position. Newest is
-								 added to the end. */
-	hash_list_t *by_rel_pos;	/**< Queued items sorted by relative position */
+	ostree_t by_position;		/**< Queued items sorted on arrival order.
+								 The rank in the tree is the position. */
+	ostree_t by_rel_pos;		/**< Alive items sorted on arrival order. The
+								 rank is the relative position and the node
+								 weights are the estimated slot times */
 	hash_list_t *by_date_dead;	/**< Dead items sorted on last update */
 	statx_t *slot_stats;		/**< Slot kept-time statistics */
+	uint64 seqno;			/**< Arrival sequence number generator */
+	uint eta;				/**< ETA of the head of "by_rel_pos" */
 	int by_position_length;	/**< Number of items in "by_position" */
 
 	int num;				/**< Queue number */
@@ -224,11 +228,14 @@ enum parq_ul_magic {
 struct parq_ul_queued {
 	enum parq_ul_magic magic;			/**< Magic number */
 	uint32 flags;			/**< Operating flags */
-	uint position;			/**< Current position in the queue */
-	uint relative_position; /**< Relative position in the queue, if 'not alive'
-								  uploads are taken into account */
-	uint eta;				/**< Expected time in seconds till an upload slot is
-							     reached, this is a relative timestamp */
+	uint64 seqno;			/**< Arrival order in the queue */
+	osnode_t pos_node;		/**< Embedded node in "by_position" */
+	osnode_t rel_node;		/**< Embedded node in "by_rel_pos" */
+	uint relative_position; /**< Last relative position when not listed in
+								 "by_rel_pos", 0 if it has a regular slot.
+								 See parq_ul_rel_pos() for actual value */
+	uint eta;				/**< Last ETA when not listed in "by_rel_pos",
+								 see parq_ul_eta() for actual value */
 
 	time_t expire;			/**< Time when the queue position will be lost */
 	time_t retry;			/**< Time when the first retry-after is expected */
@@ -1420,22 +1427,114 @@ parq_estimated_slot_time(const struct parq_ul_queued *puq)
 	return pd ? MIN(pd, d) : d;
 }
 
+/**
+ * Function used to keep the queued items sorted by order of arrival in the
+ * queue, which is what absolute and relative positions refer to.
+ */
+static int
+parq_ul_seqno_cmp(const void *a, const void *b)
+{
+	const struct parq_ul_queued *as = a, *bs = b;
+
+	return CMP(as->seqno, bs->seqno);
+}
+
+/**
+ * @return the absolute position of the queued item, starting at 1.
+ */
+static inline uint
+parq_ul_position(const struct parq_ul_queued *puq)
+{
+	return ostree_rank(&puq->queue->by_position, &puq->pos_node);
+}
+
+/**
+ * @return the relative position of the queued item, starting at 1, as
+ * given by its rank among the alive items, or the last known relative
+ * position if it is not listed, 0 meaning it has a regular slot.
+ */
+static uint
+parq_ul_rel_pos(const struct parq_ul_queued *puq)
+{
+	if (osnode_is_linked(&puq->rel_node))
+		return ostree_rank(&puq->queue->by_rel_pos, &puq->rel_node);
+
+	return puq->relative_position;
+}
+
+/**
+ * @return the ETA of the queued item.
+ *
+ * For items listed in the relative position tree, this is the ETA of the
+ * head of the queue plus the estimated slot times of all the items before
+ * it without a slot, which are kept as weights in the tree.
+ */
+static uint
+parq_ul_eta(const struct parq_ul_queued *puq)
+{
+	const struct parq_ul_queue *q = puq->queue;
+	uint64 eta;
+
+	if (!osnode_is_linked(&puq->rel_node))
+		return puq->eta;
+
+	eta = q->eta + ostree_weight_before(&q->by_rel_pos, &puq->rel_node);
+
+	/*
+	 * For the first "max_uploads" ones, we use the normal computation.
+	 * For slots further away, we further compute the average time it
+	 * would take to move to a runnable slot based on global removal
+	 * rate from all the queues.
+	 */
+
+	if (!puq->has_slot) {
+		uint rel = ostree_rank(&q->by_rel_pos, &puq->rel_node);
+
+		/*
+		 * When sharing is disabled, items queued behind another one
+		 * will not get a slot any time soon.
+		 */
+
+		if (rel > 1 && GNET_PROPERTY(max_uploads) <= 0)
+			return (uint) -1;
+
+		if (rel > GNET_PROPERTY(max_uploads)) {
+			time_delta_t running_time = delta_time(tm_time(), parq_start);
+			time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
+			uint64 cheap_eta = rel * (uint64) per_slot;
+
+			eta = MIN(eta, cheap_eta);
+		}
+	}
+
+	return MIN(eta, MAX_INT_VAL(uint));
+}
+
+/**
+ * Update the weight of a queued item in the relative position tree, which
+ * is the time it will keep an upload slot once it gets one.
+ */
+static void
+parq_upload_update_weight(struct parq_ul_queued *puq)
+{
+	if (osnode_is_linked(&puq->rel_node)) {
+		ostree_set_weight(&puq->queue->by_rel_pos, &puq->rel_node,
+			puq->has_slot ? 0 : parq_estimated_slot_time(puq));
+	}
+}
+
 /**
  * Updates the ETA of all queued items in the given queue.
+ *
+ * This computes the ETA of the head of the queue and refreshes the estimated
+ * slot time of all the alive items, from which individual ETAs derive.
  */
 static void
 parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 {
 	plist_t *l;
+	osnode_t *n;
 	uint eta = 0;
-	uint avg_bps;
-	time_delta_t running_time = delta_time(tm_time(), parq_start);
-	hash_list_iter_t *iter;
-
-	avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
-	avg_bps = MAX(1024, avg_bps);		/* Assume at least 1 KiB/s */
-	if (GNET_PROPERTY(parq_optimistic))
-		avg_bps = MAX(avg_bps, GNET_PROPERTY(bw_http_out));
 
 	if (which_ul_queue->active_uploads) {
 		/*
@@ -1443,8 +1542,9 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 		 * Locate the first active upload in this queue.
 		 */
 
-		PLIST_FOREACH(which_ul_queue->by_position, l) {
-			struct parq_ul_queued *puq = l->data;
+		OSTREE_FOREACH(&which_ul_queue->by_position, n) {
+			struct parq_ul_queued *puq =
+				ostree_data(&which_ul_queue->by_position, n);
 
 			if (puq->has_slot) {		/* Recompute ETA */
 				eta += parq_estimated_slot_time(puq);
@@ -1473,86 +1573,15 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 			g_warning("[PARQ UL] Was unable to calculate an accurate ETA");
 	}
 
-	iter = hash_list_iterator(which_ul_queue->by_rel_pos);
+	which_ul_queue->eta = eta;
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	OSTREE_FOREACH(&which_ul_queue->by_rel_pos, n) {
+		struct parq_ul_queued *puq = ostree_data(&which_ul_queue->by_rel_pos, n);
 
 		g_assert(puq->is_alive);
 
-		puq->eta = eta;
-
-		if (puq->has_slot)
-			continue;			/* Skip already uploading uploads */
-
-		/*
-		 * Recalculate ETA of queued slots
-		 *
-		 * For the first "max_uploads" ones, we use the normal computation.
-		 * For slots further away, we further compute the average time it
-		 * would take to move to a runnable slot based on global removal
-		 * rate from all the queues.
-		 */
-
-		if (puq->relative_position > GNET_PROPERTY(max_uploads)) {
-			time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
-			uint cheap_eta = puq->relative_position * per_slot;
-
-			if (cheap_eta < eta)
-				puq->eta = cheap_eta;
-		}
-
-		eta += parq_estimated_slot_time(puq);
+		parq_upload_update_weight(puq);
 	}
-
-	hash_list_iter_release(&iter);
-}
-
-/**
- * Decreases the position of all queued items after the given queued item.
- */
-static void
-parq_upload_decrease_all_after(struct parq_ul_queued *puq)
-{
-	plist_t *l;
-	int pos_cnt = 0;	/* Used for assertion */
-
-	g_assert(puq != NULL);
-	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_position_length > 0);
-
-	l = plist_find(puq->queue->by_position, puq);
-	pos_cnt = ((struct parq_ul_queued *) l->data)->position;
-
-	l = plist_next(l);	/* Decrease _after_ current parq */
-
-	/*
-	 * Cycle through list and decrease all positions by one. Position should
-	 * never reach 0 which would mean the queued item is currently uploading
-	 */
-	for (;	l; l = plist_next(l)) {
-		struct parq_ul_queued *p = l->data;
-
-		g_assert(p != NULL);
-		g_assert(p->position > 1);
-		g_assert(p->position - 1 == UNSIGNED(pos_cnt));
-
-		p->position--;
-		pos_cnt++;
-	}
-}
-
-/**
- * Function used to keep the relative position list sorted by absolute
- * queue positions, which refer to the order of arrival in the queue.
- */
-static int
-parq_ul_rel_pos_cmp(const void *a, const void *b)
-{
-	const struct parq_ul_queued *as = a, *bs = b;
-
-	return CMP(as->position, bs->position);
 }
 
 /**
@@ -1561,93 +1590,34 @@ parq_ul_rel_pos_cmp(const void *a, const void *b)
 static inline void
 parq_upload_insert_relative(struct parq_ul_queued *puq)
 {
+	void *old;
+
 	parq_ul_queued_check(puq);
 
 	g_assert(!(puq->flags & PARQ_UL_FROZEN));
 
 	puq->relative_position = 0;
-	hash_list_insert_sorted(puq->queue->by_rel_pos, puq, parq_ul_rel_pos_cmp);
+	old = ostree_insert(&puq->queue->by_rel_pos, &puq->rel_node);
+	g_assert(NULL == old);
+	parq_upload_update_weight(puq);
 }
 
 /**
- * Remove item from relative position list.
+ * Remove item from relative position list, if present.
+ *
+ * The item remembers its last relative position and ETA.
  */
 static inline void
 parq_upload_remove_relative(struct parq_ul_queued *puq)
 {
 	parq_ul_queued_check(puq);
 
-	hash_list_remove(puq->queue->by_rel_pos, puq);
-	parq_slots_removed++;
-}
-
-/**
- * Recomputes all absolute positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
- */
-static void
-parq_upload_recompute_positions(struct parq_ul_queue *q)
-{
-	uint pos = 0;
-	uint prev_pos = 0;
-	plist_t *l;
-
-	parq_ul_queue_check(q);
-
-	PLIST_FOREACH(q->by_position, l) {
-		struct parq_ul_queued *puq = l->data;
-
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(puq->position > prev_pos,	/* Was sorted by construction */
-			"pos=%u,, prev=%u", puq->position, prev_pos);
-
-		prev_pos = puq->position;
-		puq->position = ++pos;
-	}
-
-	g_assert(pos <= UNSIGNED(q->by_position_length));
-}
-
-/**
- * Recomputes all relative positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
- */
-static void
-parq_upload_recompute_relative_positions(struct parq_ul_queue *q)
-{
-	uint rel = 0;
-	uint prev_rel = 0;
-	uint prev_pos = 0;
-	hash_list_iter_t *iter;
-
-	parq_ul_queue_check(q);
-
-	iter = hash_list_iterator(q->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(
-			0 == puq->relative_position || puq->relative_position > prev_rel,
-			"rel=%u, prev=%u", puq->relative_position, prev_rel);
-		g_assert_log(puq->position > prev_pos,			/* Was sorted */
-			"pos=%u, prev=%u", puq->position, prev_pos);
-
-		if (puq->relative_position != 0)
-			prev_rel = puq->relative_position;
-		prev_pos = puq->position;
-		puq->relative_position = ++rel;
+	if (osnode_is_linked(&puq->rel_node)) {
+		puq->relative_position = parq_ul_rel_pos(puq);
+		puq->eta = parq_ul_eta(puq);
+		ostree_remove(&puq->queue->by_rel_pos, &puq->rel_node);
 	}
-
-	hash_list_iter_release(&iter);
-
-	g_assert(rel <= UNSIGNED(q->by_position_length));
-	g_assert(hash_list_length(q->by_rel_pos) == rel);
+	parq_slots_removed++;
 }
 
 /**
@@ -1693,7 +1663,7 @@ parq_upload_free(struct parq_ul_queued *puq)
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->queue != NULL);
 	g_assert(puq->queue->by_position_length > 0);
-	g_assert(puq->queue->by_position != NULL);
+	g_assert(osnode_is_linked(&puq->pos_node));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->total > 0);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -1701,8 +1671,6 @@ parq_upload_free(struct parq_ul_queued *puq)
 	if (puq->u != NULL)
 		puq->u->parq_ul = NULL;
 
-	parq_upload_decrease_all_after(puq);
-
 	if (puq->flags & PARQ_UL_QUEUE)
 		hash_list_remove(ul_parq_queue, puq);
 
@@ -1733,36 +1701,25 @@ parq_upload_free(struct parq_ul_queued *puq)
 		hash_list_remove(puq->queue->by_date_dead, puq);
 	}
 
-	/* Remove the current queued item from all lists */
-	puq->queue->by_position = plist_remove(puq->queue->by_position, puq);
+	/*
+	 * Remove the current queued item from all lists.
+	 *
+	 * Positions, relative positions and ETAs of the items after this one
+	 * are derived from the trees, so they are implicitly updated.
+	 */
 
+	ostree_remove(&puq->queue->by_position, &puq->pos_node);
 	parq_upload_remove_relative(puq);
 
 	hikset_remove(ul_all_parq_by_addr_and_name, puq->addr_and_name);
 	htable_remove(ul_all_parq_by_id, &puq->id);
 
 	g_assert(!hash_list_contains(puq->queue->by_date_dead, puq));
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+	g_assert(!osnode_is_linked(&puq->rel_node));
 
-	/*
-	 * Queued upload is now removed from all lists. So queue size can be
-	 * safely decreased and new ETAs can be calculated.
-	 */
 	g_assert(puq->queue->by_position_length > 0);
 	puq->queue->by_position_length--;
 
-	/*
-	 * Don't update ETA on shutdown, we don't need this information, so speed
-	 * up the shutdown process. Also it is better not doing so as on shutdown
-	 * not all entries are removed the 'correct' way, we just want to free
-	 * the memory
-	 */
-	if (!parq_shutdown) {
-		parq_upload_recompute_positions(puq->queue);
-		parq_upload_recompute_relative_positions(puq->queue);
-		parq_upload_update_eta(puq->queue);
-	}
-
 	/* Free the memory used by the current queued item */
 	HFREE_NULL(puq->addr_and_name);
 	atom_sha1_free_null(&puq->sha1);
@@ -1784,7 +1741,7 @@ static uint32
 parq_ul_calc_retry(struct parq_ul_queued *puq)
 {
 	int result = PARQ_TIMER_BY_POS +
-		(puq->relative_position - 1) * (PARQ_TIMER_BY_POS / 2);
+		(parq_ul_rel_pos(puq) - 1) * (PARQ_TIMER_BY_POS / 2);
 
 	if (GNET_PROPERTY(parq_optimistic)) {
 		struct parq_ul_queued *puq_prev = NULL;
@@ -1793,7 +1750,10 @@ parq_ul_calc_retry(struct parq_ul_queued *puq)
 		avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
 		avg_bps = MAX(1, avg_bps);
 
-		puq_prev = hash_list_previous(puq->queue->by_rel_pos, puq);
+		if (osnode_is_linked(&puq->rel_node)) {
+			puq_prev = ostree_data(&puq->queue->by_rel_pos,
+				ostree_prev(&puq->rel_node));
+		}
 
 		if (puq_prev != NULL && puq_prev->has_slot) {
 			int fast_result =
@@ -1824,7 +1784,10 @@ parq_upload_new_queue(void)
 	queue->magic = PARQ_UL_QUEUE_MAGIC;
 	queue->active = TRUE;
 	queue->slot_stats = statx_make();
-	queue->by_rel_pos = hash_list_new(NULL, NULL);
+	ostree_init(&queue->by_position, parq_ul_seqno_cmp,
+		offsetof(struct parq_ul_queued, pos_node));
+	ostree_init(&queue->by_rel_pos, parq_ul_seqno_cmp,
+		offsetof(struct parq_ul_queued, rel_node));
 	queue->by_date_dead = hash_list_new(NULL, NULL);
 
 	ul_parqs = plist_append(ul_parqs, queue);
@@ -1922,10 +1885,8 @@ parq_upload_create(struct upload *u)
 {
 	time_t now = tm_time();
 	struct parq_ul_queued *puq = NULL;
-	struct parq_ul_queued *prev_puq = NULL;
 	struct parq_ul_queue *q = NULL;
-	uint eta = 0;
-	uint rel_pos = 1;
+	void *old;
 
 	upload_check(u);
 	g_assert(ul_all_parq_by_addr_and_name != NULL);
@@ -1934,27 +1895,6 @@ parq_upload_create(struct upload *u)
 	q = parq_upload_which_queue(u);
 	g_assert(q != NULL);
 
-	/* Locate the last alive queued item so we can calculate the ETA */
-	prev_puq = hash_list_tail(q->by_rel_pos);
-
-	if (prev_puq != NULL) {
-		parq_ul_queued_check(prev_puq);
-		g_assert(prev_puq->is_alive);	/* Must be to belong to that list */
-
-		rel_pos = prev_puq->relative_position + 1;
-
-		eta = prev_puq->eta;
-
-		if (GNET_PROPERTY(max_uploads) <= 0) {
-			eta = (uint) -1;
-		} else {
-			eta += parq_estimated_slot_time(prev_puq);
-		}
-	}
-
-	/* Will append item to the list */
-	g_assert(hash_list_length(q->by_rel_pos) + 1 == rel_pos);
-
 	/* Create new parq_upload item */
 	WALLOC0(puq);
 	puq->magic = PARQ_UL_MAGIC;
@@ -1970,9 +1910,7 @@ parq_upload_create(struct upload *u)
 	g_assert(puq->addr_and_name != NULL);
 
 	/* Fill puq structure */
-	puq->position = q->by_position_length + 1;
-	puq->relative_position = rel_pos;
-	puq->eta = eta;
+	puq->seqno = ++q->seqno;
 	puq->enter = now;
 	puq->updated = now;
 	puq->file_size = u->file_size;
@@ -2004,17 +1942,24 @@ parq_upload_create(struct upload *u)
 	/* Save into hash table so we can find the current parq ul later */
 	htable_insert(ul_all_parq_by_id, &puq->id, puq);
 
+	/*
+	 * Append item to the queue: having the largest sequence number, it
+	 * is inserted last in the trees.  Its ETA derives from the estimated
+	 * slot times of all the alive items before it.
+	 */
+
 	q->by_position_length++;
-	q->by_position = plist_append(q->by_position, puq);
+	old = ostree_insert(&q->by_position, &puq->pos_node);
+	g_assert(NULL == old);
 
-	hash_list_append(puq->queue->by_rel_pos, puq);
+	parq_upload_insert_relative(puq);
 
 	if (GNET_PROPERTY(parq_debug) > 3) {
 		g_debug("PARQ UL Q %d/%zd (%3d[%3d]/%3d): New: %s \"%s\"; ID=\"%s\"",
 			puq->queue->num,
 			plist_length(ul_parqs),
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_pos(puq),
 			puq->queue->by_position_length,
 			host_addr_to_string(puq->remote_addr),
 			puq->name,
@@ -2041,15 +1986,12 @@ parq_upload_create(struct upload *u)
 	puq->by_addr->list = plist_prepend(puq->by_addr->list, puq);
 
 	g_assert(puq != NULL);
-	g_assert(puq->position > 0);
+	g_assert(parq_ul_position(puq) == UNSIGNED(q->by_position_length));
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->name != NULL);
 	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_rel_pos != NULL);
-	g_assert(puq->queue->by_position->data != NULL);
-	g_assert(puq->relative_position > 0);
-	g_assert(puq->relative_position <=
+	g_assert(parq_ul_rel_pos(puq) == ostree_count(&q->by_rel_pos));
+	g_assert(parq_ul_rel_pos(puq) <=
 		UNSIGNED(puq->queue->by_position_length));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -2098,7 +2040,8 @@ parq_upload_free_queue(struct parq_ul_queue *queue)
 	ul_parqs_cnt--;
 
 	/* Free memory */
-	hash_list_free(&queue->by_rel_pos);
+	g_assert(0 == ostree_count(&queue->by_position));
+	g_assert(0 == ostree_count(&queue->by_rel_pos));
 	hash_list_free(&queue->by_date_dead);
 	statx_free(queue->slot_stats);
 	queue->magic = 0;
@@ -2215,8 +2158,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"not PARQ-aware, not sending QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_pos(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2233,8 +2176,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"no valid address to send QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_pos(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2306,8 +2249,8 @@ parq_upload_send_queue(struct parq_ul_queued *puq)
 			"Sending QUEUE #%d to %s for ID=%s: '%s'",
 			puq->queue->num,
 			ul_parqs_cnt,
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_pos(puq),
 			puq->queue->by_position_length,
 			puq->queue_sent,
 			host_addr_port_to_string(puq->addr, puq->port),
@@ -2517,13 +2460,11 @@ parq_dead_timer(void *unused_udata)
 static void
 parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 {
-	hash_list_iter_t *iter;
+	osnode_t *n;
 	pslist_t *to_remove = *rlp;
 
-	iter = hash_list_iterator(q->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	OSTREE_FOREACH(&q->by_rel_pos, n) {
+		struct parq_ul_queued *puq = ostree_data(&q->by_rel_pos, n);
 		time_delta_t grace;
 
 		g_assert(puq != NULL);
@@ -2570,8 +2511,8 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 					"Timeout: ID=%s %s '%s'",
 					puq->queue->num,
 					ul_parqs_cnt,
-					puq->position,
-					puq->relative_position,
+					parq_ul_position(puq),
+					parq_ul_rel_pos(puq),
 					puq->queue->by_position_length,
 					guid_hex_str(&puq->id),
 					host_addr_to_string(puq->remote_addr),
@@ -2579,16 +2520,14 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 
 
 			/*
-			 * Mark for removal. Can't remove now as we are still using the
-			 * ul_parq_by_position linked list. (prepend is probably the
+			 * Mark for removal. Can't remove now as we are still traversing
+			 * the relative position tree. (prepend is probably the
 			 * fastest function)
 			 */
 			to_remove = pslist_prepend(to_remove, puq);
 		}
 	}
 
-	hash_list_iter_release(&iter);
-
 	*rlp = to_remove;
 }
 
@@ -2744,7 +2683,7 @@ parq_upload_timer(time_t now)
 			parq_upload_frozen_clear(puq);
 
 		parq_upload_remove_relative(puq);
-		puq->queue->recompute = TRUE;	/* Defer costly recomputations */
+		puq->queue->recompute = TRUE;	/* Defer ETA refreshing */
 
 		if (enable_real_passive && parq_still_sharing(puq)) {
 			hash_list_append(puq->queue->by_date_dead, puq);
@@ -2753,14 +2692,13 @@ parq_upload_timer(time_t now)
 	}
 
 	/*
-	 * Recompute data only for the queues in which we removed items --RAM.
+	 * Refresh ETAs only for the queues in which we removed items --RAM.
 	 */
 
 	PLIST_FOREACH(ul_parqs, queues) {
 		struct parq_ul_queue *q = queues->data;
 
 		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
 			parq_upload_update_eta(q);
 			q->recompute = FALSE;
 		}
@@ -3013,11 +2951,10 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 					uqx->is_alive ? "alive" : "dead",
 					guid_hex_str(&uqx->id), uqx->queue->num,
 					host_addr_to_string(puq->by_addr->addr),
-					uqx->relative_position);
+					parq_ul_rel_pos(uqx));
 
 			parq_upload_remove_relative(uqx);
 			parq_upload_frozen_set(uqx);
-			uqx->queue->recompute = TRUE;	/* Defer update */
 			extra++;
 		}
 
@@ -3030,19 +2967,6 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), frozen);
 
 	g_assert(puq->by_addr->frozen == frozen);
-
-	/*
-	 * Recompute data only for the queues in which we removed items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3067,10 +2991,9 @@ parq_upload_unfreeze_one(struct parq_ul_queued *puq)
 
 	parq_upload_frozen_clear(puq);
 
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+	g_assert(!osnode_is_linked(&puq->rel_node));
 
 	parq_upload_insert_relative(puq);
-	parq_upload_recompute_relative_positions(puq->queue);
 }
 
 /**
@@ -3101,7 +3024,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			parq_upload_frozen_clear(uqx);
 			if (uqx->is_alive) {
 				parq_upload_insert_relative(uqx);
-				uqx->queue->recompute = TRUE;		/* Defer update */
 				inserted++;
 			}
 
@@ -3121,19 +3043,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), inserted);
 
 	g_assert(0 == puq->by_addr->frozen);
-
-	/*
-	 * Recompute data only for the queues in which we inserted items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3144,41 +3053,38 @@ static void
 parq_ul_dump_earlier(struct parq_ul_queued *item)
 {
 	struct parq_ul_queue *q;
-	hash_list_iter_t *iter;
-	unsigned old_relative = 0;
+	osnode_t *n;
+	unsigned relative = 0;
+	unsigned item_relative;
 
 	parq_ul_queued_check(item);
 
 	q = item->queue;
 	parq_ul_queue_check(q);
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	item_relative = parq_ul_rel_pos(item);
+
+	OSTREE_FOREACH(&q->by_rel_pos, n) {
+		struct parq_ul_queued *puq = ostree_data(&q->by_rel_pos, n);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-		
 		parq_ul_queued_check(puq);
-		g_assert_log(puq->relative_position > old_relative,
-			"relative=%u, old=%u", puq->relative_position, old_relative);
-		old_relative = puq->relative_position;
+		relative++;
 
 		if (
-			puq->relative_position >= item->relative_position ||
-			puq->relative_position > GNET_PROPERTY(max_uploads)
+			relative >= item_relative ||
+			relative > GNET_PROPERTY(max_uploads)
 		)
 			break;
 
 		g_debug("[PARQ UL] Q#%d pos=%u, rel=%u, slot<has=%s had=%s> updated=%s"
 			" active=%s, quick=%s, alive=%s, flags=0x%x, ID=%s, expire=%s ",
-			q->num, puq->position, puq->relative_position,
+			q->num, parq_ul_position(puq), relative,
 			puq->has_slot ? "y" : "n", puq->had_slot ? "y" : "n",
 			compact_time(delta_time(tm_time(), puq->updated)),
 			puq->active_queued ? "y" : "n", puq->quick ? "y" : "n",
 			puq->is_alive ? "y" : "n", puq->flags, guid_hex_str(&puq->id),
 			timestamp_utc_to_string(puq->expire));
 	}
-	
-	hash_list_iter_release(&iter);
 }
 
 /**
@@ -3274,7 +3180,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 	 * already downloading something in another queue.
 	 */
 
-	if (puq->relative_position <= UNSIGNED(slots_free)) {
+	if (parq_ul_rel_pos(puq) <= UNSIGNED(slots_free)) {
 		if (GNET_PROPERTY(parq_debug))
 			g_debug("[PARQ UL] [#%d] allowing %supload \"%s\" from %s (%s), "
 				"relative pos = %u [%s]",
@@ -3284,7 +3190,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 				host_addr_port_to_string(
 					puq->u->socket->addr, puq->u->socket->port),
 				upload_vendor_str(puq->u),
-				puq->relative_position, guid_hex_str(&puq->id));
+				parq_ul_rel_pos(puq), guid_hex_str(&puq->id));
 
 		return TRUE;
 	}
@@ -3295,8 +3201,8 @@ parq_upload_continue(struct parq_ul_queued *puq)
 			puq->queue->num, puq->u->name,
 			host_addr_port_to_string(
 				puq->u->socket->addr, puq->u->socket->port),
-			upload_vendor_str(puq->u), puq->position,
-			puq->relative_position);
+			upload_vendor_str(puq->u), parq_ul_position(puq),
+			parq_ul_rel_pos(puq));
 
 		if (GNET_PROPERTY(parq_debug) > 5)
 			parq_ul_dump_earlier(puq);
@@ -3448,8 +3354,8 @@ parq_upload_get(struct upload *u, const header_t *header)
 				"ETA: %s Added: %s '%s' %s",
 				puq->queue->num,
 				ul_parqs_cnt,
-				puq->position,
-				puq->relative_position,
+				parq_ul_position(puq),
+				parq_ul_rel_pos(puq),
 				puq->queue->by_position_length,
 				short_time(parq_upload_lookup_eta(u)),
 				host_addr_to_string(puq->remote_addr),
@@ -3515,14 +3421,11 @@ parq_upload_get(struct upload *u, const header_t *header)
 		puq->queue->alive++;
 		puq->is_alive = TRUE;
 		g_assert(puq->queue->alive > 0);
-		g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+		g_assert(!osnode_is_linked(&puq->rel_node));
 
 		/* Re-insert in the relative position list, unless entry is frozen */
-		if (!(puq->flags & PARQ_UL_FROZEN)) {
+		if (!(puq->flags & PARQ_UL_FROZEN))
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
-			parq_upload_update_eta(puq->queue);
-		}
 	}
 
 	buf = header_get(header, "X-Queue");
@@ -3773,11 +3676,11 @@ parq_upload_request(struct upload *u)
 
 	if (puq->has_slot) {
 		if (!puq->quick) {
-			g_assert(puq->relative_position == 0);
+			g_assert(parq_ul_rel_pos(puq) == 0);
 			return TRUE;			/* Has regular slot */
 		}
 		if (parq_upload_quick_continue(puq)) {
-			g_assert(puq->relative_position > 0);
+			g_assert(parq_ul_rel_pos(puq) > 0);
 			return TRUE;			/* Has quick slot */
 		}
 		if (GNET_PROPERTY(parq_debug))
@@ -3811,10 +3714,11 @@ parq_upload_request(struct upload *u)
 		 *		--RAM, 2007-08-17
 		 */
 
-		g_assert(puq->relative_position > 0);	/* Was a quick slot */
+		g_assert(parq_ul_rel_pos(puq) > 0);	/* Was a quick slot */
 
 		puq->by_addr->uploading--;
 		puq->has_slot = FALSE;
+		parq_upload_update_weight(puq);
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
 	}
 
@@ -3853,7 +3757,7 @@ parq_upload_request(struct upload *u)
 			if (puq->flags & PARQ_UL_FROZEN)
 				puq->active_queued = FALSE;
 			else if (
-				puq->relative_position <=
+				parq_ul_rel_pos(puq) <=
 				1 + UNSIGNED(free_upload_slots(puq->queue)) / 2
 			)
 				u->status = GTA_UL_QUEUED;	/* Maintain active queuing */
@@ -3872,7 +3776,7 @@ parq_upload_request(struct upload *u)
 					"switching from active to passive for %s (%s)",
 					puq->queue->num, guid_hex_str(&puq->id),
 					fd_avail_status_string(fds),
-					puq->relative_position, u->push ? "y" : "n",
+					parq_ul_rel_pos(puq), u->push ? "y" : "n",
 					(puq->flags & PARQ_UL_FROZEN) ? "y" : "n",
 					host_addr_port_to_string(u->socket->addr, u->socket->port),
 					upload_vendor_str(u));
@@ -3914,7 +3818,7 @@ parq_upload_request(struct upload *u)
 		queueable = GNET_PROPERTY(sys_nofile) * 4 / 5 >
 			max_fd_used + (MIN_ALWAYS_QUEUE * GNET_PROPERTY(max_uploads));
 
-		if (puq->relative_position <= MIN_ALWAYS_QUEUE)
+		if (parq_ul_rel_pos(puq) <= MIN_ALWAYS_QUEUE)
 			queueable = TRUE;
 
 		/*
@@ -3940,8 +3844,8 @@ parq_upload_request(struct upload *u)
 		}
 
 		if (
-			(u->push && puq->relative_position <= max_slot) ||
-			(queueable && puq->relative_position <=
+			(u->push && parq_ul_rel_pos(puq) <= max_slot) ||
+			(queueable && parq_ul_rel_pos(puq) <=
 				UNSIGNED(free_upload_slots(puq->queue)) + MIN_UPLOAD_ASLOT)
 		) {
 			if ((puq->flags & PARQ_UL_FROZEN) && !activeable) {
@@ -3996,7 +3900,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	if (GNET_PROPERTY(parq_debug) > 2) {
 		g_debug("PARQ UL [#%d] upload pos=%d rel=%d (%s, %s, %s) "
 			"is now busy [%s]",
-			puq->queue->num, puq->position, puq->relative_position,
+			puq->queue->num, parq_ul_position(puq), parq_ul_rel_pos(puq),
 			puq->active_queued ? "active" : "passive",
 			puq->has_slot ? "with slot" : "no slot yet",
 			puq->quick ? "quick" : "regular",
@@ -4020,9 +3924,8 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	 *		--RAM, 2007-08-16
 	 */
 
-	if (!puq->quick && puq->relative_position) {
+	if (!puq->quick && parq_ul_rel_pos(puq)) {
 		parq_upload_remove_relative(puq);
-		parq_upload_recompute_relative_positions(puq->queue);
 
 		puq->relative_position = 0;		/* Signals: has regular slot */
 		puq->had_slot = TRUE;			/* Had a regular slot */
@@ -4043,6 +3946,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	puq->has_slot = TRUE;
 	puq->by_addr->uploading++;
 	puq->slot_granted = tm_time();
+	parq_upload_update_weight(puq);		/* If quick slot, still listed */
 }
 
 void
@@ -4216,7 +4120,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 	 */
 
 	if (puq->has_slot) {
-		hash_list_iter_t *iter;
+		osnode_t *n;
 
 		if (GNET_PROPERTY(parq_debug) > 2)
 			g_debug("PARQ UL: [#%d] [%s] Freed an upload slot%s",
@@ -4234,10 +4138,9 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 		 * Tell next waiting upload that a slot is available, using QUEUE
 		 */
 
-		iter = hash_list_iterator(puq->queue->by_rel_pos);
-
-		while (hash_list_iter_has_next(iter)) {
-			struct parq_ul_queued *puq_next = hash_list_iter_next(iter);
+		OSTREE_FOREACH(&puq->queue->by_rel_pos, n) {
+			struct parq_ul_queued *puq_next =
+				ostree_data(&puq->queue->by_rel_pos, n);
 
 			parq_ul_queued_check(puq_next);
 
@@ -4262,13 +4165,11 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			break;
 		}
 
-		hash_list_iter_release(&iter);
-
 		/*
 		 * Put back in queue until it expires.
 		 */
 
-		if (0 == puq->relative_position) {
+		if (0 == parq_ul_rel_pos(puq)) {
 			puq->queue->active_uploads--;
 			puq->expire = time_advance(now, GUARDING_TIME);
 
@@ -4281,10 +4182,9 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			if (puq->had_slot)
 				puq->flags |= PARQ_UL_NOQUEUE;
 
-			g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+			g_assert(!osnode_is_linked(&puq->rel_node));
 
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
 		}
 
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
@@ -4364,6 +4264,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 done:
 	puq->has_slot = FALSE;
 	puq->slot_granted = 0;
+	parq_upload_update_weight(puq);
 
 	return FALSE;
 }
@@ -4389,12 +4290,12 @@ parq_upload_add_old_queue_header(char *buf, size_t size,
 	if (small_reply) {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, min_poll, max_poll);
+				parq_ul_rel_pos(puq), min_poll, max_poll);
 	} else {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, length=%d, "
 				"limit=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, puq->queue->by_position_length,
+				parq_ul_rel_pos(puq), puq->queue->by_position_length,
 				1, min_poll, max_poll);
 	}
 	if (len >= size || (len > 0 && '\n' != buf[len - 1])) {
@@ -4430,7 +4331,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 		puq->flags |= PARQ_UL_ID_SENT;
 
 		len = concat_strings(&buf[rw], size,
-			"; position=", uint32_to_string(puq->relative_position),
+			"; position=", uint32_to_string(parq_ul_rel_pos(puq)),
 			(void *) 0);
 
 		if (len < size) {
@@ -4452,7 +4353,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 						rw += len;
 						size -= len;
 						len = concat_strings(&buf[rw], size,
-							"; ETA=", uint32_to_string(puq->eta),
+							"; ETA=", uint32_to_string(parq_ul_eta(puq)),
 							(void *) 0);
 						if (len < size) {
 							rw += len;
@@ -4623,7 +4524,7 @@ parq_upload_lookup_position(const struct upload *u)
 	puq = parq_upload_find(u);
 
 	if (puq != NULL) {
-		return puq->relative_position;
+		return parq_ul_rel_pos(puq);
 	} else {
 		return (uint) -1;
 	}
@@ -4655,7 +4556,7 @@ parq_upload_lookup_eta(const struct upload *u)
 
 	/* If puq == NULL the current upload isn't queued and ETA is unknown */
 	if (puq != NULL)
-		return puq->eta;
+		return parq_ul_eta(puq);
 	else
 		return (uint) -1;
 }
@@ -4844,8 +4745,7 @@ parq_upload_send_queue_conf(struct upload *u)
 /**
  * Saves an individual queued upload to disc.
  *
- * This is the callback function used by plist_foreach() in function
- * parq_upload_save_queue().
+ * This is called for each queued item by parq_upload_save_queue().
  */
 static inline void
 parq_store(void *data, void *file_ptr)
@@ -4874,8 +4774,8 @@ parq_store(void *data, void *file_ptr)
 		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): Saving %s: '%s' - %s '%s'",
 			  puq->queue->num,
 			  ul_parqs_cnt,
-			  puq->position,
-			  puq->relative_position,
+			  parq_ul_position(puq),
+			  parq_ul_rel_pos(puq),
 			  puq->queue->by_position_length,
 			  puq->supports_parq ? "PARQ" : "slot",
 			  guid_hex_str(&puq->id),
@@ -4902,7 +4802,7 @@ parq_store(void *data, void *file_ptr)
 		"IP: %s\n"
 		,
 		puq->queue->num,
-		puq->position,
+		parq_ul_position(puq),
 		enter_buf,
 		expire,
 		guid_hex_str(&puq->id),
@@ -4966,8 +4866,11 @@ parq_upload_save_queue(void)
 		queues = plist_last(ul_parqs) ; queues != NULL; queues = queues->prev
 	) {
 		struct parq_ul_queue *queue = queues->data;
+		osnode_t *n;
 
-		PLIST_FOREACH_CALL_DATA(queue->by_position, parq_store, f);
+		OSTREE_FOREACH(&queue->by_position, n) {
+			parq_store(ostree_data(&queue->by_position, n), f);
+		}
 	}
 
 	file_config_close(f, &fp);
@@ -5386,8 +5289,8 @@ parq_upload_load_queue(void)
 					"restored: %s%s '%s'",
 					puq->queue->num,
 					ul_parqs_cnt,
-					puq->position,
-				 	puq->relative_position,
+					parq_ul_position(puq),
+				 	parq_ul_rel_pos(puq),
 					puq->queue->by_position_length,
 					short_time(parq_upload_lookup_eta(fake_upload)),
 					host_addr_to_string(puq->remote_addr),
@@ -5487,8 +5390,6 @@ parq_close_pre(void)
 	plist_t *dl, *queues;
 	pslist_t *sl, *to_remove = NULL, *to_removeq = NULL;
 
-	parq_shutdown = TRUE;
-
 	parq_upload_save_queue();
 	cq_periodic_remove(&parq_dead_timer_ev);
 	cq_periodic_remove(&parq_save_timer_ev);
@@ -5513,12 +5414,10 @@ parq_close_pre(void)
 	 */
 	for (queues = ul_parqs; queues != NULL; queues = queues->next) {
 		struct parq_ul_queue *queue = queues->data;
+		osnode_t *n;
 
-		PLIST_FOREACH(queue->by_position, dl) {
-			struct parq_ul_queued *puq = dl->data;
-
-			if (puq == NULL)
-				break;
+		OSTREE_FOREACH(&queue->by_position, n) {
+			struct parq_ul_queued *puq = ostree_data(&queue->by_position, n);
 
 			puq->by_addr->uploading = 0;
 
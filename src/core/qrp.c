@@ -5345,11 +5345,18 @@ qrp_node_can_route(const gnutella_node_t *n, const query_hashvec_t *qhv)
  * or UPs that don't support last-hop QRP, plus those whose QRP table says
  * they could bring a match.
  *
- * @returns list of nodes, a subset of the currently connected nodes.
+ * @param candidates	the nodes to consider as targets
+ * @param qhvec			the query hash vector
+ * @param hops			query hop count
+ * @param ttl			query TTL
+ * @param leaves		whether leaves can be targeted
+ * @param source		the node which sent us the query, NULL if none
+ *
+ * @returns list of nodes, a subset of the candidates.
  * Once used, the list of nodes can be freed with pslist_free().
  */
 G_GNUC_HOT pslist_t *
-qrt_build_query_target(
+qrt_build_query_target_from(const pslist_t *candidates,
 	query_hashvec_t *qhvec, int hops, int ttl, bool leaves,
 	gnutella_node_t *source)
 {
@@ -5388,7 +5395,7 @@ qrt_build_query_target(
 	 * always get the query.
 	 */
 
-	PSLIST_FOREACH(node_all_gnet_nodes(), sl) {
+	PSLIST_FOREACH(candidates, sl) {
 		gnutella_node_t *dn = sl->data;
 		struct routing_table *rt = dn->recv_query_table;
 		bool is_leaf;
@@ -5533,6 +5540,23 @@ qrt_build_query_target(
 	return nodes;
 }
 
+/**
+ * Compute list of nodes to send the query to, among all the connected nodes.
+ *
+ * @see qrt_build_query_target_from() for the parameters.
+ *
+ * @returns list of nodes, a subset of the currently connected nodes.
+ * Once used, the list of nodes can be freed with pslist_free().
+ */
+pslist_t *
+qrt_build_query_target(
+	query_hashvec_t *qhvec, int hops, int ttl, bool leaves,
+	gnutella_node_t *source)
+{
+	return qrt_build_query_target_from(node_all_gnet_nodes(),
+		qhvec, hops, ttl, leaves, source);
+}
+
 /**
  * Route query message to leaf nodes, based on their QRT, or to ultrapeers
  * that support last-hop QRP if TTL=1.
@@ -5617,8 +5641,7 @@ qrt_route_query(gnutella_node_t *n, query_hashvec_t *qhvec,
 	if G_UNLIKELY(gnutella_header_get_ttl(&n->header) == 0)
 		gnutella_header_set_ttl(&n->header, 1);
 
-	gmsg_split_routeto_all(nodes, n, &n->header, n->data,
-		n->size + GTA_HEADER_SIZE);
+	gmsg_node_routeto_all(nodes, n);
 
 	pslist_free(nodes);
 }
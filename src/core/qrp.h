@@ -111,6 +111,9 @@ uint qhvec_count(const struct query_hashvec *qhv);
 
 struct pslist;
 
+struct pslist *qrt_build_query_target_from(const struct pslist *candidates,
+	query_hashvec_t *qhvec, int hops, int ttl, bool leaves,
+	struct gnutella_node *source);
 struct pslist *qrt_build_query_target(
 	query_hashvec_t *qhvec, int hops, int ttl, bool leaves,
 	struct gnutella_node *source);
@@ -50,8 +50,9 @@
 
 #include "lib/aging.h"
 #include "lib/atoms.h"
+#include "lib/cq.h"
 #include "lib/endian.h"
-#include "lib/halloc.h"
+#include "lib/guidtab.h"
 #include "lib/hashing.h"
 #include "lib/host_addr.h"
 #include "lib/hset.h"
@@ -97,27 +98,61 @@ routing_udp_node_check(const struct routing_udp_node * const un)
 
 #define ROUTE_UDP_LIFETIME	180		/**< Keep UDP routes for 3 minutes */
 
+/**
+ * A route recorded for a message: the node from where it came.
+ */
+struct message_route {
+	struct route_data *rd;		/**< route_data from where the message came */
+	uint8 ttl;					/**< For broadcasted messages: TTL of route */
+};
+
+#define MESSAGE_ROUTES		2	/**< Amount of routes held inline */
+
 /**
  * An entry in the routing table.
  *
- * Each entry is stored in the "message_array[]", to keep track of the
- * order used to create the routes, and in a hash table for quick lookup,
- * hashing being made based on the muid and the function.
+ * Each entry is stored in a GUID table, indexed by the muid and the function,
+ * which also takes care of aging the entries.
  *
  * Query hit routes and push routes are precious, therefore they are
- * moved to the tail of the "message_array[]" when they get used to increase
- * their liftime.
+ * revitalized when they get used to increase their lifetime.
+ *
+ * Most messages come from a single route, so the first routes are held
+ * inline in the structure, and only messages reaching us through more than
+ * MESSAGE_ROUTES routes need an allocated route vector.
  */
 struct message {
 	struct guid muid;			/**< Message UID */
-	struct message **slot;		/**< Place where we're referenced from */
-	pslist_t *routes;            /**< route_data from where the message came */
-	pslist_t *ttls;			/**< For broadcasted messages: TTL by route */
+	union {
+		struct message_route inl[MESSAGE_ROUTES];	/**< Inline routes */
+		struct message_route *vec;		/**< Routes, when rcap is larger */
+	} r;
+	uint16 nroutes;				/**< Amount of routes recorded */
+	uint16 rcap;				/**< Capacity of the route array */
 	uint8 function;				/**< Type of the message */
 	uint8 ttl;					/**< Max TTL we saw for this message */
-	uint8 chunk_idx;			/**< Index of chunk holding the slot */
 };
 
+/**
+ * @return the array of routes of the message.
+ */
+static inline struct message_route *
+message_routes(struct message *m)
+{
+	return m->rcap > MESSAGE_ROUTES ? m->r.vec : m->r.inl;
+}
+
+/**
+ * @return the route_data of the i-th route of the message.
+ */
+static inline struct route_data *
+message_route(struct message *m, uint i)
+{
+	g_assert(i < m->nroutes);
+
+	return message_routes(m)[i].rd;
+}
+
 /**
  * We don't store a list of nodes in the message structure, but a list of
  * route_data: the reason is that nodes can go away, but we don't want to
@@ -142,46 +177,33 @@ static struct route_data fake_route;		/**< Our fake route_data */
 static const char *debug_msg[256];
 
 /*
- * We're using the message table to store Query hit routes for Push requests,
- * but this is a temporary solution.  As we continuously refresh those
- * routes, we must make sure they stay alive for some time after having been
- * updated.  Given that we periodically supersede the message_array[] in a
- * round-robin fashion, it is not really appropriate.
- *		--RAM, 06/01/2002
+ * We're using the message table to store Query hit routes for Push requests.
+ * As we continuously refresh those routes, we must make sure they stay alive
+ * for some time after having been updated: each use of a route revitalizes
+ * its entry, moving it to the current generation of the GUID table so that
+ * it is not aged out with the older generations.
  */
 #define QUERY_HIT_ROUTE_SAVE	0	/**< Function used to store QHit GUIDs */
 
 /*
  * Routing table data structures.
  *
- * This is known as the "message_array[]".  It used to be a fixed-sized
- * array, but it is no more.  Instead, we use an array of chunks that
- * are dynamically allocated as needed.  The aim is to not cycle
- * back to the beginning of the table, loosing all the routing information
- * before at least TABLE_MIN_CYCLE seconds have elapsed or we have
- * allocated more than the amount of chunks we can tolerate.
- *
- * Each chunk contains pointers to dynamically allocated message entries,
- * each pointer being called a "slot" whilst the message structure is called
- * the "entry".
+ * Messages are kept in a GUID table, whose entries are aged by generations
+ * of GEN_MESSAGES entries.  The aim is to not lose routing information
+ * before at least TABLE_MIN_CYCLE seconds have elapsed, unless we hold more
+ * than MAX_GENERATIONS generations of messages, the maximum we can tolerate.
  */
 
-#define CHUNK_BITS			14 	  /**< log2 of # messages stored  in a chunk */
-#define MAX_CHUNKS			64	  /**< Max # of chunks */
+#define GEN_MESSAGES		16384 /**< Amount of messages in a generation */
+#define MAX_GENERATIONS		64	  /**< Max # of live generations */
 #define TABLE_MIN_CYCLE		3600  /**< 1 hour at least */
-
-#define CHUNK_MESSAGES		(1 << CHUNK_BITS)
-#define CHUNK_INDEX(x)		(((x) & ~(CHUNK_MESSAGES - 1)) >> CHUNK_BITS)
-#define ENTRY_INDEX(x)		((x) & (CHUNK_MESSAGES - 1))
+#define STATS_PERIOD		(5*1000)	/**< Update table stats every 5 secs */
 
 static struct {
-	struct message **chunks[MAX_CHUNKS];
-	int next_idx;				 /**< Next slot to use in "message_array[]" */
-	int capacity;				 /**< Capacity in terms of messages */
-	int count;					 /**< Amount really stored */
-	unsigned nchunks;			 /**< Amount of allocated chunks */
-	hset_t *messages_hashed;	 /**< All messages (key = struct message) */
-	time_t last_rotation;		 /**< Last time we restarted from idx=0 */
+	guidtab_t *messages;		/**< All messages, by (muid, function) */
+	cperiodic_t *stats_ev;		/**< Periodic statistics update */
+	size_t routes;				/**< Amount of routes recorded */
+	size_t vectors;				/**< Memory used by allocated route vectors */
 } routing;
 
 /**
@@ -827,231 +849,131 @@ init_routing_data(gnutella_node_t *node)
 }
 
 /**
- * Make sure slot belongs to specified chunk index.
+ * Record new route for the message.
+ *
+ * @param m		the message
+ * @param rd	the route_data from where the message came
+ * @param ttl	the TTL of the message along that route
  */
 static void
-slot_check(struct message * const * const slot, unsigned chunk_idx)
+message_route_add(struct message *m, struct route_data *rd, uint8 ttl)
 {
-	const void *chunk_base;
-	const void *chunk_end;
-
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk_idx < routing.nchunks);
+	struct message_route *mr;
 
-	chunk_base = routing.chunks[chunk_idx];
-	chunk_end = const_ptr_add_offset(chunk_base, CHUNK_MESSAGES * sizeof *slot);
+	g_assert(m->nroutes <= m->rcap);
 
-	g_assert(ptr_cmp(slot, chunk_base) >= 0);
-	g_assert(ptr_cmp(slot, chunk_end) < 0);
-}
+	if G_UNLIKELY(m->nroutes == m->rcap) {
+		uint16 ncap = m->rcap * 2;
 
-/**
- * Asserts that a message entry is consistent and belongs to the correct chunk.
- */
-static void
-message_check(const struct message * const m, unsigned chunk_idx)
-{
-	g_assert(m != NULL);
-	slot_check(m->slot, chunk_idx);
-	g_assert(chunk_idx == m->chunk_idx);
-}
+		g_assert(ncap > m->rcap);		/* No overflow */
 
-/**
- * Clean already allocated entry.
- */
-static void
-clean_entry(struct message *entry)
-{
-	g_assert(entry != NULL);
-
-	hset_remove(routing.messages_hashed, entry);
-
-	if (entry->routes != NULL)
-		free_route_list(entry);
+		if (m->rcap > MESSAGE_ROUTES) {
+			WREALLOC_ARRAY(m->r.vec, m->rcap, ncap);
+		} else {
+			struct message_route *vec;
 
-	g_assert(entry->ttls == NULL);		/* Cleaned by free_route_list() */
-	g_assert(entry->routes == NULL);	/* Idem */
+			WALLOC_ARRAY(vec, ncap);
+			memcpy(vec, m->r.inl, m->nroutes * sizeof vec[0]);
+			m->r.vec = vec;
+		}
+		routing.vectors += (ncap - m->rcap) * sizeof m->r.vec[0];
+		m->rcap = ncap;
+	}
 
-	entry->ttl = 0;
+	mr = &message_routes(m)[m->nroutes++];
+	mr->rd = rd;
+	mr->ttl = ttl;
+	routing.routes++;
 }
 
 /**
- * Prepare entry, cleaning any old value we can find at the referenced slot.
- * We try to avoid re-allocating something if we can.
- *
- * @return message entry to use
+ * Remove the i-th route of the message, keeping the order of the other routes.
  */
-static struct message *
-prepare_entry(struct message **entryp, unsigned chunk_idx)
+static void
+message_route_remove(struct message *m, uint i)
 {
-	struct message *entry = *entryp;
+	struct message_route *routes = message_routes(m);
 
-	STATIC_ASSERT(MAX_CHUNKS <= MAX_INT_VAL(uint8));
+	g_assert(i < m->nroutes);
 
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	slot_check(entryp, chunk_idx);
-
-	if (entry == NULL) {
-		WALLOC0(entry);
-		*entryp = entry;
-		entry->slot = entryp;
-		entry->chunk_idx = chunk_idx;	/* 8-bit value, must fit */
-		routing.count++;
-		gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
-		goto done;
-	}
+	m->nroutes--;
+	routing.routes--;
+	memmove(&routes[i], &routes[i + 1], (m->nroutes - i) * sizeof routes[0]);
 
 	/*
-	 * We cycled over the table, remove the message at the slot we're
-	 * going to supersede.  We don't need to allocate anything, we'll
-	 * reuse the old structure, which will be rehashed after being updated.
+	 * Go back to inline routes when there is enough room.
 	 */
 
-	clean_entry(entry);
-
-	/*
-	 * Attempt to move the object around if it can help compacting.
-	 */
+	if G_UNLIKELY(m->rcap > MESSAGE_ROUTES && m->nroutes <= MESSAGE_ROUTES) {
+		struct message_route *vec = m->r.vec;
 
-	{
-		struct message *nentry = WMOVE(entry);
-
-		if (nentry != entry)
-			entry = *entryp = nentry;
+		memcpy(m->r.inl, vec, m->nroutes * sizeof vec[0]);
+		routing.vectors -= m->rcap * sizeof vec[0];
+		WFREE_ARRAY(vec, m->rcap);
+		m->rcap = MESSAGE_ROUTES;
 	}
-
-done:
-	g_assert(entryp == entry->slot);
-	message_check(entry, chunk_idx);
-
-	return entry;
 }
 
 /**
- * Attempt to reallocate an already allocated chunk to see if the VMM layer
- * can relocate a fragment.
+ * Free message entry, invoked when the entry is discarded from the table.
  */
-static struct message **
-routing_chunk_move(struct message **chunk, unsigned chunk_idx)
+static void
+message_free(void *value, void *unused_data)
 {
-	struct message **nchunk;
-	struct message **p;
-	unsigned i;
-
-	g_assert(chunk != NULL);
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk == routing.chunks[chunk_idx]);
-
-	nchunk = hrealloc(chunk, CHUNK_MESSAGES * sizeof(struct message *));
-	if (nchunk == chunk)
-		return chunk;
+	struct message *m = value;
 
-	/*
-	 * VMM layer chose to relocate the chunk, update all the entries.
-	 */
-
-	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT moving chunk #%u from %p to %p",
-			chunk_idx, (void *) chunk, (void *) nchunk);
-	}
-
-	for (p = &nchunk[0], i = 0; i < CHUNK_MESSAGES; i++, p++) {
-		struct message *m = *p;
-
-		if (m != NULL) {
-			message_check(m, chunk_idx);
-			m->slot = p;
-		}
-	}
+	(void) unused_data;
 
-	return routing.chunks[chunk_idx] = nchunk;
+	free_route_list(m);
+	WFREE(m);
+	gnet_stats_dec_general(GNR_ROUTING_TABLE_COUNT);
 }
 
 /**
- * Try to move the chunks we have, since the lowest indices
- * (which are going to be the more permanent chunks) will be
- * better hosted in the early VM space, freeing up the upper
- * VM space for more volatile data and possibly defragmenting.
+ * Update the routing table statistics.
  */
 static void
-routing_chunk_move_attempt(void)
+routing_update_stats(void)
 {
-	size_t i;
-
-	for (i = 0; i < routing.nchunks; i++) {
-		routing.chunks[i] = routing_chunk_move(routing.chunks[i], i);
-	}
+	gnet_stats_set_general(GNR_ROUTING_TABLE_GENERATIONS,
+		guidtab_generations(routing.messages));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY,
+		guidtab_capacity(routing.messages));
 }
 
 /**
- * Advance slot index so that a call to get_next_slot() will return the
- * next available slot.
+ * Periodic update of the routing table statistics, which are kept out of
+ * the message forwarding path.
  */
-static void
-advance_slot(void)
+static bool
+routing_stats_periodic(void *unused_obj)
 {
-	/*
-	 * It's OK to go beyond the last allocated chunk (a new chunk will
-	 * be allocated next time) unless we already reached the last chunk.
-	 */
+	(void) unused_obj;
 
-	routing.next_idx++;
-
-	if (CHUNK_INDEX(routing.next_idx) >= MAX_CHUNKS)
-		routing.next_idx = 0;		/* Will force cycling over next time */
+	routing_update_stats();
+	return TRUE;		/* Keep calling */
 }
 
 /**
- * Clear routing table, starting with specified chunk index.
+ * Compute the amount of memory used by the routing table.
+ *
+ * @param messages	if non-NULL, written with the amount of messages held
+ * @param routes	if non-NULL, written with the amount of routes recorded
  *
- * @param idx	the index of the first chunk to clear
+ * @return amount of bytes used by the table, its entries and route vectors.
  */
-static void
-routing_clear(unsigned idx)
+size_t
+routing_table_usage(size_t *messages, size_t *routes)
 {
-	size_t i;
-
-	for (i = idx; i < routing.nchunks; i++) {
-		struct message **rchunk = routing.chunks[i];
-		size_t j;
-
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT freeing chunk #%zu at %p, now holds %d / %d",
-				i, (void *) rchunk, routing.count, routing.capacity);
-		}
-
-		for (j = 0; j < CHUNK_MESSAGES; j++) {
-			struct message *m = rchunk[j];
-
-			if (m != NULL) {
-				message_check(m, i);
-				g_assert(m->slot == &rchunk[j]);
-				clean_entry(m);
-				WFREE(m);
-				routing.count--;
-			}
-		}
-
-		routing.capacity -= CHUNK_MESSAGES;
-		HFREE_NULL(routing.chunks[i]);
-	}
+	size_t count = guidtab_count(routing.messages);
 
-	routing.nchunks = idx;
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CHUNKS, routing.nchunks);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY, routing.capacity);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT, routing.count);
+	if (messages != NULL)
+		*messages = count;
+	if (routes != NULL)
+		*routes = routing.routes;
 
-	g_assert(uint_is_non_negative(routing.nchunks));
-
-	/*
-	 * After freeing chunks, we may be able to move around some of the
-	 * remaining ones.
-	 */
-
-	routing_chunk_move_attempt();
+	return guidtab_memory(routing.messages) +
+		count * sizeof(struct message) + routing.vectors;
 }
 
 /**
@@ -1061,202 +983,43 @@ void
 routing_clear_all(void)
 {
 	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT clearing whole table (holds %d / %d)",
-			routing.capacity, routing.count);
+		g_debug("RT clearing whole table (holds %zu / %zu)",
+			guidtab_count(routing.messages),
+			guidtab_capacity(routing.messages));
 	}
 
-	routing_clear(0);
-	routing.next_idx = 0;
-	routing.last_rotation = tm_time();
-	hset_clear(routing.messages_hashed);	/* Paranoid */
+	guidtab_clear(routing.messages);
+	routing_update_stats();
 }
 
 /**
- * Fetch next routing table slot, a pointer to a routing entry.
- *
- * When `advance' is FALSE, the slot is allocated as usual but there is
- * no increment of the slot index for next time.  This allows trial allocation
- * to see where the message will be allocated.  If the slot is kept, the
- * caller must call advance_slot().
- *
- * When `advance' is TRUE, the slot is allocated and the slot index is
- * incremented immediately.
- *
- * @param advance		whether to advance the slot index
- * @param cidx			if non-NULL, filled with the chunk index where slot is
- *
- * @return the address of the allocated slot.
+ * Create new routing table entry for the message, which must not be
+ * already present in the table.
  */
-static struct message **
-get_next_slot(bool advance, unsigned *cidx)
+static struct message *
+get_next_entry(const struct guid *muid, uint8 function)
 {
-	unsigned idx;
-	unsigned chunk_idx;
-	struct message **chunk;
-	struct message **slot = NULL;
-	time_t now = tm_time();
-	time_delta_t elapsed = delta_time(now, routing.last_rotation);
-
-	idx = routing.next_idx;
-	chunk_idx = CHUNK_INDEX(idx);
-
-	g_assert(UNSIGNED(chunk_idx) < MAX_CHUNKS);
-
-	chunk = routing.chunks[chunk_idx];
-
-	/*
-	 * If we get back here with a next index of zero and the chunk is
-	 * allocated, it means we've naturally cycled over.  There is nothing
-	 * to free up (or we would discard the whole table).
-	 */
-
-	if G_UNLIKELY(0 == idx && NULL != chunk) {
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT cycled naturally over table, elapsed=%u, holds %d / %d",
-				(unsigned) elapsed, routing.count, routing.capacity);
-		}
-		routing.last_rotation = now;	/* Just cycled over */
-		elapsed = 0;
-	}
-
-	/*
-	 * If we've taken more than TABLE_MIN_CYCLE seconds since the last
-	 * rotation and reach the start of an allocated chunk, it means we
-	 * have more chunks than we need.  Discard all remaining chunks before
-	 * rotating.
-	 */
-
-	if G_UNLIKELY(elapsed > TABLE_MIN_CYCLE) {
-		/*
-		 * 0 != ENTRY_INDEX(idx): means we're not at the start of a chunk.
-		 * chunk == NULL: means we've reached an empty chunk, nothing to free.
-		 */
-
-		if G_UNLIKELY(chunk != NULL && 0 == ENTRY_INDEX(idx)) {
-			routing_clear(chunk_idx);
-			chunk = NULL;
-		}
-	}
-
-	if (chunk == NULL) {
-
-		g_assert(idx >= UNSIGNED(routing.capacity));
-
-		/*
-		 * Chunk does not exist yet, determine whether we should create
-		 * it or recycle the table by going back to the start.
-		 */
-
-		if (idx > 0 && elapsed > TABLE_MIN_CYCLE) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT cycling over table, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
-
-			chunk_idx = 0;
-			idx = routing.next_idx = 0;
-			routing.last_rotation = now;
-			slot = routing.chunks[0];
-		} else {
-			/*
-			 * Allocate new chunk, expanding the capacity of the table.
-			 */
-
-			g_assert(idx == 0 || chunk_idx > 0);
-			g_assert(chunk_idx == routing.nchunks);
-
-			routing_chunk_move_attempt();		/* Compact before allocating */
-
-			routing.nchunks++;
-			routing.capacity += CHUNK_MESSAGES;
-			routing.chunks[chunk_idx] =
-				halloc0(CHUNK_MESSAGES * sizeof(struct message *));
-
-			gnet_stats_inc_general(GNR_ROUTING_TABLE_CHUNKS);
-			gnet_stats_count_general(GNR_ROUTING_TABLE_CAPACITY,
-				CHUNK_MESSAGES);
-
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT created new chunk #%d at %p, now holds %d / %d",
-					chunk_idx, (void *) routing.chunks[chunk_idx],
-					routing.count, routing.capacity);
-			}
-
-			slot = routing.chunks[chunk_idx];	/* First slot in new chunk */
-		}
-	} else {
-		unsigned entry_idx = ENTRY_INDEX(idx);
-
-		/*
-		 * Each time we move to a new chunk, see whether we can move some
-		 * of the existing ones around to compact the VM space.
-		 */
-
-		if (0 == entry_idx) {
-			routing_chunk_move_attempt();
-			chunk = routing.chunks[chunk_idx];	/* In case it moved */
-		}
-
-		/*
-		 * If we went back to the first index without allocating a chunk,
-		 * it means we finally cycled over the table, in a forced way,
-		 * because we have already allocated the maximum amount of chunks.
-		 */
-
-		if (0 == idx && MAX_CHUNKS == routing.nchunks) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_warning("RT cycling over FORCED, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
-			routing.last_rotation = now;
-		}
-
-		slot = &chunk[entry_idx];
-	}
-
-	g_assert(slot != NULL);
-	g_assert(idx == UNSIGNED(routing.next_idx));
-	g_assert(idx < UNSIGNED(routing.capacity));
-	g_assert(routing.nchunks <= MAX_CHUNKS);
-
-	if (advance)
-		advance_slot();
-
-	if (cidx != NULL)
-		*cidx = chunk_idx;
+	struct message *entry;
 
-	slot_check(slot, chunk_idx);
+	WALLOC0(entry);
+	entry->muid = *muid;
+	entry->function = function;
+	entry->rcap = MESSAGE_ROUTES;
 
-	return slot;
-}
+	guidtab_insert(routing.messages, muid, function, entry);
+	gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
 
-/**
- * Fetch next routing table entry to be able to store routing information.
- */
-static struct message *
-get_next_entry(void)
-{
-	struct message **slot;
-	unsigned chunk_idx;
-
-	slot = get_next_slot(TRUE, &chunk_idx);
-	return prepare_entry(slot, chunk_idx);
+	return entry;
 }
 
 /**
  * When a precious route (for query hit or push) is used, revitalize the
- * entry by moving it to the end of the "message_array[]", thereby making
+ * entry by moving it to the current generation of the table, thereby making
  * it unlikely that it expires soon.
- *
- * @return the new location of the revitalized entry
  */
 static void
 revitalize_entry(struct message *entry, bool force)
 {
-	struct message **relocated;
-	struct message *prev;
-	unsigned chunk_idx;
-
 	/*
 	 * Leaves don't route anything, so we usually don't revitalize their
 	 * entries.  The only exception is when it makes use of the recorded
@@ -1266,46 +1029,7 @@ revitalize_entry(struct message *entry, bool force)
 	if (!force && settings_is_leaf())
 		return;
 
-	/*
-	 * Relocate at the end of the table, preventing early expiration.
-	 */
-
-	relocated = get_next_slot(FALSE, &chunk_idx);
-
-	/*
-	 * If slot is allocated in the same chunk, there's no need to revitalize
-	 * since entries in the same chunk will roughly have the same lifetime.
-	 */
-
-	if (chunk_idx == entry->chunk_idx)			/* Same chunk being used */
-		return;
-
-	/*
-	 * Clean and reclaim new slot content, if present.
-	 */
-
-	advance_slot();							/* Keeping the slot */
-	prev = *relocated;
-
-	if (prev != NULL) {
-		message_check(prev, chunk_idx);
-		g_assert(prev->slot == relocated);
-		clean_entry(prev);
-		WFREE(prev);
-		routing.count--;
-		gnet_stats_dec_general(GNR_ROUTING_TABLE_COUNT);
-	}
-
-	/*
-	 * Move `entry' to this new slot.
-	 */
-
-	*relocated = entry;
-	*(entry->slot) = NULL;					/* Old slot "freed" */
-	entry->slot = relocated;				/* Entry now at new slot */
-	entry->chunk_idx = chunk_idx;			/* Entry moved to new chunk */
-
-	message_check(entry, chunk_idx);
+	(void) guidtab_revitalize(routing.messages, &entry->muid, entry->function);
 }
 
 /**
@@ -1315,7 +1039,8 @@ static bool
 route_node_sent_message(gnutella_node_t *n, struct message *m)
 {
 	struct route_data *route;
-	pslist_t *sl;
+	const struct message_route *routes;
+	uint i;
 
 	if (n == fake_node)
 		route = &fake_route;
@@ -1330,8 +1055,10 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
 	if (route == NULL)
 		return FALSE;
 
-	PSLIST_FOREACH(m->routes, sl) {
-		if (route == sl->data)
+	routes = message_routes(m);
+
+	for (i = 0; i < m->nroutes; i++) {
+		if (route == routes[i].rd)
 			return TRUE;
 	}
 
@@ -1349,8 +1076,8 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
 static bool
 route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 {
-	pslist_t *l;
-	int i;
+	struct message_route *routes;
+	uint i;
 	struct route_data *route;
 
 	g_assert(n != fake_node);
@@ -1366,7 +1093,6 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	if (GTA_MSG_G2_SEARCH == m->function)
 		return FALSE;		/* As a G2 leaf, we do not care, it's a dup */
 
-	g_assert(m->ttls != NULL);
 	g_assert(
 		m->function == GTA_MSG_PUSH_REQUEST || m->function == GTA_MSG_SEARCH);
 
@@ -1374,17 +1100,14 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 
 	g_assert(route != NULL);
 
-	for (l = m->routes, i = 0; l; l = pslist_next(l), i++) {
-		if (route == l->data) {
-			pslist_t *t = pslist_nth(m->ttls, i);
-			uint8 old_ttl;
+	routes = message_routes(m);
 
-			g_assert(t != NULL);
-			old_ttl = GPOINTER_TO_INT(t->data);
-			if (old_ttl >= ttl)
+	for (i = 0; i < m->nroutes; i++) {
+		if (route == routes[i].rd) {
+			if (routes[i].ttl >= ttl)
 				return FALSE;
 
-			t->data = GUINT_TO_POINTER((uint) ttl);
+			routes[i].ttl = ttl;
 			return TRUE;
 		}
 	}
@@ -1393,40 +1116,6 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	return FALSE;
 }
 
-/**
- * compares two message structures
- */
-static int
-message_compare_func(const void *p, const void *q)
-{
-	const struct message *a = p, *b = q;
-
-	return a->function == b->function && guid_eq(&a->muid, &b->muid);
-}
-
-/**
- * Hashes message structures for storage in a hash table.
- */
-static uint
-message_hash_func(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash(msg->function) ^
-		universal_hash(&msg->muid, GUID_RAW_SIZE);
-}
-
-/**
- * Alternate hashing of message structures for storage in a hash table.
- */
-static uint
-message_hash_func2(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
-}
-
 /**
  * Reset this node's GUID.
  */
@@ -1526,9 +1215,11 @@ routing_init(void)
 	 * need to be deallocated
 	 */
 
-	routing.messages_hashed = hset_create_any(message_hash_func,
-		message_hash_func2, message_compare_func);
-	routing.last_rotation = tm_time();
+	routing.messages = guidtab_make(GEN_MESSAGES, MAX_GENERATIONS,
+		TABLE_MIN_CYCLE, message_free, NULL);
+	routing_update_stats();
+	routing.stats_ev = cq_periodic_main_add(STATS_PERIOD,
+		routing_stats_periodic, NULL);
 
 	/*
 	 * Push proxification and starving GUIDs.
@@ -1603,22 +1294,25 @@ remove_one_message_reference(struct route_data *rd)
 static void
 free_route_list(struct message *m)
 {
-	pslist_t *sl;
+	const struct message_route *routes;
+	uint i;
 
 	g_assert(m);
 
-	PSLIST_FOREACH(m->routes, sl) {
-		remove_one_message_reference(sl->data);
-	}
+	routes = message_routes(m);
 
-	pslist_free_null(&m->routes);
+	for (i = 0; i < m->nroutes; i++) {
+		remove_one_message_reference(routes[i].rd);
+	}
 
-	/*
-	 * If the message was a broadcasted one, we kept track of the TTL of
-	 * each message along the route.  This needs to be freed as well.
-	 */
+	if (m->rcap > MESSAGE_ROUTES) {
+		routing.vectors -= m->rcap * sizeof m->r.vec[0];
+		WFREE_ARRAY(m->r.vec, m->rcap);
+	}
 
-	pslist_free_null(&m->ttls);	/* Data are ints, nothing to free */
+	routing.routes -= m->nroutes;
+	m->nroutes = 0;
+	m->rcap = MESSAGE_ROUTES;
 }
 
 /**
@@ -1713,14 +1407,8 @@ message_add(const struct guid *muid, uint8 function,
 
 	if (found)			/* Dup message forwarded due to higher TTL */
 		entry = m;		/* Reuse existing entry */
-	else {
-		entry = get_next_entry();
-		g_assert(entry->routes == NULL);
-
-		/* fill in that storage space */
-		entry->muid = *muid;
-		entry->function = function;
-	}
+	else
+		entry = get_next_entry(muid, function);
 
 	g_assert(route != NULL);
 
@@ -1734,13 +1422,11 @@ message_add(const struct guid *muid, uint8 function,
 	if (!found || !route_node_sent_message(node, m)) {
 		uint ttl;
 
-		route->saved_messages++;
-		entry->routes = pslist_append(entry->routes, route);
-
 		/*
-		 * If message is typically broadcasted, also record the TTL of
-		 * that route, since a node is allowed to resend us a message
-		 * if it comes with a higher TTL than previously seen.
+		 * We also record the TTL of that route, which is used when the
+		 * message is typically broadcasted since a node is allowed to
+		 * resend us a message if it comes with a higher TTL than
+		 * previously seen.
 		 *		--RAM, 2005-10-02
 		 */
 
@@ -1748,12 +1434,8 @@ message_add(const struct guid *muid, uint8 function,
 				? GNET_PROPERTY(my_ttl)
 				: gnutella_header_get_ttl(&node->header);
 
-		switch (function) {
-		case GTA_MSG_PUSH_REQUEST:
-		case GTA_MSG_SEARCH:
-			entry->ttls = pslist_append(entry->ttls, GUINT_TO_POINTER(ttl));
-			break;
-		}
+		route->saved_messages++;
+		message_route_add(entry, route, ttl);
 	}
 
 	if (found)
@@ -1767,9 +1449,6 @@ message_add(const struct guid *muid, uint8 function,
 		entry->ttl = gnutella_header_get_ttl(&node->header);
 	else
 		entry->ttl = GNET_PROPERTY(my_ttl);
-
-	/* insert the new message into the hash table */
-	hset_insert(routing.messages_hashed, entry);
 }
 
 /**
@@ -1779,29 +1458,16 @@ message_add(const struct guid *muid, uint8 function,
 static void
 purge_dangling_references(struct message *m)
 {
-	pslist_t *sl;
-	pslist_t *t;
+	uint i = 0;
 
-	for (sl = m->routes, t = m->ttls; sl; /* empty */) {
-		struct route_data *rd = sl->data;
+	while (i < m->nroutes) {
+		struct route_data *rd = message_route(m, i);
 
 		if (rd->node == NULL) {
-			pslist_t *next = pslist_next(sl);
-			m->routes = pslist_remove_link(m->routes, sl);
+			message_route_remove(m, i);
 			remove_one_message_reference(rd);
-			pslist_free_1(sl);
-			sl = next;
-
-			if (t) {
-				next = pslist_next(t);
-				m->ttls = pslist_remove_link(m->ttls, t);
-				pslist_free_1(t);
-				t = next;
-			}
 		} else {
-			sl = pslist_next(sl);
-			if (t)
-				t = pslist_next(t);
+			i++;
 		}
 	}
 }
@@ -1818,9 +1484,8 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 {
 	bool found;
 	struct message *m;
-	pslist_t *sl;
-	pslist_t *t;
 	struct route_data *route;
+	uint i;
 
 	g_assert(muid != NULL);
 	node_check(node);
@@ -1832,17 +1497,11 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 	route = get_routing_data(node);
 	g_return_unless(route != NULL);
 
-	for (
-		sl = m->routes, t = m->ttls;
-		sl != NULL;
-		sl = pslist_next(sl), t = pslist_next(t)
-	) {
-		struct route_data *rd = sl->data;
+	for (i = 0; i < m->nroutes; i++) {
+		struct route_data *rd = message_route(m, i);
 
 		if (route == rd) {
-			m->routes = pslist_remove_link(m->routes, sl);
-			if (t != NULL)
-				m->ttls = pslist_remove_link(m->ttls, t);
+			message_route_remove(m, i);
 			remove_one_message_reference(rd);
 			break;
 		}
@@ -1853,22 +1512,18 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
  * Look for a particular message in the routing tables.
  *
  * If none of the nodes that sent us the message are still present, then
- * m->routes will be NULL.
+ * m->nroutes will be 0.
  *
  * @return TRUE if the message is found.
  */
 static bool
 find_message(const struct guid *muid, uint8 function, struct message **m)
 {
-	struct message dummy;
-	const void *orig_key;
-
-	dummy.muid = *muid;
-	dummy.function = function;
+	struct message *msg;
 
-	if (hset_contains_extended(routing.messages_hashed, &dummy, &orig_key)) {
-		struct message *msg = deconstify_pointer(orig_key);
+	msg = guidtab_lookup(routing.messages, muid, function);
 
+	if (msg != NULL) {
 		/* wipe out dead references to old nodes */
 		purge_dangling_references(msg);
 
@@ -1976,9 +1631,9 @@ route_max_forward_ttl(const gnutella_node_t *sender)
  * The message is not physically sent yet, but the `dest' structure is filled
  * with proper routing information.
  *
- * `routes' is normally NULL unless we're forwarding a PUSH request.  In that
- * case, it must be sent to the whole list of routes we have, and `target' will
- * be NULL.
+ * `m' is normally NULL unless we're forwarding a PUSH request.  In that
+ * case, it must be sent to the whole list of routes we have for the message,
+ * and `target' will be NULL.
  *
  * @attention
  * NB: we're just *recording* routing information for the message into `dest',
@@ -1990,11 +1645,11 @@ static bool
 forward_message(
 	struct route_log *route_log,
 	gnutella_node_t **node,
-	gnutella_node_t *target, struct route_dest *dest, pslist_t *routes)
+	gnutella_node_t *target, struct route_dest *dest, struct message *m)
 {
 	gnutella_node_t *sender = *node;
 
-	g_assert(routes == NULL || target == NULL);
+	g_assert(m == NULL || target == NULL);
 	g_assert(settings_is_ultra());
 
 	/* Drop messages that would travel way too many nodes --RAM */
@@ -2046,19 +1701,19 @@ forward_message(
 	} else {
 		/*
 		 * Forward message to all others nodes, or the the ones specified
-		 * by the `routes' parameter if not NULL.
+		 * by the routes of `m' if not NULL.
 		 */
 
-		if (routes != NULL) {
-			pslist_t *l;
+		if (m != NULL) {
 			pslist_t *nodes = NULL;
 			int count = 0;
+			uint i;
 
 			g_assert(gnutella_header_get_function(&sender->header)
 					== GTA_MSG_PUSH_REQUEST);
 
-			PSLIST_FOREACH(routes, l) {
-				struct route_data *rd = l->data;
+			for (i = 0; i < m->nroutes; i++) {
+				struct route_data *rd = message_route(m, i);
 				if (rd->node == sender)
 					continue;
 
@@ -2202,7 +1857,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 	 * each route.
 	 */
 
-	if (m->routes && route_node_sent_message(sender, m)) {
+	if (m->nroutes != 0 && route_node_sent_message(sender, m)) {
 		bool higher_ttl;
 
 		/*
@@ -2268,7 +1923,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 				gmsg_log_bad(sender, "dup message from same node");
 		}
 	} else {
-		if (m->routes == NULL) {
+		if (0 == m->nroutes) {
 			routing_log_extra(route_log, "all routes lost");
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
@@ -2278,13 +1933,13 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 			}
 		} else {
 			if (GNET_PROPERTY(log_gnutella_routing)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = m->nroutes;
 				routing_log_extra(route_log, "%u remaining route%s",
 					count, plural(count));
 			}
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = m->nroutes;
 				gmsg_log_duplicate(sender,
 					"from %s: %sother node, %u route%s (dups=%u)",
 					node_infostr(sender), oob ? "OOB, " : "",
@@ -2450,7 +2105,7 @@ route_push(struct route_log *route_log,
 
 		forward_message(route_log, node, neighbour, dest, NULL);
 
-	} else if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
+	} else if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->nroutes) {
 		gnet_stats_inc_general(GNR_PUSH_RELAYED_VIA_TABLE_ROUTE);
 
 		/*
@@ -2459,10 +2114,10 @@ route_push(struct route_log *route_log,
 		 */
 
 		revitalize_entry(m, FALSE);
-		forward_message(route_log, node, NULL, dest, m->routes);
+		forward_message(route_log, node, NULL, dest, m);
 
 	} else {
-		if (m && m->routes == NULL) {
+		if (m && 0 == m->nroutes) {
 			routing_log_extra(route_log, "route to target GUID %s gone",
 				guid_hex_str(guid));
 			gnet_stats_count_dropped(sender, MSG_DROP_ROUTE_LOST);
@@ -2635,7 +2290,7 @@ route_query_hit(struct route_log *route_log,
 				message_add(origin_guid, QUERY_HIT_ROUTE_SAVE, sender);
 				route_starving_check(origin_guid);
 			}
-		} else if (m->routes == NULL || !route_node_sent_message(sender, m)) {
+		} else if (0 == m->nroutes || !route_node_sent_message(sender, m)) {
 			struct route_data *route;
 
 			/*
@@ -2655,9 +2310,7 @@ route_query_hit(struct route_log *route_log,
 			 * no recording of the TTLs at which we see it.
 			 */
 
-			g_assert(m->ttls == NULL);
-
-			m->routes = pslist_append(m->routes, route);
+			message_route_add(m, route, 0);
 			route->saved_messages++;
 
 			/*
@@ -2699,18 +2352,18 @@ route_query_hit(struct route_log *route_log,
 	g_assert(m);		/* Or find_message() would have returned FALSE */
 
 	/*
-	 * Since this routing data is used, relocate it at the end of
-	 * the "message_array[]" to augment its lifetime.
+	 * Since this routing data is used, move it to the current generation
+	 * of the GUID table to augment its lifetime.
 	 */
 
 	revitalize_entry(m, FALSE);
 
 	/*
-	 * If `m->routes' is NULL, we have seen the request, but unfortunately
+	 * If `m->nroutes' is 0, we have seen the request, but unfortunately
 	 * none of the nodes that sent us the request are connected any more.
 	 */
 
-	if (m->routes == NULL)
+	if (0 == m->nroutes)
 		goto route_lost;
 
 	if (route_node_sent_message(fake_node, m)) {
@@ -2747,12 +2400,12 @@ route_query_hit(struct route_log *route_log,
 	 * XXX route for relaying. --RAM, 2004-08-29
 	 */
 	{
-		pslist_t *sl;
+		uint i;
 		bool skipped_transient = FALSE;
 
 		found = NULL;
-		PSLIST_FOREACH(m->routes, sl) {
-			struct route_data *route = sl->data;
+		for (i = 0; i < m->nroutes; i++) {
+			struct route_data *route = message_route(m, i);
 
 			g_assert(route);
 			g_assert(route->node);
@@ -2775,7 +2428,7 @@ route_query_hit(struct route_log *route_log,
 				 * will be logged as a message targeted to a transient node.
 				 */
 
-				if (NULL != pslist_next(sl)) {
+				if (i + 1 < m->nroutes) {
 					gnutella_node_t *rn;
 
 					rn = route_node_get_gnutella(route->node);
@@ -3037,7 +2690,7 @@ route_exists_for_reply(const struct guid *muid, uint8 function)
 {
 	struct message *m;
 
-	if (!find_message(muid, function & ~0x01, &m) || m->routes == NULL)
+	if (!find_message(muid, function & ~0x01, &m) || 0 == m->nroutes)
 		return FALSE;
 
 	return TRUE;
@@ -3075,12 +2728,13 @@ route_towards_guid(const struct guid *guid)
 	if (node)
 		return pslist_prepend(NULL, node);
 	
-	if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
-		pslist_t *iter, *nodes = NULL;
+	if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->nroutes) {
+		pslist_t *nodes = NULL;
+		uint i;
 		
 		revitalize_entry(m, TRUE);
-		PSLIST_FOREACH(m->routes, iter) {
-			struct route_data *rd = iter->data;
+		for (i = 0; i < m->nroutes; i++) {
+			struct route_data *rd = message_route(m, i);
 			nodes = pslist_prepend(nodes, rd->node);
 		}
 		return nodes;
@@ -3152,25 +2806,10 @@ routing_close(void)
 {
 	uint cnt;
 
-	g_assert(routing.messages_hashed != NULL);
-
-	hset_free_null(&routing.messages_hashed);
+	g_assert(routing.messages != NULL);
 
-	for (cnt = 0; cnt < MAX_CHUNKS; cnt++) {
-		struct message **chunk = routing.chunks[cnt];
-		if (chunk != NULL) {
-			int i;
-			for (i = 0; i < CHUNK_MESSAGES; i++) {
-				struct message *m = chunk[i];
-				if (m != NULL) {
-					message_check(m, cnt);
-					free_route_list(m);
-					WFREE(m);
-				}
-			}
-			HFREE_NULL(chunk);
-		}
-	}
+	cq_periodic_remove(&routing.stats_ev);
+	guidtab_free_null(&routing.messages);
 
 	hset_foreach(ht_banned_push, free_banned_push, NULL);
 	hset_free_null(&ht_banned_push);
@@ -398,7 +398,7 @@ record_query_string(const guid_t *muid, const char *query, unsigned media_types)
 			 */
 
 			WALLOC(qd);
-			canonized = UNICODE_CANONIZE(query);
+			canonized = UNICODE_CANONIZE_CACHED(query);
 			qd->muid = atom_guid_get(muid);
 			qd->query = atom_str_get(canonized);
 			qd->media_mask = media_types;
@@ -128,15 +128,14 @@ struct shared_file {
 	const char *name_canonic;	/**< UTF-8 canonized ver. of filename (atom)! */
 	const char *relative_path;	/**< UTF-8 NFC string (atom) */
 
-	size_t name_nfc_len;		/**< strlen(name_nfc) */
-	size_t name_canonic_len;	/**< strlen(name_canonic) */
-
 	time_t mtime;				/**< Last modif. time, for SHA1 computation */
 	time_t ctime;				/**< File creation time */
 
 	filesize_t file_size;		/**< File size in Bytes */
 	uint32 file_index;			/**< the files index within our local DB */
 	uint32 sort_index;			/**< the index for sorted listings */
+	uint32 name_nfc_len;		/**< strlen(name_nfc) */
+	uint32 name_canonic_len;	/**< strlen(name_canonic) */
 
 	enum mime_type mime_type;	/* MIME type of the file */
 
@@ -2130,6 +2129,12 @@ recursive_update_scan_timing(void *data)
 	gnet_prop_set_timestamp_val(PROP_LIBRARY_RESCAN_FINISHED, tm_time());
 	gnet_prop_set_guint32_val(PROP_LIBRARY_RESCAN_DURATION, elapsed);
 
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE library rescan took %s for %s file%s",
+			short_time_ascii(elapsed), uint64_to_string(ctx->files_scanned),
+			plural(ctx->files_scanned));
+	}
+
 	return NULL;
 }
 
@@ -2243,8 +2248,11 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 
 	if (GNET_PROPERTY(share_debug) > 1) {
 		int count = st_count(ctx->search_tb);
-		g_debug("SHARE installing new search table (%d item%s)",
-			count, plural(count));
+		size_t memory = st_memory(ctx->search_tb);
+		g_debug("SHARE installing new search table (%d item%s, %s, "
+			"%zu bytes/item)",
+			count, plural(count), compact_size(memory, FALSE),
+			memory / MAX(count, 1));
 	}
 
 	/*
@@ -2542,8 +2550,9 @@ recursive_scan_step_install_partials(struct bgtask *bt, void *data, int ticks)
 
 	if (GNET_PROPERTY(share_debug) > 1) {
 		int count = st_count(ctx->partial_tb);
-		g_debug("SHARE installing new partial table (%d item%s)",
-			count, plural(count));
+		g_debug("SHARE installing new partial table (%d item%s, %s)",
+			count, plural(count),
+			compact_size(st_memory(ctx->partial_tb), FALSE));
 	}
 
 	SHARED_LIBFILE_LOCK;
@@ -3553,7 +3562,7 @@ shared_file_from_fileinfo(fileinfo_t *fi)
 	sf->flags = SHARE_F_HAS_DIGEST;
 	sf->mtime = fi->last_flush;
 	sf->ctime = fi->created;
-	sf->sha1 = atom_sha1_get(fi->sha1);
+	sf->sha1 = atom_sha1_ref(fi->sha1);
 
 	/* FIXME: DOWNLOAD_SIZE:
 	 * Do we need to add anything here now that fileinfos can have an
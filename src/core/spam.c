@@ -51,11 +51,11 @@
 #include "lib/halloc.h"
 #include "lib/parse.h"
 #include "lib/path.h"
-#include "lib/pslist.h"
+#include "lib/regset.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/tokenizer.h"
 #include "lib/utf8.h"
-#include "lib/walloc.h"
 #include "lib/watcher.h"
 
 #include "if/gnet_property.h"
@@ -114,7 +114,7 @@ static const char spam_what[] = "Spam database";
 /****** END IDEAS ONLY ******/
 
 struct spam_lut {
-	pslist_t *sl_names;	/* List of struct namesize_item */
+	regset_t *names;	/* Filename patterns, with size ranges */
 };
 
 static struct spam_lut spam_lut;
@@ -150,38 +150,26 @@ spam_string_to_tag(const char *s)
 	return TOKENIZE(s, spam_tags);
 }
 
-struct namesize_item {
-	regex_t		pattern;
-	filesize_t	min_size;
-	filesize_t	max_size;
-};
-
 static bool 
 spam_add_name_and_size(const char *name,
 	filesize_t min_size, filesize_t max_size)
 {
-	struct namesize_item *item;
-	int error;
+	char buf[1024];
 
 	g_return_val_if_fail(name, TRUE);
 	g_return_val_if_fail(min_size <= max_size, TRUE);
 
-	WALLOC(item);
-	error = regcomp(&item->pattern, name, REG_EXTENDED | REG_NOSUB);
-	if (error) {
-		char buf[1024];
+	if (NULL == spam_lut.names)
+		spam_lut.names = regset_make(REG_EXTENDED | REG_NOSUB);
 
-		regerror(error, &item->pattern, buf, sizeof buf);
+	if (
+		!regset_add(spam_lut.names, name, min_size, max_size, buf, sizeof buf)
+	) {
 		g_warning("%s(): regcomp() failed: %s", G_STRFUNC, buf);
-		regfree(&item->pattern);
-		WFREE(item);
 		return TRUE;
-	} else {
-		item->min_size = min_size;
-		item->max_size = max_size;
-		spam_lut.sl_names = pslist_prepend(spam_lut.sl_names, item);
-		return FALSE;
 	}
+
+	return FALSE;
 }
 
 struct spam_item {
@@ -400,6 +388,25 @@ spam_load(FILE *f)
 
 	spam_sha1_sync();
 
+	/*
+	 * Compile all the filename patterns at once, so that a filename can be
+	 * checked against all the patterns applying to its size in one pass.
+	 */
+
+	if (spam_lut.names != NULL) {
+		regset_compile(spam_lut.names);
+
+		if (GNET_PROPERTY(spam_debug)) {
+			size_t n = regset_count(spam_lut.names);
+			size_t r = regset_regex_count(spam_lut.names);
+			size_t b = regset_bucket_count(spam_lut.names);
+
+			g_debug("%s(): compiled %zu filename pattern%s into %zu regex%s "
+				"over %zu size range%s",
+				G_STRFUNC, n, plural(n), r, plural_es(r), b, plural(b));
+		}
+	}
+
 	return item_count;
 }
 
@@ -498,16 +505,7 @@ spam_init(void)
 void
 spam_close(void)
 {
-	pslist_t *sl;
-
-	PSLIST_FOREACH(spam_lut.sl_names, sl) {
-		struct namesize_item *item = sl->data;
-
-		g_assert(item);
-		regfree(&item->pattern);
-		WFREE(item);
-	}
-	pslist_free_null(&spam_lut.sl_names);
+	regset_free_null(&spam_lut.names);
 	spam_sha1_close();
 }
 
@@ -520,23 +518,12 @@ spam_close(void)
 bool
 spam_check_filename_size(const char *filename, filesize_t size)
 {
-	const pslist_t *sl;
-
 	g_return_val_if_fail(filename, FALSE);
 
-	PSLIST_FOREACH(spam_lut.sl_names, sl) {
-		const struct namesize_item *item = sl->data;
+	if (NULL == spam_lut.names)
+		return FALSE;
 
-		g_assert(item);
-		if (
-			size >= item->min_size &&
-			size <= item->max_size &&
-			0 == regexec(&item->pattern, filename, 0, NULL, 0)
-		) {
-			return TRUE;
-		}
-	}
-	return FALSE;
+	return regset_match(spam_lut.names, filename, size);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
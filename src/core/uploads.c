@@ -199,6 +199,51 @@ static const char stall_again[] = "stall again";
 #define STALL_FIRST (deconstify_pointer(stall_first))
 #define STALL_AGAIN (deconstify_pointer(stall_again))
 
+/**
+ * A pre-formatted HTTP header line.
+ */
+struct upload_header_line {
+	char *str;					/**< Line with trailing "\r\n" (halloc'ed) */
+	size_t len;					/**< Length of line */
+};
+
+/**
+ * Header lines pertaining to a shared file which do not depend on the
+ * request being served: they are formatted once and then copied into all
+ * the HTTP replies made for that file, which matters when busy queues keep
+ * answering the same requests over and over.
+ *
+ * Entries are indexed by SHA1 and expire when the file is no longer being
+ * requested.  Since several shared files may bear the same SHA1, lines are
+ * checked against the file information they were derived from.
+ */
+struct upload_file_headers {
+	const struct sha1 *sha1;	/**< SHA1 of the file (atom), the key */
+	const struct tth *tth;		/**< TTH in X-Thex-URI (atom), NULL if none */
+	const char *mime;			/**< MIME type in Content-Type */
+	time_t mtime;				/**< Time in Last-Modified */
+	struct upload_header_line urn;		/**< X-Gnutella-Content-URN */
+	struct upload_header_line thex;		/**< X-Thex-URI */
+	struct upload_header_line type;		/**< Content-Type */
+	struct upload_header_line modified;	/**< Last-Modified */
+};
+
+#define UPLOAD_HEADERS_TIMEOUT	600	/**< Keep file header lines for 10 min */
+
+static aging_table_t *upload_file_headers;
+
+/**
+ * Header lines which do not depend on the upload at all, rebuilt only
+ * when the information they convey changes.
+ */
+static struct upload_static_headers {
+	struct upload_header_line xhost;	/**< X-Host */
+	struct upload_header_line xguid;	/**< X-GUID */
+	host_addr_t addr;					/**< Address in X-Host */
+	uint16 port;						/**< Port in X-Host */
+	guid_t guid;						/**< GUID in X-GUID */
+} upload_static_headers;
+
 static void upload_request(struct upload *u, header_t *header);
 static void upload_error_remove(struct upload *u,
 		int code, const char *msg, ...) G_GNUC_PRINTF(3, 4);
@@ -1530,6 +1575,147 @@ upload_likely_from_browser(const header_t *header)
 	return FALSE;
 }
 
+/**
+ * Set header line to "name: value\r\n".
+ */
+static void
+upload_header_line_set(struct upload_header_line *hl,
+	const char *name, const char *value)
+{
+	HFREE_NULL(hl->str);
+	hl->str = h_strconcat(name, ": ", value, "\r\n", (void *) 0);
+	hl->len = strlen(hl->str);
+}
+
+/**
+ * Clear header line.
+ */
+static void
+upload_header_line_clear(struct upload_header_line *hl)
+{
+	HFREE_NULL(hl->str);
+	hl->len = 0;
+}
+
+/**
+ * Copy header line into `buf', provided it fits entirely.
+ *
+ * @param hl		the header line to copy
+ * @param buf		buffer where header must be written to
+ * @param size		size of supplied buffer
+ * @param what		name of the header, for logging
+ *
+ * @return length of copied line, 0 if it did not fit or is empty.
+ */
+static size_t
+upload_header_line_copy(const struct upload_header_line *hl,
+	char *buf, size_t size, const char *what)
+{
+	if (NULL == hl->str)
+		return 0;
+
+	if (hl->len >= size) {
+		if (GNET_PROPERTY(upload_debug)) {
+			g_warning("U/L cannot send %s header back: only %u byte%s left",
+				what, (unsigned) size, plural(size));
+		}
+		return 0;
+	}
+
+	memcpy(buf, hl->str, hl->len + 1);		/* Includes trailing NUL */
+	return hl->len;
+}
+
+/**
+ * Free cached file header lines -- aging table callback.
+ */
+static void
+upload_file_headers_free(void *unused_key, void *value)
+{
+	struct upload_file_headers *fh = value;
+
+	(void) unused_key;
+
+	atom_sha1_free_null(&fh->sha1);
+	atom_tth_free_null(&fh->tth);
+	upload_header_line_clear(&fh->urn);
+	upload_header_line_clear(&fh->thex);
+	upload_header_line_clear(&fh->type);
+	upload_header_line_clear(&fh->modified);
+	WFREE(fh);
+}
+
+/**
+ * Get the cached header lines for a shared file, creating or refreshing
+ * them as needed.
+ *
+ * @return the header lines, NULL if the file has no known SHA1.
+ */
+static const struct upload_file_headers *
+upload_file_headers_get(const shared_file_t *sf)
+{
+	struct upload_file_headers *fh;
+	const struct sha1 *sha1;
+	const struct tth *tth;
+	const char *mime;
+	time_t mtime;
+
+	shared_file_check(sf);
+
+	sha1 = shared_file_sha1(sf);
+	if (NULL == sha1)
+		return NULL;
+
+	fh = aging_lookup_revitalise(upload_file_headers, sha1);
+
+	if (NULL == fh) {
+		WALLOC0(fh);
+		fh->sha1 = atom_sha1_get(sha1);
+		upload_header_line_set(&fh->urn,
+			"X-Gnutella-Content-URN", sha1_to_urn_string(sha1));
+		aging_insert(upload_file_headers, fh->sha1, fh);
+	}
+
+	/*
+	 * The TTH of a file can be computed after its SHA1 is known, and
+	 * files sharing the same SHA1 may differ by their type or their
+	 * modification time.
+	 */
+
+	tth = shared_file_tth(sf);
+
+	if G_UNLIKELY(fh->tth != tth) {
+		atom_tth_free_null(&fh->tth);
+		upload_header_line_clear(&fh->thex);
+
+		if (tth != NULL) {
+			char uri[128];
+
+			fh->tth = atom_tth_get(tth);
+			str_bprintf(uri, sizeof uri, "/uri-res/N2X?%s;%s",
+				sha1_to_urn_string(sha1), tth_base32(tth));
+			upload_header_line_set(&fh->thex, "X-Thex-URI", uri);
+		}
+	}
+
+	mime = shared_file_mime_type(sf);
+
+	if G_UNLIKELY(fh->mime != mime) {
+		fh->mime = mime;
+		upload_header_line_set(&fh->type, "Content-Type", mime);
+	}
+
+	mtime = shared_file_modification_time(sf);
+
+	if G_UNLIKELY(NULL == fh->modified.str || fh->mtime != mtime) {
+		fh->mtime = mtime;
+		upload_header_line_set(&fh->modified,
+			"Last-Modified", timestamp_rfc1123_to_string(mtime));
+	}
+
+	return fh;
+}
+
 /**
  * Wrapper to http_send_status() to disable TCP quick ACKs before sending
  * the actual status.
@@ -1563,9 +1749,9 @@ static size_t
 upload_http_xhost_add(char *buf, size_t size,
 	void *unused_arg, uint32 unused_flags)
 {
+	struct upload_static_headers *xh;
 	host_addr_t addr;
 	uint16 port;
-	size_t len;
 
 	(void) unused_arg;
 	(void) unused_flags;
@@ -1574,20 +1760,22 @@ upload_http_xhost_add(char *buf, size_t size,
 	addr = listen_addr();
 	port = socket_listen_port();
 
-	if (host_is_valid(addr, port)) {
-		len = concat_strings(buf, size,
-				"X-Host: ", host_addr_port_to_string(addr, port), "\r\n",
-				(void *) 0);
-	} else {
-		len = 0;
-	}
+	if (!host_is_valid(addr, port))
+		return 0;
 
-	if (len >= size && GNET_PROPERTY(upload_debug)) {
-		g_warning("U/L cannot send X-Host header back: only %u byte%s left",
-			(unsigned) size, plural(size));
+	xh = &upload_static_headers;
+
+	if (
+		NULL == xh->xhost.str || xh->port != port ||
+		!host_addr_equiv(xh->addr, addr)
+	) {
+		xh->addr = addr;
+		xh->port = port;
+		upload_header_line_set(&xh->xhost,
+			"X-Host", host_addr_port_to_string(addr, port));
 	}
 
-	return len < size ? len : 0;
+	return upload_header_line_copy(&xh->xhost, buf, size, "X-Host");
 }
 
 /**
@@ -1623,7 +1811,7 @@ upload_xfeatures_add(char *buf, size_t size,
 static size_t
 upload_xguid_add(char *buf, size_t size, void *arg, uint32 flags)
 {
-	size_t rw;
+	struct upload_static_headers *xh;
 	guid_t guid;
 
 	/*
@@ -1655,16 +1843,14 @@ upload_xguid_add(char *buf, size_t size, void *arg, uint32 flags)
 
 	gnet_prop_get_storage(PROP_SERVENT_GUID, &guid, sizeof guid);
 
-	rw = concat_strings(buf, size,
-			"X-GUID: ", guid_hex_str(&guid), "\r\n",
-			(void *) 0);
+	xh = &upload_static_headers;
 
-	if (rw >= size && GNET_PROPERTY(upload_debug)) {
-		g_warning("U/L cannot send X-GUID header back: only %u byte%s left",
-			(unsigned) size, plural(size));
+	if (NULL == xh->xguid.str || !guid_eq(&xh->guid, &guid)) {
+		xh->guid = guid;
+		upload_header_line_set(&xh->xguid, "X-GUID", guid_hex_str(&guid));
 	}
 
-	return rw < size ? rw : 0;
+	return upload_header_line_copy(&xh->xguid, buf, size, "X-GUID");
 }
 
 /**
@@ -1682,16 +1868,15 @@ upload_gnutella_content_urn_add(char *buf, size_t size, void *arg, uint32 flags)
 {
 	struct upload_http_cb *a = arg;
 	struct upload *u = a->u;
-	const struct sha1 *sha1;
-	size_t len;
+	const struct upload_file_headers *fh;
 
 	upload_check(u);
 
 	g_return_val_if_fail(u->sf, 0);
 	shared_file_check(u->sf);
 
-	sha1 = shared_file_sha1(u->sf);
-	g_return_val_if_fail(sha1, 0);
+	fh = upload_file_headers_get(u->sf);
+	g_return_val_if_fail(fh, 0);
 
 	/*
 	 * We don't send the SHA1 if we're short on bandwidth and they
@@ -1708,17 +1893,8 @@ upload_gnutella_content_urn_add(char *buf, size_t size, void *arg, uint32 flags)
 	if ((flags & HTTP_CBF_BW_SATURATED) && u->n2r)
 		return 0;
 
-	len = concat_strings(buf, size,
-			"X-Gnutella-Content-URN: ", sha1_to_urn_string(sha1), "\r\n",
-			(void *) 0);
-
-	if (len >= size && GNET_PROPERTY(upload_debug)) {
-		g_warning("U/L cannot send X-Gnutella-Content-URN header back: "
-			"only %u byte%s left",
-			(unsigned) size, plural(size));
-	}
-
-	return len < size ? len : 0;
+	return upload_header_line_copy(&fh->urn, buf, size,
+		"X-Gnutella-Content-URN");
 }
 
 /**
@@ -1736,37 +1912,20 @@ upload_thex_uri_add(char *buf, size_t size, void *arg, uint32 flags)
 {
 	struct upload_http_cb *a = arg;
 	struct upload *u = a->u;
-	const struct sha1 *sha1;
-	const struct tth *tth;
-	size_t len = 0;
+	const struct upload_file_headers *fh;
 
 	upload_check(u);
 
 	g_return_val_if_fail(u->sf, 0);
 	shared_file_check(u->sf);
 
-	sha1 = shared_file_sha1(u->sf);
-	g_return_val_if_fail(sha1, 0);
+	fh = upload_file_headers_get(u->sf);
+	g_return_val_if_fail(fh, 0);
 
 	if ((flags & HTTP_CBF_BW_SATURATED) && u->n2r)
 		return 0;
 
-	tth = shared_file_tth(u->sf);
-	if (!tth)
-		return 0;
-	
-	len = concat_strings(buf, size,
-			"X-Thex-URI: /uri-res/N2X?", sha1_to_urn_string(sha1),
-			";", tth_base32(tth),
-			"\r\n",
-			(void *) 0);
-
-	if (len >= size && GNET_PROPERTY(upload_debug)) {
-		g_warning("U/L cannot send X-Thex-URI header back: only %u byte%s left",
-			(unsigned) size, plural(size));
-	}
-
-	return len < size ? len : 0;
+	return upload_header_line_copy(&fh->thex, buf, size, "X-Thex-URI");
 }
 
 /**
@@ -1958,6 +2117,7 @@ upload_http_content_type_add(char *buf, size_t size,
 {
 	struct upload_http_cb *a = arg;
 	struct upload *u = a->u;
+	const struct upload_file_headers *fh;
 	size_t len;
 
 	(void) unused_flags;
@@ -1966,7 +2126,10 @@ upload_http_content_type_add(char *buf, size_t size,
 	if (!u->sf)
 		return 0;
 
-	shared_file_check(u->sf);
+	fh = upload_file_headers_get(u->sf);
+	if (fh != NULL)
+		return upload_header_line_copy(&fh->type, buf, size, "Content-Type");
+
 	len = concat_strings(buf, size,
 			"Content-Type: ", shared_file_mime_type(u->sf), "\r\n",
 			(void *) 0);
@@ -1985,9 +2148,20 @@ upload_http_last_modified_add(char *buf, size_t size,
 	void *arg, uint32 unused_flags)
 {
 	struct upload_http_cb *a = arg;
+	const struct upload *u = a->u;
 	size_t len;
 
 	(void) unused_flags;
+	upload_check(u);
+
+	if (u->sf != NULL) {
+		const struct upload_file_headers *fh = upload_file_headers_get(u->sf);
+
+		if (fh != NULL && fh->mtime == a->mtime) {
+			return upload_header_line_copy(&fh->modified, buf, size,
+				"Last-Modified");
+		}
+	}
 
 	len = concat_strings(buf, size,
 			"Last-Modified: ", timestamp_rfc1123_to_string(a->mtime), "\r\n",
@@ -5758,6 +5932,8 @@ upload_init(void)
 		host_addr_hash_func, host_addr_eq_func, wfree_host_addr);
 	push_conn_failed = aging_make(PUSH_BAN_FREQ,
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
+	upload_file_headers = aging_make(UPLOAD_HEADERS_TIMEOUT,
+		sha1_hash, sha1_eq, upload_file_headers_free);
 
 	header_features_add_guarded(FEATURES_UPLOADS, "browse",
 		BH_VERSION_MAJOR, BH_VERSION_MINOR,
@@ -5807,6 +5983,9 @@ upload_close(void)
 	aging_destroy(&stalling_uploads);
 	aging_destroy(&push_requests);
 	aging_destroy(&push_conn_failed);
+	aging_destroy(&upload_file_headers);
+	upload_header_line_clear(&upload_static_headers.xhost);
+	upload_header_line_clear(&upload_static_headers.xguid);
 	wd_free_null(&early_stall_wd);
 	wd_free_null(&stall_wd);
 }
@@ -40,6 +40,7 @@
 #include "common.h"
 
 #include "whitelist.h"
+#include "ipclass.h"
 #include "settings.h"
 #include "ipp_cache.h"
 #include "nodes.h"
@@ -48,6 +49,7 @@
 
 #include "lib/adns.h"
 #include "lib/ascii.h"
+#include "lib/iprange.h"
 #include "lib/cq.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
@@ -231,6 +233,7 @@ whitelist_add(struct whitelist *item)
 		log_whitelist_item(item, "adding");
 
 	sl_whitelist = pslist_prepend(sl_whitelist, item);
+	ipclass_invalidate();
 }
 
 /**
@@ -257,10 +260,13 @@ whitelist_dns_cb(const host_addr_t *addrs, size_t n, void *udata)
 			if (ctx->revalidate) {
 				item->addr = ipv4_unspecified;
 				item->bits = 0;
+				ipclass_invalidate();
 			} else {
 				whitelist_free(item);
 			}
 		} else {
+			host_addr_t old_addr = item->addr;
+
 			item->addr = addrs[random_value(n - 1)];	/* Pick one randomly */
 			item->bits = addr_default_mask(item->addr);
 
@@ -271,6 +277,8 @@ whitelist_dns_cb(const host_addr_t *addrs, size_t n, void *udata)
 			}
 			if (!ctx->revalidate) {
 				whitelist_add(item);
+			} else if (!host_addr_equiv(old_addr, item->addr)) {
+				ipclass_invalidate();
 			}
 		}
 	}
@@ -565,6 +573,15 @@ whitelist_connect(void)
  */
 bool
 whitelist_check(const host_addr_t ha)
+{
+	return 0 != (ipclass_get(ha) & IPCLASS_WHITELIST);
+}
+
+/**
+ * Add the whitelisted addresses to the IP classification map.
+ */
+void
+whitelist_classify(struct iprange_map *map)
 {
 	const pslist_t *sl;
 
@@ -574,11 +591,20 @@ whitelist_check(const host_addr_t ha)
 		if (!is_host_addr(item->addr))
 			continue;
 
-		if (host_addr_matches(ha, item->addr, item->bits))
-			return TRUE;
+		switch (host_addr_net(item->addr)) {
+		case NET_TYPE_IPV4:
+			iprange_map_add_cidr(map, host_addr_ipv4(item->addr),
+				item->bits, IPCLASS_WHITELIST);
+			break;
+		case NET_TYPE_IPV6:
+			iprange_map_add_cidr6(map, host_addr_ipv6(&item->addr),
+				item->bits, IPCLASS_WHITELIST);
+			break;
+		case NET_TYPE_LOCAL:
+		case NET_TYPE_NONE:
+			break;
+		}
 	}
-
-	return FALSE;
 }
 
 /**
@@ -674,6 +700,7 @@ whitelist_close(void)
 	}
 
     pslist_free_null(&sl_whitelist);
+	ipclass_invalidate();
 }
 
 /* vi: set ts=4 sw=4 cindent: */
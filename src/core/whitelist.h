@@ -45,5 +45,8 @@ void whitelist_init(void);
 void whitelist_close(void);
 uint whitelist_connect(void);
 
+struct iprange_map;
+void whitelist_classify(struct iprange_map *map);
+
 #endif /* _core_whitelist_h_ */
 /* vi: set ts=4 sw=4 cindent: */
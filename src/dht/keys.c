@@ -92,6 +92,7 @@
 #include "lib/dbmw.h"
 #include "lib/dbstore.h"
 #include "lib/glib-missing.h"
+#include "lib/erbtree.h"
 #include "lib/hikset.h"
 #include "lib/hset.h"
 #include "lib/patricia.h"
@@ -99,6 +100,7 @@
 #include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/timestamp.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -114,6 +116,10 @@
 
 #define KEYS_DB_CACHE_SIZE	512	/**< Amount of keys to keep cached in RAM */
 #define KEYS_SYNC_PERIOD	(60*1000)	/**< Sync DB every minute */
+#define KEYS_EXPIRE_PERIOD	(5*1000)	/**< Expire due keys every 5 secs */
+#define KEYS_EXPIRE_SLICE	128		/**< Max amount of keys expired per slice */
+#define KEYS_EXPIRE_MS		20		/**< Time budget (ms) for expire slice */
+#define KEYS_EXPIRE_RETRY	60		/**< Retry delay (secs) on expire failure */
 
 /**
  * Information about our neighbourhood (k-ball), updated periodically.
@@ -143,6 +149,7 @@ enum keyinfo_magic { KEYINFO_MAGIC = 0x79d4de97U };
 struct keyinfo {
 	enum keyinfo_magic magic;
 	kuid_t *kuid;				/**< The key (atom) */
+	rbnode_t expire_node;		/**< Node in `keys_by_expire' */
 	float get_req_load;			/**< EMA of # of (read) requests per period */
 	float store_req_load;		/**< EMA of # of (store) requests per period */
 	time_t next_expire;			/**< Earliest expiration of a value */
@@ -186,6 +193,12 @@ struct keydata {
  */
 static hikset_t *keys;		/**< KUID => struct keyinfo */
 
+/**
+ * All the keys sorted by increasing next expiration time, so that the
+ * periodic expiration only needs to look at the keys that are due.
+ */
+static erbtree_t keys_by_expire;
+
 /**
  * DBM wrapper to store keydata.
  */
@@ -196,6 +209,7 @@ static char db_keywhat[] = "DHT key data";
 static cevent_t *kball_ev;		/**< Event for periodic k-ball update */
 static cperiodic_t *keys_periodic_ev;
 static cperiodic_t *keys_sync_ev;
+static cperiodic_t *keys_expire_ev;
 
 /**
  * Decimation factor to adjust expiration time depending on the distance
@@ -213,6 +227,41 @@ static double decimation_factor[KUID_RAW_BITSIZE];
 
 static void keys_periodic_kball(cqueue_t *cq, void *obj);
 
+/**
+ * Comparison routine for keys in the `keys_by_expire' tree.
+ *
+ * This sorts keys by increasing expiration time, and since we cannot have
+ * identical items in the red-black tree, compare keyinfo addresses if the
+ * expiration time matches.
+ */
+static int
+keys_expire_cmp(const void *a, const void *b)
+{
+	const struct keyinfo *ka = a, *kb = b;
+
+	if G_UNLIKELY(ka->next_expire == kb->next_expire)
+		return ptr_cmp(ka, kb);
+
+	return ka->next_expire > kb->next_expire ? +1 : -1;
+}
+
+/**
+ * Update the next expiration time of a key, repositioning it in the
+ * `keys_by_expire' tree.
+ */
+static void
+keys_set_next_expire(struct keyinfo *ki, time_t expire)
+{
+	keyinfo_check(ki);
+
+	if (expire == ki->next_expire)
+		return;
+
+	erbtree_remove(&keys_by_expire, &ki->expire_node);
+	ki->next_expire = expire;
+	erbtree_insert(&keys_by_expire, &ki->expire_node);
+}
+
 /**
  * @return TRUE if key is stored here.
  */
@@ -434,6 +483,7 @@ keys_reclaim(struct keyinfo *ki, bool can_remove)
 		g_debug("DHT STORE key %s reclaimed", kuid_to_hex_string(ki->kuid));
 
 	dbmw_delete(db_keydata, ki->kuid);
+	erbtree_remove(&keys_by_expire, &ki->expire_node);
 	if (can_remove)
 		hikset_remove(keys, &ki->kuid);
 
@@ -458,6 +508,7 @@ keys_expire_values(struct keyinfo *ki, time_t now)
 	int i;
 	int expired = 0;
 	time_t next_expire = TIME_T_MAX;
+	uint64 dbkeys[MAX_VALUES];
 	const char *reason = NULL;
 	char buf[80];
 
@@ -478,26 +529,35 @@ keys_expire_values(struct keyinfo *ki, time_t now)
 		uint64 dbkey = kd->dbkeys[i];
 		time_t expire = kd->expire[i];
 
-		if (
-			delta_time(now, expire) >= 0 &&
-			values_has_expired(dbkey, now, &expire)		/* Updates `expire' */
-		) {
-			expired++;
+		if (delta_time(now, expire) >= 0) {
+			/* Next call updates `expire' */
+			if (values_has_expired(dbkey, now, &expire)) {
+				dbkeys[expired++] = dbkey;
+
+				/*
+				 * A mismatch indicates a severe database corruption, hence
+				 * we use a mandatory warning.
+				 */
+
+				if (kd->expire[i] != expire) {
+					g_warning("DHT KEYS mismatching expire time "
+						"for value #%d in %s (held %u, should have been %u)",
+						i, kuid_to_hex_string(ki->kuid),
+						(uint) kd->expire[i], (uint) expire);
+				}
+				continue;
+			}
 
 			/*
-			 * A mismatch indicates a severe database corruption, hence
-			 * we use a mandatory warning.
+			 * If the value could not be read, retry later: keeping its past
+			 * expiration time would leave the key due forever, at the head
+			 * of `keys_by_expire', stalling the expiration of other keys.
 			 */
 
-			if (kd->expire[i] != expire) {
-				g_warning("DHT KEYS mismatching expire time for value #%d in %s"
-					" (held %u, should have been %u)",
-					i, kuid_to_hex_string(ki->kuid),
-					(uint) kd->expire[i], (uint) expire);
-			}
-		} else {
-			next_expire = MIN(expire, next_expire);
+			if (delta_time(now, expire) >= 0)
+				expire = time_advance(now, KEYS_EXPIRE_RETRY);
 		}
+		next_expire = MIN(expire, next_expire);
 	}
 
 	if (GNET_PROPERTY(dht_storage_debug) > 3)
@@ -506,15 +566,28 @@ keys_expire_values(struct keyinfo *ki, time_t now)
 			ki->values);
 
 	if (next_expire != TIME_T_MAX)
-		ki->next_expire = next_expire;	/* Next check, if values remain */
+		keys_set_next_expire(ki, next_expire);	/* Next check, if values remain */
 
 	/*
-	 * Reclaim expired values, which will call keys_remove_value() for each
-	 * value that has expired.
+	 * Reclaim our expired values, which will call keys_remove_value() for
+	 * each of them.  Since this updates the keydata, `kd' must no longer
+	 * be used from now on.
 	 */
 
-	values_reclaim_expired();
+	for (i = 0; i < expired; i++) {
+		values_reclaim(dbkeys[i]);
+	}
+
 	keyinfo_check(ki);		/* Keyinfo reclaim is asynchronous */
+
+	/*
+	 * Likewise, if the expired values could not all be removed from the
+	 * keydata, do not leave the key due.
+	 */
+
+	if (0 != ki->values && delta_time(now, ki->next_expire) >= 0)
+		keys_set_next_expire(ki, time_advance(now, KEYS_EXPIRE_RETRY));
+
 	return TRUE;			/* OK */
 
 discard_key:
@@ -655,6 +728,7 @@ keys_remove_value(const kuid_t *id, const kuid_t *cid, uint64 dbkey)
 	struct keyinfo *ki;
 	struct keydata *kd;
 	int idx;
+	time_t next_expire;
 
 	ki = hikset_lookup(keys, id);
 
@@ -697,12 +771,14 @@ keys_remove_value(const kuid_t *id, const kuid_t *cid, uint64 dbkey)
 	 * Recompute next expiration time.
 	 */
 
-	ki->next_expire = TIME_T_MAX;
+	next_expire = TIME_T_MAX;
 
 	for (idx = 0; idx < ki->values; idx++) {
-		ki->next_expire = MIN(ki->next_expire, kd->expire[idx]);
+		next_expire = MIN(next_expire, kd->expire[idx]);
 	}
 
+	keys_set_next_expire(ki, next_expire);
+
 	dbmw_write(db_keydata, id, kd, sizeof *kd);
 
 	if (GNET_PROPERTY(dht_storage_debug) > 2) {
@@ -728,7 +804,7 @@ keys_update_value(const kuid_t *id, const kuid_t *cid, time_t expire)
 	ki = hikset_lookup(keys, id);
 	g_assert(ki != NULL);
 
-	ki->next_expire = MIN(ki->next_expire, expire);
+	keys_set_next_expire(ki, MIN(ki->next_expire, expire));
 	kd = get_keydata(id);
 
 	if (kd != NULL) {
@@ -778,6 +854,8 @@ allocate_keyinfo(const kuid_t *kuid, size_t common)
 	ki->magic = KEYINFO_MAGIC;
 	ki->kuid = kuid_get_atom(kuid);
 	ki->common_bits = common & 0xff;
+	ki->next_expire = TIME_T_MAX;
+	erbtree_insert(&keys_by_expire, &ki->expire_node);
 
 	return ki;
 }
@@ -821,7 +899,7 @@ keys_add_value(const kuid_t *id, const kuid_t *cid,
 				kuid_to_hex_string2(cid));
 
 		ki = allocate_keyinfo(id, common);
-		ki->next_expire = expire;
+		keys_set_next_expire(ki, expire);
 		ki->flags = in_kball ? 0 : DHT_KEY_F_CACHED;
 
 		hikset_insert_key(keys, &ki->kuid);
@@ -900,7 +978,7 @@ keys_add_value(const kuid_t *id, const kuid_t *cid,
 		kd->dbkeys[low] = dbkey;
 		kd->expire[low] = expire;
 
-		ki->next_expire = MIN(ki->next_expire, expire);
+		keys_set_next_expire(ki, MIN(ki->next_expire, expire));
 	}
 
 	kd->values++;
@@ -1192,18 +1270,10 @@ keys_update_load(void *val, void *u)
 	keyinfo_check(ki);
 
 	/*
-	 * Check for expired values.
-	 */
-
-	if (ctx->now >= ki->next_expire) {
-		if (!keys_expire_values(ki, ctx->now))
-			return TRUE;		/* ki was freed, delete entry */
-	}
-
-	/*
-	 * Collection of empty keys happens in a separate check because we also
-	 * call keys_expire_values() when we get a STORE request, so we can
-	 * have empty keys already when we reach this place.
+	 * Expiration of values is handled by keys_periodic_expire(), which only
+	 * looks at the keys that are due.  However keys_expire_values() is
+	 * also called when we get a STORE request, so we can have empty keys
+	 * already when we reach this place, and they are collected here.
 	 */
 
 	if (0 == ki->values) {
@@ -1451,7 +1521,7 @@ reload_ki(void *key, void *value, size_t u_len, void *data)
 		}
 	}
 
-	ki->next_expire = next_expire;
+	keys_set_next_expire(ki, next_expire);
 
 	return FALSE;		/* Keep keydata */
 }
@@ -1589,6 +1659,76 @@ keys_init_keyinfo(void)
 	gnet_stats_set_general(GNR_DHT_KEYS_HELD, hikset_count(keys));
 }
 
+/**
+ * Periodic expiration of values held under the keys that are due.
+ *
+ * Keys are processed in increasing expiration order, within a bounded
+ * slice: the ones we could not process remain at the head of the tree and
+ * will be handled at the next period.
+ */
+static bool
+keys_periodic_expire(void *unused_obj)
+{
+	struct keyinfo *due[KEYS_EXPIRE_SLICE];
+	struct keyinfo *ki;
+	rbnode_t *rn;
+	size_t i, n = 0;
+	time_t now = tm_time();
+	tm_t start;
+
+	(void) unused_obj;
+
+	/*
+	 * Collect the due keys first: expiring values will reposition the keys
+	 * in the tree, possibly back at its head if they still cannot be
+	 * expired, and we must not process them twice.
+	 */
+
+	for (
+		rn = erbtree_first(&keys_by_expire);
+		rn != NULL && n < G_N_ELEMENTS(due);
+		rn = erbtree_next(rn)
+	) {
+		ki = erbtree_data(&keys_by_expire, rn);
+		if (delta_time(now, ki->next_expire) < 0)
+			break;
+		due[n++] = ki;
+	}
+
+	if (0 == n)
+		return TRUE;		/* Keep calling */
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < n; i++) {
+		tm_t end;
+
+		ki = due[i];
+		keyinfo_check(ki);
+
+		/*
+		 * Keys left with no values are reclaimed by the periodic load
+		 * computation, not here.  A corrupted key can be reclaimed by
+		 * keys_expire_values(), but only the key being processed.
+		 */
+
+		(void) keys_expire_values(ki, now);
+
+		tm_now_exact(&end);
+		if (tm_elapsed_ms(&end, &start) >= KEYS_EXPIRE_MS) {
+			i++;
+			break;
+		}
+	}
+
+	values_slice_stall(&start, "key expire", i);
+
+	if (i < n)
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_TRUNCATED);
+
+	return TRUE;		/* Keep calling */
+}
+
 /**
  * Periodic DB synchronization.
  */
@@ -1615,11 +1755,16 @@ keys_init(void)
 		{ serialize_keydata, deserialize_keydata, NULL };
 
 	g_assert(NULL == keys_periodic_ev);
+	g_assert(NULL == keys_expire_ev);
 	g_assert(NULL == keys);
 	g_assert(NULL == db_keydata);
 
 	keys_periodic_ev = cq_periodic_main_add(LOAD_PERIOD * 1000,
 		keys_periodic_load, NULL);
+	keys_expire_ev = cq_periodic_main_add(KEYS_EXPIRE_PERIOD,
+		keys_periodic_expire, NULL);
+	erbtree_init(&keys_by_expire, keys_expire_cmp,
+		offsetof(struct keyinfo, expire_node));
 
 	keys = hikset_create(
 		offsetof(struct keyinfo, kuid), HASH_KEY_FIXED, KUID_RAW_SIZE);
@@ -1802,6 +1947,7 @@ keys_close(void)
 	if (keys) {
 		hikset_foreach(keys, keys_free_kv, NULL);
 		hikset_free_null(&keys);
+		erbtree_clear(&keys_by_expire);
 	}
 
 	kuid_atom_free_null(&kball.furthest);
@@ -1812,6 +1958,7 @@ keys_close(void)
 
 	cq_cancel(&kball_ev);
 	cq_periodic_remove(&keys_periodic_ev);
+	cq_periodic_remove(&keys_expire_ev);
 	cq_periodic_remove(&keys_sync_ev);
 }
 
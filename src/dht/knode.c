@@ -46,13 +46,45 @@
 #include "core/hostiles.h"
 
 #include "lib/atoms.h"
+#include "lib/once.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/vendors.h"
-#include "lib/walloc.h"
+#include "lib/zalloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
+#define KNODE_ZONE_HINT	1024	/**< Amount of nodes per zone chunk */
+
+/**
+ * Kademlia nodes are allocated from their own zone, which acts as an arena:
+ * the routing table and the lookup shortlists are then made of nodes packed
+ * in a few contiguous chunks instead of being scattered amongst all the
+ * other objects of the same size handed out by walloc().
+ */
+static zone_t *knode_zone;
+static once_flag_t knode_zone_inited;
+
+/**
+ * Create the Kademlia node zone.
+ */
+static void
+knode_zone_init_once(void)
+{
+	knode_zone = zcreate(sizeof(knode_t), KNODE_ZONE_HINT, FALSE);
+}
+
+/**
+ * Allocate a new Kademlia node structure.
+ */
+static inline knode_t *
+knode_alloc(void)
+{
+	ONCE_FLAG_RUN(knode_zone_inited, knode_zone_init_once);
+
+	return zalloc(knode_zone);
+}
+
 /**
  * Hashing of knodes,
  */
@@ -159,7 +191,8 @@ knode_new(
 {
 	knode_t *kn;
 
-	WALLOC0(kn);
+	kn = knode_alloc();
+	ZERO(kn);
 	kn->magic = KNODE_MAGIC;
 	kn->id = kuid_get_atom(id);
 	kn->vcode = vcode;
@@ -190,7 +223,7 @@ knode_clone(const knode_t *kn)
 {
 	knode_t *cn;
 
-	WALLOC(cn);
+	cn = knode_alloc();
 	*cn = *kn;						/* Struct copy */
 	cn->status = KNODE_UNKNOWN;		/* This instance is not in routing table */
 	cn->refcnt = 1;					/* New instance */
@@ -411,7 +444,7 @@ knode_dispose(knode_t *kn)
 
 	kuid_atom_free_null(&kn->id);
 	kn->magic = 0;
-	WFREE(kn);
+	zfree(knode_zone, kn);
 }
 
 /**
@@ -504,4 +537,16 @@ knode_still_alive_probability(const knode_t *kn)
 	}
 }
 
+/**
+ * Destroy the Kademlia node zone, at final shutdown.
+ */
+void
+knode_close(void)
+{
+	if (knode_zone != NULL) {
+		zdestroy(knode_zone);
+		knode_zone = NULL;
+	}
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -55,6 +55,7 @@ bool knode_can_recontact(const knode_t *kn);
 bool knode_is_usable(const knode_t *kn);
 bool knode_addr_is_usable(const knode_t *kn);
 double knode_still_alive_probability(const knode_t *kn);
+void knode_close(void);
 
 #endif /* _dht_knode_h_ */
 
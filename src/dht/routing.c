@@ -107,6 +107,7 @@
 #include "lib/tokenizer.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
+#include "lib/xsort.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -4413,16 +4414,85 @@ dht_size(void)
 }
 
 /**
- * GList sort callback.
+ * A candidate node for inclusion in the closest nodes vector, along with
+ * its XOR distance to the target, computed once before sorting.
+ */
+struct kclosest {
+	kuid_t dist;				/**< Distance to the target KUID */
+	knode_t *kn;				/**< The candidate node */
+};
+
+/**
+ * Context for fill_closest_collect().
+ */
+struct kclosest_ctx {
+	struct kclosest *vec;		/**< Candidate vector */
+	size_t count;				/**< Amount of candidates in vector */
+	size_t size;				/**< Capacity of vector */
+	const kuid_t *id;			/**< Target KUID */
+	const kuid_t *exclude;		/**< KUID to exclude (NULL if none) */
+	time_t now;					/**< Current time */
+	bool alive;					/**< Only want known-to-be-alive nodes */
+};
+
+/**
+ * Sort callback for closest node candidates, by increasing distance.
  */
 static int
-distance_to(const void *a, const void *b, void *user_data)
+kclosest_cmp(const void *a, const void *b)
+{
+	const struct kclosest *ka = a;
+	const struct kclosest *kb = b;
+
+	return kuid_cmp(&ka->dist, &kb->dist);
+}
+
+/**
+ * Hash list iterator to collect the nodes from a bucket list that can be
+ * candidates for the closest nodes vector.
+ */
+static void
+fill_closest_collect(void *data, void *udata)
 {
-	const knode_t *ka = a;
-	const knode_t *kb = b;
-	const kuid_t *id = user_data;
+	knode_t *kn = data;
+	struct kclosest_ctx *ctx = udata;
+	struct kclosest *kc;
+
+	knode_check(kn);
+
+	if (ctx->exclude != NULL && kuid_eq(kn->id, ctx->exclude))
+		return;
+
+	switch (kn->status) {
+	case KNODE_GOOD:
+		if (ctx->alive && !(kn->flags & KNODE_F_ALIVE))
+			return;
+		break;
+	case KNODE_STALE:
+		g_assert(!ctx->alive);
+		if (knode_still_alive_probability(kn) < ALIVE_PROBA_LOW_THRESH)
+			return;
+		break;
+	case KNODE_PENDING:
+		if (kn->flags & KNODE_F_SHUTDOWNING)
+			return;
+		if (
+			ctx->alive && (
+				!(kn->flags & KNODE_F_ALIVE) ||
+				delta_time(ctx->now, kn->last_seen) >= alive_period()
+			)
+		)
+			return;
+		break;
+	case KNODE_UNKNOWN:
+		g_assert_not_reached();
+	}
+
+	g_assert(ctx->count < ctx->size);
 
-	return kuid_cmp3(id, ka->id, kb->id);
+	kc = &ctx->vec[ctx->count++];
+	kc->kn = kn;
+	kuid_xor_distance(&kc->dist, kn->id, ctx->id);
 }
 
 /**
@@ -4430,6 +4500,13 @@ distance_to(const void *a, const void *b, void *user_data)
  * nodes from the current bucket, inserting them by increasing distance
  * to the supplied ID.
  *
+ * This routine is at the heart of dht_fill_closest(), which is called
+ * for every lookup and every incoming FIND_NODE or FIND_VALUE: candidates
+ * are therefore collected in a vector along with their distance to the
+ * target, so that no memory allocation is required and distances are
+ * computed only once, regardless of the amount of comparisons made by the
+ * sorting algorithm.
+ *
  * @param id		the KUID for which we're finding the closest neighbours
  * @param kb		the bucket used
  * @param kvec		base of the "knode_t *" vector
@@ -4444,14 +4521,26 @@ fill_closest_in_bucket(
 	const kuid_t *id, struct kbucket *kb,
 	knode_t **kvec, int kcnt, const kuid_t *exclude, bool alive)
 {
-	plist_t *nodes = NULL, *good, *l;
-	int added;
-	int available = 0;
+	struct kclosest vec[K_BUCKET_GOOD + K_BUCKET_STALE + K_BUCKET_PENDING];
+	struct kclosest_ctx ctx;
+	size_t i, max;
 
 	g_assert(id);
 	g_assert(is_leaf(kb));
 	g_assert(kvec);
 
+	max = hash_list_length(kb->nodes->good) +
+		hash_list_length(kb->nodes->stale) +
+		hash_list_length(kb->nodes->pending);
+
+	ctx.vec = max <= G_N_ELEMENTS(vec) ? vec : walloc(max * sizeof vec[0]);
+	ctx.size = MAX(max, G_N_ELEMENTS(vec));
+	ctx.count = 0;
+	ctx.id = id;
+	ctx.exclude = exclude;
+	ctx.now = tm_time();
+	ctx.alive = alive;
+
 	/*
 	 * If we can determine that we do not have enough good nodes in the bucket
 	 * to fill the vector, consider "stale" nodes and then "pending" nodes
@@ -4459,24 +4548,7 @@ fill_closest_in_bucket(
 	 * recently (defined by the aliveness period).
 	 */
 
-	good = hash_list_list(kb->nodes->good);
-
-	while (good != NULL) {
-		knode_t *kn = good->data;
-
-		knode_check(kn);
-		g_assert(KNODE_GOOD == kn->status);
-
-		if (
-			(!exclude || !kuid_eq(kn->id, exclude)) &&
-			(!alive || (kn->flags & KNODE_F_ALIVE))
-		) {
-			nodes = plist_prepend(nodes, kn);
-			available++;
-		}
-
-		good = plist_remove(good, kn);
-	}
+	hash_list_foreach(kb->nodes->good, fill_closest_collect, &ctx);
 
 	/*
 	 * Only stale nodes that are still somewhat likely to be alive are
@@ -4489,75 +4561,33 @@ fill_closest_in_bucket(
 	 * without having to ping them explicitly.
 	 */
 
-	if (!alive) {
-		plist_t *stale = hash_list_list(kb->nodes->stale);
-
-		while (stale != NULL) {
-			knode_t *kn = stale->data;
-
-			knode_check(kn);
-			g_assert(KNODE_STALE == kn->status);
-
-			if (
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
-				knode_still_alive_probability(kn) >= ALIVE_PROBA_LOW_THRESH
-			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
-			}
-
-			stale = plist_remove(stale, kn);
-		}
-	}
+	if (!alive)
+		hash_list_foreach(kb->nodes->stale, fill_closest_collect, &ctx);
 
 	/*
 	 * Pending nodes come last, if we miss nodes.
 	 */
 
-	if (available < kcnt) {
-		plist_t *pending = hash_list_list(kb->nodes->pending);
-		time_t now = tm_time();
-
-		while (pending != NULL) {
-			knode_t *kn = pending->data;
-
-			knode_check(kn);
-			g_assert(KNODE_PENDING == kn->status);
-
-			if (
-				!(kn->flags & KNODE_F_SHUTDOWNING) &&
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
-				(!alive ||
-					(
-						(kn->flags & KNODE_F_ALIVE) &&
-						delta_time(now, kn->last_seen) < alive_period()
-					)
-				)
-			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
-			}
-
-			pending = plist_remove(pending, kn);
-		}
-	}
+	if (ctx.count < UNSIGNED(kcnt))
+		hash_list_foreach(kb->nodes->pending, fill_closest_collect, &ctx);
 
 	/*
 	 * Sort the candidates by increasing distance to the target KUID and
 	 * insert them in the vector.
 	 */
 
-	nodes = plist_sort_with_data(nodes, distance_to, deconstify_pointer(id));
+	xqsort(ctx.vec, ctx.count, sizeof ctx.vec[0], kclosest_cmp);
 
-	for (added = 0, l = nodes; l && kcnt; l = plist_next(l)) {
-		*kvec++ = l->data;
-		kcnt--;
-		added++;
+	max = MIN(ctx.count, UNSIGNED(kcnt));
+
+	for (i = 0; i < max; i++) {
+		kvec[i] = ctx.vec[i].kn;
 	}
 
-	plist_free(nodes);
+	if (ctx.vec != vec)
+		wfree(ctx.vec, ctx.size * sizeof vec[0]);
 
-	return added;
+	return max;
 }
 
 /**
@@ -4897,11 +4927,15 @@ dht_close(bool exiting)
 	size_t i;
 
 	/*
-	 * If the DHT was never initialized, there's nothing to close.
+	 * If the DHT was never initialized, or was already closed, there's
+	 * nothing to close but the node zone, when exiting.
 	 */
 
-	if (NULL == root)
+	if (NULL == root) {
+		if (exiting)
+			knode_close();
 		return;
+	}
 
 	dht_route_store();
 
@@ -4938,6 +4972,9 @@ dht_close(bool exiting)
 
 	ZERO(&stats);			/* Clear all stats */
 	gnet_prop_set_guint32_val(PROP_DHT_BOOT_STATUS, DHT_BOOT_NONE);
+
+	if (exiting)
+		knode_close();		/* All the nodes are now gone */
 }
 
 /***
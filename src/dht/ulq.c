@@ -47,6 +47,13 @@
  * by the user: the larger the hints, the more concurrency will take place
  * and the faster the results will come back, at the expense on bandwidth.
  *
+ * When the queues hold a large backlog, lookups for targets lying in the
+ * same region of the KUID space as an already running lookup are deferred
+ * until that lookup completes.  By then, the k-closest nodes it found have
+ * been recorded in the roots cache and will seed the shortlist of the
+ * deferred lookups, which are then able to converge almost immediately
+ * instead of each redoing the whole node discovery from the routing table.
+ *
  * @author Raphael Manfredi
  * @date 2008
  */
@@ -56,6 +63,7 @@
 #include "ulq.h"
 #include "kuid.h"
 #include "lookup.h"
+#include "routing.h"		/* For dht_get_kball_furthest() */
 
 #include "if/gnet_property_priv.h"
 #include "if/dht/kademlia.h"
@@ -66,6 +74,7 @@
 #include "lib/atoms.h"
 #include "lib/cq.h"
 #include "lib/fifo.h"
+#include "lib/pslist.h"
 #include "lib/slist.h"
 #include "lib/str.h"
 #include "lib/walloc.h"
@@ -75,6 +84,7 @@
 #define ULQ_MAX_RUNNING		3		/**< Initial amount of concurrent reqs */
 #define ULQ_UDP_DELAY		5000	/**< Delay in ms if UDP flow-controlled */
 #define ULQ_EMA_SHIFT		7		/**< Shifting during EMA computation */
+#define ULQ_REGION_BACKLOG	16		/**< Min backlog for region batching */
 
 #define vema(x)	((x) >> ULQ_EMA_SHIFT)
 
@@ -89,6 +99,7 @@ struct ulq {
 	enum ulq_magic magic;
 	const char *name;				/**< Queue name */
 	fifo_t *q;						/**< Queue is a FIFO */
+	slist_t *resumed;				/**< Deferred lookups now runnable */
 	slist_t *launched;				/**< Launched lookups */
 	int running;					/**< Amount of launched lookups */
 	int weight;						/**< Scheduling weight */
@@ -120,6 +131,8 @@ struct ulq_item {
 	lookup_cb_start_t start;		/**< Optional starting callback */
 	lookup_cb_err_t err;			/**< Error callback */
 	void *arg;						/**< Common callback opaque argument */
+	pslist_t *deferred;				/**< Lookups waiting for our completion */
+	unsigned was_deferred:1;		/**< Already deferred once */
 };
 
 /**
@@ -147,6 +160,7 @@ static struct ulq_sched {
 	slist_t *runq;					/**< Runnable queues */
 	int running;					/**< Total running lookups */
 	int pending;					/**< Total pending lookups */
+	int deferred;					/**< Total lookups deferred on a region */
 	int bw_in_ema;					/**< Slow EMA of incoming b/w per lookup */
 	int bw_out_ema;					/**< Slow EMA of outgoing b/w per lookup */
 	int sz_in_ema;					/**< Slow EMA of incoming message size */
@@ -188,6 +202,8 @@ allocate_ulq_item(lookup_type_t type, const kuid_t *kuid,
 	ui->start = start;
 	ui->err = err;
 	ui->arg = arg;
+	ui->deferred = NULL;
+	ui->was_deferred = FALSE;
 
 	return ui;
 }
@@ -199,6 +215,7 @@ static void
 free_ulq_item(struct ulq_item *ui)
 {
 	ulq_item_check(ui);
+	g_assert(NULL == ui->deferred);
 
 	kuid_atom_free(ui->kuid);
 	ui->kuid = NULL;
@@ -206,6 +223,15 @@ free_ulq_item(struct ulq_item *ui)
 	WFREE(ui);
 }
 
+/**
+ * @return amount of lookups that can be launched from the queue.
+ */
+static inline uint
+ulq_count(const struct ulq *uq)
+{
+	return fifo_count(uq->q) + slist_length(uq->resumed);
+}
+
 /**
  * Add queue to the run queue.
  */
@@ -233,11 +259,105 @@ ulq_sched_reset(void)
 		g_assert(!uq->runnable);
 
 		uq->scheduled = 0;
-		if (fifo_count(uq->q) > 0)
+		if (ulq_count(uq) > 0)
 			ulq_sched_add(uq);
 	}
 }
 
+/**
+ * Make a lookup that was deferred on a KUID region runnable again.
+ */
+static void
+ulq_resume(void *data)
+{
+	struct ulq_item *ui = data;
+	struct ulq *uq;
+
+	ulq_item_check(ui);
+	g_assert(ui->was_deferred);
+	g_assert(sched.deferred > 0);
+
+	uq = ui->uq;
+	ulq_check(uq);
+
+	slist_append(uq->resumed, ui);
+	sched.deferred--;
+	sched.pending++;
+
+	if (!uq->runnable && uq->scheduled < uq->weight)
+		ulq_sched_add(uq);
+}
+
+/**
+ * Look for a running lookup whose target is in the same KUID region as
+ * the one targeted by the lookup item, and defer the item until that
+ * running lookup completes.
+ *
+ * Two targets sharing at least as many leading bits as our k-ball furthest
+ * frontier are likely to have most of their k-closest nodes in common.
+ * Hence, waiting for the running lookup to complete will let us seed the
+ * item's shortlist with the roots it found, saving most of the node
+ * discovery RPCs.
+ *
+ * This is only attempted when we have a large backlog of lookups, since
+ * then items are going to wait anyway, and each item is only deferred once.
+ *
+ * @return TRUE if the item was deferred.
+ */
+static bool
+ulq_region_defer(struct ulq_item *ui)
+{
+	size_t i, bits;
+
+	ulq_item_check(ui);
+
+	if (ui->was_deferred || sched.pending < ULQ_REGION_BACKLOG)
+		return FALSE;
+
+	bits = dht_get_kball_furthest();
+
+	if (0 == bits)
+		return FALSE;		/* DHT size unknown, regions meaningless */
+
+	for (i = 0; i < G_N_ELEMENTS(ulq); i++) {
+		struct ulq *uq = ulq[i];
+		slist_iter_t *iter;
+		struct ulq_item *leader = NULL;
+
+		iter = slist_iter_before_head(uq->launched);
+		while (slist_iter_has_next(iter)) {
+			struct ulq_item *li = slist_iter_next(iter);
+
+			ulq_item_check(li);
+
+			if (kuid_common_prefix(li->kuid, ui->kuid) >= bits) {
+				leader = li;
+				break;
+			}
+		}
+		slist_iter_free(&iter);
+
+		if (leader != NULL) {
+			leader->deferred = pslist_prepend(leader->deferred, ui);
+			ui->was_deferred = TRUE;
+			sched.deferred++;
+			gnet_stats_inc_general(GNR_DHT_ULQ_REGION_DEFERRED_LOOKUPS);
+
+			if (GNET_PROPERTY(dht_ulq_debug) > 1) {
+				g_debug("DHT ULQ %s deferring lookup for %s "
+					"until %s lookup for %s completes (%zu common bits)",
+					ui->uq->name, kuid_to_hex_string(ui->kuid),
+					leader->uq->name, kuid_to_hex_string2(leader->kuid),
+					kuid_common_prefix(leader->kuid, ui->kuid));
+			}
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 /**
  * Lookup is completed.
  */
@@ -256,6 +376,21 @@ ulq_completed(struct ulq_item *ui)
 	uq->running--;
 	sched.running--;
 	slist_remove(uq->launched, ui);
+
+	/*
+	 * Lookups that were deferred because they target the same KUID region
+	 * can now be launched: the roots cache was updated with the k-closest
+	 * nodes we found and will seed their initial shortlist.
+	 */
+
+	if (ui->deferred != NULL) {
+		pslist_t *deferred = ui->deferred;
+
+		ui->deferred = NULL;
+		PSLIST_FOREACH_CALL(deferred, ulq_resume);
+		pslist_free(deferred);
+	}
+
 	free_ulq_item(ui);
 
 	ulq_needs_servicing();		/* Check for more work to do */
@@ -386,7 +521,12 @@ ulq_queue_status(void)
 
 		offset += str_bprintf(&buf[offset], sizeof(buf) - offset,
 			"%s%s: %u/%u", offset > 0 ? ", " : "",
-			uq->name, uq->running, fifo_count(uq->q));
+			uq->name, uq->running, ulq_count(uq));
+	}
+
+	if (sched.deferred != 0) {
+		str_bprintf(&buf[offset], sizeof(buf) - offset,
+			", deferred: %d", sched.deferred);
 	}
 
 	return buf;
@@ -404,14 +544,24 @@ ulq_launch(struct ulq *uq)
 	struct ulq_item *ui;
 
 	ulq_check(uq);
-	g_assert(fifo_count(uq->q));
+	g_assert(ulq_count(uq));
 	g_assert(sched.pending > 0);
 
-	ui = fifo_remove(uq->q);
+	/*
+	 * Lookups resumed after having been deferred have precedence: they
+	 * were already picked from the FIFO in a previous round.
+	 */
+
+	ui = slist_shift(uq->resumed);
+	if (NULL == ui)
+		ui = fifo_remove(uq->q);
 	sched.pending--;
 
 	ulq_item_check(ui);
 
+	if (ulq_region_defer(ui))
+		return FALSE;
+
 	/*
 	 * If there is a "starting" callback, make sure it returns TRUE
 	 * before launching the request.
@@ -583,7 +733,7 @@ ulq_service(void)
 
 		launched = ulq_launch(uq);
 
-		if (fifo_count(uq->q) > 0 && uq->scheduled < uq->weight)
+		if (ulq_count(uq) > 0 && uq->scheduled < uq->weight)
 			slist_append(sched.runq, uq);
 		else
 			uq->runnable = FALSE;
@@ -836,6 +986,7 @@ ulq_init_queue(const char *name, int weight)
 	uq->magic = ULQ_MAGIC;
 	uq->name = name;
 	uq->q = fifo_make();
+	uq->resumed = slist_new();
 	uq->launched = slist_new();
 	uq->running = 0;
 	uq->weight = weight;
@@ -909,6 +1060,23 @@ free_fifo_item(void *item, void *data)
 	free_ulq_item(ui);
 }
 
+/**
+ * Release lookups deferred on a launched lookup item.
+ */
+static void
+free_deferred_items(void *item, void *data)
+{
+	struct ulq_item *ui = item;
+	pslist_t *deferred;
+
+	ulq_item_check(ui);
+
+	deferred = ui->deferred;
+	ui->deferred = NULL;
+	PSLIST_FOREACH_CALL_DATA(deferred, free_fifo_item, data);
+	pslist_free(deferred);
+}
+
 /**
  * Shutdown the user lookup queue.
  *
@@ -932,13 +1100,17 @@ ulq_close(bool exiting)
 			 * duly cancelled by lookup_close(): tell free_fifo_item() that
 			 * we are exiting.
 			 *
-			 * Enqueued lookups on the other hand (still in the FIFO) need
-			 * to be properly cleaned-up by forcing the registered error
-			 * callback, since there is no lookup object yet.
+			 * Enqueued lookups on the other hand (still in the FIFO, or
+			 * deferred on a launched lookup) need to be properly cleaned-up
+			 * by forcing the registered error callback, since there is no
+			 * lookup object yet.
 			 */
 
+			slist_foreach(uq->launched, free_deferred_items, &exiting);
 			slist_foreach(uq->launched, free_fifo_item, &one);
 			slist_free(&uq->launched);
+			slist_foreach(uq->resumed, free_fifo_item, &exiting);
+			slist_free(&uq->resumed);
 			fifo_free_all(uq->q, free_fifo_item, &exiting);
 			WFREE(uq);
 
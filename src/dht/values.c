@@ -122,6 +122,9 @@
 
 #define MAX_VALUES		262144	/**< Max # of values we accept to manage */
 #define EXPIRE_PERIOD	30		/**< Asynchronous expire period: 30 secs */
+#define EXPIRE_BACKLOG	1000	/**< Delay (ms) between slices on backlog */
+#define EXPIRE_SLICE_MAX	256	/**< Max amount of values reclaimed per slice */
+#define EXPIRE_SLICE_MS		20	/**< Time budget (ms) for a reclaim slice */
 
 #define VALUES_DB_CACHE_SIZE 1024	/**< Amount of values to keep cached */
 #define RAW_DB_CACHE_SIZE	 512	/**< Amount of raw data to keep cached */
@@ -218,6 +221,7 @@ static char db_expbase[] = "dht_expired";
 static char db_expwhat[] = "DHT expired values";
 
 static cperiodic_t *values_expire_ev;	/**< Value expire periodic event */
+static cevent_t *values_backlog_ev;		/**< Pending expire backlog event */
 
 /**
  * @return amount of values managed.
@@ -992,31 +996,162 @@ delete_valuedata(uint64 dbkey, bool has_expired)
 }
 
 /**
- * Hash table iterator callback to reclaim an expired DB key.
+ * Account for the time spent in an expiry slice started at `start'.
+ *
+ * Slices are sorted in a coarse logarithmic histogram of their duration,
+ * kept as general statistics so that stalls can be monitored at runtime.
+ *
+ * @param start		time at which the slice started
+ * @param what		what the slice was about, for logging
+ * @param count		amount of items processed during the slice
  */
-static bool
-reclaim_dbkey(const void *key, void *u_data)
+void
+values_slice_stall(const tm_t *start, const char *what, size_t count)
 {
-	const uint64 *dbatom = key;
+	tm_t end;
+	time_delta_t ms;
+
+	tm_now_exact(&end);
+	ms = tm_elapsed_ms(&end, start);
+
+	if (ms < 1)
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_UNDER_1MS);
+	else if (ms < 10)
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_UNDER_10MS);
+	else if (ms < 100)
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_UNDER_100MS);
+	else
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_OVER_100MS);
 
-	(void) u_data;
+	if (GNET_PROPERTY(dht_storage_debug) > 1 || ms >= 100) {
+		if (count != 0 || GNET_PROPERTY(dht_storage_debug) > 4) {
+			g_debug("DHT STORE %s slice processed %zu item%s in %ld ms",
+				what, count, plural(count), (long) ms);
+		}
+	}
+}
 
+/**
+ * Context for reclaim_dbkey().
+ */
+struct reclaim_ctx {
+	tm_t start;				/**< Start of slice */
+	size_t count;			/**< Amount of values reclaimed */
+	bool truncated;			/**< Whether we stopped on budget */
+};
+
+/**
+ * Physically delete an expired value from the database.
+ */
+static void
+reclaim_value(const uint64 *dbatom)
+{
 	delete_valuedata(*dbatom, TRUE);
 
 	if (GNET_PROPERTY(dht_storage_debug) > 2)
 		g_debug("DHT value DB-key %s reclaimed", uint64_to_string(*dbatom));
 
 	atom_uint64_free(dbatom);
+}
+
+/**
+ * Hash table iterator callback to reclaim an expired DB key.
+ *
+ * Stops reclaiming once the slice budget (amount and time) is exhausted,
+ * leaving the remaining keys for the next slice.
+ */
+static bool
+reclaim_dbkey(const void *key, void *data)
+{
+	struct reclaim_ctx *ctx = data;
+
+	if (ctx->truncated)
+		return FALSE;
+
+	if (ctx->count >= EXPIRE_SLICE_MAX) {
+		ctx->truncated = TRUE;
+		return FALSE;
+	}
+
+	/*
+	 * Reading the clock is not free, so only check the time budget
+	 * every 16 items.
+	 */
+
+	if (0 != ctx->count && 0 == (ctx->count & 0xf)) {
+		tm_t now;
+
+		tm_now_exact(&now);
+		if (tm_elapsed_ms(&now, &ctx->start) >= EXPIRE_SLICE_MS) {
+			ctx->truncated = TRUE;
+			return FALSE;
+		}
+	}
+
+	reclaim_value(key);
+	ctx->count++;
+
 	return TRUE;
 }
 
 /**
- * Reclaim all expired entries from the database.
+ * Reclaim expired entries from the database, within a bounded slice.
+ *
+ * @return TRUE if there are still expired entries left to reclaim.
  */
-void
+bool
 values_reclaim_expired(void)
 {
-	hset_foreach_remove(expired, reclaim_dbkey, NULL);
+	struct reclaim_ctx ctx;
+
+	if (0 == hset_count(expired))
+		return FALSE;
+
+	ZERO(&ctx);
+	tm_now_exact(&ctx.start);
+
+	hset_foreach_remove(expired, reclaim_dbkey, &ctx);
+	values_slice_stall(&ctx.start, "value reclaim", ctx.count);
+
+	if (ctx.truncated)
+		gnet_stats_inc_general(GNR_DHT_EXPIRY_SLICES_TRUNCATED);
+
+	return ctx.truncated;
+}
+
+/**
+ * Reclaim value if it was recorded as being expired.
+ *
+ * This allows a key to get rid of its own expired values without having
+ * to flush the whole set of expired values.
+ *
+ * @param dbkey		the 64-bit DB key of the value
+ */
+void
+values_reclaim(uint64 dbkey)
+{
+	const void *key;
+
+	if (hset_contains_extended(expired, &dbkey, &key)) {
+		hset_remove(expired, &dbkey);
+		reclaim_value(key);
+	}
+}
+
+/**
+ * Callout queue callback to process the backlog of expired values.
+ */
+static void
+values_expire_backlog(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
+
+	cq_zero(cq, &values_backlog_ev);
+
+	if (values_reclaim_expired()) {
+		values_backlog_ev =
+			cq_main_insert(EXPIRE_BACKLOG, values_expire_backlog, NULL);
+	}
 }
 
 /**
@@ -1027,7 +1162,17 @@ values_periodic_expire(void *unused_obj)
 {
 	(void) unused_obj;
 
-	values_reclaim_expired();
+	/*
+	 * When the slice could not reclaim everything, process the backlog
+	 * more frequently until it is gone, rather than stalling the main
+	 * thread for a long time in one go.
+	 */
+
+	if (NULL == values_backlog_ev && values_reclaim_expired()) {
+		values_backlog_ev =
+			cq_main_insert(EXPIRE_BACKLOG, values_expire_backlog, NULL);
+	}
+
 	return TRUE;		/* Keep calling */
 }
 
@@ -2204,6 +2349,7 @@ values_close(void)
 	acct_net_free_null(&values_per_ip);
 	acct_net_free_null(&values_per_class_c);
 	cq_periodic_remove(&values_expire_ev);
+	cq_cancel(&values_backlog_ev);
 	values_managed = 0;
 
 	gnet_stats_set_general(GNR_DHT_VALUES_HELD, 0);
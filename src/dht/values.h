@@ -39,6 +39,7 @@
 
 #include "lib/bstr.h"
 #include "lib/pmsg.h"
+#include "lib/tm.h"
 
 /*
  * Public interface.
@@ -54,7 +55,9 @@ size_t values_count(void);
 
 uint16 values_store(const knode_t *kn, const dht_value_t *v, bool token);
 dht_value_t *values_get(uint64 dbkey, dht_value_type_t type);
-void values_reclaim_expired(void);
+bool values_reclaim_expired(void);
+void values_reclaim(uint64 dbkey);
+void values_slice_stall(const tm_t *start, const char *what, size_t count);
 bool values_has_expired(uint64 dbkey, time_t now, time_t *expire);
 void values_sync(void);
 
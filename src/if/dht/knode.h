@@ -47,6 +47,10 @@ typedef enum {
 
 /**
  * A Kademlia node.
+ *
+ * Fields are laid out so that the structure is free from internal padding:
+ * a fully populated routing table plus the lookup shortlists can hold tens
+ * of thousands of these.  The node flags all fit in 16 bits.
  */
 typedef struct knode {
 	knode_magic_t magic;
@@ -55,12 +59,12 @@ typedef struct knode {
 	time_t first_seen;			/**< First time we heard about that node */
 	time_t last_seen;			/**< Last seen message from that node */
 	time_t last_sent;			/**< Last sent RPC to that node */
+	host_addr_t addr;			/**< IP of the node */
 	vendor_code_t vcode;		/**< Vendor code (vcode.u32 == 0 if unknown) */
 	uint32 rtt;					/**< Round-trip time in milliseconds */
-	uint32 flags;				/**< Operating flags */
-	host_addr_t addr;			/**< IP of the node */
 	knode_status_t status;		/**< Node status (good, stale, pending) */
 	uint16 port;				/**< Port of the node */
+	uint16 flags;				/**< Operating flags */
 	uint8 rpc_pending;			/**< Amount of pending RPCs (may saturate) */
 	uint8 rpc_timeouts;			/**< Amount of consecutive RPC timeouts */
 	uint8 major;				/**< Major version */
@@ -1,5 +1,5 @@
 /*
- * Generated on Wed Jul  2 13:59:03 2014 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 15:47:08 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -16,7 +16,7 @@
  */
 static const char *stats_symbols[] = {
 	"routing_errors",
-	"routing_table_chunks",
+	"routing_table_generations",
 	"routing_table_capacity",
 	"routing_table_count",
 	"routing_transient_avoided",
@@ -317,6 +317,12 @@ static const char *stats_symbols[] = {
 	"dht_successful_push_proxy_lookups",
 	"dht_successful_node_push_entry_lookups",
 	"dht_seeding_of_orphan",
+	"dht_ulq_region_deferred_lookups",
+	"dht_expiry_slices_under_1ms",
+	"dht_expiry_slices_under_10ms",
+	"dht_expiry_slices_under_100ms",
+	"dht_expiry_slices_over_100ms",
+	"dht_expiry_slices_truncated",
 };
 
 /**
@@ -339,8 +345,8 @@ gnet_stats_general_to_string(gnr_stats_t x)
  */
 static const char *stats_text[] = {
 	N_("Routing errors"),
-	N_("Routing table chunks"),
-	N_("Routing table message capacity"),
+	N_("Routing table generations"),
+	N_("Routing table slot capacity"),
 	N_("Routing table message count"),
 	N_("Routing through transient node avoided"),
 	N_("Duplicates with higher TTL"),
@@ -640,6 +646,12 @@ static const char *stats_text[] = {
 	N_("DHT successful push-proxy lookups"),
 	N_("DHT successful node push-entry lookups"),
 	N_("DHT re-seeding of orphan downloads"),
+	N_("DHT lookups deferred to reuse same-region roots"),
+	N_("DHT expiry slices taking less than 1 ms"),
+	N_("DHT expiry slices taking 1 to 10 ms"),
+	N_("DHT expiry slices taking 10 to 100 ms"),
+	N_("DHT expiry slices taking over 100 ms"),
+	N_("DHT expiry slices interrupted with a backlog"),
 };
 
 /**
@@ -1,5 +1,5 @@
 /*
- * Generated on Wed Jul  2 13:59:03 2014 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 15:47:08 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,11 +8,11 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 302
+ * Enum count: 308
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
-	GNR_ROUTING_TABLE_CHUNKS,
+	GNR_ROUTING_TABLE_GENERATIONS,
 	GNR_ROUTING_TABLE_CAPACITY,
 	GNR_ROUTING_TABLE_COUNT,
 	GNR_ROUTING_TRANSIENT_AVOIDED,
@@ -313,6 +313,12 @@ typedef enum {
 	GNR_DHT_SUCCESSFUL_PUSH_PROXY_LOOKUPS,
 	GNR_DHT_SUCCESSFUL_NODE_PUSH_ENTRY_LOOKUPS,
 	GNR_DHT_SEEDING_OF_ORPHAN,
+	GNR_DHT_ULQ_REGION_DEFERRED_LOOKUPS,
+	GNR_DHT_EXPIRY_SLICES_UNDER_1MS,
+	GNR_DHT_EXPIRY_SLICES_UNDER_10MS,
+	GNR_DHT_EXPIRY_SLICES_UNDER_100MS,
+	GNR_DHT_EXPIRY_SLICES_OVER_100MS,
+	GNR_DHT_EXPIRY_SLICES_TRUNCATED,
 
 	GNR_TYPE_COUNT
 } gnr_stats_t;
@@ -39,9 +39,12 @@
 #include "common.h"
 
 #include "atoms.h"
+#include "atomic.h"
 #include "constants.h"
+#include "elist.h"
 #include "endian.h"
 #include "hashing.h"
+#include "hset.h"
 #include "htable.h"
 #include "log.h"
 #include "misc.h"
@@ -50,6 +53,8 @@
 #include "spinlock.h"
 #include "str.h"
 #include "stringify.h"
+#include "thread.h"
+#include "tm.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -95,9 +100,10 @@ union mem_chunk {
  * What we return to the outside is the value of atom_arena(), not a
  * pointer to the atom structure.
  *
- * The reference count is not held in the atom header but is stored in the
- * hash table tracking atoms of a given type, to limit the memory overhead,
- * and mprotect() overhead when compiling with PROTECT_ATOMS.
+ * The reference count and the atom size are held in the atom header, so
+ * that the hash tables tracking atoms of a given type are mere sets, and
+ * so that the reference count can be updated with atomic operations without
+ * looking the atom up.
  */
 typedef struct atom {
 #ifdef ATOMS_HAVE_MAGIC
@@ -109,6 +115,8 @@ typedef struct atom {
 	spinlock_t lock;			/**< Thread-safety lock */
 	size_t trackcnt;			/**< Tracking count (reference count) */
 #endif	/* TRACK_ATOMS */
+	int refcnt;					/**< Reference count */
+	uint32 size;				/**< Allocated size, including header */
 } atom_t;
 
 #define ARENA_OFFSET \
@@ -116,84 +124,21 @@ typedef struct atom {
 		((sizeof(atom_t) % MEM_ALIGNBYTES) ? 1 : 0)))
 
 /*
- * On 32-bit machines, the size and reference counts of atoms are stored as
- * values in the atom hash table.
- *
- * On 64-bit machines, the size and reference counts are encoded in the
- * pointer field.
- *
- * The atom size is therefore limited to 4 GiB, which is a reasonable upper
- * limit given that each time the atom is requested, we need to hash it.
+ * The atom size is limited to 4 GiB, which is a reasonable upper limit
+ * given that each time the atom is requested, we need to hash it.
  */
 
 #define ATOM_SIZE_MAX	0xffffffffU
 
 /*
- * Atom information on 32-bit machines, stored in the hash table.
- */
-struct atom_info {
-	size_t len;			/**< Atom length */
-	int refcnt;			/**< Reference count */
-};
-
-/*
- * On 64-bit machines:
- *
- * - the size is stored in the upper 32 bits of the atom's hash table
- *   64-bit value
- * - the reference count is held in the lower 32 bits of that value.
- *
- * This allows us to simply increment or decrement the whole value to account
- * for reference changes made to the atom.
- */
-
-#if PTRSIZE > 4
-#define ATOM_LENGTH(x)	((x) >> 32)
-#define ATOM_REFCNT(x)	((x) & ATOM_SIZE_MAX)
-#define ATOM_INFO(l)	((l) << 32)
-#else	/* PTRSIZE <= 4 */
-/*
- * Make sure this unreachable code on 32-bit machines does not trigger
- * compilation warnings, and is indeed unreacheable.
- */
-#define ATOM_LENGTH(x)	(s_error_expr("unused code called"), ATOM_SIZE_MAX)
-#define ATOM_REFCNT(x)	(s_error_expr("unused code called"), 0)
-#define ATOM_INFO(x)	(s_error_expr("unused code called"), 0)
-#endif	/* PTRSIZE > 4 */
-
-/**
- * Return the atom's length from the information stored in the hash table.
+ * When tracking or protecting atoms, all reference count updates are done
+ * under the lock of the table holding the atom: tracking needs to keep its
+ * own count in sync, and protected atoms need to be remapped read-write to
+ * update their header.
  */
-static inline size_t
-atom_info_length(void *p)
-{
-	if (4 == sizeof p) {
-		/* 32-bit machine, value is a pointer to a struct atom_info */
-		struct atom_info *ai = p;
-		return ai->len;
-	} else {
-		/* 64-bit machine, value is encoded */
-		return ATOM_LENGTH(pointer_to_ulong(p));
-	}
-}
-
-/**
- * Return the atom's reference count from the information stored in
- * the hash table.
- */
-static inline int
-atom_info_refcnt(void *p)
-{
-	if (4 == sizeof p) {
-		/* 32-bit machine, value is a pointer to a struct atom_info */
-		struct atom_info *ai = p;
-		return ai->refcnt;
-	} else {
-		/* 64-bit machine, value is encoded */
-		return ATOM_REFCNT(pointer_to_ulong(p));
-	}
-}
-
+#if defined(TRACK_ATOMS) || defined(PROTECT_ATOMS)
+#define ATOMS_LOCKED_REFCNT
+#endif
 
 static inline atom_t *
 atom_from_arena(const void *key)
@@ -520,21 +465,38 @@ atom_dealloc(atom_t *a, size_t size)
 typedef size_t (*len_func_t)(const void *v);
 typedef const char *(*str_func_t)(const void *v);
 
+/*
+ * Atoms of a given type are spread among several independently locked
+ * tables, the shard being selected by the atom's hash value.  This limits
+ * lock contention when several threads create or release atoms at the
+ * same time, for instance during a library rescan.
+ */
+#define ATOM_SHARD_BITS		4
+#define ATOM_SHARDS			(1U << ATOM_SHARD_BITS)
+
+/**
+ * An atom table shard.
+ */
+struct atom_shard {
+	spinlock_t lock;			/**< Lock protecting the hash table */
+	hset_t *table;				/**< Set of atoms held in the shard */
+};
+
 /**
  * Description of atom types.
  */
 typedef struct atom_desc {
-	spinlock_t lock;			/**< Lock protecting the hash table */
 	const char *type;			/**< Type of atoms */
-	htable_t *table;			/**< Table of atoms: "atom value" -> size */
 	hash_fn_t hash_func;		/**< Hashing function for atoms */
 	eq_fn_t eq_func;			/**< Atom equality function */
 	len_func_t len_func;		/**< Atom length function */
 	str_func_t str_func;		/**< Atom to human-readable string */
+	int cache;					/**< Thread-local cache index, -1 if none */
+	struct atom_shard shard[ATOM_SHARDS];	/**< Atom tables */
 } atom_desc_t;
 
-#define ATOM_TABLE_LOCK(t)		spinlock(&(t)->lock)
-#define ATOM_TABLE_UNLOCK(t)	spinunlock(&(t)->lock)
+#define ATOM_SHARD_LOCK(s)		spinlock(&(s)->lock)
+#define ATOM_SHARD_UNLOCK(s)	spinunlock(&(s)->lock)
 
 static size_t str_xlen(const void *v);
 static const char *str_str(const void *v);
@@ -562,23 +524,70 @@ static const char *gnet_host_str(const void *v);
 #define gnh_eq		gnet_host_equal
 #define gnh_len		gnet_host_length
 #define gnh_str		gnet_host_str
-#define S			SPINLOCK_INIT
-#define N			NULL
 
 /**
  * The set of all atom types we know about.
  */
 static atom_desc_t atoms[] = {
-	{ S, "String", N, str_hash,    str_eq,     str_xlen,   str_str  }, /* 0 */
-	{ S, "GUID",   N, guid_hash,   guid_eq,    guid_len,   guid_str }, /* 1 */
-	{ S, "SHA1",   N, sha1_hash,   sha1_eq,	   sha1_len,   sha1_str }, /* 2 */
-	{ S, "TTH",    N, tth_hash,    tth_eq,	   tth_len,    tth_str },  /* 3 */
-	{ S, "uint64", N, uint64_hash, uint64_eq,  uint64_len, uint64_str},/* 4 */
-	{ S, "filesize", N, fs_hash,   fs_eq,      fs_len,     fs_str },   /* 5 */
-	{ S, "uint32", N, uint32_hash, uint32_eq,  uint32_len, uint32_str},/* 6 */
-	{ S, "host",   N, gnh_hash,    gnh_eq,     gnh_len,    gnh_str },  /* 7 */
+	{ "String",   str_hash,    str_eq,    str_xlen,   str_str,    -1 }, /* 0 */
+	{ "GUID",     guid_hash,   guid_eq,   guid_len,   guid_str,    0 }, /* 1 */
+	{ "SHA1",     sha1_hash,   sha1_eq,	  sha1_len,   sha1_str,    1 }, /* 2 */
+	{ "TTH",      tth_hash,    tth_eq,	  tth_len,    tth_str,    -1 }, /* 3 */
+	{ "uint64",   uint64_hash, uint64_eq, uint64_len, uint64_str, -1 }, /* 4 */
+	{ "filesize", fs_hash,     fs_eq,     fs_len,     fs_str,     -1 }, /* 5 */
+	{ "uint32",   uint32_hash, uint32_eq, uint32_len, uint32_str, -1 }, /* 6 */
+	{ "host",     gnh_hash,    gnh_eq,    gnh_len,    gnh_str,    -1 }, /* 7 */
+};
+
+/*
+ * Each thread keeps a small direct-mapped cache of the GUID and SHA1 atoms
+ * it recently resolved, holding a reference on each cached atom.  A hit in
+ * the cache lets atom_get() bump the reference count with an atomic
+ * operation, without locking the table or looking the atom up there.
+ *
+ * Since cached references keep atoms alive, the cache is bounded to
+ * ATOM_CACHE_SIZE atoms per type, and it is flushed when the thread
+ * accesses it after ATOM_CACHE_MAX_AGE seconds.
+ */
+#define ATOM_CACHE_BITS		6
+#define ATOM_CACHE_SIZE		(1U << ATOM_CACHE_BITS)
+#define ATOM_CACHE_MAX_AGE	60		/* seconds */
+
+/**
+ * Atom types having a thread-local cache, indexed by atom_desc_t.cache.
+ */
+static const enum atom_type atom_cache_types[] = {
+	ATOM_GUID,
+	ATOM_SHA1,
 };
 
+/**
+ * A thread-local atom cache.
+ */
+struct atom_cache {
+	const void *slot[G_N_ELEMENTS(atom_cache_types)][ATOM_CACHE_SIZE];
+	spinlock_t lock;			/**< Thread-safe lock, for atoms_close() */
+	time_t stamp;				/**< Last time cache was flushed */
+	link_t lnk;					/**< Links all the thread caches */
+};
+
+#define ATOM_CACHE_LOCK(c)		spinlock_hidden(&(c)->lock)
+#define ATOM_CACHE_UNLOCK(c)	spinunlock_hidden(&(c)->lock)
+
+static once_flag_t atom_cache_key_inited;
+static thread_key_t atom_cache_key = THREAD_KEY_INIT;
+
+/*
+ * All the thread-local caches are linked, so that atoms_close() can flush
+ * them all.  Once atoms_closing is set, the caches are no longer used.
+ */
+static elist_t atom_caches = ELIST_INIT(offsetof(struct atom_cache, lnk));
+static spinlock_t atom_caches_slk = SPINLOCK_INIT;
+static bool atoms_closing;
+
+#define ATOM_CACHES_LOCK		spinlock(&atom_caches_slk)
+#define ATOM_CACHES_UNLOCK		spinunlock(&atom_caches_slk)
+
 #undef str_hash
 #undef str_eq
 #undef fs_hash
@@ -589,8 +598,6 @@ static atom_desc_t atoms[] = {
 #undef gnh_eq
 #undef gnh_len
 #undef gnh_str
-#undef S
-#undef N
 
 /**
  * @return length of string + trailing NUL.
@@ -923,8 +930,14 @@ atoms_init_once(void)
 
 	for (i = 0; i < G_N_ELEMENTS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		uint j;
 
-		ad->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		for (j = 0; j < G_N_ELEMENTS(ad->shard); j++) {
+			struct atom_shard *sh = &ad->shard[j];
+
+			spinlock_init(&sh->lock);
+			sh->table = hset_create_any(ad->hash_func, NULL, ad->eq_func);
+		}
 	}
 
 	/*
@@ -963,6 +976,223 @@ atoms_init(void)
 	once_flag_run(&atoms_inited, atoms_init_once);
 }
 
+/**
+ * @return the shard of the atom table where atoms hashing to ``hv'' are held.
+ */
+static inline struct atom_shard *
+atom_shard_hashed(atom_desc_t *ad, uint hv)
+{
+	return &ad->shard[hashing_fold(hv, ATOM_SHARD_BITS)];
+}
+
+/**
+ * @return the shard of the atom table where atom ``key'' is held.
+ */
+static inline struct atom_shard *
+atom_shard(atom_desc_t *ad, const void *key)
+{
+	return atom_shard_hashed(ad, (*ad->hash_func)(key));
+}
+
+/**
+ * Increment the atom reference count.
+ *
+ * Must be called with the shard holding the atom locked.
+ *
+ * @return new reference count.
+ */
+static inline int
+atom_refcnt_inc(atom_t *a)
+{
+#ifdef PROTECT_ATOMS
+	int refcnt;
+
+	mem_unprotect(a, sizeof *a);
+	refcnt = ++a->refcnt;
+	mem_protect(a, sizeof *a);
+	return refcnt;
+#else
+	return atomic_int_inc(&a->refcnt) + 1;
+#endif
+}
+
+/**
+ * Decrement the atom reference count.
+ *
+ * Must be called with the shard holding the atom locked.
+ *
+ * @return new reference count.
+ */
+static inline int
+atom_refcnt_dec(atom_t *a)
+{
+#ifdef PROTECT_ATOMS
+	int refcnt;
+
+	mem_unprotect(a, sizeof *a);
+	refcnt = --a->refcnt;
+	mem_protect(a, sizeof *a);
+	return refcnt;
+#else
+	return atomic_int_dec(&a->refcnt) - 1;
+#endif
+}
+
+/**
+ * Attempt to release a reference on the atom without locking its shard.
+ *
+ * This can only be done when we are not releasing the last reference,
+ * since the atom must then be removed from its table.  Atoms are only
+ * looked up in their table with the shard locked, so a reference count
+ * above 1 cannot drop to 0 behind our back.
+ *
+ * @return TRUE if the reference was released.
+ */
+static inline bool
+atom_refcnt_release(atom_t *a)
+{
+#ifdef ATOMS_LOCKED_REFCNT
+	(void) a;
+	return FALSE;
+#else
+	if (!atomic_ops_available())
+		return FALSE;
+
+	for (;;) {
+		int refcnt = atomic_int_get(&a->refcnt);
+
+		g_assert(refcnt > 0);
+
+		if (1 == refcnt)
+			return FALSE;
+
+		if (atomic_int_xchg_if_eq(&a->refcnt, refcnt, refcnt - 1))
+			return TRUE;
+	}
+#endif	/* ATOMS_LOCKED_REFCNT */
+}
+
+/**
+ * Release all the atoms held in the thread-local cache, which must be locked.
+ */
+static void
+atom_cache_flush(struct atom_cache *ac)
+{
+	uint i, j;
+
+	ac->stamp = tm_time();
+
+	for (i = 0; i < G_N_ELEMENTS(ac->slot); i++) {
+		for (j = 0; j < G_N_ELEMENTS(ac->slot[0]); j++) {
+			const void *atom = ac->slot[i][j];
+
+			if (atom != NULL) {
+				ac->slot[i][j] = NULL;
+				atom_free(atom_cache_types[i], atom);
+			}
+		}
+	}
+}
+
+#ifndef ATOMS_LOCKED_REFCNT
+/**
+ * Free the thread-local cache when the thread exits.
+ *
+ * Once atoms_close() was called, the cache was already flushed and the
+ * atom tables are gone, hence there is nothing to do.
+ */
+static void
+atom_cache_free(void *p)
+{
+	struct atom_cache *ac = p;
+
+	/*
+	 * The cache is flushed under the global lock, so that atoms_close()
+	 * cannot free the atom tables whilst we are releasing atoms.
+	 */
+
+	ATOM_CACHES_LOCK;
+
+	if G_UNLIKELY(atoms_closing) {
+		ATOM_CACHES_UNLOCK;
+		return;
+	}
+
+	elist_remove(&atom_caches, ac);
+	ATOM_CACHE_LOCK(ac);
+	atom_cache_flush(ac);
+	ATOM_CACHE_UNLOCK(ac);
+	ATOM_CACHES_UNLOCK;
+
+	spinlock_destroy(&ac->lock);
+	xfree(ac);
+}
+
+/**
+ * Create the thread-local cache key, once.
+ */
+static void
+atom_cache_key_init(void)
+{
+	if (-1 == thread_local_key_create(&atom_cache_key, atom_cache_free))
+		s_error("cannot initialize atom cache key: %m");
+}
+#endif	/* !ATOMS_LOCKED_REFCNT */
+
+/**
+ * Get the thread-local cache for atoms of the given type, locked.
+ *
+ * Atoms held in the cache for too long are released before returning it.
+ *
+ * @param ad	the atom type descriptor
+ *
+ * @return the locked cache, NULL if atoms of this type are not cached.
+ */
+static struct atom_cache *
+atom_cache_get(const atom_desc_t *ad)
+{
+#ifdef ATOMS_LOCKED_REFCNT
+	(void) ad;
+	return NULL;
+#else
+	struct atom_cache *ac;
+
+	if (ad->cache < 0 || atoms_closing || !atomic_ops_available())
+		return NULL;
+
+	ONCE_FLAG_RUN(atom_cache_key_inited, atom_cache_key_init);
+
+	ac = thread_local_get(atom_cache_key);
+
+	if G_UNLIKELY(NULL == ac) {
+		XMALLOC0(ac);
+		spinlock_init(&ac->lock);
+		ac->stamp = tm_time();
+		ATOM_CACHES_LOCK;
+		elist_append(&atom_caches, ac);
+		ATOM_CACHES_UNLOCK;
+		thread_local_set(atom_cache_key, ac);
+	}
+
+	ATOM_CACHE_LOCK(ac);
+
+	/*
+	 * If atoms_close() flushed the cache since we checked atoms_closing,
+	 * the cache must no longer be used.
+	 */
+
+	if G_UNLIKELY(atoms_closing) {
+		ATOM_CACHE_UNLOCK(ac);
+		return NULL;
+	}
+
+	if G_UNLIKELY(delta_time(tm_time(), ac->stamp) > ATOM_CACHE_MAX_AGE)
+		atom_cache_flush(ac);
+
+	return ac;
+#endif	/* ATOMS_LOCKED_REFCNT */
+}
+
 /**
  * Check whether atom exists.
  *
@@ -971,12 +1201,20 @@ atoms_init(void)
 bool
 atom_exists(enum atom_type type, const void *key)
 {
+	struct atom_shard *sh;
+	bool found;
+
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_contains(atoms[type].table, key);
+	sh = atom_shard(&atoms[type], key);
+	ATOM_SHARD_LOCK(sh);
+	found = hset_contains(sh->table, key);
+	ATOM_SHARD_UNLOCK(sh);
+
+	return found;
 }
 
 /**
@@ -987,42 +1225,21 @@ atom_exists(enum atom_type type, const void *key)
 bool
 atom_is_atom(enum atom_type type, const void *key)
 {
+	struct atom_shard *sh;
 	const void *atom;
+	bool found;
 
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_lookup_extended(atoms[type].table, key, &atom, NULL)
-		&& key == atom;
-}
+	sh = atom_shard(&atoms[type], key);
+	ATOM_SHARD_LOCK(sh);
+	found = hset_contains_extended(sh->table, key, &atom);
+	ATOM_SHARD_UNLOCK(sh);
 
-/**
- * Increment / decrement the atom reference count.
- *
- * Must be called with the table description locked.
- *
- * @return new reference count.
- */
-static inline size_t
-atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
-{
-	if (4 == sizeof(void *)) {
-		/* 32-bit machine, we can directly update the atom_info structure */
-		struct atom_info *ai = value;
-		ai->refcnt += delta;
-		return ai->refcnt;
-	} else {
-		/* 64-bit machine, we must update the hash table value */
-		ulong v = pointer_to_ulong(value);
-		if (delta > 0)
-			v += delta;
-		else
-			v -= -delta;	/* Necessary since int may be smaller than long */
-		htable_insert(ad->table, key, ulong_to_pointer(v));
-		return ATOM_REFCNT(v);
-	}
+	return found && key == atom;
 }
 
 /**
@@ -1035,10 +1252,13 @@ const void *
 atom_get(enum atom_type type, const void *key)
 {
 	atom_desc_t *ad;
-	const void *orig_key;
-	void *value;
+	struct atom_shard *sh;
+	const void *orig_key, *atom, *evicted = NULL;
+	const void **slot = NULL;
+	struct atom_cache *ac;
 	size_t size;
 	atom_t *a;
+	uint hv;
 
 	STATIC_ASSERT(0 == ARENA_OFFSET % MEM_ALIGNBYTES);
 	STATIC_ASSERT(ARENA_OFFSET >= sizeof(atom_t));
@@ -1050,26 +1270,47 @@ atom_get(enum atom_type type, const void *key)
 		atoms_init();
 
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	hv = (*ad->hash_func)(key);
+	ac = atom_cache_get(ad);
+
+	/*
+	 * The thread-local cache holds a reference on its atoms, hence we can
+	 * safely increment the reference count of a cached atom without locking
+	 * its table.
+	 */
+
+	if (ac != NULL) {
+		slot = &ac->slot[ad->cache][hashing_keep(hv, ATOM_CACHE_BITS)];
+
+		if (*slot != NULL && (*ad->eq_func)(*slot, key)) {
+			atom = *slot;
+			atom_refcnt_inc(atom_from_arena(atom));
+			ATOM_CACHE_UNLOCK(ac);
+			return atom;
+		}
+	}
+
+	sh = atom_shard_hashed(ad, hv);
+	ATOM_SHARD_LOCK(sh);
+
+	if (hset_contains_extended(sh->table, key, &orig_key)) {
+		int refcnt;
 
-	if (htable_lookup_extended(ad->table, key, &orig_key, &value)) {
-		size_t refcnt;
+		a = atom_from_arena(orig_key);
+		atom_check(a);
 
-		size = atom_info_length(value);
 		/* Prevent gcc warning if ARENA_OFFSET == 0 */
-		g_assert(size == ARENA_OFFSET || size > ARENA_OFFSET);
+		g_assert(a->size == ARENA_OFFSET || a->size > ARENA_OFFSET);
 
 		/*
 		 * Atom exists, increment ref count and return it.
 		 */
 
-		g_assert(atom_info_refcnt(value) > 0);
+		g_assert(a->refcnt > 0);
 
-		refcnt = atom_refcnt_add(ad, orig_key, value, +1);
+		refcnt = atom_refcnt_inc(a);
 		ATOM_TRACK_REFCNT(orig_key, +1, refcnt);
-		ATOM_TABLE_UNLOCK(ad);
-
-		return orig_key;
+		atom = orig_key;
 	} else {
 		size_t len;
 
@@ -1082,31 +1323,76 @@ atom_get(enum atom_type type, const void *key)
 		size = round_size_fast(MEM_ALIGNBYTES, ARENA_OFFSET + len);
 
 		a = atom_alloc(size);
+		a->refcnt = 1;
+		a->size = size;
 		memcpy(atom_arena(a), key, len);
 		atom_protect(a, size);
 
-		/*
-		 * Insert atom in table.
-		 *
-		 * On 32-bit machines, we have to allocate the atom_info structure.
-		 * On 64-bit machines, encode size and refcnt in a long.
-		 */
-
-		if (4 == sizeof(void *)) {
-			struct atom_info *ai;
+		atom = atom_arena(a);
+		hset_insert(sh->table, atom);
+	}
 
-			WALLOC(ai);
-			ai->len = size;
-			ai->refcnt = 1;
-			htable_insert(ad->table, atom_arena(a), ai);
-		} else {
-			ulong v = ATOM_INFO(size) + 1;
-			htable_insert(ad->table, atom_arena(a), ulong_to_pointer(v));
-		}
+	/*
+	 * Replace the cached atom, taking a reference for the cache.
+	 */
 
-		ATOM_TABLE_UNLOCK(ad);
-		return atom_arena(a);
+	if (slot != NULL) {
+		atom_refcnt_inc(a);
+		evicted = *slot;
+		*slot = atom;
 	}
+
+	ATOM_SHARD_UNLOCK(sh);
+
+	if (ac != NULL)
+		ATOM_CACHE_UNLOCK(ac);
+
+	/*
+	 * The evicted atom may be held in the same shard, release it after
+	 * unlocking.
+	 */
+
+	if (evicted != NULL)
+		atom_free(type, evicted);
+
+	return atom;
+}
+
+/**
+ * Take a new reference on an existing atom.
+ *
+ * The caller must already own a reference to the atom, which guarantees
+ * that it cannot disappear, hence the reference count is updated without
+ * looking the atom up or locking its table.
+ *
+ * @return the atom.
+ */
+const void *
+atom_ref(enum atom_type type, const void *atom)
+{
+#ifndef ATOMS_LOCKED_REFCNT
+	atom_t *a;
+#endif
+
+	g_assert(atom != NULL);
+	g_assert(UNSIGNED(type) < G_N_ELEMENTS(atoms));
+
+#ifdef ATOMS_LOCKED_REFCNT
+	return atom_get(type, atom);
+#else
+	if (!atomic_ops_available())
+		return atom_get(type, atom);
+
+	a = atom_from_arena(atom);
+	atom_check(a);
+
+	g_assert_log(atomic_int_get(&a->refcnt) > 0,
+		"attempting to reference unknown %s atom at %p",
+		atoms[type].type, atom);
+
+	atomic_int_inc(&a->refcnt);
+	return atom;
+#endif	/* ATOMS_LOCKED_REFCNT */
 }
 
 /**
@@ -1117,20 +1403,31 @@ void
 atom_free(enum atom_type type, const void *key)
 {
 	atom_desc_t *ad;
+	struct atom_shard *sh;
 	size_t size;
 	atom_t *a;
 	bool found;
-	int refcnt;
-	void *value;
 	const void *orig_key;
 
     g_assert(key != NULL);
 	g_assert(UNSIGNED(type) < G_N_ELEMENTS(atoms));
 
+	a = atom_from_arena(key);
+	atom_check(a);
+
+	/*
+	 * Unless we are releasing the last reference, there is no need to
+	 * lock the table.
+	 */
+
+	if (atom_refcnt_release(a))
+		return;
+
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	sh = atom_shard(ad, key);
+	ATOM_SHARD_LOCK(sh);
 
-	found = htable_lookup_extended(ad->table, key, &orig_key, &value);
+	found = hset_contains_extended(sh->table, key, &orig_key);
 
 	g_assert_log(found,
 		"attempting to free unknown %s atom at %p", ad->type, key);
@@ -1138,33 +1435,28 @@ atom_free(enum atom_type type, const void *key)
 		"attempt to free %s atom copy at %p, atom was at %p",
 			ad->type, key, orig_key);
 
-	size = atom_info_length(value);
+	size = a->size;
 
 	/* Prevent gcc warning if ARENA_OFFSET == 0 */
 	g_assert(size == ARENA_OFFSET || size > ARENA_OFFSET);
 
-	a = atom_from_arena(key);
-	refcnt = atom_info_refcnt(value);
-
 	/*
 	 * Dispose of atom when its reference count reaches 0.
+	 *
+	 * Another thread may have grabbed a new reference since we last looked
+	 * at the reference count, so we can only know now whether we are
+	 * releasing the last one.
 	 */
 
-	if (1 == refcnt) {
-		htable_remove(ad->table, key);
-		if (4 == sizeof(void *)) {
-			/* 32-bit machine */
-			struct atom_info *ai = value;
-			WFREE(ai);
-		}
+	if (0 == atom_refcnt_dec(a)) {
+		hset_remove(sh->table, key);
 		atom_unprotect(a, size);
 		atom_dealloc(a, size);
 	} else {
-		size_t rcnt = atom_refcnt_add(ad, key, value, -1);
-		ATOM_TRACK_REFCNT(key, -1, rcnt);
+		ATOM_TRACK_REFCNT(key, -1, a->refcnt);
 	}
 
-	ATOM_TABLE_UNLOCK(ad);
+	ATOM_SHARD_UNLOCK(sh);
 }
 
 #ifdef TRACK_ATOMS
@@ -1361,13 +1653,13 @@ dump_tracking_table(const void *atom, htable_t *h, char *what)
  * Warning about existing atom that should have been freed.
  */
 static void
-atom_warn_free(const void *key, void *value, void *udata)
+atom_warn_free(const void *key, void *udata)
 {
 	atom_t *a = atom_from_arena(key);
 	atom_desc_t *ad = udata;
 
 	g_warning("found remaining %s atom %p, refcnt=%d: \"%s\"",
-		ad->type, key, atom_info_refcnt(value), (*ad->str_func)(key));
+		ad->type, key, a->refcnt, (*ad->str_func)(key));
 
 #ifdef TRACK_ATOMS
 	spinlock(&a->lock);
@@ -1392,15 +1684,37 @@ atom_warn_free(const void *key, void *value, void *udata)
 void
 atoms_close(void)
 {
+	struct atom_cache *ac;
 	uint i;
 
+	/*
+	 * Flush the caches of all the threads, which will no longer be used
+	 * nor freed once atoms_closing is set.
+	 */
+
+	ATOM_CACHES_LOCK;
+	atoms_closing = TRUE;
+
+	ELIST_FOREACH_DATA(&atom_caches, ac) {
+		ATOM_CACHE_LOCK(ac);
+		atom_cache_flush(ac);
+		ATOM_CACHE_UNLOCK(ac);
+	}
+
+	ATOM_CACHES_UNLOCK;
+
 	for (i = 0; i < G_N_ELEMENTS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		uint j;
+
+		for (j = 0; j < G_N_ELEMENTS(ad->shard); j++) {
+			struct atom_shard *sh = &ad->shard[j];
 
-		ATOM_TABLE_LOCK(ad);
-		htable_foreach(ad->table, atom_warn_free, ad);
-		htable_free_null(&ad->table);
-		ATOM_TABLE_UNLOCK(ad);
+			ATOM_SHARD_LOCK(sh);
+			hset_foreach(sh->table, atom_warn_free, ad);
+			hset_free_null(&sh->table);
+			ATOM_SHARD_UNLOCK(sh);
+		}
 	}
 }
 
@@ -56,6 +56,7 @@ enum atom_type {
 
 #if !defined(TRACK_ATOMS) || defined(ATOMS_SOURCE)
 const void *atom_get(enum atom_type type, const void *key);
+const void *atom_ref(enum atom_type type, const void *atom);
 void atom_free(enum atom_type type, const void *key);
 #endif
 
@@ -72,9 +73,11 @@ bool atom_is_atom(enum atom_type type, const void *key);
 #define atom_str_free(k)	atom_free_track(ATOM_STRING, (k), _WHERE_, __LINE__)
 
 #define atom_guid_get(k)	atom_get_track(ATOM_GUID, (k), _WHERE_, __LINE__)
+#define atom_guid_ref(k)	atom_get_track(ATOM_GUID, (k), _WHERE_, __LINE__)
 #define atom_guid_free(k)	atom_free_track(ATOM_GUID, (k), _WHERE_, __LINE__)
 
 #define atom_sha1_get(k)	atom_get_track(ATOM_SHA1, (k), _WHERE_, __LINE__)
+#define atom_sha1_ref(k)	atom_get_track(ATOM_SHA1, (k), _WHERE_, __LINE__)
 #define atom_sha1_free(k)	atom_free_track(ATOM_SHA1, (k), _WHERE_, __LINE__)
 
 #define atom_tth_get(k)		atom_get_track(ATOM_TTH, (k), _WHERE_, __LINE__)
@@ -96,6 +99,7 @@ bool atom_is_atom(enum atom_type type, const void *key);
 
 #ifndef ATOMS_SOURCE
 #define atom_get(t,k)		atom_get_track(t, (k), _WHERE_, __LINE__)
+#define atom_ref(t,k)		atom_get_track(t, (k), _WHERE_, __LINE__)
 #define atom_free(t,k)		atom_free_track(t, (k), _WHERE_, __LINE__)
 #endif
 
@@ -119,6 +123,15 @@ atom_guid_get(const struct guid *k)
 	return atom_get(ATOM_GUID, k);
 }
 
+/**
+ * Take a new reference on a GUID atom the caller already holds.
+ */
+static inline const struct guid *
+atom_guid_ref(const struct guid *k)
+{
+	return atom_ref(ATOM_GUID, k);
+}
+
 static inline void
 atom_guid_free(const struct guid *k)
 {
@@ -131,6 +144,15 @@ atom_sha1_get(const struct sha1 *k)
 	return atom_get(ATOM_SHA1, k);
 }
 
+/**
+ * Take a new reference on a SHA1 atom the caller already holds.
+ */
+static inline const struct sha1 *
+atom_sha1_ref(const struct sha1 *k)
+{
+	return atom_ref(ATOM_SHA1, k);
+}
+
 static inline void
 atom_sha1_free(const struct sha1 *k)
 {
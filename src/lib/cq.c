@@ -81,6 +81,7 @@ struct cevent {
 	cq_time_t ce_time;			/**< Absolute trigger time (virtual cq time) */
 	struct cevent *ce_bnext;	/**< Next item in hash bucket */
 	struct cevent *ce_bprev;	/**< Prev item in hash bucket */
+	struct chash *ce_bucket;	/**< Bucket (or wheel slot) holding event */
 	cqueue_t *ce_cq;			/**< Callout queue where event is registered */
 	cq_service_t ce_fn;			/**< Callback routine */
 	void *ce_arg;				/**< Argument to pass to said callback */
@@ -153,6 +154,10 @@ cevent_is_extended(const cevent_t *ce)
  * yet-to-come messages, or whatever. We don't care, and we don't want to care.
  * The notion of "current time" is simply given by calling cq_clock() at
  * regular intervals and giving it the "elasped time" since the last call.
+ *
+ * Alternatively, a queue can be created with cq_make_wheel() to use a
+ * hierarchical timing wheel instead of the sorted hash list, in which case
+ * cq_hash is the array of wheel slots (see below).
  */
 
 struct chash {
@@ -181,7 +186,9 @@ struct cqueue {
 	int cq_items;				/**< Amount of recorded events */
 	int cq_last_bucket;			/**< Last bucket slot we were at */
 	int cq_period;				/**< Regular callout period, in ms */
+	cq_time_t cq_wtick;			/**< Wheel tick, all prior ones expired */
 	uint8 cq_call_extended;		/**< Is cq_call an extended event? */
+	uint8 cq_wheel;				/**< Is cq_hash a timing wheel? */
 	time_t cq_last_idle;		/**< Last time we ran the idle callbacks */
 	mutex_t cq_lock;			/**< Thread-safety for queue changes */
 	mutex_t cq_idle_lock;		/**< Protects idle callbacks */
@@ -208,6 +215,32 @@ cqueue_check(const struct cqueue * const cq)
 #define EV_HASH(x) (((x) >> 5) & HASH_MASK)
 #define EV_OVER(x) (((x) >> 5) & ~HASH_MASK)
 
+/*
+ * The timing wheel uses the same 32-unit ticks as the hash list.
+ *
+ * Level 0 has one slot per tick and holds the events due within the next
+ * 256 ticks.  Each upper level has 64 slots, each slot spanning a whole
+ * revolution of the level below: their events are not sorted and are only
+ * redistributed to the lower levels ("cascaded") when the level below wraps
+ * around.  Inserting or removing an event is therefore O(1) regardless of
+ * the amount of events held, and far-away events are only kept with a coarse
+ * granularity until they get closer.
+ *
+ * With 4 levels, the wheel covers 2^26 ticks, which is the full range of
+ * the "int" delays we accept when time is measured in ms.  Anything beyond
+ * is kept in the farthest slot and cascaded again later.
+ */
+#define WHEEL_TICK(x)	((x) >> 5)
+#define WHEEL_TIME(x)	((x) << 5)
+#define WHEEL_BITS0		8		/**< Level 0 has 2^8 slots */
+#define WHEEL_BITSN		6		/**< Upper levels have 2^6 slots */
+#define WHEEL_LEVELS	4
+#define WHEEL_SIZE0		(1 << WHEEL_BITS0)
+#define WHEEL_SIZEN		(1 << WHEEL_BITSN)
+#define WHEEL_MASK0		(WHEEL_SIZE0 - 1)
+#define WHEEL_MASKN		(WHEEL_SIZEN - 1)
+#define WHEEL_SLOTS		(WHEEL_SIZE0 + (WHEEL_LEVELS - 1) * WHEEL_SIZEN)
+
 /**
  * Locking of the callout queue for short period of time, in sections that
  * do not encompass memory allocation or do not call other routines that may
@@ -301,9 +334,13 @@ cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
 
 	cq->cq_magic = CQUEUE_MAGIC;
 	cq->cq_name = atom_str_get(name);
-	XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+	if (cq->cq_wheel)
+		XMALLOC0_ARRAY(cq->cq_hash, WHEEL_SLOTS);
+	else
+		XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
 	cq->cq_time = now;
 	cq->cq_last_bucket = EV_HASH(now);
+	cq->cq_wtick = WHEEL_TICK(now);
 	cq->cq_period = period;
 	cq->cq_stid = THREAD_INVALID_ID;
 	mutex_init(&cq->cq_lock);
@@ -336,6 +373,33 @@ cq_make(const char *name, cq_time_t now, int period)
 	return cq;
 }
 
+/**
+ * Create a new callout queue object managed through a timing wheel.
+ *
+ * Such a queue is better suited than the one returned by cq_make() when
+ * many events are inserted, cancelled or rescheduled with widely spread
+ * delays, typically timeouts that almost never fire: all these operations
+ * are done in constant time.
+ *
+ * @param name		queue name, for logging
+ * @param now		virtual current time -- use 0 if not important
+ * @param period	period between heartbeats, in ms
+ *
+ * @return a new callout queue
+ */
+cqueue_t *
+cq_make_wheel(const char *name, cq_time_t now, int period)
+{
+	cqueue_t *cq;
+
+	WALLOC0(cq);
+	cq->cq_wheel = TRUE;
+	cq_initialize(cq, name, now, period);
+	cq_vars_add(cq);
+
+	return cq;
+}
+
 /**
  * @return the amount of items held in the callout queue.
  */
@@ -449,6 +513,91 @@ ev_free(cevent_t *ev)
 	}
 }
 
+/**
+ * Append event at the tail of a bucket list.
+ */
+static inline void
+ev_bucket_append(struct chash *ch, cevent_t *ev)
+{
+	ev->ce_bucket = ch;
+	ev->ce_bnext = NULL;
+	ev->ce_bprev = ch->ch_tail;
+
+	if (NULL == ch->ch_tail)
+		ch->ch_head = ev;
+	else
+		ch->ch_tail->ce_bnext = ev;
+
+	ch->ch_tail = ev;
+}
+
+/**
+ * Remove event from the bucket list holding it.
+ */
+static inline void
+ev_bucket_remove(cevent_t *ev)
+{
+	struct chash *ch = ev->ce_bucket;
+
+	if (ch->ch_head == ev)
+		ch->ch_head = ev->ce_bnext;
+	if (ch->ch_tail == ev)
+		ch->ch_tail = ev->ce_bprev;
+
+	if (ev->ce_bprev)
+		ev->ce_bprev->ce_bnext = ev->ce_bnext;
+	if (ev->ce_bnext)
+		ev->ce_bnext->ce_bprev = ev->ce_bprev;
+
+	g_assert(ch->ch_head == NULL || ch->ch_head->ce_bprev == NULL);
+	g_assert(ch->ch_tail == NULL || ch->ch_tail->ce_bnext == NULL);
+}
+
+/**
+ * Compute the timing wheel slot where an event triggering at the specified
+ * time must be stored.
+ *
+ * Events due at or before the current tick go to the current level-0 slot,
+ * which is the one being processed by cq_clock().
+ */
+static struct chash *
+cq_wheel_slot(const cqueue_t *cq, cq_time_t trigger)
+{
+	cq_time_t tick = WHEEL_TICK(trigger), delta;
+	uint level, shift;
+
+	if (tick <= cq->cq_wtick)
+		return &cq->cq_hash[cq->cq_wtick & WHEEL_MASK0];
+
+	delta = tick - cq->cq_wtick;
+
+	if (delta < WHEEL_SIZE0)
+		return &cq->cq_hash[tick & WHEEL_MASK0];
+
+	/*
+	 * Level n (n >= 1) holds events due within 2^(8 + 6n) ticks, its slots
+	 * being indexed by the tick number divided by 2^(8 + 6(n-1)).
+	 */
+
+	for (
+		level = 1, shift = WHEEL_BITS0;
+		level < WHEEL_LEVELS;
+		level++, shift += WHEEL_BITSN
+	) {
+		if (0 == (delta >> (shift + WHEEL_BITSN)))
+			break;
+	}
+
+	if G_UNLIKELY(WHEEL_LEVELS == level) {
+		level--;
+		shift -= WHEEL_BITSN;
+		tick = cq->cq_wtick + ((cq_time_t) 1 << (shift + WHEEL_BITSN)) - 1;
+	}
+
+	return &cq->cq_hash[WHEEL_SIZE0 + (level - 1) * WHEEL_SIZEN +
+		((tick >> shift) & WHEEL_MASKN)];
+}
+
 /**
  * Link event into the callout queue.
  */
@@ -470,6 +619,15 @@ ev_link(cevent_t *ev)
 	trigger = ev->ce_time;
 	cq->cq_items++;
 
+	/*
+	 * Slots in the timing wheel are not sorted.
+	 */
+
+	if (cq->cq_wheel) {
+		ev_bucket_append(cq_wheel_slot(cq, trigger), ev);
+		return;
+	}
+
 	/*
 	 * Important corner case: we may be rescheduling an event BEFORE
 	 * the current clock time, in which case we must insert the event
@@ -484,6 +642,8 @@ ev_link(cevent_t *ev)
 
 	g_assert(ch);
 
+	ev->ce_bucket = ch;
+
 	/*
 	 * If bucket is empty, the event is the new head.
 	 */
@@ -552,7 +712,6 @@ ev_link(cevent_t *ev)
 static void
 ev_unlink(cevent_t *ev)
 {
-	struct chash *ch;			/* Hashing bucket */
 	cqueue_t *cq;
 
 	cevent_check(ev);
@@ -560,25 +719,17 @@ ev_unlink(cevent_t *ev)
 	cqueue_check(cq);
 	assert_mutex_is_owned(&cq->cq_lock);
 
-	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
 	cq->cq_items--;
 
 	/*
 	 * Unlinking the item is straigthforward, unlike insertion!
+	 *
+	 * We use the recorded bucket and not the one computed from the trigger
+	 * time since an event rescheduled before the current time was put in
+	 * the bucket being scanned by cq_clock().
 	 */
 
-	if (ch->ch_head == ev)
-		ch->ch_head = ev->ce_bnext;
-	if (ch->ch_tail == ev)
-		ch->ch_tail = ev->ce_bprev;
-
-	if (ev->ce_bprev)
-		ev->ce_bprev->ce_bnext = ev->ce_bnext;
-	if (ev->ce_bnext)
-		ev->ce_bnext->ce_bprev = ev->ce_bprev;
-
-	g_assert(ch->ch_head == NULL || ch->ch_head->ce_bprev == NULL);
-	g_assert(ch->ch_tail == NULL || ch->ch_tail->ce_bnext == NULL);
+	ev_bucket_remove(ev);
 }
 
 /**
@@ -1043,6 +1194,118 @@ cq_replace(cevent_t *ev, cq_service_t fn, void *arg)
 	return TRUE;
 }
 
+/**
+ * Cascade all the events held in a slot of an upper level of the timing
+ * wheel down to the lower levels.
+ */
+static void
+cq_wheel_cascade(cqueue_t *cq, struct chash *ch)
+{
+	cevent_t *ev, *next;
+
+	ev = ch->ch_head;
+	ch->ch_head = ch->ch_tail = NULL;
+
+	for (; ev != NULL; ev = next) {
+		next = ev->ce_bnext;
+		ev_bucket_append(cq_wheel_slot(cq, ev->ce_time), ev);
+	}
+}
+
+/**
+ * Move the timing wheel to the next tick, cascading the upper levels
+ * when the lower ones wrap around.
+ */
+static void
+cq_wheel_advance(cqueue_t *cq)
+{
+	cq_time_t tick = ++cq->cq_wtick;
+	uint level, shift;
+
+	if (0 != (tick & WHEEL_MASK0))
+		return;
+
+	for (
+		level = 1, shift = WHEEL_BITS0;
+		level < WHEEL_LEVELS;
+		level++, shift += WHEEL_BITSN
+	) {
+		uint idx = (tick >> shift) & WHEEL_MASKN;
+
+		cq_wheel_cascade(cq,
+			&cq->cq_hash[WHEEL_SIZE0 + (level - 1) * WHEEL_SIZEN + idx]);
+
+		if (idx != 0)
+			break;
+	}
+}
+
+/**
+ * Expire the events held in the timing wheel, up to the current time.
+ *
+ * @return the amount of events triggered.
+ */
+static size_t
+cq_wheel_clock(cqueue_t *cq, cq_time_t now)
+{
+	cq_time_t now_tick = WHEEL_TICK(now);
+	struct chash *ch, later;
+	cevent_t *ev;
+	size_t processed = 0;
+
+	/*
+	 * All the events in the slots of the ticks that have fully elapsed
+	 * are due, and we can expire them all without checking their time.
+	 */
+
+	while (cq->cq_wtick < now_tick) {
+		cq_time_t tick = cq->cq_wtick;
+
+		if (0 == cq->cq_items) {
+			cq->cq_wtick = now_tick;		/* Nothing to cascade */
+			break;
+		}
+
+		ch = &cq->cq_hash[tick & WHEEL_MASK0];
+		cq->cq_current = ch;
+
+		while (NULL != (ev = ch->ch_head)) {
+			cq_expire_internal(cq, ev);
+			processed++;
+		}
+
+		if (tick == cq->cq_wtick)		/* No recursive call moved on */
+			cq_wheel_advance(cq);
+	}
+
+	/*
+	 * In the current tick, only expire the events that are due, so that
+	 * we never trigger events too early.  The others are moved aside as
+	 * we go and put back at the end.
+	 */
+
+	ch = &cq->cq_hash[cq->cq_wtick & WHEEL_MASK0];
+	cq->cq_current = ch;
+	later.ch_head = later.ch_tail = NULL;
+
+	while (NULL != (ev = ch->ch_head)) {
+		if (ev->ce_time <= now) {
+			cq_expire_internal(cq, ev);
+			processed++;
+		} else {
+			ev_bucket_remove(ev);
+			ev_bucket_append(&later, ev);
+		}
+	}
+
+	while (NULL != (ev = later.ch_head)) {
+		ev_bucket_remove(ev);
+		ev_bucket_append(cq_wheel_slot(cq, ev->ce_time), ev);
+	}
+
+	return processed;
+}
+
 /**
  * The heartbeat of our callout queue.
  *
@@ -1095,6 +1358,11 @@ cq_clock(cqueue_t *cq, int elapsed)
 	cq->cq_time += elapsed;
 	now = cq->cq_time;
 
+	if (cq->cq_wheel) {
+		processed = cq_wheel_clock(cq, now);
+		goto done;
+	}
+
 	bucket = cq->cq_last_bucket;		/* Bucket we traversed last time */
 	ch = &cq->cq_hash[bucket];
 	last_bucket = EV_HASH(now);			/* Last bucket to traverse now */
@@ -1199,6 +1467,95 @@ done:
 	return processed;		/* Do not count idle events */
 }
 
+/**
+ * @return the minimum between the given delay and the delay until the
+ * earliest event held in the wheel slot.
+ */
+static int
+cq_wheel_slot_delay(const struct chash *ch, cq_time_t now, int delay)
+{
+	const cevent_t *ev;
+
+	for (ev = ch->ch_head; ev != NULL; ev = ev->ce_bnext) {
+		if G_UNLIKELY(ev->ce_time <= now)
+			return 0;
+		if (ev->ce_time - now < (cq_time_t) delay)
+			delay = ev->ce_time - now;
+	}
+
+	return delay;
+}
+
+/**
+ * Compute delay until the next event registered in the timing wheel.
+ *
+ * @param cq		the callout queue
+ * @param scanned	where the amount of slots scanned is written
+ *
+ * @return the "virtual time" delay until the next registered event.
+ */
+static int
+cq_wheel_delay(const cqueue_t *cq, int *scanned)
+{
+	int delay = MAX_INT_VAL(int);
+	cq_time_t now = cq->cq_time;
+	uint i, level, shift;
+	int n = 0;
+
+	/*
+	 * Level-0 slots hold events for a single tick each, so the first
+	 * non-empty slot holds the earliest events of that level.
+	 */
+
+	for (i = 0; i < WHEEL_SIZE0; i++) {
+		const struct chash *ch =
+			&cq->cq_hash[(cq->cq_wtick + i) & WHEEL_MASK0];
+
+		n++;
+		if (NULL == ch->ch_head)
+			continue;
+
+		delay = cq_wheel_slot_delay(ch, now, delay);
+		break;
+	}
+
+	/*
+	 * Events in the upper levels may come before those of level 0 since
+	 * they are not cascaded as time passes.  In each level, we look at the
+	 * slots in the order they will be cascaded, until the start of the
+	 * period they cover comes after the delay we have so far.  We cannot
+	 * stop at the first non-empty slot because events too far away to fit
+	 * in the wheel are parked in a slot covering an earlier period.
+	 */
+
+	for (
+		level = 1, shift = WHEEL_BITS0;
+		level < WHEEL_LEVELS;
+		level++, shift += WHEEL_BITSN
+	) {
+		const struct chash *slots =
+			&cq->cq_hash[WHEEL_SIZE0 + (level - 1) * WHEEL_SIZEN];
+		cq_time_t block = cq->cq_wtick >> shift;
+
+		for (i = 1; i <= WHEEL_SIZEN; i++) {
+			const struct chash *ch = &slots[(block + i) & WHEEL_MASKN];
+			cq_time_t start = WHEEL_TIME((block + i) << shift);
+
+			n++;
+			if (NULL == ch->ch_head)
+				continue;
+
+			if (start > now && start - now >= (cq_time_t) delay)
+				break;
+
+			delay = cq_wheel_slot_delay(ch, now, delay);
+		}
+	}
+
+	*scanned = n;
+	return delay;
+}
+
 /**
  * Compute delay until the next registered event, expressed in units of the
  * callout queue "virtual time".
@@ -1227,6 +1584,11 @@ cq_delay(const cqueue_t *cq)
 
 	mutex_lock_const(&cq->cq_lock);
 
+	if (cq->cq_wheel) {
+		delay = cq_wheel_delay(cq, &i);
+		goto scanned;
+	}
+
 	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
 	now = cq->cq_time;
 
@@ -1259,6 +1621,8 @@ cq_delay(const cqueue_t *cq)
 		delay = MIN(delay, edelay);
 	}
 
+scanned:
+
 	/*
 	 * If there are idle events registered in the queue, then we need to make
 	 * sure they are scheduled at least once every CQ_IDLE_FORCE seconds.
@@ -1399,6 +1763,39 @@ cq_heartbeat(cqueue_t *cq)
 	return triggered;
 }
 
+/**
+ * Advance the "virtual time" of the callout queue by the specified amount,
+ * triggering all the events that are due.
+ *
+ * This is meant for queues whose time is not measured in ms, and which are
+ * therefore not given heartbeats.  As with cq_heartbeat(), the queue must
+ * always be advanced from the same thread.
+ *
+ * @param cq		the callout queue
+ * @param elapsed	the elapsed "virtual time"
+ *
+ * @return the amount of triggered events.
+ */
+size_t
+cq_advance(cqueue_t *cq, int elapsed)
+{
+	uint stid = thread_small_id();
+
+	cqueue_check(cq);
+	g_assert(elapsed >= 0);
+
+	CQ_LOCK(cq);
+
+	if G_UNLIKELY(THREAD_INVALID_ID == cq->cq_stid)
+		cq->cq_stid = stid;
+
+	g_assert_log(stid == cq->cq_stid,
+		"%s(): callout queue \"%s\" used to run from %s, called from %s",
+		G_STRFUNC, cq->cq_name, thread_id_name(cq->cq_stid), thread_name());
+
+	return cq_clock(cq, elapsed);	/* Releases the mutex */
+}
+
 /**
  * Convenience routine: insert event in the main callout queue.
  *
@@ -2131,7 +2528,7 @@ cq_free(cqueue_t *cq)
 {
 	cevent_t *ev;
 	cevent_t *ev_next;
-	int i;
+	int i, n;
 	struct chash *ch;
 
 	cqueue_check(cq);
@@ -2145,7 +2542,9 @@ cq_free(cqueue_t *cq)
 
 	mutex_lock(&cq->cq_lock);
 
-	for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
+	n = cq->cq_wheel ? WHEEL_SLOTS : HASH_SIZE;
+
+	for (ch = cq->cq_hash, i = 0; i < n; i++, ch++) {
 		for (ev = ch->ch_head; ev; ev = ev_next) {
 			ev_next = ev->ce_bnext;
 			ev_free(ev);
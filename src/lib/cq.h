@@ -99,6 +99,7 @@ void cq_close(void);
 
 cqueue_t *cq_main(void);
 cqueue_t *cq_make(const char *name, cq_time_t now, int period);
+cqueue_t *cq_make_wheel(const char *name, cq_time_t now, int period);
 cqueue_t *cq_submake(const char *name, cqueue_t *parent, int period);
 cqueue_t *cq_main_submake(const char *name, int period);
 void cq_free_null(cqueue_t **cq_ptr);
@@ -106,6 +107,7 @@ cevent_t *cq_insert(cqueue_t *cq, int delay, cq_service_t fn, void *arg);
 cevent_t *cq_main_insert(int delay, cq_service_t fn, void *arg);
 cq_time_t cq_remaining(const cevent_t *ev);
 size_t cq_heartbeat(cqueue_t *cq);
+size_t cq_advance(cqueue_t *cq, int elapsed);
 bool cq_expire(cevent_t *ev);
 void cq_zero(cqueue_t *cq, cevent_t **ev_ptr);
 bool cq_zero_if_triggered(cevent_t **ev_ptr);
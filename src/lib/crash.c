@@ -2375,6 +2375,13 @@ crash_handler(int signo)
 		signal_unblock(signo);
 	}
 
+	/*
+	 * Flush pending asynchronous log messages, so that they are not lost
+	 * and appear before the crash report.
+	 */
+
+	log_async_flush();
+
 	/*
 	 * Crashing early means we can't be called from a signal handler: rather
 	 * we were called manually, from crash_abort().
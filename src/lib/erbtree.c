@@ -521,6 +521,75 @@ erbtree_lookup(const erbtree_t *tree, const void *key)
 	return NULL == rn ? NULL : ptr_add_offset(rn, -tree->offset);
 }
 
+/**
+ * Look up key in the tree, returning the closest node on the given side
+ * when the key is not found.
+ *
+ * @param tree		the red-black tree
+ * @param key		pointer to the key structure (NOT a node)
+ * @param above		whether to return the closest node above or below key
+ *
+ * @return node associated with key if present, otherwise the node that
+ * would follow (above) or precede (below) key, NULL if there is none.
+ */
+static rbnode_t *
+erbtree_getnode_closest(const erbtree_t *tree, const void *key, bool above)
+{
+	rbnode_t *parent;
+	bool is_left;
+	rbnode_t *rn;
+
+	erbtree_check(tree);
+	g_assert(key != NULL);
+
+	if (erbtree_is_extended(tree)) {
+		rn = do_lookup_ext(ERBTREE_E(tree), key, &parent, &is_left);
+	} else {
+		rn = do_lookup(tree, key, &parent, &is_left);
+	}
+
+	if (rn != NULL || NULL == parent)
+		return rn;
+
+	/*
+	 * The key would be inserted as a child of "parent", on its left if
+	 * it is smaller than the parent, on its right otherwise.
+	 */
+
+	if (above)
+		return is_left ? parent : erbtree_next(parent);
+	else
+		return is_left ? erbtree_prev(parent) : parent;
+}
+
+/**
+ * Look up the largest item in the tree that is less than or equal to key.
+ *
+ * @param tree		the red-black tree
+ * @param key		pointer to the key structure (NOT a node)
+ *
+ * @return found item, NULL if all the items are greater than key.
+ */
+void *
+erbtree_lookup_floor(const erbtree_t *tree, const void *key)
+{
+	return erbtree_data(tree, erbtree_getnode_closest(tree, key, FALSE));
+}
+
+/**
+ * Look up the smallest item in the tree that is greater than or equal to key.
+ *
+ * @param tree		the red-black tree
+ * @param key		pointer to the key structure (NOT a node)
+ *
+ * @return found item, NULL if all the items are smaller than key.
+ */
+void *
+erbtree_lookup_ceil(const erbtree_t *tree, const void *key)
+{
+	return erbtree_data(tree, erbtree_getnode_closest(tree, key, TRUE));
+}
+
 /**
  * Look up key in the tree, returning the associated node pointer.
  *
@@ -119,6 +119,8 @@ rbnode_t *erbtree_next(const rbnode_t *node);
 rbnode_t *erbtree_prev(const rbnode_t *node);
 bool erbtree_contains(const erbtree_t *tree, const void *key);
 void *erbtree_lookup(const erbtree_t *tree, const void *key);
+void *erbtree_lookup_floor(const erbtree_t *tree, const void *key);
+void *erbtree_lookup_ceil(const erbtree_t *tree, const void *key);
 rbnode_t *erbtree_getnode(const erbtree_t *tree, const void *key);
 void *erbtree_insert(erbtree_t *tree, rbnode_t *node);
 void erbtree_remove(erbtree_t *tree, rbnode_t *node);
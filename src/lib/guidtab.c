@@ -0,0 +1,603 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * GUID tables, open-addressing hash tables keyed by a GUID and a tag byte,
+ * with generational aging of the entries.
+ *
+ * These tables are tailored for the Gnutella routing table, which needs to
+ * remember a very large amount of GUIDs for a limited time, the bulk of
+ * the operations being lookups of GUIDs that are either present or unknown.
+ *
+ * Keys are held inline in the table slots, using linear probing and
+ * backward-shift deletion so that no tombstones are ever needed.  A separate
+ * array of control bytes holds a 7-bit fingerprint of the hashed key of each
+ * used slot: probing scans this compact array and only looks at the slot
+ * itself when the fingerprint matches, hence an unsuccessful lookup usually
+ * touches a single cache line.
+ *
+ * Entries are not individually timed.  Instead, each entry records the
+ * generation in which it was inserted (or last revitalized), generations
+ * being closed after a fixed amount of items were accounted to them.  When
+ * the oldest generation expires, either because the generation that followed
+ * it was started more than the minimal lifetime ago or because there are
+ * too many live generations, all its entries become dead at once.  Dead
+ * entries are then reclaimed lazily: when looked up, by an incremental sweep
+ * of a few slots at each insertion, and when the table is resized.
+ *
+ * Revitalizing an entry simply means moving it to the current generation,
+ * which is done in place.
+ *
+ * These tables are not thread-safe.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "guidtab.h"
+#include "halloc.h"
+#include "hashing.h"
+#include "misc.h"			/* For GUID_RAW_SIZE */
+#include "pow2.h"
+#include "tm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define GUIDTAB_MIN_SIZE	1024	/**< Minimal amount of slots */
+#define GUIDTAB_SWEEP		4		/**< Slots swept at each insertion */
+
+#define GUIDTAB_NONE		((size_t) -1)
+#define GUIDTAB_FP(h)		((uint8) (0x80 | ((h) >> 25)))
+
+enum guidtab_magic { GUIDTAB_MAGIC = 0x1d6a4f93 };
+
+/**
+ * A table slot.
+ *
+ * Keys are held inline in the slot, so that comparing keys never requires
+ * a pointer indirection.
+ */
+struct guidtab_slot {
+	char key[GUID_RAW_SIZE];	/**< The GUID */
+	uint32 gen;					/**< Generation of insertion or refresh */
+	uint8 tag;					/**< Additional key byte */
+	void *value;				/**< Value associated with the key */
+};
+
+/**
+ * A GUID table.
+ *
+ * The `ctrl' array holds one byte per slot: 0 for an empty slot, otherwise
+ * 7 bits of the hashed key held in the slot with the upper bit set.
+ */
+struct guidtab {
+	enum guidtab_magic magic;	/**< Magic number */
+	uint8 *ctrl;				/**< Control bytes, one per slot */
+	struct guidtab_slot *slots;	/**< The slots */
+	time_t *gen_start;			/**< Start time of live generations */
+	guidtab_free_t freecb;		/**< Value freeing callback */
+	void *data;					/**< Additional callback argument */
+	size_t capacity;			/**< Amount of slots, a power of 2 */
+	size_t count;				/**< Amount of used slots (live or dead) */
+	size_t sweep;				/**< Index of next slot to sweep */
+	size_t gen_items;			/**< Amount of items per generation */
+	size_t gen_count;			/**< Items accounted to current generation */
+	time_delta_t min_life;		/**< Minimal lifetime of entries */
+	uint32 gen;					/**< Current generation */
+	uint32 oldest;				/**< Oldest live generation */
+	uint max_gen;				/**< Max amount of live generations */
+};
+
+static inline void
+guidtab_check(const struct guidtab * const gt)
+{
+	g_assert(gt != NULL);
+	g_assert(GUIDTAB_MAGIC == gt->magic);
+}
+
+/**
+ * Hash a key.
+ */
+static inline uint
+guidtab_hash(const void *key, uint8 tag)
+{
+	return u32_hash(binary_hash(key, GUID_RAW_SIZE) + tag);
+}
+
+/**
+ * @return whether entries from generation `gen' are still alive.
+ */
+static inline bool
+guidtab_alive(const guidtab_t *gt, uint32 gen)
+{
+	return gt->gen - gen <= gt->gen - gt->oldest;
+}
+
+/**
+ * Allocate the table arrays for the given capacity.
+ */
+static void
+guidtab_allocate(guidtab_t *gt, size_t capacity)
+{
+	g_assert(is_pow2(capacity));
+
+	gt->capacity = capacity;
+	gt->count = 0;
+	gt->sweep = 0;
+	gt->ctrl = halloc0(capacity);
+	HALLOC_ARRAY(gt->slots, capacity);
+}
+
+/**
+ * Locate slot holding key.
+ *
+ * @return the slot index, GUIDTAB_NONE if not found.
+ */
+static size_t
+guidtab_find(const guidtab_t *gt, const void *key, uint8 tag, uint h)
+{
+	size_t mask = gt->capacity - 1;
+	size_t i = h & mask;
+	uint8 fp = GUIDTAB_FP(h);
+
+	/*
+	 * The table is never full, hence we always find an empty slot that
+	 * will stop the probing.
+	 */
+
+	for (;;) {
+		uint8 c = gt->ctrl[i];
+
+		if G_UNLIKELY(0 == c)
+			return GUIDTAB_NONE;
+
+		if (c == fp) {
+			const struct guidtab_slot *s = &gt->slots[i];
+
+			if (s->tag == tag && 0 == memcmp(s->key, key, GUID_RAW_SIZE))
+				return i;
+		}
+
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Delete entry at slot index `i', shifting back the following entries
+ * of the cluster as needed to keep all the probing sequences valid.
+ */
+static void
+guidtab_delete(guidtab_t *gt, size_t i)
+{
+	size_t mask = gt->capacity - 1;
+	size_t j = i;
+
+	g_assert(gt->ctrl[i] != 0);
+
+	for (;;) {
+		const struct guidtab_slot *s;
+		size_t home;
+
+		j = (j + 1) & mask;
+		if (0 == gt->ctrl[j])
+			break;
+
+		/*
+		 * Move entry at `j' into the hole at `i' unless its home slot lies
+		 * cyclically within ]i, j], in which case it must stay there.
+		 */
+
+		s = &gt->slots[j];
+		home = guidtab_hash(s->key, s->tag) & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			gt->ctrl[i] = gt->ctrl[j];
+			gt->slots[i] = *s;			/* Struct copy */
+			i = j;
+		}
+	}
+
+	gt->ctrl[i] = 0;
+	gt->count--;
+}
+
+/**
+ * Delete entry at slot index `i' and free its value.
+ */
+static void
+guidtab_expire(guidtab_t *gt, size_t i)
+{
+	void *value = gt->slots[i].value;
+
+	guidtab_delete(gt, i);
+	(*gt->freecb)(value, gt->data);
+}
+
+/**
+ * Resize table, dropping all the dead entries.
+ */
+static void
+guidtab_resize(guidtab_t *gt, size_t capacity)
+{
+	uint8 *octrl = gt->ctrl;
+	struct guidtab_slot *oslots = gt->slots;
+	size_t ocapacity = gt->capacity;
+	size_t mask = capacity - 1;
+	size_t i;
+
+	guidtab_allocate(gt, capacity);
+
+	for (i = 0; i < ocapacity; i++) {
+		const struct guidtab_slot *s = &oslots[i];
+		size_t j;
+
+		if (0 == octrl[i])
+			continue;
+
+		if (!guidtab_alive(gt, s->gen)) {
+			(*gt->freecb)(s->value, gt->data);
+			continue;
+		}
+
+		j = guidtab_hash(s->key, s->tag) & mask;
+		while (0 != gt->ctrl[j])
+			j = (j + 1) & mask;
+
+		gt->ctrl[j] = octrl[i];
+		gt->slots[j] = *s;				/* Struct copy */
+		gt->count++;
+	}
+
+	g_assert(gt->count * 4 <= gt->capacity * 3);
+
+	HFREE_NULL(octrl);
+	HFREE_NULL(oslots);
+}
+
+/**
+ * Reclaim dead entries within the next `n' slots of the sweeping cursor.
+ */
+static void
+guidtab_sweep(guidtab_t *gt, size_t n)
+{
+	while (n-- != 0) {
+		size_t i = gt->sweep;
+
+		if (0 != gt->ctrl[i] && !guidtab_alive(gt, gt->slots[i].gen)) {
+			guidtab_expire(gt, i);
+			continue;		/* Slot can now hold a shifted-back entry */
+		}
+
+		gt->sweep = (i + 1) & (gt->capacity - 1);
+
+		/*
+		 * When we complete a whole sweep, see whether the table has become
+		 * too sparse.  The sweep restarts from scratch after a resize.
+		 */
+
+		if G_UNLIKELY(
+			0 == gt->sweep && gt->capacity > GUIDTAB_MIN_SIZE &&
+			gt->count < gt->capacity / 8
+		) {
+			guidtab_resize(gt, gt->capacity / 2);
+			break;
+		}
+	}
+}
+
+/**
+ * Expire the oldest generations whose entries have all lived for at least
+ * the minimal lifetime.
+ */
+static void
+guidtab_age(guidtab_t *gt, time_t now)
+{
+	while (gt->oldest != gt->gen) {
+		time_t next = gt->gen_start[(gt->oldest + 1) % gt->max_gen];
+
+		if (delta_time(now, next) <= gt->min_life)
+			break;
+
+		gt->oldest++;
+	}
+}
+
+/**
+ * Account for a new item in the current generation, starting a new
+ * generation when the current one is full.
+ */
+static void
+guidtab_account(guidtab_t *gt, time_t now)
+{
+	if G_LIKELY(++gt->gen_count < gt->gen_items)
+		return;
+
+	gt->gen++;
+	gt->gen_count = 0;
+
+	/*
+	 * If we have too many live generations, forcefully expire the oldest,
+	 * whose starting time slot we are going to reuse.
+	 */
+
+	if (gt->gen - gt->oldest >= gt->max_gen)
+		gt->oldest++;
+
+	gt->gen_start[gt->gen % gt->max_gen] = now;
+}
+
+/**
+ * Create a new GUID table.
+ *
+ * @param gen_items		amount of items per generation
+ * @param max_gen		maximum amount of live generations
+ * @param min_life		entries live at least that long, unless we have
+ *						more than `max_gen' live generations
+ * @param fn			callback to free values
+ * @param data			additional argument for the freeing callback
+ *
+ * @return new GUID table.
+ */
+guidtab_t *
+guidtab_make(size_t gen_items, uint max_gen, time_delta_t min_life,
+	guidtab_free_t fn, void *data)
+{
+	guidtab_t *gt;
+
+	g_assert(gen_items != 0);
+	g_assert(max_gen != 0);
+	g_assert(fn != NULL);
+
+	WALLOC0(gt);
+	gt->magic = GUIDTAB_MAGIC;
+	gt->freecb = fn;
+	gt->data = data;
+	gt->gen_items = gen_items;
+	gt->max_gen = max_gen;
+	gt->min_life = min_life;
+	HALLOC0_ARRAY(gt->gen_start, max_gen);
+	gt->gen_start[0] = tm_time();
+	guidtab_allocate(gt, GUIDTAB_MIN_SIZE);
+
+	return gt;
+}
+
+/**
+ * Lookup value associated with key.
+ *
+ * @return the value if found, NULL otherwise.
+ */
+void *
+guidtab_lookup(guidtab_t *gt, const struct guid *key, uint8 tag)
+{
+	size_t i;
+
+	guidtab_check(gt);
+
+	guidtab_age(gt, tm_time());
+	i = guidtab_find(gt, key, tag, guidtab_hash(key, tag));
+
+	if (GUIDTAB_NONE == i)
+		return NULL;
+
+	if G_UNLIKELY(!guidtab_alive(gt, gt->slots[i].gen)) {
+		guidtab_expire(gt, i);
+		return NULL;
+	}
+
+	return gt->slots[i].value;
+}
+
+/**
+ * Insert value associated with key, which must not be already present.
+ */
+void
+guidtab_insert(guidtab_t *gt, const struct guid *key, uint8 tag, void *value)
+{
+	struct guidtab_slot *s;
+	time_t now = tm_time();
+	size_t mask, i;
+	uint h;
+	uint8 fp;
+
+	guidtab_check(gt);
+
+	guidtab_age(gt, now);
+	guidtab_sweep(gt, GUIDTAB_SWEEP);
+
+	if G_UNLIKELY((gt->count + 1) * 4 > gt->capacity * 3)
+		guidtab_resize(gt, gt->capacity * 2);
+
+	h = guidtab_hash(key, tag);
+	fp = GUIDTAB_FP(h);
+	mask = gt->capacity - 1;
+
+	for (i = h & mask; 0 != gt->ctrl[i]; i = (i + 1) & mask) {
+		s = &gt->slots[i];
+
+		if (
+			gt->ctrl[i] == fp && s->tag == tag &&
+			0 == memcmp(s->key, key, GUID_RAW_SIZE)
+		) {
+			/* Reuse slot held by a dead entry */
+			g_assert(!guidtab_alive(gt, s->gen));
+			(*gt->freecb)(s->value, gt->data);
+			goto fill;
+		}
+	}
+
+	gt->ctrl[i] = fp;
+	gt->count++;
+
+fill:
+	s = &gt->slots[i];
+	memcpy(s->key, key, GUID_RAW_SIZE);
+	s->tag = tag;
+	s->gen = gt->gen;
+	s->value = value;
+
+	guidtab_account(gt, now);
+}
+
+/**
+ * Revitalize entry, moving it to the current generation.
+ *
+ * @return TRUE if entry was found, FALSE otherwise.
+ */
+bool
+guidtab_revitalize(guidtab_t *gt, const struct guid *key, uint8 tag)
+{
+	struct guidtab_slot *s;
+	time_t now = tm_time();
+	size_t i;
+
+	guidtab_check(gt);
+
+	guidtab_age(gt, now);
+	i = guidtab_find(gt, key, tag, guidtab_hash(key, tag));
+
+	if (GUIDTAB_NONE == i)
+		return FALSE;
+
+	s = &gt->slots[i];
+
+	if G_UNLIKELY(!guidtab_alive(gt, s->gen)) {
+		guidtab_expire(gt, i);
+		return FALSE;
+	}
+
+	if (s->gen != gt->gen) {
+		s->gen = gt->gen;
+		guidtab_account(gt, now);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Free all the values and release the table arrays.
+ */
+static void
+guidtab_discard(guidtab_t *gt)
+{
+	size_t i;
+
+	for (i = 0; i < gt->capacity; i++) {
+		if (0 != gt->ctrl[i])
+			(*gt->freecb)(gt->slots[i].value, gt->data);
+	}
+
+	HFREE_NULL(gt->ctrl);
+	HFREE_NULL(gt->slots);
+}
+
+/**
+ * Clear the table, freeing all the values.
+ */
+void
+guidtab_clear(guidtab_t *gt)
+{
+	time_t now = tm_time();
+
+	guidtab_check(gt);
+
+	guidtab_discard(gt);
+	guidtab_allocate(gt, GUIDTAB_MIN_SIZE);
+
+	gt->oldest = gt->gen;
+	gt->gen_count = 0;
+	gt->gen_start[gt->gen % gt->max_gen] = now;
+}
+
+/**
+ * Free GUID table, freeing all the values, and nullify its pointer.
+ */
+void
+guidtab_free_null(guidtab_t **gt_ptr)
+{
+	guidtab_t *gt = *gt_ptr;
+
+	if (gt != NULL) {
+		guidtab_check(gt);
+
+		guidtab_discard(gt);
+		HFREE_NULL(gt->gen_start);
+		gt->magic = 0;
+		WFREE(gt);
+		*gt_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of entries in the table, including dead ones not yet
+ * reclaimed.
+ */
+size_t
+guidtab_count(const guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	return gt->count;
+}
+
+/**
+ * @return amount of slots in the table.
+ */
+size_t
+guidtab_capacity(const guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	return gt->capacity;
+}
+
+/**
+ * @return amount of memory used by the table itself, excluding values.
+ */
+size_t
+guidtab_memory(const guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	return sizeof *gt + gt->max_gen * sizeof gt->gen_start[0] +
+		gt->capacity * (sizeof gt->ctrl[0] + sizeof gt->slots[0]);
+}
+
+/**
+ * @return amount of live generations.
+ */
+uint
+guidtab_generations(const guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	return gt->gen - gt->oldest + 1;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
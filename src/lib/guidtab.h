@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * GUID tables, open-addressing hash tables keyed by a GUID and a tag byte,
+ * with generational aging of the entries.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _guidtab_h_
+#define _guidtab_h_
+
+#include "common.h"
+
+#include "tm.h"			/* For time_delta_t */
+
+struct guid;
+
+typedef struct guidtab guidtab_t;
+
+/**
+ * Callback invoked to free values when entries expire or are discarded.
+ */
+typedef void (*guidtab_free_t)(void *value, void *data);
+
+/*
+ * Public interface.
+ */
+
+guidtab_t *guidtab_make(size_t gen_items, uint max_gen, time_delta_t min_life,
+	guidtab_free_t fn, void *data);
+void guidtab_free_null(guidtab_t **gt_ptr);
+
+void *guidtab_lookup(guidtab_t *gt, const struct guid *key, uint8 tag);
+void guidtab_insert(guidtab_t *gt,
+	const struct guid *key, uint8 tag, void *value);
+bool guidtab_revitalize(guidtab_t *gt, const struct guid *key, uint8 tag);
+void guidtab_clear(guidtab_t *gt);
+
+size_t guidtab_count(const guidtab_t *gt);
+size_t guidtab_capacity(const guidtab_t *gt);
+size_t guidtab_memory(const guidtab_t *gt);
+uint guidtab_generations(const guidtab_t *gt);
+
+#endif	/* _guidtab_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -50,6 +50,7 @@
 #include "glib-missing.h"
 #include "hashtable.h"
 #include "malloc.h"
+#include "memprof.h"
 #include "mempcpy.h"
 #include "misc.h"
 #include "once.h"
@@ -305,6 +306,10 @@ halloc(size_t size)
 	hstats.blocks++;
 	HSTATS_UNLOCK;
 
+	/* Small blocks were already accounted for by walloc() */
+	if (size >= walloc_threshold)
+		memprof_sample(MEMPROF_HALLOC, size);
+
 	return p;
 }
 
@@ -49,6 +49,147 @@
 
 #include "override.h"		/* Must be the last header included */
 
+/***
+ *** Known header fields
+ ***/
+
+/*
+ * The header fields we routinely look for, in alphabetical order.
+ *
+ * Their index is given by a perfect hash on the lower-cased name, computed
+ * by header_known_hash(): HEADER_KNOWN_SEED was chosen so that all these
+ * names hash to distinct values, the header_known_slot[] table mapping
+ * each hash value back to the index of the name, plus 1.
+ *
+ * When adding a name, keep the list sorted, choose a new seed leading to
+ * no collision and regenerate the slot table.
+ */
+
+#define HEADER_KNOWN_ENTRY(x)	{ x, CONST_STRLEN(x) }
+
+static const struct header_known_name {
+	const char *name;
+	size_t len;
+} header_known[] = {
+	HEADER_KNOWN_ENTRY("Accept"),
+	HEADER_KNOWN_ENTRY("Accept-Encoding"),
+	HEADER_KNOWN_ENTRY("Bye-Packet"),
+	HEADER_KNOWN_ENTRY("Connection"),
+	HEADER_KNOWN_ENTRY("Content-Encoding"),
+	HEADER_KNOWN_ENTRY("Content-Length"),
+	HEADER_KNOWN_ENTRY("Content-Range"),
+	HEADER_KNOWN_ENTRY("Content-Type"),
+	HEADER_KNOWN_ENTRY("Date"),
+	HEADER_KNOWN_ENTRY("Host"),
+	HEADER_KNOWN_ENTRY("If-Modified-Since"),
+	HEADER_KNOWN_ENTRY("Location"),
+	HEADER_KNOWN_ENTRY("Range"),
+	HEADER_KNOWN_ENTRY("Remote-IP"),
+	HEADER_KNOWN_ENTRY("Retry-After"),
+	HEADER_KNOWN_ENTRY("Server"),
+	HEADER_KNOWN_ENTRY("Transfer-Encoding"),
+	HEADER_KNOWN_ENTRY("User-Agent"),
+	HEADER_KNOWN_ENTRY("Vendor-Message"),
+	HEADER_KNOWN_ENTRY("X-Alt"),
+	HEADER_KNOWN_ENTRY("X-Available-Ranges"),
+	HEADER_KNOWN_ENTRY("X-Content-URN"),
+	HEADER_KNOWN_ENTRY("X-Degree"),
+	HEADER_KNOWN_ENTRY("X-Dynamic-Querying"),
+	HEADER_KNOWN_ENTRY("X-Ext-Probes"),
+	HEADER_KNOWN_ENTRY("X-Falt"),
+	HEADER_KNOWN_ENTRY("X-FW-Node-Info"),
+	HEADER_KNOWN_ENTRY("X-Gnutella-Alternate-Location"),
+	HEADER_KNOWN_ENTRY("X-Gnutella-Content-URN"),
+	HEADER_KNOWN_ENTRY("X-Guess"),
+	HEADER_KNOWN_ENTRY("X-GUID"),
+	HEADER_KNOWN_ENTRY("X-Host"),
+	HEADER_KNOWN_ENTRY("X-Hostname"),
+	HEADER_KNOWN_ENTRY("X-Hub"),
+	HEADER_KNOWN_ENTRY("X-Listen-IP"),
+	HEADER_KNOWN_ENTRY("X-Live-Since"),
+	HEADER_KNOWN_ENTRY("X-Max-TTL"),
+	HEADER_KNOWN_ENTRY("X-Nalt"),
+	HEADER_KNOWN_ENTRY("X-Node"),
+	HEADER_KNOWN_ENTRY("X-Node-IPv6"),
+	HEADER_KNOWN_ENTRY("X-Push-Proxies"),
+	HEADER_KNOWN_ENTRY("X-Push-Proxy"),
+	HEADER_KNOWN_ENTRY("X-Query-Routing"),
+	HEADER_KNOWN_ENTRY("X-Queue"),
+	HEADER_KNOWN_ENTRY("X-Queued"),
+	HEADER_KNOWN_ENTRY("X-Remote-IP"),
+	HEADER_KNOWN_ENTRY("X-Thex-URI"),
+	HEADER_KNOWN_ENTRY("X-Token"),
+	HEADER_KNOWN_ENTRY("X-Try-Hubs"),
+	HEADER_KNOWN_ENTRY("X-Ultrapeer"),
+	HEADER_KNOWN_ENTRY("X-Ultrapeer-Needed"),
+	HEADER_KNOWN_ENTRY("X-Ultrapeer-Query-Routing"),
+};
+
+#define HEADER_KNOWN_COUNT	G_N_ELEMENTS(header_known)
+#define HEADER_KNOWN_SEED	0x8dU
+
+static const uint8 header_known_slot[256] = {
+	 0,  0,  9,  0,  0, 12,  0,  0, 33,  0,  0, 27, 26,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 14,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0, 19,  0,  0, 44, 41,  0,  0,  0,
+	 0,  0,  0, 15,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0,  0,
+	 0, 45,  0,  0,  0,  0,  0,  0, 13,  0,  0, 22,  0,  0,  0, 17,
+	 0, 29,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  7,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0, 47, 50,  0,  0,  0,  0,  0,  0, 18,
+	 0, 35, 51,  0,  0,  0,  0,  0,  0,  1,  0,  0, 52,  0,  0,  0,
+	 0, 49,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 32,  0,  0,  0,
+	 0,  0,  0,  0, 36,  0,  0,  0,  0,  0,  0,  2, 46, 11,  0,  0,
+	28,  0, 31,  0,  3, 43, 24, 21,  0,  0,  0,  0,  4,  0,  0, 42,
+	 0, 25,  0,  0,  0, 37,  0,  0,  0, 30,  0,  0,  0,  0,  0, 38,
+	 0,  0,  0,  8, 40,  0,  0, 10,  0,  0, 34,  0,  0,  0,  0, 23,
+	 0,  0,  0,  0,  5,  0, 48,  0, 39,  0,  0,  0,  0, 20,  0,  0,
+	 0,  0,  6,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+
+/**
+ * Compute perfect hash of known field names, case-insensitively.
+ *
+ * Field names are made of letters, digits and dashes only, hence we can
+ * turn them to lowercase by simply setting the 0x20 bit.
+ */
+static inline uint
+header_known_hash(const char *name, size_t len)
+{
+	const uchar *p = (const uchar *) name;
+	uint32 h = HEADER_KNOWN_SEED;
+
+	while (len-- != 0)
+		h = (h ^ (*p++ | 0x20)) * 0x01000193U;	/* FNV-1a prime */
+
+	return h >> 24;
+}
+
+/**
+ * Lookup field name among the known fields.
+ *
+ * @param name		the field name (not necessarily NUL-terminated)
+ * @param len		length of the field name
+ *
+ * @return the index of the field in header_known[], -1 if not a known one.
+ */
+static int
+header_known_index(const char *name, size_t len)
+{
+	const struct header_known_name *k;
+	uint slot;
+
+	slot = header_known_slot[header_known_hash(name, len)];
+	if (0 == slot)
+		return -1;
+
+	k = &header_known[slot - 1];
+	if (k->len != len || 0 != ascii_strncasecmp(name, k->name, len))
+		return -1;
+
+	return slot - 1;
+}
+
 enum header_magic { HEADER_MAGIC = 0x71b8484fU };
 
 /*
@@ -60,11 +201,16 @@ enum header_magic { HEADER_MAGIC = 0x71b8484fU };
  * The `fields' field holds a list of all the fields, in the order they
  * appeared.  The value is a header_field_t structure.  It allows one to
  * dump the header exactly as it was read.
+ *
+ * Fields whose name is listed in header_known[] bypass the hash table and
+ * are stored in the `known' array, at the index given by the perfect hash
+ * of their name.
  */
 
 struct header {
 	enum header_magic magic;
 	htable_t *headers;			/**< Indexed by name (case-insensitively) */
+	str_t *known[HEADER_KNOWN_COUNT];	/**< Values of known fields */
 	slist_t *fields;			/**< Ordered list of header_field_t */
 	int flags;					/**< Various operating flags */
 	int size;					/**< Total header size, in bytes */
@@ -105,6 +251,7 @@ typedef struct {
 	enum header_field magic;
 	char *name;					/**< Field name */
 	slist_t *lines;				/**< List of lines making this header */
+	str_t *value;				/**< Value held in the header object */
 } header_field_t;
 
 static inline void
@@ -162,17 +309,17 @@ header_num_lines(const header_t *h)
  ***/
 
 /**
- * Create a new empty header field, whose name is `name'.
- * A private copy of `name' is done.
+ * Create a new empty header field, whose name is the `len' first bytes
+ * of `name'.  A private copy of the name is done.
  */
 static header_field_t *
-hfield_make(const char *name)
+hfield_make(const char *name, size_t len)
 {
 	header_field_t *h;
 
 	WALLOC0(h);
 	h->magic = HEADER_FIELD_MAGIC;
-	h->name = h_strdup(name);
+	h->name = h_strndup(name, len);
 
 	return h;
 }
@@ -356,16 +503,46 @@ header_free_null(header_t **o_ptr)
 void
 header_reset(header_t *o)
 {
+	size_t i;
+
 	header_check(o);
 
 	if (o->headers != NULL) {
 		htable_foreach_remove(o->headers, free_header_data, NULL);
 		htable_free_null(&o->headers);
 	}
+	for (i = 0; i < HEADER_KNOWN_COUNT; i++) {
+		if (o->known[i] != NULL) {
+			str_destroy(o->known[i]);
+			o->known[i] = NULL;
+		}
+	}
 	slist_free_all(&o->fields, cast_to_free_fn(hfield_free));
 	o->flags = o->size = o->num_lines = 0;
 }
 
+/**
+ * Lookup value of field in the header.
+ *
+ * @return the value, NULL if the field is not present.
+ */
+static str_t *
+header_lookup(const header_t *o, const char *field)
+{
+	int idx;
+
+	header_check(o);
+
+	idx = header_known_index(field, strlen(field));
+	if (idx >= 0)
+		return o->known[idx];
+
+	if (o->headers)
+		return htable_lookup(o->headers, deconstify_char(field));
+
+	return NULL;
+}
+
 /**
  * Get field value, or NULL if not present.  The value returned is a
  * pointer to the internals of the header structure, so it must not be
@@ -374,16 +551,7 @@ header_reset(header_t *o)
 char *
 header_get(const header_t *o, const char *field)
 {
-	str_t *v;
-
-	header_check(o);
-
-	if (o->headers) {
-		v = htable_lookup(o->headers, deconstify_char(field));
-	} else {
-		v = NULL;
-	}
-	return str_2c(v);
+	return str_2c(header_lookup(o, field));
 }
 
 /**
@@ -399,13 +567,7 @@ header_get_extended(const header_t *o, const char *field, size_t *len_ptr)
 {
 	str_t *v;
 
-	header_check(o);
-
-	if (o->headers) {
-		v = htable_lookup(o->headers, deconstify_char(field));
-	} else {
-		v = NULL;
-	}
+	v = header_lookup(o, field);
 	if (v && len_ptr != NULL) {
 		*len_ptr = str_len(v);
 	}
@@ -413,19 +575,38 @@ header_get_extended(const header_t *o, const char *field, size_t *len_ptr)
 }
 
 /**
- * Add header line to the `headers' hash for specified field name.
+ * Add header line for the field whose name is given by the first `len'
+ * bytes of `field'.  Known fields are directly stored in their slot, the
+ * other ones being recorded in the `headers' hash.
  * A private copy of the `field' name and of the `text' data is made.
+ *
+ * @return the value held for the field.
  */
-static void
-add_header(header_t *o, const char *field, const char *text)
+static str_t *
+add_header(header_t *o, const char *field, size_t len, const char *text)
 {
-	htable_t *ht;
-	str_t *v;
+	str_t **vp, *v;
+	htable_t *ht = NULL;
+	int idx;
 
 	header_check(o);
 
-	ht = header_get_table(o);
-	v = htable_lookup(ht, field);
+	idx = header_known_index(field, len);
+	if (idx >= 0) {
+		vp = &o->known[idx];
+		v = *vp;
+	} else {
+		char key[MAX_LINE_SIZE];
+
+		g_assert(len < sizeof key);
+
+		memcpy(key, field, len);
+		key[len] = '\0';
+		ht = header_get_table(o);
+		v = htable_lookup(ht, key);
+		vp = NULL;
+	}
+
 	if (v) {
 		/*
 		 * Header already exists, according to RFC2616 we need to append
@@ -436,34 +617,18 @@ add_header(header_t *o, const char *field, const char *text)
 		str_cat(v, text);
 
 	} else {
-		char *key;
-
 		/*
-		 * Create a new header entry in the hash table.
+		 * Create a new header entry in the slot or in the hash table.
 		 */
 
-		key = h_strdup(field);
 		v = str_new_from(text);
-		htable_insert(ht, key, v);
+		if (vp != NULL)
+			*vp = v;
+		else
+			htable_insert(ht, h_strndup(field, len), v);
 	}
-}
-
-/**
- * Add continuation line to the `headers' hash for specified field name.
- * A private copy of the data is made.
- */
-static void
-add_continuation(header_t *o, const char *field, const char *text)
-{
-	str_t *v;
 
-	header_check(o);
-	g_assert(o->headers);
-
-	v = htable_lookup(o->headers, field);
-	g_assert(v != NULL);
-	str_putc(v, ' ');
-	str_cat(v, text);
+	return v;
 }
 
 /**
@@ -475,7 +640,6 @@ add_continuation(header_t *o, const char *field, const char *text)
 int
 header_append(header_t *o, const char *text, int len)
 {
-	char buf[MAX_LINE_SIZE];
 	const char *p = text;
 	uchar c;
 	header_field_t *hf;
@@ -559,16 +723,13 @@ header_append(header_t *o, const char *text, int len)
 
 		hf = slist_tail(o->fields);
 		hfield_append(hf, p);
-		add_continuation(o, hf->name, p);
+		str_putc(hf->value, ' ');		/* Also append to the value */
+		str_cat(hf->value, p);
 		o->size += len - (p - text);	/* Count only effective text */
 
-		/*
-		 * Also append the data in the hash table.
-		 */
-
 	} else {
-		char *b;
-		bool seen_space = FALSE;
+		const char *end = NULL;
+		size_t flen;
 
 		/*
 		 * It's a new header line.
@@ -580,47 +741,52 @@ header_append(header_t *o, const char *text, int len)
 		 * Parse header field.  Must be composed of ascii chars only.
 		 * (no control characters, no space, no ISO Latin or other extension).
 		 * The field name ends with ':', after possible white spaces.
+		 *
+		 * The name is tokenized in place: `end' is set to the first
+		 * trailing space, if any.
 		 */
 
-		for (b = buf, c = *p; c; c = *(++p)) {
-			if (c == ':') {
-				*b++ = '\0';			/* Reached end of field */
-				break;					/* Done, buf[] holds field name */
-			}
+		for (c = *p; c; c = *(++p)) {
+			if (c == ':')
+				break;					/* Reached end of field */
 			if (is_ascii_space(c)) {
-				seen_space = TRUE;		/* Only trailing spaces allowed */
+				if (NULL == end)
+					end = p;			/* Only trailing spaces allowed */
 				continue;
 			}
 			if (
-				seen_space || (c != '-' &&
+				end != NULL || (c != '-' &&
 					(!isascii(c) || is_ascii_cntrl(c) || is_ascii_punct(c)))
 			) {
 				o->flags |= HEAD_F_SKIP;
 				return HEAD_BAD_CHARS;
 			}
-			*b++ = c;
 		}
 
 		/*
-		 * If buf[] does not end with a NUL, we did not fully recognize
-		 * the header: we reached the end of the line without encountering
+		 * If we did not stop on a ':', we did not fully recognize the
+		 * header: we reached the end of the line without encountering
 		 * the ':' marker.
 		 *
-		 * If the buffer starts with a NUL char, it's also clearly malformed.
+		 * If the field name is empty, it's also clearly malformed, and
+		 * so is a name too long to be looked up by add_header().
 		 */
 
-		g_assert(b > buf || (b == buf && *text == '\0'));
+		if (NULL == end)
+			end = p;
+
+		flen = end - text;
 
-		if (b == buf || *(b-1) != '\0') {
+		if (0 == flen || flen >= MAX_LINE_SIZE || c != ':') {
 			o->flags |= HEAD_F_SKIP;
 			return HEAD_MALFORMED;
 		}
 
 		/*
-		 * We have a valid header field in buf[].
+		 * We have a valid header field in the first `flen' bytes of text.
 		 */
 
-		hf = hfield_make(buf);
+		hf = hfield_make(text, flen);
 
 		/*
 		 * Strip leading spaces in the value.
@@ -636,7 +802,7 @@ header_append(header_t *o, const char *text, int len)
 		 */
 
 		hfield_append(hf, p);
-		add_header(o, buf, p);
+		hf->value = add_header(o, text, flen, p);
 		if (!o->fields) {
 			o->fields = slist_new();
 		}
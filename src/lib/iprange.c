@@ -31,6 +31,12 @@
  * Lookup IP addresses from a set of IP ranges defined by a list of addresses
  * in CIDR (Classless Internet Domain Routing) format.
  *
+ * Several such sets can also be merged into a compiled map, associating a
+ * 32-bit attribute word to each address, where each set contributes its
+ * own bits.  The map is flattened into disjoint ranges, indexed by the
+ * leading 16 bits of the address, so that looking up an address costs a
+ * direct index access followed, at most, by a short binary search.
+ *
  * @author Raphael Manfredi
  * @date 2004, 2011
  * @author Christian Biere
@@ -39,6 +45,8 @@
 
 #include "common.h"
 
+#include "endian.h"
+#include "halloc.h"
 #include "host_addr.h"
 #include "iprange.h"
 #include "misc.h"			/* For bitcmp() */
@@ -46,6 +54,7 @@
 #include "sorted_array.h"
 #include "stringify.h"
 #include "walloc.h"
+#include "xsort.h"
 
 #include "override.h"		/* Must be the last header included */
 
@@ -53,6 +62,10 @@ enum iprange_db_magic {
    	IPRANGE_DB_MAGIC = 0x01b3a59e
 };
 
+enum iprange_map_magic {
+	IPRANGE_MAP_MAGIC = 0x4c0e1d97
+};
+
 /**
  * A CIDR network description for IPv4 addresses.
  */
@@ -438,4 +451,620 @@ iprange_get_host_count4(const struct iprange_db *idb)
 	return hosts;
 }
 
+/***
+ *** Compiled maps.
+ ***/
+
+#define IPRANGE_MAP_SHIFT	16		/**< Leading address bits indexed */
+#define IPRANGE_MAP_INDEX	(1U << IPRANGE_MAP_SHIFT)
+#define IPRANGE_MAP_DEPTH	130		/**< Max CIDR nesting, plus one */
+
+/**
+ * An address, as a 128-bit integer (IPv4 addresses only use the low part).
+ */
+struct iprange_key {
+	uint64 hi;
+	uint64 lo;
+};
+
+/**
+ * A CIDR network added to a map, as an inclusive range of addresses.
+ */
+struct iprange_block {
+	struct iprange_key start;	/**< First address in network */
+	struct iprange_key end;		/**< Last address in network */
+	uint32 attr;				/**< Attributes of the network */
+};
+
+/**
+ * A compiled range: addresses from start up to the start of the next range.
+ */
+struct iprange_seg {
+	struct iprange_key start;
+	uint32 attr;
+};
+
+struct iprange_blocks {
+	struct iprange_block *vec;
+	size_t count;
+	size_t capacity;
+};
+
+/*
+ * A compiled map, associating attributes to each address.
+ *
+ * Until the map is compiled, the networks are merely collected.  Compiling
+ * turns them into sorted disjoint ranges covering the whole address space,
+ * with index[i] giving the range holding the first address whose leading
+ * bits are "i", so that any address falls between the ranges at index[i]
+ * and index[i + 1] and most of the time, when both are equal, directly in
+ * the one at index[i].
+ */
+struct iprange_map {
+	enum iprange_map_magic magic;	/**< Magic number */
+	struct iprange_blocks b4;		/**< IPv4 networks, until compiled */
+	struct iprange_blocks b6;		/**< IPv6 networks, until compiled */
+	uint32 *start4;					/**< IPv4 range start */
+	uint32 *attr4;					/**< IPv4 range attributes */
+	uint32 *index4;					/**< IPv4 index */
+	struct iprange_key *start6;		/**< IPv6 range start */
+	uint32 *attr6;					/**< IPv6 range attributes */
+	uint32 *index6;					/**< IPv6 index */
+	size_t count4;					/**< Amount of IPv4 ranges */
+	size_t count6;					/**< Amount of IPv6 ranges */
+	unsigned compiled:1;			/**< Whether map was compiled */
+};
+
+static inline void
+iprange_map_check(const struct iprange_map * const map)
+{
+	g_assert(map != NULL);
+	g_assert(IPRANGE_MAP_MAGIC == map->magic);
+}
+
+static inline int
+iprange_key_cmp(const struct iprange_key *a, const struct iprange_key *b)
+{
+	return a->hi != b->hi ? CMP(a->hi, b->hi) : CMP(a->lo, b->lo);
+}
+
+static inline bool
+iprange_key_eq(const struct iprange_key *a, const struct iprange_key *b)
+{
+	return a->hi == b->hi && a->lo == b->lo;
+}
+
+/**
+ * Sort blocks by increasing start, larger blocks first.
+ */
+static int
+iprange_block_cmp(const void *p, const void *q)
+{
+	const struct iprange_block *a = p, *b = q;
+	int c;
+
+	c = iprange_key_cmp(&a->start, &b->start);
+	return 0 != c ? c : iprange_key_cmp(&b->end, &a->end);
+}
+
+/**
+ * Create a new empty map, to be filled before being compiled.
+ */
+struct iprange_map *
+iprange_map_new(void)
+{
+	struct iprange_map *map;
+
+	WALLOC0(map);
+	map->magic = IPRANGE_MAP_MAGIC;
+	return map;
+}
+
+/**
+ * Free the collected blocks.
+ */
+static void
+iprange_blocks_free(struct iprange_blocks *bl)
+{
+	HFREE_NULL(bl->vec);
+	bl->count = bl->capacity = 0;
+}
+
+/**
+ * Destroy map and nullify its pointer.
+ */
+void
+iprange_map_free(struct iprange_map **map_ptr)
+{
+	struct iprange_map *map = *map_ptr;
+
+	if (map != NULL) {
+		iprange_map_check(map);
+		iprange_blocks_free(&map->b4);
+		iprange_blocks_free(&map->b6);
+		HFREE_NULL(map->start4);
+		HFREE_NULL(map->attr4);
+		HFREE_NULL(map->index4);
+		HFREE_NULL(map->start6);
+		HFREE_NULL(map->attr6);
+		HFREE_NULL(map->index6);
+		map->magic = 0;
+		WFREE(map);
+		*map_ptr = NULL;
+	}
+}
+
+/**
+ * Record a new block.
+ */
+static void
+iprange_blocks_add(struct iprange_blocks *bl,
+	const struct iprange_key *start, const struct iprange_key *end,
+	uint32 attr)
+{
+	struct iprange_block *b;
+
+	if (bl->count == bl->capacity) {
+		bl->capacity = MAX(64, bl->capacity * 2);
+		HREALLOC_ARRAY(bl->vec, bl->capacity);
+	}
+
+	b = &bl->vec[bl->count++];
+	b->start = *start;
+	b->end = *end;
+	b->attr = attr;
+}
+
+/**
+ * Add the IPv4 network net/bits, ignoring trailing bits of the network.
+ */
+static void
+iprange_map_add4(struct iprange_map *map, uint32 net, unsigned bits,
+	uint32 attr)
+{
+	struct iprange_key start, end;
+	uint32 mask = cidr_to_netmask(bits);
+
+	start.hi = end.hi = 0;
+	start.lo = net & mask;
+	end.lo = (net & mask) | ~mask;
+
+	iprange_blocks_add(&map->b4, &start, &end, attr);
+}
+
+/**
+ * Add the IPv6 network net/bits, ignoring trailing bits of the network.
+ */
+static void
+iprange_map_add6(struct iprange_map *map, const uint8 *net, unsigned bits,
+	uint32 attr)
+{
+	struct iprange_key start, end;
+	uint64 hmask, lmask;
+
+	hmask = bits >= 64 ? MAX_INT_VAL(uint64) :
+		MAX_INT_VAL(uint64) << (64 - bits);
+	lmask = bits <= 64 ? 0 : MAX_INT_VAL(uint64) << (128 - bits);
+
+	start.hi = peek_be64(&net[0]) & hmask;
+	start.lo = peek_be64(&net[8]) & lmask;
+	end.hi = start.hi | ~hmask;
+	end.lo = start.lo | ~lmask;
+
+	iprange_blocks_add(&map->b6, &start, &end, attr);
+}
+
+/**
+ * Add CIDR IPv4 network to the map, with given attributes.
+ *
+ * Trailing bits in the network prefix are ignored.  Networks may overlap,
+ * addresses belonging to several networks getting the union of their
+ * attributes.
+ *
+ * @param map	the map being built
+ * @param net	the IPv4 network prefix
+ * @param bits	the amount of bits in the network prefix
+ * @param attr	the attribute bits of the network
+ *
+ * @return IPR_ERR_OK if successful, an error code otherwise.
+ */
+iprange_err_t
+iprange_map_add_cidr(struct iprange_map *map,
+	uint32 net, unsigned bits, uint32 attr)
+{
+	iprange_map_check(map);
+	g_assert(!map->compiled);
+	g_return_val_if_fail(bits > 0, IPR_ERR_BAD_PREFIX);
+	g_return_val_if_fail(bits <= 32, IPR_ERR_BAD_PREFIX);
+
+	iprange_map_add4(map, net, bits, attr);
+	return IPR_ERR_OK;
+}
+
+/**
+ * Add CIDR IPv6 network to the map, with given attributes.
+ *
+ * Trailing bits in the network prefix are ignored.  Networks may overlap,
+ * addresses belonging to several networks getting the union of their
+ * attributes.
+ *
+ * @param map	the map being built
+ * @param net	the IPv6 network prefix
+ * @param bits	the amount of bits in the network prefix
+ * @param attr	the attribute bits of the network
+ *
+ * @return IPR_ERR_OK if successful, an error code otherwise.
+ */
+iprange_err_t
+iprange_map_add_cidr6(struct iprange_map *map,
+	const uint8 *net, unsigned bits, uint32 attr)
+{
+	iprange_map_check(map);
+	g_assert(!map->compiled);
+	g_return_val_if_fail(bits > 0, IPR_ERR_BAD_PREFIX);
+	g_return_val_if_fail(bits <= 128, IPR_ERR_BAD_PREFIX);
+
+	iprange_map_add6(map, net, bits, attr);
+	return IPR_ERR_OK;
+}
+
+/**
+ * Add all the networks of a database to the map.
+ *
+ * Each address listed in the database gets the value associated with its
+ * network, shifted left by the specified amount, in its attributes.
+ *
+ * @param map	the map being built
+ * @param idb	the IP range database (must have been synced)
+ * @param shift	how many bits to shift the value left by
+ */
+void
+iprange_map_add_db(struct iprange_map *map,
+	const struct iprange_db *idb, unsigned shift)
+{
+	size_t i, n;
+
+	iprange_map_check(map);
+	iprange_db_check(idb);
+	g_assert(!map->compiled);
+	g_assert(!idb->tab4_unsorted && !idb->tab6_unsorted);
+	g_assert(shift < 32);
+
+	n = sorted_array_size(idb->tab4);
+	for (i = 0; i < n; i++) {
+		const struct iprange_net4 *item = sorted_array_item(idb->tab4, i);
+		iprange_map_add4(map, item->ip, item->bits,
+			(uint32) item->value << shift);
+	}
+
+	n = sorted_array_size(idb->tab6);
+	for (i = 0; i < n; i++) {
+		const struct iprange_net6 *item = sorted_array_item(idb->tab6, i);
+		iprange_map_add6(map, item->ip, item->bits,
+			(uint32) item->value << shift);
+	}
+}
+
+/**
+ * Append a compiled range, merging it with the previous one when possible.
+ */
+static void
+iprange_seg_emit(struct iprange_seg **segs, size_t *count, size_t *capacity,
+	const struct iprange_key *start, uint32 attr)
+{
+	size_t n = *count;
+
+	/*
+	 * A range starting at the same address as the previous one supersedes
+	 * it, and there is no need to start a new range with the attributes
+	 * the previous range already has.
+	 */
+
+	if (n != 0 && iprange_key_eq(&(*segs)[n - 1].start, start))
+		n--;
+
+	if (n != 0 && (*segs)[n - 1].attr == attr) {
+		*count = n;
+		return;
+	}
+
+	if (n == *capacity) {
+		*capacity = MAX(64, *capacity * 2);
+		HREALLOC_ARRAY(*segs, *capacity);
+	}
+
+	(*segs)[n].start = *start;
+	(*segs)[n].attr = attr;
+	*count = n + 1;
+}
+
+/**
+ * Flatten the collected blocks into sorted disjoint ranges covering the
+ * whole address space, up to the "top" address.
+ *
+ * Because CIDR networks are either disjoint or nested, the blocks sorted
+ * by increasing start and decreasing size can be processed with a stack
+ * holding the nested networks covering the current address, along with
+ * the union of their attributes.
+ *
+ * @return the allocated ranges, their amount being written in ``count''.
+ */
+static struct iprange_seg *
+iprange_blocks_flatten(struct iprange_blocks *bl,
+	const struct iprange_key *top, size_t *count)
+{
+	const struct iprange_block *stack[IPRANGE_MAP_DEPTH];
+	uint32 acc[IPRANGE_MAP_DEPTH];
+	struct iprange_seg *segs = NULL;
+	struct iprange_key zero;
+	size_t i, j, n = 0, capacity = 0, sp = 0;
+
+	/*
+	 * Sort blocks and merge duplicate networks, so that the nesting depth
+	 * is bounded by the amount of distinct prefix lengths.
+	 */
+
+	if (bl->count > 1)
+		xqsort(bl->vec, bl->count, sizeof bl->vec[0], iprange_block_cmp);
+
+	for (i = j = 0; i < bl->count; i++) {
+		if (
+			j != 0 &&
+			iprange_key_eq(&bl->vec[j - 1].start, &bl->vec[i].start) &&
+			iprange_key_eq(&bl->vec[j - 1].end, &bl->vec[i].end)
+		) {
+			bl->vec[j - 1].attr |= bl->vec[i].attr;
+		} else {
+			bl->vec[j++] = bl->vec[i];
+		}
+	}
+	bl->count = j;
+
+	ZERO(&zero);
+	iprange_seg_emit(&segs, &n, &capacity, &zero, 0);
+
+	for (i = 0; i <= bl->count; i++) {
+		const struct iprange_block *b = i < bl->count ? &bl->vec[i] : NULL;
+
+		/*
+		 * Close all the networks ending before the new block starts.
+		 * The address following a closed network is covered by the
+		 * networks remaining on the stack.
+		 */
+
+		while (
+			sp != 0 &&
+			(NULL == b || iprange_key_cmp(&stack[sp - 1]->end, &b->start) < 0)
+		) {
+			struct iprange_key next = stack[--sp]->end;
+
+			if (0 == ++next.lo)
+				next.hi++;
+
+			/*
+			 * Nothing follows a network ending at the top address, the
+			 * next address then being beyond the top or wrapping to 0.
+			 */
+
+			if (
+				iprange_key_cmp(&next, top) <= 0 &&
+				!iprange_key_eq(&next, &zero)
+			) {
+				iprange_seg_emit(&segs, &n, &capacity, &next,
+					0 == sp ? 0 : acc[sp - 1]);
+			}
+		}
+
+		if (NULL == b)
+			break;
+
+		g_assert(sp < G_N_ELEMENTS(stack));
+		g_assert(0 == sp || iprange_key_cmp(&stack[sp - 1]->end, &b->end) >= 0);
+
+		acc[sp] = b->attr | (0 == sp ? 0 : acc[sp - 1]);
+		stack[sp++] = b;
+		iprange_seg_emit(&segs, &n, &capacity, &b->start, acc[sp - 1]);
+	}
+
+	iprange_blocks_free(bl);
+
+	*count = n;
+	return segs;
+}
+
+/**
+ * Compile the collected networks.
+ *
+ * Once compiled, no further networks can be added to the map.
+ */
+void
+iprange_map_compile(struct iprange_map *map)
+{
+	struct iprange_seg *segs;
+	struct iprange_key top;
+	size_t i, j, n;
+
+	iprange_map_check(map);
+	g_assert(!map->compiled);
+
+	/*
+	 * IPv4 ranges.
+	 */
+
+	top.hi = 0;
+	top.lo = MAX_INT_VAL(uint32);
+	segs = iprange_blocks_flatten(&map->b4, &top, &n);
+
+	HALLOC_ARRAY(map->start4, n);
+	HALLOC_ARRAY(map->attr4, n);
+	HALLOC_ARRAY(map->index4, IPRANGE_MAP_INDEX + 1);
+
+	for (i = 0; i < n; i++) {
+		map->start4[i] = segs[i].start.lo;
+		map->attr4[i] = segs[i].attr;
+	}
+
+	for (i = j = 0; i < IPRANGE_MAP_INDEX; i++) {
+		uint32 addr = (uint32) i << (32 - IPRANGE_MAP_SHIFT);
+
+		while (j + 1 < n && map->start4[j + 1] <= addr)
+			j++;
+		map->index4[i] = j;
+	}
+	map->index4[IPRANGE_MAP_INDEX] = n - 1;
+	map->count4 = n;
+	HFREE_NULL(segs);
+
+	/*
+	 * IPv6 ranges.
+	 */
+
+	top.hi = top.lo = MAX_INT_VAL(uint64);
+	segs = iprange_blocks_flatten(&map->b6, &top, &n);
+
+	HALLOC_ARRAY(map->start6, n);
+	HALLOC_ARRAY(map->attr6, n);
+	HALLOC_ARRAY(map->index6, IPRANGE_MAP_INDEX + 1);
+
+	for (i = 0; i < n; i++) {
+		map->start6[i] = segs[i].start;
+		map->attr6[i] = segs[i].attr;
+	}
+
+	for (i = j = 0; i < IPRANGE_MAP_INDEX; i++) {
+		struct iprange_key addr;
+
+		addr.hi = (uint64) i << (64 - IPRANGE_MAP_SHIFT);
+		addr.lo = 0;
+
+		while (j + 1 < n && iprange_key_cmp(&map->start6[j + 1], &addr) <= 0)
+			j++;
+		map->index6[i] = j;
+	}
+	map->index6[IPRANGE_MAP_INDEX] = n - 1;
+	map->count6 = n;
+	HFREE_NULL(segs);
+
+	map->compiled = TRUE;
+}
+
+/**
+ * Retrieve attributes associated with an IPv4 address.
+ *
+ * @param map	the compiled map
+ * @param ip	the IPv4 address to lookup
+ *
+ * @return the union of the attributes of all the networks holding the
+ * address, 0 if none.
+ */
+uint32
+iprange_map_get(const struct iprange_map *map, uint32 ip)
+{
+	size_t lo, hi;
+	uint32 i = ip >> (32 - IPRANGE_MAP_SHIFT);
+
+	iprange_map_check(map);
+	g_assert(map->compiled);
+
+	lo = map->index4[i];
+	hi = map->index4[i + 1];
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo + 1) / 2;
+
+		if (map->start4[mid] <= ip)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return map->attr4[lo];
+}
+
+/**
+ * Retrieve attributes associated with an IPv6 address.
+ *
+ * @param map	the compiled map
+ * @param ip6	the IPv6 address to lookup
+ *
+ * @return the union of the attributes of all the networks holding the
+ * address, 0 if none.
+ */
+uint32
+iprange_map_get6(const struct iprange_map *map, const uint8 *ip6)
+{
+	struct iprange_key key;
+	size_t lo, hi;
+	uint32 i;
+
+	iprange_map_check(map);
+	g_assert(map->compiled);
+
+	key.hi = peek_be64(&ip6[0]);
+	key.lo = peek_be64(&ip6[8]);
+	i = key.hi >> (64 - IPRANGE_MAP_SHIFT);
+
+	lo = map->index6[i];
+	hi = map->index6[i + 1];
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo + 1) / 2;
+
+		if (iprange_key_cmp(&map->start6[mid], &key) <= 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return map->attr6[lo];
+}
+
+/**
+ * Retrieve attributes associated with an IP address.
+ *
+ * IPv4-mapped and tunneled IPv6 addresses are looked up as the IPv4
+ * address they stand for, as iprange_get_addr() does.
+ *
+ * @param map	the compiled map
+ * @param ha	the IP address to lookup
+ *
+ * @return the union of the attributes of all the networks holding the
+ * address, 0 if none.
+ */
+uint32
+iprange_map_get_addr(const struct iprange_map *map, const host_addr_t ha)
+{
+	host_addr_t to;
+
+	if (
+		host_addr_convert(ha, &to, NET_TYPE_IPV4) ||
+		host_addr_tunnel_client(ha, &to)
+	) {
+		return iprange_map_get(map, host_addr_ipv4(to));
+	} else if (host_addr_is_ipv6(ha)) {
+		return iprange_map_get6(map, host_addr_ipv6(&ha));
+	}
+	return 0;
+}
+
+/**
+ * @return the amount of distinct IPv4 ranges in the compiled map.
+ */
+size_t
+iprange_map_range_count4(const struct iprange_map *map)
+{
+	iprange_map_check(map);
+	return map->count4;
+}
+
+/**
+ * @return the amount of distinct IPv6 ranges in the compiled map.
+ */
+size_t
+iprange_map_range_count6(const struct iprange_map *map)
+{
+	iprange_map_check(map);
+	return map->count6;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
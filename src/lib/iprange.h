@@ -66,6 +66,24 @@ unsigned iprange_get_item_count6(const struct iprange_db *idb);
 
 unsigned iprange_get_host_count4(const struct iprange_db *idb);
 
+struct iprange_map;
+
+struct iprange_map *iprange_map_new(void);
+iprange_err_t iprange_map_add_cidr(
+	struct iprange_map *map, uint32 net, unsigned bits, uint32 attr);
+iprange_err_t iprange_map_add_cidr6(
+	struct iprange_map *map, const uint8 *net, unsigned bits, uint32 attr);
+void iprange_map_add_db(struct iprange_map *map,
+	const struct iprange_db *idb, unsigned shift);
+void iprange_map_compile(struct iprange_map *map);
+uint32 iprange_map_get(const struct iprange_map *map, uint32 ip);
+uint32 iprange_map_get6(const struct iprange_map *map, const uint8 *ip6);
+uint32 iprange_map_get_addr(const struct iprange_map *map,
+	const host_addr_t ha);
+size_t iprange_map_range_count4(const struct iprange_map *map);
+size_t iprange_map_range_count6(const struct iprange_map *map);
+void iprange_map_free(struct iprange_map **map_ptr);
+
 #endif	/* _iprange_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
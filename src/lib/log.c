@@ -64,12 +64,14 @@
 #include "atomic.h"
 #include "atoms.h"
 #include "ckalloc.h"
+#include "compat_sleep_ms.h"
 #include "crash.h"
 #include "fd.h"				/* For is_valid_fd() */
 #include "glog.h"
 #include "halloc.h"
 #include "hashing.h"		/* For string_mix_hash() and string_eq() */
 #include "hashtable.h"
+#include "mutex.h"
 #include "offtime.h"
 #include "once.h"
 #include "signal.h"
@@ -79,6 +81,7 @@
 #include "stringify.h"
 #include "thread.h"
 #include "tm.h"
+#include "vmm.h"
 #include "walloc.h"
 
 #include "override.h"		/* Must be the last header included */
@@ -634,6 +637,452 @@ log_printable(enum log_file which)
 	return TRUE;
 }
 
+/*
+ * Asynchronous logging.
+ *
+ * When enabled, regular messages emitted to stderr are not written by the
+ * logging thread: they are copied to a ring buffer private to that thread
+ * and a dedicated logger thread periodically collects all the pending lines
+ * and writes them in batch with writev().
+ *
+ * Each ring has a single producer (the thread owning it) and is only drained
+ * by the thread holding ``log_async_drainer'', so the head and tail indices
+ * can be updated without locks: the producer only moves the head, the
+ * consumer only moves the tail.
+ *
+ * Draining writes to stderr, which can block for an unbounded amount of
+ * time (paused pipe, full terminal), hence ``log_async_drainer'' is not a
+ * spinlock: threads waiting to drain the rings sleep instead of spinning,
+ * which would trigger the spinlock deadlock detection.
+ *
+ * The logger thread is started and stopped under ``log_async_mtx'', which
+ * is never taken on the logging path, hence messages can be logged whilst
+ * the thread is being created.
+ *
+ * Critical messages, fatal errors, messages logged from signal handlers and
+ * those emitted whilst crashing are still written synchronously, after
+ * flushing the pending asynchronous lines.
+ */
+
+#define LOG_ASYNC_RING		(64 * 1024)	/**< Per-thread ring buffer size */
+#define LOG_ASYNC_PERIOD	100			/**< Logger wakeup period (ms) */
+#define LOG_ASYNC_IOV		32			/**< Max I/O vectors per writev() */
+#define LOG_ASYNC_STACK		THREAD_STACK_MIN
+
+/**
+ * Per-thread ring buffer.
+ */
+struct logring {
+	volatile size_t head;		/**< Total bytes written by producer */
+	volatile size_t tail;		/**< Total bytes consumed by logger */
+	char buf[LOG_ASYNC_RING];	/**< Ring buffer */
+};
+
+static struct logring *log_rings[THREAD_MAX];
+static enum log_async_mode log_async;
+static spinlock_t log_async_slk = SPINLOCK_INIT;
+static atomic_lock_t log_async_drainer;	/**< Held whilst draining rings */
+static mutex_t log_async_mtx = MUTEX_INIT;
+static uint log_async_id;				/**< Logger thread ID */
+static bool log_async_running;			/**< Whether logger thread runs */
+static bool log_async_started;			/**< Logger thread not joined yet */
+static struct log_async_stats log_async_stats;
+
+/**
+ * Get ring buffer for thread, allocating it if needed.
+ *
+ * @return the ring buffer, NULL if we cannot allocate it.
+ */
+static struct logring *
+log_async_ring(uint stid)
+{
+	struct logring *r;
+
+	g_assert(stid < G_N_ELEMENTS(log_rings));
+
+	r = log_rings[stid];
+
+	if G_UNLIKELY(NULL == r) {
+		/*
+		 * The ring is only allocated by its owning thread, and remains
+		 * attached to the thread small ID, which is reused by another
+		 * thread only after the previous one has exited.
+		 */
+
+		r = vmm_core_alloc_not_leaking(sizeof *r);
+		if (NULL == r)
+			return NULL;
+		r->head = r->tail = 0;
+		atomic_mb();
+		log_rings[stid] = r;
+	}
+
+	return r;
+}
+
+/**
+ * Write the pending data of the rings to the stderr log file.
+ *
+ * Only the data that could be written is consumed from the rings, and we
+ * retry until everything has been written or an error occurs.
+ *
+ * @param fd		the file descriptor of the stderr log file
+ * @param rings		the rings to write
+ * @param heads		the head of each ring, where data to write ends
+ * @param n			amount of rings
+ * @param safe		if TRUE, we're crashing: bypass atio_writev()
+ */
+static void
+log_async_write(int fd, struct logring **rings, const size_t *heads, uint n,
+	bool safe)
+{
+	iovec_t iov[LOG_ASYNC_IOV];
+
+	g_assert(n <= G_N_ELEMENTS(iov) / 2);
+
+	for (;;) {
+		uint i, cnt = 0;
+		size_t len = 0;
+		ssize_t w;
+
+		for (i = 0; i < n; i++) {
+			struct logring *r = rings[i];
+			size_t start = r->tail % LOG_ASYNC_RING;
+			size_t rlen = heads[i] - r->tail;
+
+			if (0 == rlen)
+				continue;
+
+			if (start + rlen > LOG_ASYNC_RING) {
+				size_t first = LOG_ASYNC_RING - start;
+				iovec_set(&iov[cnt++], &r->buf[start], first);
+				iovec_set(&iov[cnt++], &r->buf[0], rlen - first);
+			} else {
+				iovec_set(&iov[cnt++], &r->buf[start], rlen);
+			}
+			len += rlen;
+		}
+
+		if (0 == cnt)
+			break;
+
+		if (safe)
+			w = writev(fd, iov, cnt);
+		else
+			w = atio_writev(fd, iov, cnt);
+
+		log_async_stats.writes++;
+
+		/*
+		 * On errors, discard the pending data since it cannot be written.
+		 */
+
+		if G_UNLIKELY(w <= 0) {
+			if (-1 == w && EINTR == errno)
+				continue;
+			w = len;
+		}
+
+		atomic_mb();	/* Data was consumed before moving tails */
+
+		for (i = 0; i < n && w != 0; i++) {
+			struct logring *r = rings[i];
+			size_t used = MIN(UNSIGNED(w), heads[i] - r->tail);
+
+			r->tail += used;
+			w -= used;
+		}
+	}
+}
+
+/**
+ * Drain all the ring buffers to the stderr log file.
+ *
+ * @param safe		if TRUE, we're crashing: don't wait for the lock and
+ *					bypass atio_writev()
+ */
+static void
+log_async_drain(bool safe)
+{
+	struct logring *rings[LOG_ASYNC_IOV / 2];
+	size_t heads[LOG_ASYNC_IOV / 2];
+	uint i, n = 0;
+	int fd;
+	bool locked;
+
+	locked = atomic_acquire(&log_async_drainer);
+
+	if (!safe) {
+		while (!locked) {
+			compat_sleep_ms(1);
+			locked = atomic_acquire(&log_async_drainer);
+		}
+	}
+
+	fd = log_get_fd(LOG_STDERR);
+
+	for (i = 0; i <= G_N_ELEMENTS(log_rings); i++) {
+		struct logring *r = i < G_N_ELEMENTS(log_rings) ? log_rings[i] : NULL;
+
+		if (r != NULL) {
+			size_t head = r->head;
+
+			atomic_mb();	/* Read data after the head index */
+
+			if (head != r->tail) {
+				rings[n] = r;
+				heads[n++] = head;
+			}
+		}
+
+		/*
+		 * Write when we cannot add another ring or when we're done.
+		 */
+
+		if (
+			n != 0 &&
+			(n == G_N_ELEMENTS(rings) || i == G_N_ELEMENTS(log_rings))
+		) {
+			log_async_write(fd, rings, heads, n, safe);
+			n = 0;
+		}
+	}
+
+	if (locked)
+		atomic_release(&log_async_drainer);
+}
+
+/**
+ * Append formatted log line to the thread's ring buffer.
+ *
+ * @return TRUE if the line was handled, FALSE if it must be written now.
+ */
+static bool
+log_async_append(uint stid, const iovec_t *iov, uint iovcnt)
+{
+	struct logring *r;
+	size_t len = 0, head, used;
+	uint i;
+
+	if G_UNLIKELY(!log_async_running || stid == log_async_id)
+		return FALSE;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iovec_len(&iov[i]);
+	}
+
+	if G_UNLIKELY(len > LOG_ASYNC_RING / 2)
+		return FALSE;
+
+	r = log_async_ring(stid);
+	if G_UNLIKELY(NULL == r)
+		return FALSE;
+
+	head = r->head;
+
+	for (;;) {
+		used = head - r->tail;
+
+		if G_LIKELY(used + len <= LOG_ASYNC_RING)
+			break;
+
+		if (LOG_ASYNC_DROP == log_async) {
+			atomic_uint_inc(&log_async_stats.dropped);
+			return TRUE;
+		}
+
+		/*
+		 * Blocking mode: wake up the logger and wait for it to drain us.
+		 */
+
+		atomic_uint_inc(&log_async_stats.blocked);
+		thread_unblock(log_async_id);
+		compat_sleep_ms(1);
+
+		if G_UNLIKELY(!log_async_running)
+			return FALSE;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		const char *p = iovec_base(&iov[i]);
+		size_t n = iovec_len(&iov[i]);
+
+		while (n != 0) {
+			size_t start = head % LOG_ASYNC_RING;
+			size_t chunk = MIN(n, LOG_ASYNC_RING - start);
+
+			memcpy(&r->buf[start], p, chunk);
+			p += chunk;
+			n -= chunk;
+			head += chunk;
+		}
+	}
+
+	atomic_mb();	/* Data must be visible before the new head */
+	r->head = head;
+	atomic_uint_inc(&log_async_stats.lines);
+
+	/*
+	 * Wake up the logger early when the ring gets half full.
+	 */
+
+	if G_UNLIKELY(used < LOG_ASYNC_RING / 2 && used + len >= LOG_ASYNC_RING / 2)
+		thread_unblock(log_async_id);
+
+	return TRUE;
+}
+
+/**
+ * The logger thread.
+ */
+static void *
+log_async_main(void *unused_arg)
+{
+	(void) unused_arg;
+
+	thread_set_name("logger");
+
+	while (LOG_ASYNC_OFF != log_async) {
+		unsigned events = thread_block_prepare();
+		tm_t period;
+
+		log_async_drain(FALSE);
+
+		period.tv_sec = 0;
+		period.tv_usec = LOG_ASYNC_PERIOD * 1000;
+		thread_timed_block_self(events, &period);
+	}
+
+	atomic_bool_set(&log_async_running, FALSE);
+	log_async_drain(FALSE);
+
+	return NULL;
+}
+
+/**
+ * Synchronously flush all the pending asynchronous log messages.
+ *
+ * This is safe to call from the crash handler.
+ */
+void
+log_async_flush(void)
+{
+	if (log_async_running || LOG_ASYNC_OFF != log_async)
+		log_async_drain(NULL != log_str || signal_in_handler());
+}
+
+/**
+ * Configure asynchronous logging mode.
+ *
+ * @param mode		LOG_ASYNC_OFF, LOG_ASYNC_DROP or LOG_ASYNC_BLOCK
+ */
+void
+log_async_set(enum log_async_mode mode)
+{
+	g_assert(LOG_ASYNC_OFF == mode ||
+		LOG_ASYNC_DROP == mode || LOG_ASYNC_BLOCK == mode);
+
+	/*
+	 * The state is changed under the spinlock, but the logger thread is
+	 * created and joined outside of it, under a mutex that is never taken
+	 * when logging, so that messages can be logged meanwhile.
+	 */
+
+	mutex_lock(&log_async_mtx);
+
+	spinlock(&log_async_slk);
+	log_async = mode;
+	spinunlock(&log_async_slk);
+
+	if (LOG_ASYNC_OFF == mode) {
+		/*
+		 * Wait for the logger thread to exit, so that it cannot still be
+		 * running when asynchronous logging is turned back on.
+		 */
+
+		if (log_async_started) {
+			thread_unblock(log_async_id);
+			if (-1 == thread_join(log_async_id, NULL)) {
+				s_warning("%s(): cannot join logger thread: %m",
+					G_STRFUNC);
+			}
+			log_async_started = FALSE;
+		}
+	} else if (!log_async_started) {
+		int r;
+
+		r = thread_create(log_async_main, NULL,
+				THREAD_F_NO_CANCEL | THREAD_F_NO_POOL, LOG_ASYNC_STACK);
+
+		if (-1 == r) {
+			spinlock(&log_async_slk);
+			log_async = LOG_ASYNC_OFF;
+			spinunlock(&log_async_slk);
+			mutex_unlock(&log_async_mtx);
+			s_warning("%s(): cannot create logger thread: %m", G_STRFUNC);
+			return;
+		}
+
+		log_async_id = r;
+		log_async_started = TRUE;
+		atomic_bool_set(&log_async_running, TRUE);
+	}
+
+	mutex_unlock(&log_async_mtx);
+
+	/*
+	 * The logger thread is gone, but lines may have been appended after its
+	 * last drain, by producers that saw it running.
+	 */
+
+	if (LOG_ASYNC_OFF == mode)
+		log_async_drain(FALSE);
+}
+
+/**
+ * @return current asynchronous logging mode.
+ */
+enum log_async_mode
+log_async_get(void)
+{
+	return log_async;
+}
+
+/**
+ * Fill supplied structure with asynchronous logging statistics.
+ */
+void
+log_async_stats_get(struct log_async_stats *buf)
+{
+	g_assert(buf != NULL);
+
+	*buf = log_async_stats;		/* Struct copy */
+}
+
+/**
+ * Should a message with given level be logged asynchronously?
+ */
+static inline bool
+log_async_level(GLogLevelFlags level)
+{
+	return LOG_ASYNC_OFF != log_async && NULL == log_str &&
+		0 == (level & (
+			G_LOG_FLAG_FATAL	|	G_LOG_LEVEL_CRITICAL |
+			G_LOG_LEVEL_ERROR	|	LOG_FLAG_COPY
+		));
+}
+
+/**
+ * Flush pending asynchronous messages before logging synchronously from
+ * given thread, to preserve the ordering of its messages.
+ */
+static inline void
+log_async_sync(uint stid)
+{
+	if G_UNLIKELY(LOG_ASYNC_OFF != log_async && stid != log_async_id)
+		log_async_flush();
+}
+
 /**
  * Emit log message.
  */
@@ -645,7 +1094,8 @@ log_fprint(enum log_file which, const struct tm *ct, long usec,
 	char buf[32];
 	const char *tprefix;
 	str_t *ls;
-	ssize_t w;
+	ssize_t w = 0;
+	bool queued = FALSE;
 
 #define FORMAT_STR	"%02d-%02d-%02d %.02d:%.02d:%.02d.%03ld (%s)%s%s: %s\n"
 
@@ -688,7 +1138,18 @@ log_fprint(enum log_file which, const struct tm *ct, long usec,
 	 * the file.  Hence use our own atio_write() routine.
 	 */
 
-	w = atio_write(fileno(lf->f), str_2c(ls), str_len(ls));
+	if (LOG_STDERR == which) {
+		if (log_async_level(level) && !signal_in_handler()) {
+			iovec_t iov;
+			iovec_set(&iov, str_2c(ls), str_len(ls));
+			queued = log_async_append(stid, &iov, 1);
+		}
+		if (!queued)
+			log_async_sync(stid);
+	}
+
+	if (!queued)
+		w = atio_write(fileno(lf->f), str_2c(ls), str_len(ls));
 
 	if G_UNLIKELY((ssize_t) -1 == w) {
 		lf->ioerror = TRUE;
@@ -1146,7 +1607,14 @@ s_logv(logthread_t *lt, GLogLevelFlags level, const char *format, va_list args)
 		print_str(": ");		/* 8 */
 		print_str(str_2c(msg));	/* 9 */
 		print_str("\n");		/* 10 */
-		log_flush_err_atomic();
+
+		if (
+			!log_async_level(level) || in_signal_handler || NULL == lt ||
+			!log_async_append(stid, print_str_iov_, print_str_iov_cnt_)
+		) {
+			log_async_sync(stid);
+			log_flush_err_atomic();
+		}
 
 		if G_UNLIKELY(
 			level & (
@@ -2437,6 +2905,7 @@ log_crashing(struct str *str)
 	g_assert(str != NULL);
 
 	log_str = str;
+	log_async_flush();
 }
 
 /**
@@ -2495,6 +2964,8 @@ log_close(void)
 {
 	size_t i;
 
+	log_async_set(LOG_ASYNC_OFF);
+
 	for (i = 0; i < G_N_ELEMENTS(logfile); i++) {
 		struct logfile *lf = &logfile[i];
 
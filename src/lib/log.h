@@ -52,6 +52,25 @@ struct logstat {
 	unsigned need_reopen:1;	/**< Logfile pending a reopen */
 };
 
+/**
+ * Asynchronous logging modes.
+ */
+enum log_async_mode {
+	LOG_ASYNC_OFF = 0,		/**< Synchronous logging */
+	LOG_ASYNC_DROP,			/**< Asynchronous, drop lines when buffer full */
+	LOG_ASYNC_BLOCK			/**< Asynchronous, wait when buffer full */
+};
+
+/**
+ * Asynchronous logging statistics.
+ */
+struct log_async_stats {
+	uint lines;				/**< Lines queued */
+	uint dropped;			/**< Lines dropped because buffer was full */
+	uint blocked;			/**< Times a thread waited for buffer space */
+	uint writes;			/**< Batched writes done by logger */
+};
+
 struct logagent;
 typedef struct logagent logagent_t;
 
@@ -83,6 +102,10 @@ bool log_file_printable(const FILE *out);
 void log_set_duplicate(enum log_file which, int dupfd);
 void log_force_fd(enum log_file which, int fd);
 int log_get_fd(enum log_file which);
+void log_async_set(enum log_async_mode mode);
+enum log_async_mode log_async_get(void);
+void log_async_flush(void);
+void log_async_stats_get(struct log_async_stats *buf);
 
 /*
  * Safe logging interface (to avoid recursive logging, or from signal handlers).
@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sampling allocation profiler.
+ *
+ * When enabled, the allocators (walloc(), halloc() and xmalloc()) report
+ * each allocation through memprof_sample().  Every thread maintains a byte
+ * countdown and when it expires, the stack of the allocating routine is
+ * captured and accounted to its call site.  The countdown is reset to a
+ * random value averaging the configured period, so that periodic allocation
+ * patterns cannot systematically escape sampling.
+ *
+ * An allocation of ``size'' bytes made with a sampling period of ``period''
+ * bytes is sampled with a probability of roughly size / period, hence each
+ * sample stands for MAX(size, period) bytes: this is what we accumulate to
+ * estimate the amount of memory allocated at each call site.
+ *
+ * The cost when profiling is disabled is a test on a global variable in
+ * the allocators.  When enabled, the cost is a subtraction per allocation
+ * plus a stack unwinding for each sample.
+ *
+ * Since sampling may allocate memory (stack atoms, hash table growth), the
+ * code guards against recursion on a per-thread basis: allocations made by
+ * the profiler itself are not sampled.
+ *
+ * Likewise, an allocator using another allocator to get its memory flags
+ * the thread with memprof_nest(), so that only the outermost allocator
+ * samples the allocation.  When capturing the stack, the frames of the
+ * allocators and of their wrappers are skipped by name, so that the call
+ * site is the routine requesting memory regardless of how the allocators
+ * were inlined or nested.
+ *
+ * Results can be dumped as a table sorted by decreasing estimated amount of
+ * allocated bytes, or in the legacy heap profile format understood by pprof.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "memprof.h"
+
+#include "hashtable.h"
+#include "log.h"
+#include "misc.h"
+#include "mutex.h"
+#include "random.h"
+#include "stacktrace.h"
+#include "str.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "unsigned.h"
+#include "vsort.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define MEMPROF_MAPS	"/proc/self/maps"
+#define MEMPROF_SKIP	16		/**< Max amount of allocator frames skipped */
+
+/**
+ * Allocation statistics for a given call site.
+ */
+struct memprof_site {
+	const struct stackatom *frame;	/**< Allocating call site (atom) */
+	uint64 samples;					/**< Amount of samples taken */
+	uint64 bytes;					/**< Sum of sampled allocation sizes */
+	uint64 estimated;				/**< Estimated amount of bytes allocated */
+	size_t max;						/**< Largest sampled allocation */
+	uint64 count[MEMPROF_ALLOC_COUNT];	/**< Samples per allocator */
+};
+
+static const char *memprof_alloc_name[] = {
+	"walloc",		/* MEMPROF_WALLOC */
+	"halloc",		/* MEMPROF_HALLOC */
+	"xmalloc",		/* MEMPROF_XMALLOC */
+};
+
+/**
+ * Allocators skipped when looking for the allocating call site.
+ */
+static const char *memprof_allocators[] = {
+	"walloc",
+	"walloc0",
+	"walloc_raw",
+	"walloc_track",
+	"walloc0_track",
+	"wcopy_track",
+	"halloc",
+	"halloc0",
+	"halloc_track",
+	"halloc0_track",
+	"h_strdup",
+	"h_strndup",
+	"h_strconcat",
+	"h_strjoinv",
+	"h_strdup_vprintf",
+	"h_strdup_len_vprintf",
+	"xmalloc",
+	"xmalloc0",
+	"xcalloc",
+	"xcopy",
+	"xstrdup",
+	"xstrndup",
+};
+
+size_t memprof_period;					/**< Sampling period, 0 if off */
+
+static hash_table_t *memprof_sites;		/**< stackatom -> memprof_site */
+static mutex_t memprof_lock = MUTEX_INIT;
+static time_t memprof_start;			/**< When profiling started */
+static uint64 memprof_samples;			/**< Total amount of samples */
+static uint64 memprof_estimated;		/**< Total estimated bytes */
+static size_t memprof_recursions;		/**< Allocations made by profiler */
+
+/*
+ * Per-thread sampling state, indexed by thread small ID.
+ */
+static ssize_t memprof_countdown[THREAD_MAX];
+static bool memprof_busy[THREAD_MAX];
+static bool memprof_nested[THREAD_MAX];
+
+#define MEMPROF_LOCK		mutex_lock_hidden(&memprof_lock)
+#define MEMPROF_UNLOCK		mutex_unlock_hidden(&memprof_lock)
+
+/**
+ * @return amount of bytes to allocate before taking the next sample.
+ */
+static ssize_t
+memprof_next_sample(size_t period)
+{
+	size_t range = MIN(2 * period, MAX_INT_VAL(uint32));
+
+	/*
+	 * The value is uniformly distributed in [1, 2*period), hence averages
+	 * the requested period.
+	 */
+
+	return 1 + random_value(range - 2);
+}
+
+/**
+ * Is the routine to which the PC belongs a known allocator?
+ */
+static bool
+memprof_is_allocator(const void *pc)
+{
+	const char *name = stacktrace_routine_name(pc, FALSE);
+	uint i;
+
+	for (i = 0; i < G_N_ELEMENTS(memprof_allocators); i++) {
+		if (0 == strcmp(name, memprof_allocators[i]))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Sample allocation of ``size'' bytes by ``which''.
+ *
+ * The allocating call site is the first routine in the calling stack that
+ * is not an allocator.
+ */
+static NO_INLINE void
+memprof_take_sample(enum memprof_alloc which, size_t size, size_t period)
+{
+	void *stack[STACKTRACE_DEPTH + MEMPROF_SKIP];
+	struct stacktrace t;
+	const struct stackatom *frame;
+	struct memprof_site *ms;
+	size_t i, count;
+
+	/*
+	 * Neither we nor memprof_record() can be inlined, hence the first two
+	 * frames are always ours.
+	 */
+
+	count = stacktrace_unwind(stack, G_N_ELEMENTS(stack), 2);
+
+	for (i = 0; i < count && i < MEMPROF_SKIP; i++) {
+		if (!memprof_is_allocator(stack[i]))
+			break;
+	}
+
+	t.len = MIN(count - i, G_N_ELEMENTS(t.stack));
+	memcpy(t.stack, &stack[i], t.len * sizeof t.stack[0]);
+	frame = stacktrace_get_atom(&t);
+
+	MEMPROF_LOCK;
+
+	if G_UNLIKELY(NULL == memprof_sites) {
+		memprof_sites = hash_table_new();
+		memprof_start = tm_time();
+	}
+
+	ms = hash_table_lookup(memprof_sites, frame);
+
+	if (NULL == ms) {
+		XMALLOC0(ms);
+		ms->frame = frame;
+		hash_table_insert(memprof_sites, frame, ms);
+	}
+
+	ms->samples++;
+	ms->bytes += size;
+	ms->estimated += MAX(size, period);
+	ms->max = MAX(ms->max, size);
+	ms->count[which]++;
+
+	memprof_samples++;
+	memprof_estimated += MAX(size, period);
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * Record allocation of ``size'' bytes by ``which'' allocator.
+ *
+ * This is normally invoked through memprof_sample() only when profiling
+ * is enabled.
+ */
+NO_INLINE void
+memprof_record(enum memprof_alloc which, size_t size)
+{
+	uint stid;
+	size_t period;
+
+	g_assert(uint_is_non_negative(which) && which < MEMPROF_ALLOC_COUNT);
+
+	stid = thread_small_id();
+
+	if G_UNLIKELY(stid >= THREAD_MAX || memprof_nested[stid])
+		return;
+
+	if G_UNLIKELY(memprof_busy[stid]) {
+		memprof_recursions++;		/* Unlocked, approximate */
+		return;
+	}
+
+	memprof_countdown[stid] -= size;
+
+	if G_LIKELY(memprof_countdown[stid] > 0)
+		return;
+
+	period = memprof_period;
+
+	if G_UNLIKELY(0 == period)
+		return;			/* Profiling turned off concurrently */
+
+	memprof_busy[stid] = TRUE;
+	memprof_countdown[stid] = memprof_next_sample(period);
+	memprof_take_sample(which, size, period);
+	memprof_busy[stid] = FALSE;
+}
+
+/**
+ * Flag the calling thread as allocating memory on behalf of an allocator
+ * that will sample the allocation itself.
+ *
+ * This is normally invoked through memprof_nest() only when profiling
+ * is enabled.
+ *
+ * @return TRUE if memprof_nest_leave() must be called to clear the flag.
+ */
+bool
+memprof_nest_enter(void)
+{
+	uint stid = thread_small_id();
+
+	if G_UNLIKELY(stid >= THREAD_MAX || memprof_nested[stid])
+		return FALSE;
+
+	memprof_nested[stid] = TRUE;
+	return TRUE;
+}
+
+/**
+ * Clear the flag set by memprof_nest_enter().
+ */
+void
+memprof_nest_leave(void)
+{
+	uint stid = thread_small_id();
+
+	g_assert(stid < THREAD_MAX);
+
+	memprof_nested[stid] = FALSE;
+}
+
+/**
+ * Set the sampling period, in bytes.
+ *
+ * A period of 0 turns profiling off, but keeps the collected samples.
+ */
+void
+memprof_set_period(size_t period)
+{
+	size_t i;
+
+	g_assert(0 == period || period > 1);
+
+	/*
+	 * Resetting the countdowns is racy with respect to running threads but
+	 * this is harmless: it only influences when the next sample is taken.
+	 */
+
+	for (i = 0; i < G_N_ELEMENTS(memprof_countdown); i++) {
+		memprof_countdown[i] = 0 == period ? 0 : memprof_next_sample(period);
+	}
+
+	if (period != 0 && 0 == memprof_period) {
+		MEMPROF_LOCK;
+		if (NULL == memprof_sites)
+			memprof_start = tm_time();
+		MEMPROF_UNLOCK;
+	}
+
+	memprof_period = period;
+}
+
+/**
+ * @return the current sampling period, 0 meaning profiling is off.
+ */
+size_t
+memprof_get_period(void)
+{
+	return memprof_period;
+}
+
+static bool
+memprof_site_free(const void *key, void *value, void *data)
+{
+	struct memprof_site *ms = value;
+
+	(void) key;
+	(void) data;
+
+	xfree(ms);
+	return TRUE;
+}
+
+/**
+ * Discard all the collected samples.
+ */
+void
+memprof_reset(void)
+{
+	uint stid = thread_small_id();
+
+	memprof_busy[stid] = TRUE;
+	MEMPROF_LOCK;
+
+	if (memprof_sites != NULL)
+		hash_table_foreach_remove(memprof_sites, memprof_site_free, NULL);
+
+	memprof_samples = 0;
+	memprof_estimated = 0;
+	memprof_recursions = 0;
+	memprof_start = tm_time();
+
+	MEMPROF_UNLOCK;
+	memprof_busy[stid] = FALSE;
+}
+
+struct memprof_filler {
+	struct memprof_site *array;		/**< Snapshot of call sites */
+	size_t capacity;				/**< Allocated length of array */
+	size_t count;					/**< Filled items */
+};
+
+static void
+memprof_filler_add(const void *key, void *value, void *data)
+{
+	struct memprof_filler *fill = data;
+	const struct memprof_site *ms = value;
+
+	(void) key;
+
+	g_assert(fill->count < fill->capacity);
+
+	fill->array[fill->count++] = *ms;		/* Struct copy */
+}
+
+/**
+ * qsort() callback for sorting call sites by decreasing estimated bytes.
+ */
+static int
+memprof_site_cmp(const void *a, const void *b)
+{
+	const struct memprof_site *ma = a, *mb = b;
+
+	return CMP(mb->estimated, ma->estimated);
+}
+
+/**
+ * Take a sorted snapshot of the call sites.
+ *
+ * The caller must hold the busy flag for the current thread, so that the
+ * allocation of the snapshot does not recurse into the profiler.
+ *
+ * @return the total amount of samples and estimated bytes for the snapshot.
+ */
+static void
+memprof_snapshot(struct memprof_filler *fill,
+	uint64 *samples, uint64 *estimated, time_t *start)
+{
+	ZERO(fill);
+
+	MEMPROF_LOCK;
+
+	*samples = memprof_samples;
+	*estimated = memprof_estimated;
+	*start = memprof_start;
+
+	if (memprof_sites != NULL) {
+		fill->capacity = hash_table_size(memprof_sites);
+		XMALLOC_ARRAY(fill->array, fill->capacity);
+		hash_table_foreach(memprof_sites, memprof_filler_add, fill);
+		g_assert(fill->count == fill->capacity);
+	}
+
+	MEMPROF_UNLOCK;
+
+	if (fill->count != 0) {
+		vsort(fill->array, fill->count, sizeof fill->array[0],
+			memprof_site_cmp);
+	}
+}
+
+/**
+ * Dump the call sites having allocated the most memory to specified
+ * logging agent.
+ *
+ * @param la		logging agent where the table is written
+ * @param count		maximum amount of call sites to show (0 = all)
+ * @param verbose	whether to display the full stack of each call site
+ */
+void
+memprof_dump_log(logagent_t *la, size_t count, bool verbose)
+{
+	struct memprof_filler fill;
+	uint64 samples, estimated;
+	time_t start;
+	time_delta_t elapsed;
+	uint stid = thread_small_id();
+	size_t i;
+
+	memprof_busy[stid] = TRUE;
+	memprof_snapshot(&fill, &samples, &estimated, &start);
+
+	elapsed = (0 == start) ? 0 : delta_time(tm_time(), start);
+	elapsed = MAX(elapsed, 1);
+
+	log_info(la, "Allocation profiling is %s, sampling period is %zu bytes",
+		0 == memprof_period ? "OFF" : "ON", memprof_period);
+	log_info(la, "%'zu call site%s, %'" PRIu64 " sample%s, "
+		"~%s allocated in %s (~%s/s), %zu recursion%s",
+		fill.count, plural(fill.count), samples, plural(samples),
+		short_size(estimated, FALSE),
+		compact_time(elapsed), short_size2(estimated / elapsed, FALSE),
+		memprof_recursions, plural(memprof_recursions));
+
+	if (0 == count)
+		count = fill.count;
+
+	count = MIN(count, fill.count);
+
+	if (count != 0) {
+		log_info(la, "%5s %10s %10s %8s %10s %8s %8s %8s  %s",
+			"%", "Estimated", "Rate/s", "Samples", "Max",
+			memprof_alloc_name[MEMPROF_WALLOC],
+			memprof_alloc_name[MEMPROF_HALLOC],
+			memprof_alloc_name[MEMPROF_XMALLOC], "Call site");
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct memprof_site *ms = &fill.array[i];
+		double pct = 0 == estimated ? 0.0 : 100.0 * ms->estimated / estimated;
+		char rate[SIZE_FIELD_MAX];
+
+		(void) short_size_to_string_buf(ms->estimated / elapsed, FALSE,
+			rate, sizeof rate);
+
+		log_info(la, "%5.2f %10s %10s %8" PRIu64 " %10zu "
+			"%8" PRIu64 " %8" PRIu64 " %8" PRIu64 "  %s",
+			pct, short_size(ms->estimated, FALSE), rate, ms->samples, ms->max,
+			ms->count[MEMPROF_WALLOC], ms->count[MEMPROF_HALLOC],
+			ms->count[MEMPROF_XMALLOC],
+			0 == ms->frame->len ?
+				"??" : stacktrace_routine_name(ms->frame->stack[0], TRUE));
+
+		if (verbose)
+			stacktrace_atom_log(la, ms->frame);
+	}
+
+	XFREE_NULL(fill.array);
+	memprof_busy[stid] = FALSE;
+}
+
+/**
+ * Dump the collected samples in the legacy heap profile format, which can
+ * be fed to pprof along with the executable.
+ *
+ * Since freeings are not tracked, the in-use figures are always zero and
+ * the profile must be analyzed with "pprof --alloc_space".
+ */
+void
+memprof_dump_pprof_log(logagent_t *la)
+{
+	struct memprof_filler fill;
+	uint64 samples, estimated, bytes = 0;
+	time_t start;
+	uint stid = thread_small_id();
+	size_t i;
+	FILE *f;
+
+	memprof_busy[stid] = TRUE;
+	memprof_snapshot(&fill, &samples, &estimated, &start);
+
+	for (i = 0; i < fill.count; i++) {
+		bytes += fill.array[i].bytes;
+	}
+
+	log_info(la, "heap profile: 0: 0 [%" PRIu64 ": %" PRIu64 "] "
+		"@ heap_v2/%zu", samples, bytes,
+		0 == memprof_period ? (size_t) MEMPROF_PERIOD_DEFAULT : memprof_period);
+
+	for (i = 0; i < fill.count; i++) {
+		const struct memprof_site *ms = &fill.array[i];
+		str_t *s = str_new(80);
+		size_t j;
+
+		str_printf(s, "0: 0 [%" PRIu64 ": %" PRIu64 "] @",
+			ms->samples, ms->bytes);
+
+		for (j = 0; j < ms->frame->len; j++) {
+			str_catf(s, " %p", ms->frame->stack[j]);
+		}
+
+		log_info(la, "%s", str_2c(s));
+		str_destroy_null(&s);
+	}
+
+	XFREE_NULL(fill.array);
+
+	/*
+	 * Append the memory mappings so that pprof can map the addresses
+	 * to the proper objects.
+	 */
+
+	log_info(la, "%s", "");
+	log_info(la, "MAPPED_LIBRARIES:");
+
+	f = fopen(MEMPROF_MAPS, "r");
+	if (f != NULL) {
+		char line[1024];
+
+		while (fgets(line, sizeof line, f) != NULL) {
+			strchomp(line, 0);
+			log_info(la, "%s", line);
+		}
+
+		fclose(f);
+	}
+
+	memprof_busy[stid] = FALSE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
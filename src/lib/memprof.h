@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sampling allocation profiler.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _memprof_h_
+#define _memprof_h_
+
+#include "common.h"
+
+/**
+ * Allocators feeding the profiler.
+ */
+enum memprof_alloc {
+	MEMPROF_WALLOC = 0,
+	MEMPROF_HALLOC,
+	MEMPROF_XMALLOC,
+
+	MEMPROF_ALLOC_COUNT
+};
+
+#define MEMPROF_PERIOD_DEFAULT	(512 * 1024)	/**< Mean bytes between samples */
+
+extern size_t memprof_period;
+
+struct logagent;
+
+/*
+ * Public interface.
+ */
+
+void memprof_record(enum memprof_alloc which, size_t size);
+bool memprof_nest_enter(void);
+void memprof_nest_leave(void);
+
+void memprof_set_period(size_t period);
+size_t memprof_get_period(void);
+void memprof_reset(void);
+
+void memprof_dump_log(struct logagent *la, size_t count, bool verbose);
+void memprof_dump_pprof_log(struct logagent *la);
+
+/**
+ * Account for an allocation of ``size'' bytes made by ``which''.
+ *
+ * This is a single test of a global variable when profiling is off.
+ */
+static inline void
+memprof_sample(enum memprof_alloc which, size_t size)
+{
+	if G_UNLIKELY(memprof_period != 0)
+		memprof_record(which, size);
+}
+
+/**
+ * Flag the start of an allocation made on behalf of an allocator that will
+ * sample it itself, so that only the outermost allocator samples it.
+ *
+ * @return the value to give to memprof_unnest().
+ */
+static inline bool
+memprof_nest(void)
+{
+	if G_UNLIKELY(memprof_period != 0)
+		return memprof_nest_enter();
+
+	return FALSE;
+}
+
+/**
+ * Flag the end of the nested allocation started with memprof_nest().
+ */
+static inline void
+memprof_unnest(bool nested)
+{
+	if G_UNLIKELY(nested)
+		memprof_nest_leave();
+}
+
+#endif	/* _memprof_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
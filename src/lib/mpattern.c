@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Multi-pattern matching, Aho-Corasick automaton.
+ *
+ * A set of words is compiled into a deterministic automaton recognizing all
+ * the words at once, so that a text can be checked for all of them in a
+ * single pass, one table lookup per character.
+ *
+ * To keep the transition table small, the alphabet is reduced to the
+ * characters actually present in the words, all the other characters being
+ * mapped to a single class that leads back to the initial state.
+ *
+ * Each word comes with the amount of times it must occur in the text, the
+ * occurrences of a given word being non-overlapping.  The matching semantics
+ * are the ones we would get by repeatedly calling pattern_qsearch() for each
+ * word, starting the next search after the end of the previous match.
+ *
+ * When a state is reached, the words ending at the current position are the
+ * one recognized by that state, if any, plus the ones reachable through the
+ * dictionary suffix links, i.e. its suffixes that are also words.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "mpattern.h"
+
+#include "ascii.h"
+#include "halloc.h"
+#include "unsigned.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define MPATTERN_ALPHA	256		/**< Alphabet size */
+
+enum mpattern_magic { MPATTERN_MAGIC = 0x6a2f91d3 };
+
+/**
+ * A word to look for.
+ */
+struct mpattern_word {
+	const char *word;			/**< The word (not copied) */
+	size_t len;					/**< Word length */
+	size_t amount;				/**< Times word must occur */
+	size_t seen;				/**< Occurrences seen during matching */
+	size_t next;				/**< Offset where next occurrence may start */
+};
+
+/**
+ * A compiled set of words.
+ *
+ * States are numbered from 0, the initial state.  The transition from
+ * state s on character class c is delta[s * ncls + c].  Word indices in
+ * ``out'' are offset by 1, 0 meaning that no word ends at that state.
+ */
+struct mpattern {
+	enum mpattern_magic magic;
+	size_t count;				/**< Amount of words added */
+	size_t capacity;			/**< Capacity of the words[] array */
+	struct mpattern_word *words;	/**< Words to look for */
+	uint32 *delta;				/**< Transition table */
+	uint32 *out;				/**< 1 + index of word ending at state */
+	uint32 *dict;				/**< Dictionary suffix link */
+	size_t states;				/**< Amount of states */
+	uint ncls;					/**< Amount of character classes */
+	uint8 cls[MPATTERN_ALPHA];	/**< Character classes, 0 for "other" */
+	bool compiled;				/**< Whether automaton was built */
+};
+
+static inline void
+mpattern_check(const struct mpattern * const mp)
+{
+	g_assert(mp != NULL);
+	g_assert(MPATTERN_MAGIC == mp->magic);
+}
+
+/**
+ * Create a new multi-pattern matcher.
+ *
+ * @param count		expected amount of words (hint)
+ *
+ * @return a new matcher, to be freed with mpattern_free_null().
+ */
+mpattern_t *
+mpattern_make(size_t count)
+{
+	mpattern_t *mp;
+
+	WALLOC0(mp);
+	mp->magic = MPATTERN_MAGIC;
+	mp->capacity = MAX(count, 1);
+	HALLOC0_ARRAY(mp->words, mp->capacity);
+
+	return mp;
+}
+
+/**
+ * Add a word to the matcher.
+ *
+ * The word is not copied and must remain valid until mpattern_compile()
+ * is called.
+ *
+ * @param mp		the matcher, not yet compiled
+ * @param word		the word to look for
+ * @param len		length of the word, must be non-zero
+ * @param amount	minimum amount of non-overlapping occurrences required
+ */
+void
+mpattern_add(mpattern_t *mp, const char *word, size_t len, size_t amount)
+{
+	struct mpattern_word *w;
+
+	mpattern_check(mp);
+	g_assert(!mp->compiled);
+	g_assert(word != NULL);
+	g_assert(size_is_positive(len));
+	g_assert(size_is_positive(amount));
+
+	if (mp->count == mp->capacity) {
+		mp->capacity *= 2;
+		HREALLOC_ARRAY(mp->words, mp->capacity);
+	}
+
+	w = &mp->words[mp->count++];
+	w->word = word;
+	w->len = len;
+	w->amount = amount;
+	w->seen = 0;
+	w->next = 0;
+}
+
+/**
+ * Build the automaton recognizing all the words added to the matcher.
+ */
+void
+mpattern_compile(mpattern_t *mp)
+{
+	size_t i, maxstates, head, tail;
+	uint32 *queue, *fail;
+	uint ncls;
+
+	mpattern_check(mp);
+	g_assert(!mp->compiled);
+
+	/*
+	 * Compute the character classes.
+	 */
+
+	ncls = 1;		/* Class 0 is for characters not present in words */
+	maxstates = 1;	/* Initial state */
+
+	for (i = 0; i < mp->count; i++) {
+		const struct mpattern_word *w = &mp->words[i];
+		size_t j;
+
+		for (j = 0; j < w->len; j++) {
+			uchar c = w->word[j];
+
+			if (0 == mp->cls[c])
+				mp->cls[c] = ncls++;
+		}
+		maxstates += w->len;
+	}
+
+	g_assert(ncls <= MPATTERN_ALPHA);
+	g_assert(maxstates <= MAX_INT_VAL(uint32));
+
+	mp->ncls = ncls;
+
+	/*
+	 * Build the trie of words.
+	 *
+	 * As no transition of the trie leads back to the initial state, a
+	 * zero transition means "no transition" at this stage.
+	 */
+
+	HALLOC0_ARRAY(mp->delta, maxstates * ncls);
+	HALLOC0_ARRAY(mp->out, maxstates);
+	HALLOC0_ARRAY(mp->dict, maxstates);
+	mp->states = 1;
+
+	for (i = 0; i < mp->count; i++) {
+		const struct mpattern_word *w = &mp->words[i];
+		uint32 s = 0;
+		size_t j;
+
+		for (j = 0; j < w->len; j++) {
+			uint32 *t = &mp->delta[s * ncls + mp->cls[(uchar) w->word[j]]];
+
+			if (0 == *t)
+				*t = mp->states++;
+			s = *t;
+		}
+
+		g_assert(0 == mp->out[s]);	/* Words are expected to be distinct */
+		mp->out[s] = i + 1;
+	}
+
+	/*
+	 * Compute failure links in breadth-first order, completing the
+	 * transition table to get a deterministic automaton.
+	 */
+
+	HALLOC_ARRAY(queue, mp->states);
+	HALLOC0_ARRAY(fail, mp->states);
+	head = tail = 0;
+
+	for (i = 0; i < ncls; i++) {
+		uint32 u = mp->delta[i];
+
+		if (u != 0)
+			queue[tail++] = u;		/* Failure link is the initial state */
+	}
+
+	while (head != tail) {
+		uint32 r = queue[head++];
+
+		for (i = 0; i < ncls; i++) {
+			uint32 *t = &mp->delta[r * ncls + i];
+			uint32 f = mp->delta[fail[r] * ncls + i];
+
+			if (*t != 0) {
+				uint32 u = *t;
+
+				fail[u] = f;
+				mp->dict[u] = 0 != mp->out[f] ? f : mp->dict[f];
+				queue[tail++] = u;
+			} else {
+				*t = f;
+			}
+		}
+	}
+
+	g_assert(tail == mp->states - 1);
+
+	HFREE_NULL(queue);
+	HFREE_NULL(fail);
+
+	mp->compiled = TRUE;
+}
+
+/**
+ * Free matcher and nullify its pointer.
+ */
+void
+mpattern_free_null(mpattern_t **mp_ptr)
+{
+	mpattern_t *mp = *mp_ptr;
+
+	if (mp != NULL) {
+		mpattern_check(mp);
+		HFREE_NULL(mp->words);
+		HFREE_NULL(mp->delta);
+		HFREE_NULL(mp->out);
+		HFREE_NULL(mp->dict);
+		mp->magic = 0;
+		WFREE(mp);
+		*mp_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of words in the matcher.
+ */
+size_t
+mpattern_count(const mpattern_t *mp)
+{
+	mpattern_check(mp);
+
+	return mp->count;
+}
+
+/**
+ * @return amount of states in the automaton, 0 if not compiled yet.
+ */
+size_t
+mpattern_states(const mpattern_t *mp)
+{
+	mpattern_check(mp);
+
+	return mp->compiled ? mp->states : 0;
+}
+
+/**
+ * Account for an occurrence of a word ending at offset ``end'' in the text.
+ *
+ * @return TRUE if the word now occurred as many times as requested.
+ */
+static inline bool
+mpattern_seen(struct mpattern_word *w,
+	const char *text, size_t tlen, size_t end, qsearch_mode_t word)
+{
+	size_t start = end - w->len;
+
+	if (w->seen >= w->amount || start < w->next)
+		return FALSE;
+
+	if (word != qs_any) {
+		if (start != 0 && !is_ascii_space(text[start - 1]))
+			return FALSE;
+		if (word == qs_whole && end != tlen && !is_ascii_space(text[end]))
+			return FALSE;
+	}
+
+	w->next = end;
+	return ++w->seen == w->amount;
+}
+
+/**
+ * Check whether all the words occur in the text, each at least the amount
+ * of times specified when the word was added, occurrences of a word not
+ * overlapping each other.
+ *
+ * @param mp		the compiled matcher
+ * @param text		the text to scan
+ * @param tlen		length of the text, 0 meaning compute it
+ * @param word		whether words must match at the beginning of text words
+ *
+ * @return TRUE if all the words were found.
+ */
+G_GNUC_HOT bool
+mpattern_match_all(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word)
+{
+	const uint32 *delta;
+	const uint8 *cls;
+	size_t i, missing;
+	uint32 s = 0;
+	uint ncls;
+
+	mpattern_check(mp);
+	g_assert(mp->compiled);
+
+	if (0 == tlen)
+		tlen = strlen(text);
+
+	for (i = 0; i < mp->count; i++) {
+		mp->words[i].seen = 0;
+		mp->words[i].next = 0;
+	}
+
+	missing = mp->count;
+	if G_UNLIKELY(0 == missing)
+		return TRUE;
+
+	delta = mp->delta;
+	cls = mp->cls;
+	ncls = mp->ncls;
+
+	for (i = 0; i < tlen; i++) {
+		uint32 o;
+
+		s = delta[s * ncls + cls[(uchar) text[i]]];
+
+		/*
+		 * Visit all the words ending here: the one recognized by the state,
+		 * if any, then its suffixes through the dictionary links.
+		 */
+
+		for (o = 0 != mp->out[s] ? s : mp->dict[s]; o != 0; o = mp->dict[o]) {
+			struct mpattern_word *w = &mp->words[mp->out[o] - 1];
+
+			if (mpattern_seen(w, text, tlen, i + 1, word)) {
+				if (0 == --missing)
+					return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Report all the words occurring in the text, each at least the amount of
+ * times specified when the word was added, occurrences of a word not
+ * overlapping each other.
+ *
+ * The callback is invoked once per word found, with the index of the word
+ * in the order of mpattern_add() calls, as soon as the word has been seen
+ * the required amount of times.
+ *
+ * @param mp		the compiled matcher
+ * @param text		the text to scan
+ * @param tlen		length of the text, 0 meaning compute it
+ * @param word		whether words must match at the beginning of text words
+ * @param cb		callback invoked for each word found
+ * @param data		additional callback argument
+ *
+ * @return the amount of distinct words found.
+ */
+G_GNUC_HOT size_t
+mpattern_match_each(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word,
+	mpattern_cb_t cb, void *data)
+{
+	const uint32 *delta;
+	const uint8 *cls;
+	size_t i, found = 0;
+	uint32 s = 0;
+	uint ncls;
+
+	mpattern_check(mp);
+	g_assert(mp->compiled);
+	g_assert(cb != NULL);
+
+	if (0 == tlen)
+		tlen = strlen(text);
+
+	for (i = 0; i < mp->count; i++) {
+		mp->words[i].seen = 0;
+		mp->words[i].next = 0;
+	}
+
+	if G_UNLIKELY(0 == mp->count)
+		return 0;
+
+	delta = mp->delta;
+	cls = mp->cls;
+	ncls = mp->ncls;
+
+	for (i = 0; i < tlen; i++) {
+		uint32 o;
+
+		s = delta[s * ncls + cls[(uchar) text[i]]];
+
+		for (o = 0 != mp->out[s] ? s : mp->dict[s]; o != 0; o = mp->dict[o]) {
+			size_t n = mp->out[o] - 1;
+
+			if (mpattern_seen(&mp->words[n], text, tlen, i + 1, word)) {
+				(*cb)(n, data);
+				if (mp->count == ++found)
+					return found;
+			}
+		}
+	}
+
+	return found;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
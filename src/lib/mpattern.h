@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Multi-pattern matching, Aho-Corasick automaton.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _mpattern_h_
+#define _mpattern_h_
+
+#include "common.h"
+
+#include "pattern.h"		/* For qsearch_mode_t */
+
+typedef struct mpattern mpattern_t;
+
+typedef void (*mpattern_cb_t)(size_t idx, void *data);
+
+/*
+ * Public interface.
+ */
+
+mpattern_t *mpattern_make(size_t count);
+void mpattern_add(mpattern_t *mp, const char *word, size_t len, size_t amount);
+void mpattern_compile(mpattern_t *mp);
+void mpattern_free_null(mpattern_t **mp_ptr);
+
+size_t mpattern_count(const mpattern_t *mp);
+size_t mpattern_states(const mpattern_t *mp);
+
+bool mpattern_match_all(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word);
+size_t mpattern_match_each(mpattern_t *mp,
+	const char *text, size_t tlen, qsearch_mode_t word,
+	mpattern_cb_t cb, void *data);
+
+#endif /* _mpattern_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Embedded order-statistic red-black trees.
+ *
+ * This is a red-black tree with the same usage pattern as the embedded
+ * red-black trees from erbtree.c: nodes are embedded in the items, the
+ * comparison routine compares items and the offset of the embedded node
+ * within the items is given at initialization time.
+ *
+ * In addition, each node is augmented with the size of its subtree and
+ * the sum of the weights of the nodes in its subtree, which allows the
+ * following operations in O(log n):
+ *
+ * - ostree_rank() gives the position of an item in the tree, starting at 1.
+ * - ostree_nth() gives the item at a given position.
+ * - ostree_weight_before() gives the sum of the weights of all the items
+ *   that come before a given item.
+ *
+ * The weight of an item is an arbitrary 64-bit value attached to the node,
+ * set with ostree_set_weight(), defaulting to 0.  It must be set after the
+ * node is inserted in the tree.
+ *
+ * Like erbtree, duplicate keys are not supported.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "ostree.h"
+#include "unsigned.h"
+
+#include "override.h"			/* Must be the last header included */
+
+static inline size_t
+osnode_size(const osnode_t *n)
+{
+	return NULL == n ? 0 : n->size;
+}
+
+static inline uint64
+osnode_sum(const osnode_t *n)
+{
+	return NULL == n ? 0 : n->sum;
+}
+
+static inline bool
+osnode_is_red(const osnode_t *n)
+{
+	return n != NULL && n->red;
+}
+
+/**
+ * Recompute augmented fields of node from its children.
+ */
+static inline void
+osnode_update(osnode_t *n)
+{
+	n->size = 1 + osnode_size(n->left) + osnode_size(n->right);
+	n->sum = n->weight + osnode_sum(n->left) + osnode_sum(n->right);
+}
+
+/**
+ * Recompute augmented fields from node up to the root.
+ */
+static void
+osnode_update_path(osnode_t *n)
+{
+	for (/* empty */; n != NULL; n = n->parent)
+		osnode_update(n);
+}
+
+/**
+ * Initialize embedded order-statistic tree.
+ *
+ * @param tree		the tree to initialize
+ * @param cmp		the item comparison routine
+ * @param offset	the offset of the embedded node field within items
+ */
+void
+ostree_init(ostree_t *tree, cmp_fn_t cmp, size_t offset)
+{
+	g_assert(tree != NULL);
+	g_assert(cmp != NULL);
+	g_assert(size_is_non_negative(offset));
+
+	tree->magic = OSTREE_MAGIC;
+	tree->root = NULL;
+	tree->cmp = cmp;
+	tree->offset = offset;
+}
+
+/**
+ * Replace child ``old'' of parent with ``new''.
+ */
+static inline void
+ostree_replace_child(ostree_t *tree,
+	osnode_t *parent, osnode_t *old, osnode_t *new)
+{
+	if (NULL == parent)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+static void
+ostree_rotate_left(ostree_t *tree, osnode_t *x)
+{
+	osnode_t *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	y->parent = x->parent;
+	ostree_replace_child(tree, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+
+	y->size = x->size;		/* Same set of nodes in subtree */
+	y->sum = x->sum;
+	osnode_update(x);
+}
+
+static void
+ostree_rotate_right(ostree_t *tree, osnode_t *x)
+{
+	osnode_t *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	y->parent = x->parent;
+	ostree_replace_child(tree, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+
+	y->size = x->size;		/* Same set of nodes in subtree */
+	y->sum = x->sum;
+	osnode_update(x);
+}
+
+/**
+ * Insert node in tree.
+ *
+ * @return NULL if the node was inserted, the existing item with the same
+ * key otherwise, in which case nothing was inserted.
+ */
+void *
+ostree_insert(ostree_t *tree, osnode_t *node)
+{
+	osnode_t *parent = NULL, **link, *p;
+	const void *item;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+
+	item = const_ptr_add_offset(node, -tree->offset);
+	link = &tree->root;
+
+	while (*link != NULL) {
+		int c;
+
+		parent = *link;
+		c = (*tree->cmp)(item, ostree_data(tree, parent));
+
+		if (0 == c)
+			return ostree_data(tree, parent);
+
+		link = c < 0 ? &parent->left : &parent->right;
+	}
+
+	node->left = node->right = NULL;
+	node->parent = parent;
+	node->red = TRUE;
+	node->weight = node->sum = 0;
+	node->size = 1;
+	*link = node;
+
+	for (p = parent; p != NULL; p = p->parent)
+		p->size++;
+
+	/*
+	 * Restore red-black properties.
+	 */
+
+	while (osnode_is_red(node->parent)) {
+		osnode_t *gp;
+
+		parent = node->parent;
+		gp = parent->parent;		/* Not NULL since root is black */
+
+		if (parent == gp->left) {
+			osnode_t *uncle = gp->right;
+
+			if (osnode_is_red(uncle)) {
+				parent->red = uncle->red = FALSE;
+				gp->red = TRUE;
+				node = gp;
+				continue;
+			}
+			if (node == parent->right) {
+				ostree_rotate_left(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = FALSE;
+			gp->red = TRUE;
+			ostree_rotate_right(tree, gp);
+		} else {
+			osnode_t *uncle = gp->left;
+
+			if (osnode_is_red(uncle)) {
+				parent->red = uncle->red = FALSE;
+				gp->red = TRUE;
+				node = gp;
+				continue;
+			}
+			if (node == parent->left) {
+				ostree_rotate_right(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = FALSE;
+			gp->red = TRUE;
+			ostree_rotate_left(tree, gp);
+		}
+	}
+
+	tree->root->red = FALSE;
+
+	return NULL;
+}
+
+/**
+ * Restore red-black properties after removal of a black node.
+ *
+ * @param tree		the tree
+ * @param x			the node that replaced the removed one, may be NULL
+ * @param parent	the parent of x
+ */
+static void
+ostree_remove_fixup(ostree_t *tree, osnode_t *x, osnode_t *parent)
+{
+	while (x != tree->root && !osnode_is_red(x)) {
+		osnode_t *w;
+
+		if (x == parent->left) {
+			w = parent->right;
+			if (osnode_is_red(w)) {
+				w->red = FALSE;
+				parent->red = TRUE;
+				ostree_rotate_left(tree, parent);
+				w = parent->right;
+			}
+			if (!osnode_is_red(w->left) && !osnode_is_red(w->right)) {
+				w->red = TRUE;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!osnode_is_red(w->right)) {
+					w->left->red = FALSE;
+					w->red = TRUE;
+					ostree_rotate_right(tree, w);
+					w = parent->right;
+				}
+				w->red = parent->red;
+				parent->red = FALSE;
+				w->right->red = FALSE;
+				ostree_rotate_left(tree, parent);
+				x = tree->root;
+			}
+		} else {
+			w = parent->left;
+			if (osnode_is_red(w)) {
+				w->red = FALSE;
+				parent->red = TRUE;
+				ostree_rotate_right(tree, parent);
+				w = parent->left;
+			}
+			if (!osnode_is_red(w->left) && !osnode_is_red(w->right)) {
+				w->red = TRUE;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!osnode_is_red(w->left)) {
+					w->right->red = FALSE;
+					w->red = TRUE;
+					ostree_rotate_left(tree, w);
+					w = parent->left;
+				}
+				w->red = parent->red;
+				parent->red = FALSE;
+				w->left->red = FALSE;
+				ostree_rotate_right(tree, parent);
+				x = tree->root;
+			}
+		}
+	}
+
+	if (x != NULL)
+		x->red = FALSE;
+}
+
+/**
+ * Remove node from the tree.
+ *
+ * The node must be part of the tree.  Upon return, it is flagged as
+ * being unlinked.
+ */
+void
+ostree_remove(ostree_t *tree, osnode_t *node)
+{
+	osnode_t *y, *x, *parent;
+	bool was_red;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(osnode_is_linked(node));
+
+	/*
+	 * Node ``y'' is the one that will be spliced out of the tree: the node
+	 * itself if it has at most one child, its successor otherwise.
+	 */
+
+	if (NULL == node->left || NULL == node->right) {
+		y = node;
+	} else {
+		for (y = node->right; y->left != NULL; y = y->left)
+			/* empty */;
+	}
+
+	x = y->left != NULL ? y->left : y->right;
+	parent = y->parent;
+	was_red = y->red;
+
+	if (x != NULL)
+		x->parent = parent;
+	ostree_replace_child(tree, parent, y, x);
+
+	if (y != node) {
+		/* Move ``y'' to the place of ``node'' in the tree */
+
+		y->left = node->left;
+		y->right = node->right;
+		y->parent = node->parent;
+		y->red = node->red;
+		if (y->left != NULL)
+			y->left->parent = y;
+		if (y->right != NULL)
+			y->right->parent = y;
+		ostree_replace_child(tree, node->parent, node, y);
+
+		if (parent == node)
+			parent = y;
+	}
+
+	/*
+	 * All the nodes whose subtree changed are on the path from ``parent''
+	 * up to the root, including ``y'' if it was moved.
+	 */
+
+	osnode_update_path(parent);
+
+	if (!was_red && tree->root != NULL)
+		ostree_remove_fixup(tree, x, parent);
+
+	node->left = node->right = node->parent = NULL;
+	node->size = 0;
+	node->sum = node->weight = 0;
+}
+
+/**
+ * @return first (smallest) node in the tree, NULL if empty.
+ */
+osnode_t *
+ostree_first(const ostree_t *tree)
+{
+	osnode_t *n;
+
+	ostree_check(tree);
+
+	n = tree->root;
+	if (n != NULL) {
+		while (n->left != NULL)
+			n = n->left;
+	}
+	return n;
+}
+
+/**
+ * @return last (largest) node in the tree, NULL if empty.
+ */
+osnode_t *
+ostree_last(const ostree_t *tree)
+{
+	osnode_t *n;
+
+	ostree_check(tree);
+
+	n = tree->root;
+	if (n != NULL) {
+		while (n->right != NULL)
+			n = n->right;
+	}
+	return n;
+}
+
+/**
+ * @return next node in the tree, NULL if node was the last one.
+ */
+osnode_t *
+ostree_next(const osnode_t *node)
+{
+	const osnode_t *n = node;
+
+	g_assert(node != NULL);
+
+	if (n->right != NULL) {
+		for (n = n->right; n->left != NULL; n = n->left)
+			/* empty */;
+		return deconstify_pointer(n);
+	}
+
+	while (n->parent != NULL && n == n->parent->right)
+		n = n->parent;
+
+	return n->parent;
+}
+
+/**
+ * @return previous node in the tree, NULL if node was the first one.
+ */
+osnode_t *
+ostree_prev(const osnode_t *node)
+{
+	const osnode_t *n = node;
+
+	g_assert(node != NULL);
+
+	if (n->left != NULL) {
+		for (n = n->left; n->right != NULL; n = n->right)
+			/* empty */;
+		return deconstify_pointer(n);
+	}
+
+	while (n->parent != NULL && n == n->parent->left)
+		n = n->parent;
+
+	return n->parent;
+}
+
+/**
+ * @return the position of the node in the tree, the first node being at 1.
+ */
+size_t
+ostree_rank(const ostree_t *tree, const osnode_t *node)
+{
+	size_t rank;
+	const osnode_t *n;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(osnode_is_linked(node));
+
+	rank = osnode_size(node->left) + 1;
+
+	for (n = node; n->parent != NULL; n = n->parent) {
+		if (n == n->parent->right)
+			rank += osnode_size(n->parent->left) + 1;
+	}
+
+	g_assert(n == tree->root);
+
+	return rank;
+}
+
+/**
+ * Fetch item at a given position in the tree.
+ *
+ * @param tree		the tree
+ * @param rank		the item position, starting at 1
+ *
+ * @return the item at that position, NULL if rank is out of bounds.
+ */
+void *
+ostree_nth(const ostree_t *tree, size_t rank)
+{
+	const osnode_t *n;
+
+	ostree_check(tree);
+
+	n = tree->root;
+
+	while (n != NULL) {
+		size_t r = osnode_size(n->left) + 1;
+
+		if (rank == r)
+			return ostree_data(tree, n);
+
+		if (rank < r) {
+			n = n->left;
+		} else {
+			rank -= r;
+			n = n->right;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Set the weight of a node already inserted in the tree.
+ */
+void
+ostree_set_weight(ostree_t *tree, osnode_t *node, uint64 weight)
+{
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(osnode_is_linked(node));
+
+	if (node->weight != weight) {
+		node->weight = weight;
+		osnode_update_path(node);
+	}
+}
+
+/**
+ * @return the sum of the weights of all the nodes before the given one.
+ */
+uint64
+ostree_weight_before(const ostree_t *tree, const osnode_t *node)
+{
+	uint64 sum;
+	const osnode_t *n;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(osnode_is_linked(node));
+
+	sum = osnode_sum(node->left);
+
+	for (n = node; n->parent != NULL; n = n->parent) {
+		const osnode_t *p = n->parent;
+
+		if (n == p->right)
+			sum += osnode_sum(p->left) + p->weight;
+	}
+
+	return sum;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Embedded order-statistic red-black trees.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _ostree_h_
+#define _ostree_h_
+
+/**
+ * A node in an order-statistic tree.
+ *
+ * Each node knows the amount of nodes in its subtree, plus the sum of the
+ * weights of these nodes.  A node that is not linked in a tree has a zero
+ * size.
+ */
+typedef struct osnode {
+	struct osnode *left, *right, *parent;
+	size_t size;			/**< Amount of nodes in subtree, 0 if unlinked */
+	uint64 weight;			/**< Weight of this node */
+	uint64 sum;				/**< Sum of weights in subtree */
+	bool red;				/**< Node color */
+} osnode_t;
+
+enum ostree_magic { OSTREE_MAGIC = 0x1c8e5f2b };
+
+/**
+ * An embedded order-statistic tree.
+ */
+typedef struct ostree {
+	enum ostree_magic magic;
+	osnode_t *root;
+	cmp_fn_t cmp;		/**< Item comparison routine */
+	size_t offset;		/**< Offset of embedded node in the item structure */
+} ostree_t;
+
+static inline void
+ostree_check(const ostree_t * const t)
+{
+	g_assert(t != NULL);
+	g_assert(OSTREE_MAGIC == t->magic);
+}
+
+/*
+ * Public interface.
+ */
+
+void ostree_init(ostree_t *tree, cmp_fn_t cmp, size_t offset);
+
+void *ostree_insert(ostree_t *tree, osnode_t *node);
+void ostree_remove(ostree_t *tree, osnode_t *node);
+
+osnode_t *ostree_first(const ostree_t *tree);
+osnode_t *ostree_last(const ostree_t *tree);
+osnode_t *ostree_next(const osnode_t *node);
+osnode_t *ostree_prev(const osnode_t *node);
+
+size_t ostree_rank(const ostree_t *tree, const osnode_t *node);
+void *ostree_nth(const ostree_t *tree, size_t rank);
+
+void ostree_set_weight(ostree_t *tree, osnode_t *node, uint64 weight);
+uint64 ostree_weight_before(const ostree_t *tree, const osnode_t *node);
+
+/**
+ * @return amount of items in the tree.
+ */
+static inline size_t
+ostree_count(const ostree_t * const t)
+{
+	ostree_check(t);
+	return NULL == t->root ? 0 : t->root->size;
+}
+
+/**
+ * @return sum of the weights of all the items in the tree.
+ */
+static inline uint64
+ostree_weight(const ostree_t * const t)
+{
+	ostree_check(t);
+	return NULL == t->root ? 0 : t->root->sum;
+}
+
+/**
+ * @return whether node is linked in a tree.
+ */
+static inline bool
+osnode_is_linked(const osnode_t * const n)
+{
+	return n->size != 0;
+}
+
+/**
+ * Computes the data item address given the embedded node pointer.
+ */
+static inline void *
+ostree_data(const ostree_t *t, const osnode_t *node)
+{
+	ostree_check(t);
+	return NULL == node ? NULL :
+		deconstify_pointer(const_ptr_add_offset(node, -t->offset));
+}
+
+/**
+ * @return pointer to the first item of the tree, NULL if empty.
+ */
+static inline void *
+ostree_head(const ostree_t * const t)
+{
+	return ostree_data(t, ostree_first(t));
+}
+
+/**
+ * @return pointer to the last item of the tree, NULL if empty.
+ */
+static inline void *
+ostree_tail(const ostree_t * const t)
+{
+	return ostree_data(t, ostree_last(t));
+}
+
+#define OSTREE_FOREACH(tree, on) \
+	for ((on) = ostree_first(tree); (on) != NULL; (on) = ostree_next(on))
+
+#endif /* _ostree_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -34,9 +34,18 @@
 #include "common.h"
 
 #include "pmsg.h"
+
+#include "atomic.h"
+#include "dump_options.h"
 #include "halloc.h"
+#include "log.h"
 #include "mempcpy.h"
+#include "once.h"
+#include "str.h"
+#include "stringify.h"
+#include "tmalloc.h"
 #include "walloc.h"
+
 #include "override.h"			/* Must be the last header included */
 
 #define implies(a,b)	(!(a) || (b))
@@ -82,13 +91,218 @@ cast_to_pmsg(pmsg_ext_t *emb)
 	return &emb->pmsg;
 }
 
+/*
+ * Message blocks and data buffers are allocated through dedicated thread
+ * magazine depots, to avoid going through walloc() for each routed message
+ * and each of its clones.
+ *
+ * Data buffers are allocated from size classes: a data buffer of "len" bytes
+ * is allocated from the smallest class able to hold it, larger buffers being
+ * walloc()'ed as before.
+ *
+ * Each class also has an "inline" depot, whose blocks are large enough to
+ * hold an extended message block at their start, followed by the data buffer.
+ * This allows pmsg_new() to allocate the message block and its data with a
+ * single allocation for small enough payloads.  Such an "inline" message block
+ * is flagged with PMSG_PF_INLINE, which is not propagated to its clones.
+ * The whole block is released when the data buffer is freed, i.e. when the
+ * original message block and all its clones have been freed.
+ */
+
+#define PMSG_POOL_CLASSES	4
+#define PMSG_INLINE_MAX		1024	/**< Max payload inlined in message */
+#define PMSG_INLINE_OFFSET	sizeof(pmsg_ext_t)
+
+static const size_t pmsg_pool_class[PMSG_POOL_CLASSES] = {
+	64, 256, 1024, 4096
+};
+
+static tmalloc_t *pmsg_depot;			/**< Plain message blocks */
+static tmalloc_t *pmsg_ext_depot;		/**< Extended message blocks */
+static tmalloc_t *pdata_depot[PMSG_POOL_CLASSES];	/**< Data buffer classes */
+static tmalloc_t *pmsg_inline_depot[PMSG_POOL_CLASSES];	/**< Inline classes */
+static once_flag_t pmsg_pool_inited;
+
+/**
+ * Allocation statistics, to monitor the efficiency of the pools.
+ */
+static struct pmsg_stats {
+	AU64(pmsg_allocated);		/**< Message blocks allocated */
+	AU64(pmsg_freed);			/**< Message blocks freed */
+	AU64(pmsg_inlined);			/**< Messages allocated with their data */
+	AU64(pdata_pooled);			/**< Data buffers allocated from classes */
+	AU64(pdata_walloc);			/**< Data buffers too large for classes */
+	AU64(pdata_external);		/**< Data buffers with external arena */
+	AU64(pdata_freed);			/**< Data buffers freed */
+	AU64(pdata_class_64);		/**< Allocations in the 64-byte class */
+	AU64(pdata_class_256);		/**< Allocations in the 256-byte class */
+	AU64(pdata_class_1k);		/**< Allocations in the 1 KiB class */
+	AU64(pdata_class_4k);		/**< Allocations in the 4 KiB class */
+} pmsg_stats;
+
+#define PMSG_STATS_INC(x)	AU64_INC(&pmsg_stats.x)
+
+/**
+ * Account for an allocation in size class ``idx''.
+ */
+static inline void
+pmsg_stats_class(uint idx)
+{
+	switch (idx) {
+	case 0:	PMSG_STATS_INC(pdata_class_64);		return;
+	case 1:	PMSG_STATS_INC(pdata_class_256);	return;
+	case 2:	PMSG_STATS_INC(pdata_class_1k);		return;
+	case 3:	PMSG_STATS_INC(pdata_class_4k);		return;
+	}
+	g_assert_not_reached();
+}
+
+static void *
+pmsg_pool_alloc(size_t size)
+{
+	return walloc(size);
+}
+
+static void
+pmsg_pool_free(void *p, size_t size)
+{
+	wfree(p, size);
+}
+
+/**
+ * Create the allocation depots, once.
+ */
+static void
+pmsg_pool_init_once(void)
+{
+	size_t i;
+
+	pmsg_depot = tmalloc_create("pmsg",
+		sizeof(pmsg_t), pmsg_pool_alloc, pmsg_pool_free);
+	pmsg_ext_depot = tmalloc_create("pmsg_ext",
+		sizeof(pmsg_ext_t), pmsg_pool_alloc, pmsg_pool_free);
+
+	for (i = 0; i < G_N_ELEMENTS(pdata_depot); i++) {
+		char name[32];
+		size_t size = EMBEDDED_OFFSET + pmsg_pool_class[i];
+
+		str_bprintf(name, sizeof name, "pdata-%zu", pmsg_pool_class[i]);
+		pdata_depot[i] = tmalloc_create(name, size,
+			pmsg_pool_alloc, pmsg_pool_free);
+
+		str_bprintf(name, sizeof name, "pmsg-inline-%zu", pmsg_pool_class[i]);
+		pmsg_inline_depot[i] = tmalloc_create(name, PMSG_INLINE_OFFSET + size,
+			pmsg_pool_alloc, pmsg_pool_free);
+	}
+}
+
+static inline void
+pmsg_pool_init(void)
+{
+	ONCE_FLAG_RUN(pmsg_pool_inited, pmsg_pool_init_once);
+}
+
+/**
+ * @return the index of the smallest size class able to hold ``len'' bytes
+ * of data, or PMSG_POOL_CLASSES if there is none.
+ */
+static inline uint
+pmsg_pool_class_index(size_t len)
+{
+	uint i;
+
+	for (i = 0; i < PMSG_POOL_CLASSES; i++) {
+		if (len <= pmsg_pool_class[i])
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Allocate a message block header, extended or not.
+ */
+static inline void *
+pmsg_header_alloc(bool ext)
+{
+	pmsg_pool_init();
+	PMSG_STATS_INC(pmsg_allocated);
+
+	return tmalloc(ext ? pmsg_ext_depot : pmsg_depot);
+}
+
+/**
+ * @return whether message block was allocated along with its data buffer.
+ */
+static inline bool
+pmsg_is_inline(const pmsg_t *mb)
+{
+	return 0 != (mb->m_flags & PMSG_PF_INLINE);
+}
+
+/**
+ * Free routine for data buffers allocated from a size class.
+ *
+ * @param p		the data buffer (embedded)
+ * @param arg	the depot from which the data buffer was allocated
+ */
+static void
+pdata_pool_free(void *p, void *arg)
+{
+	pdata_t *db = p;
+
+	db->magic = 0;
+	tmfree(arg, db);
+}
+
+/**
+ * Free routine for data buffers allocated along with their message block.
+ *
+ * @param p		the data buffer (embedded)
+ * @param arg	the depot from which the whole block was allocated
+ */
+static void
+pdata_pool_free_inline(void *p, void *arg)
+{
+	pdata_t *db = p;
+
+	db->magic = 0;
+	tmfree(arg, ptr_add_offset(db, -PMSG_INLINE_OFFSET));
+}
+
 /**
  * Allocate internal variables.
  */
 void
 pmsg_init(void)
 {
-	/* Nothing to do */
+	pmsg_pool_init();
+}
+
+/**
+ * Dump pmsg statistics to specified log agent.
+ */
+G_GNUC_COLD void
+pmsg_dump_stats_log(logagent_t *la, unsigned options)
+{
+#define DUMP(x)	log_info(la, "PMSG %s = %s", #x,			\
+	(options & DUMP_OPT_PRETTY) ?							\
+		uint64_to_gstring(AU64_VALUE(&pmsg_stats.x)) :		\
+		uint64_to_string(AU64_VALUE(&pmsg_stats.x)))
+
+	DUMP(pmsg_allocated);
+	DUMP(pmsg_freed);
+	DUMP(pmsg_inlined);
+	DUMP(pdata_pooled);
+	DUMP(pdata_walloc);
+	DUMP(pdata_external);
+	DUMP(pdata_freed);
+	DUMP(pdata_class_64);
+	DUMP(pdata_class_256);
+	DUMP(pdata_class_1k);
+	DUMP(pdata_class_4k);
+
+#undef DUMP
 }
 
 /**
@@ -111,7 +325,7 @@ pmsg_reset(pmsg_t *mb)
 	pmsg_check_consistency(mb);
 
 	mb->m_rptr = mb->m_wptr = mb->m_data->d_arena;	/* Empty buffer */
-	mb->m_flags = PMSG_EXT_MAGIC == mb->magic ? PMSG_PF_EXT : 0;
+	mb->m_flags &= PMSG_PF_EXT | PMSG_PF_INLINE;	/* Allocation flags */
 	mb->m_u.m_check = NULL;						/* Clear "pre-send" checks */
 }
 
@@ -144,6 +358,41 @@ pmsg_fill(pmsg_t *mb, pdata_t *db, int prio, bool ext, const void *buf, int len)
 	return mb;
 }
 
+/**
+ * Allocate a message block along with a data buffer of ``len'' bytes
+ * in the same memory block.
+ *
+ * The message block is large enough to be an extended message block.
+ * Once filled by pmsg_fill(), it must be flagged with PMSG_PF_INLINE.
+ *
+ * @param len		length of the data buffer
+ * @param db_ptr	where the allocated data buffer is returned
+ *
+ * @return the message block, to be filled by pmsg_fill().
+ */
+static void *
+pmsg_inline_alloc(int len, pdata_t **db_ptr)
+{
+	uint idx = pmsg_pool_class_index(len);
+	tmalloc_t *depot;
+	void *p;
+
+	g_assert(idx < PMSG_POOL_CLASSES);
+
+	pmsg_pool_init();
+	depot = pmsg_inline_depot[idx];
+	p = tmalloc(depot);
+
+	*db_ptr = pdata_allocb(ptr_add_offset(p, PMSG_INLINE_OFFSET),
+		len + EMBEDDED_OFFSET, pdata_pool_free_inline, depot);
+
+	PMSG_STATS_INC(pmsg_allocated);
+	PMSG_STATS_INC(pmsg_inlined);
+	pmsg_stats_class(idx);
+
+	return p;
+}
+
 /**
  * Create new message from user provided data, which are copied into the
  * allocated data block.  If no user buffer is provided, an empty message
@@ -156,14 +405,26 @@ pmsg_new(int prio, const void *buf, int len)
 {
 	pmsg_t *mb;
 	pdata_t *db;
+	bool inlined;
 
 	g_assert(len > 0);
 	g_assert(implies(buf, valid_ptr(buf)));
 
-	WALLOC(mb);
-	db = pdata_new(len);
+	inlined = len <= PMSG_INLINE_MAX;
+
+	if G_LIKELY(inlined) {
+		mb = pmsg_inline_alloc(len, &db);
+	} else {
+		mb = pmsg_header_alloc(FALSE);
+		db = pdata_new(len);
+	}
+
+	(void) pmsg_fill(mb, db, prio, FALSE, buf, len);
 
-	return pmsg_fill(mb, db, prio, FALSE, buf, len);
+	if (inlined)
+		mb->m_flags |= PMSG_PF_INLINE;
+
+	return mb;
 }
 
 /**
@@ -175,18 +436,28 @@ pmsg_new_extend(int prio, const void *buf, int len,
 {
 	pmsg_ext_t *emb;
 	pdata_t *db;
+	bool inlined;
 
 	g_assert(len > 0);
 	g_assert(implies(buf, valid_ptr(buf)));
 
-	WALLOC(emb);
-	db = pdata_new(len);
+	inlined = len <= PMSG_INLINE_MAX;
+
+	if G_LIKELY(inlined) {
+		emb = pmsg_inline_alloc(len, &db);
+	} else {
+		emb = pmsg_header_alloc(TRUE);
+		db = pdata_new(len);
+	}
 
 	emb->m_free = free_cb;
 	emb->m_arg = arg;
 
 	(void) pmsg_fill(&emb->pmsg, db, prio, TRUE, buf, len);
 
+	if (inlined)
+		emb->pmsg.m_flags |= PMSG_PF_INLINE;
+
 	return cast_to_pmsg(emb);
 }
 
@@ -207,7 +478,7 @@ pmsg_alloc(int prio, pdata_t *db, int roff, int woff)
 	g_assert(woff >= 0 && (size_t) woff <= pdata_len(db));
 	g_assert(woff >= roff);
 
-	WALLOC(mb);
+	mb = pmsg_header_alloc(FALSE);
 
 	pmsg_fill(mb, db, prio, FALSE, NULL, 0);
 
@@ -227,13 +498,14 @@ pmsg_clone_extend(const pmsg_t *mb, pmsg_free_t free_cb, void *arg)
 
 	pmsg_check_consistency(mb);
 
-	WALLOC(nmb);
+	nmb = pmsg_header_alloc(TRUE);
 	nmb->pmsg = *mb;		/* Struct copy */
 	nmb->pmsg.magic = PMSG_EXT_MAGIC;
 
 	pdata_addref(nmb->pmsg.m_data);
 
 	nmb->pmsg.m_flags |= PMSG_PF_EXT;
+	nmb->pmsg.m_flags &= ~PMSG_PF_INLINE;	/* Allocated separately */
 	nmb->pmsg.m_refcnt = 1;
 	nmb->m_free = free_cb;
 	nmb->m_arg = arg;
@@ -335,8 +607,9 @@ pmsg_clone_ext(pmsg_ext_t *mb)
 
 	pmsg_ext_check_consistency(mb);
 
-	WALLOC(nmb);
+	nmb = pmsg_header_alloc(TRUE);
 	*nmb = *mb;					/* Struct copy */
+	nmb->pmsg.m_flags &= ~PMSG_PF_INLINE;	/* Allocated separately */
 	nmb->pmsg.m_refcnt = 1;
 	pdata_addref(nmb->pmsg.m_data);
 
@@ -358,8 +631,9 @@ pmsg_clone(const pmsg_t *mb)
 		pmsg_t *nmb;
 
 		pmsg_check_consistency(mb);
-		WALLOC(nmb);
+		nmb = pmsg_header_alloc(FALSE);
 		*nmb = *mb;					/* Struct copy */
+		nmb->m_flags &= ~PMSG_PF_INLINE;	/* Allocated separately */
 		nmb->m_refcnt = 1;
 		pdata_addref(nmb->m_data);
 
@@ -378,10 +652,10 @@ pmsg_clone_plain(const pmsg_t *mb)
 
 	pmsg_check_consistency(mb);
 
-	WALLOC(nmb);
+	nmb = pmsg_header_alloc(FALSE);
 	memcpy(nmb, mb, sizeof *nmb);
 	nmb->magic = PMSG_MAGIC;		/* Force plain message */
-	nmb->m_flags &= ~PMSG_PF_EXT;	/* In case original was extended */
+	nmb->m_flags &= ~(PMSG_PF_EXT | PMSG_PF_INLINE);	/* Plain, separate */
 	nmb->m_refcnt = 1;
 	pdata_addref(nmb->m_data);
 
@@ -446,9 +720,22 @@ pmsg_free(pmsg_t *mb)
 		pmsg_ext_t *emb = cast_to_pmsg_ext(mb);
 		if (emb->m_free)
 			(*emb->m_free)(mb, emb->m_arg);
-		WFREE0(emb);
+	}
+
+	/*
+	 * An inline message block is released along with its data buffer.
+	 */
+
+	PMSG_STATS_INC(pmsg_freed);
+
+	if (pmsg_is_inline(mb)) {
+		mb->magic = 0;
+	} else if (pmsg_is_extended(mb)) {
+		mb->magic = 0;
+		tmfree(pmsg_ext_depot, mb);
 	} else {
-		WFREE0(mb);
+		mb->magic = 0;
+		tmfree(pmsg_depot, mb);
 	}
 
 	/*
@@ -702,11 +989,26 @@ pdata_new(int len)
 {
 	pdata_t *db;
 	char *arena;
+	uint idx;
 
 	g_assert(len > 0);
 
-	arena = walloc(len + EMBEDDED_OFFSET);
-	db = pdata_allocb(arena, len + EMBEDDED_OFFSET, NULL, 0);
+	idx = pmsg_pool_class_index(len);
+
+	if G_LIKELY(idx < PMSG_POOL_CLASSES) {
+		tmalloc_t *depot;
+
+		pmsg_pool_init();
+		depot = pdata_depot[idx];
+		arena = tmalloc(depot);
+		db = pdata_allocb(arena, len + EMBEDDED_OFFSET, pdata_pool_free, depot);
+		PMSG_STATS_INC(pdata_pooled);
+		pmsg_stats_class(idx);
+	} else {
+		arena = walloc(len + EMBEDDED_OFFSET);
+		db = pdata_allocb(arena, len + EMBEDDED_OFFSET, NULL, 0);
+		PMSG_STATS_INC(pdata_walloc);
+	}
 
 	g_assert((size_t) len == pdata_len(db));
 	g_assert(db->d_arena == db->d_embedded);
@@ -762,6 +1064,7 @@ pdata_allocb_ext(void *buf, int len, pdata_free_t freecb, void *freearg)
 	g_assert(implies(freecb, valid_ptr(freecb)));
 
 	WALLOC(db);
+	PMSG_STATS_INC(pdata_external);
 	db->magic = PDATA_MAGIC;
 	db->d_arena = buf;
 	db->d_end = (char *) buf + len;
@@ -775,6 +1078,42 @@ pdata_allocb_ext(void *buf, int len, pdata_free_t freecb, void *freearg)
 	return db;
 }
 
+/**
+ * Free routine for data buffers created by pdata_slice().
+ */
+static void
+pdata_slice_free(void *unused_p, void *arg)
+{
+	(void) unused_p;
+
+	pdata_unref(arg);
+}
+
+/**
+ * Create an external data buffer referencing a slice of another data buffer,
+ * without copying the data.
+ *
+ * The slice holds a reference on the original buffer, which is therefore
+ * only reclaimed once the slice is.  Since the data is shared, it should
+ * not be modified through the slice whilst the original buffer is in use.
+ *
+ * @param db		the data buffer from which we take the slice
+ * @param offset	starting offset of the slice within the buffer
+ * @param len		length of the slice
+ *
+ * @return a new data buffer whose arena is the slice.
+ */
+pdata_t *
+pdata_slice(pdata_t *db, int offset, int len)
+{
+	pdata_check(db);
+	g_assert(offset >= 0 && len >= 0);
+	g_assert(UNSIGNED(offset) + UNSIGNED(len) <= pdata_len(db));
+
+	pdata_addref(db);
+	return pdata_allocb_ext(db->d_arena + offset, len, pdata_slice_free, db);
+}
+
 /**
  * This free routine can be used when there is nothing to be freed for
  * the buffer, probably because it was made out of a static buffer.
@@ -799,6 +1138,8 @@ pdata_free(pdata_t *db)
 
 	is_embedded = (db->d_arena == db->d_embedded);
 
+	PMSG_STATS_INC(pdata_freed);
+
 	/*
 	 * If user supplied a free routine for the buffer, invoke it.
 	 */
@@ -152,6 +152,7 @@ typedef void (*pmsg_free_t)(pmsg_t *mb, void *arg);
 #define PMSG_PF_ACKME	(1U << 5)	/**< Request remote acknowledgment */
 #define PMSG_PF_COMP	(1U << 4)	/**< Compression already attempted / done */
 #define PMSG_PF_HOOK	(1U << 3)	/**< Use ``m_check'' as standalone hook */
+#define PMSG_PF_INLINE	(1U << 2)	/**< Block allocated with its data buffer */
 
 static inline void
 pmsg_check_consistency(const pmsg_t * const mb)
@@ -185,6 +186,13 @@ pmsg_is_writable(const pmsg_t *mb)
 	return 1 == mb->m_data->d_refcnt;
 }
 
+static inline pdata_t *
+pmsg_pdata(const pmsg_t *mb)
+{
+	pmsg_check_consistency(mb);
+	return mb->m_data;
+}
+
 static inline unsigned
 pmsg_prio(const pmsg_t *mb)
 {
@@ -334,6 +342,9 @@ pmsg_mark_compressed(pmsg_t *mb)
 void pmsg_init(void);
 void pmsg_close(void);
 
+struct logagent;
+void pmsg_dump_stats_log(struct logagent *la, unsigned options);
+
 pmsg_t *pmsg_new(int prio, const void *buf, int len);
 pmsg_t * pmsg_new_extend(
 	int prio, const void *buf, int len,
@@ -366,6 +377,7 @@ pdata_t *pdata_allocb(void *buf, int len,
 	pdata_free_t freecb, void *freearg);
 pdata_t *pdata_allocb_ext(void *buf, int len,
 	pdata_free_t freecb, void *freearg);
+pdata_t *pdata_slice(pdata_t *db, int offset, int len);
 void pdata_free_nop(void *p, void *arg);
 void pdata_unref(pdata_t *db);
 
@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sets of regular expressions restricted to value intervals.
+ *
+ * Each regular expression of the set only applies when the value associated
+ * with the text to match (typically a file size) lies within a given
+ * interval.  The question we answer is whether any of the applicable
+ * expressions matches the text.
+ *
+ * Once all the expressions have been added, the set is compiled:
+ *
+ * - Expressions sharing the same interval are combined into a single
+ *   alternation, so that the regex engine can match them all in one pass
+ *   over the text instead of running each expression in turn.
+ *
+ * - The bounds of all the intervals partition the value space into buckets
+ *   within which the same groups of expressions apply, so that matching
+ *   only runs the expressions applicable to the value, after a binary
+ *   search of the bucket.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "regset.h"
+
+#include "halloc.h"
+#include "str.h"
+#include "walloc.h"
+#include "xsort.h"
+
+#include "override.h"		/* Must be the last header included */
+
+enum regset_magic { REGSET_MAGIC = 0x2b7e91a4 };
+
+/**
+ * A regular expression, as added to the set.
+ */
+struct regset_rule {
+	char *pattern;				/**< The expression (halloc'ed) */
+	uint64 min, max;			/**< Value interval, bounds included */
+	bool alone;					/**< Cannot be combined with others */
+};
+
+/**
+ * A group of expressions applying to the same interval.
+ *
+ * There is normally a single compiled expression per group, made of the
+ * alternation of all the expressions, unless some cannot be combined.
+ */
+struct regset_group {
+	uint64 min, max;			/**< Value interval, bounds included */
+	regex_t *re;				/**< Compiled expressions */
+	size_t count;				/**< Amount of compiled expressions */
+};
+
+/**
+ * A bucket of values, from ``lo'' to the ``lo'' of the next bucket
+ * (excluded), for which the same groups apply.
+ */
+struct regset_bucket {
+	uint64 lo;					/**< Lowest value in bucket */
+	uint32 *groups;				/**< Indices of applicable groups */
+	size_t count;				/**< Amount of applicable groups */
+};
+
+struct regset {
+	enum regset_magic magic;
+	int cflags;					/**< Flags for regcomp() */
+	struct regset_rule *rules;	/**< Expressions added, until compiled */
+	size_t count;				/**< Amount of expressions added */
+	size_t capacity;			/**< Capacity of the rules[] array */
+	struct regset_group *groups;	/**< Groups, once compiled */
+	size_t ngroups;				/**< Amount of groups */
+	struct regset_bucket *buckets;	/**< Buckets, sorted by ``lo'' */
+	size_t nbuckets;			/**< Amount of buckets */
+	bool compiled;				/**< Whether set was compiled */
+};
+
+static inline void
+regset_check(const struct regset * const rs)
+{
+	g_assert(rs != NULL);
+	g_assert(REGSET_MAGIC == rs->magic);
+}
+
+/**
+ * Create a new set of regular expressions.
+ *
+ * @param cflags	flags for regcomp(), must include REG_EXTENDED
+ *
+ * @return a new set, to be freed with regset_free_null().
+ */
+regset_t *
+regset_make(int cflags)
+{
+	regset_t *rs;
+
+	g_assert(cflags & REG_EXTENDED);	/* Needed for alternations */
+
+	WALLOC0(rs);
+	rs->magic = REGSET_MAGIC;
+	rs->cflags = cflags;
+
+	return rs;
+}
+
+/**
+ * Does the pattern contain a back-reference (\1 to \9)?
+ *
+ * Bracket expressions are not parsed, so a back-reference may be reported
+ * where there is none, which is harmless.
+ */
+static bool
+regset_has_backref(const char *pattern)
+{
+	const char *p;
+
+	for (p = pattern; *p != '\0'; p++) {
+		if ('\\' == *p) {
+			if (p[1] >= '1' && p[1] <= '9')
+				return TRUE;
+			if ('\0' == *++p)
+				break;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Add a regular expression to the set.
+ *
+ * @param rs		the set, not yet compiled
+ * @param pattern	the regular expression (copied)
+ * @param min		minimum value for which expression applies
+ * @param max		maximum value for which expression applies
+ * @param ebuf		where error message is written, if not NULL
+ * @param elen		length of ebuf
+ *
+ * @return TRUE if the expression was added, FALSE if it could not compile.
+ */
+bool
+regset_add(regset_t *rs, const char *pattern,
+	uint64 min, uint64 max, char *ebuf, size_t elen)
+{
+	struct regset_rule *r;
+	regex_t re;
+	size_t nsub;
+	char *wrapped;
+	bool alone = TRUE;
+	int error;
+
+	regset_check(rs);
+	g_assert(!rs->compiled);
+	g_assert(pattern != NULL);
+	g_assert(min <= max);
+
+	/*
+	 * Compile without REG_NOSUB to get an accurate amount of sub-expressions.
+	 */
+
+	error = regcomp(&re, pattern, rs->cflags & ~REG_NOSUB);
+	if (error != 0) {
+		if (ebuf != NULL)
+			regerror(error, &re, ebuf, elen);
+		return FALSE;
+	}
+	nsub = re.re_nsub;
+	regfree(&re);
+
+	/*
+	 * The expression can only be combined with others if it remains the
+	 * same expression once enclosed in parentheses, which may not be the
+	 * case with unbalanced parentheses some implementations accept.
+	 *
+	 * Back-references, an extension of extended expressions in some
+	 * implementations, refer to groups by number: these numbers would be
+	 * shifted once combined, hence such expressions are kept alone.
+	 */
+
+	if (!regset_has_backref(pattern)) {
+		wrapped = h_strconcat("(", pattern, ")", (void *) 0);
+		if (0 == regcomp(&re, wrapped, rs->cflags & ~REG_NOSUB)) {
+			alone = re.re_nsub != nsub + 1;
+			regfree(&re);
+		}
+		HFREE_NULL(wrapped);
+	}
+
+	if (rs->count == rs->capacity) {
+		rs->capacity = MAX(16, rs->capacity * 2);
+		HREALLOC_ARRAY(rs->rules, rs->capacity);
+	}
+
+	r = &rs->rules[rs->count++];
+	r->pattern = h_strdup(pattern);
+	r->min = min;
+	r->max = max;
+	r->alone = alone;
+
+	return TRUE;
+}
+
+/**
+ * Sort rules by interval.
+ */
+static int
+regset_rule_cmp(const void *a, const void *b)
+{
+	const struct regset_rule *ra = a, *rb = b;
+
+	return ra->min == rb->min ? CMP(ra->max, rb->max) : CMP(ra->min, rb->min);
+}
+
+/**
+ * Sort bucket bounds.
+ */
+static int
+regset_uint64_cmp(const void *a, const void *b)
+{
+	const uint64 *va = a, *vb = b;
+
+	return CMP(*va, *vb);
+}
+
+/**
+ * Compile the group made of the supplied rules, sharing the same interval.
+ */
+static void
+regset_group_compile(const regset_t *rs, struct regset_group *g,
+	const struct regset_rule *rules, size_t n)
+{
+	size_t i, combined = 0;
+	str_t *s;
+
+	g->min = rules[0].min;
+	g->max = rules[0].max;
+	g->count = 0;
+	HALLOC_ARRAY(g->re, n);
+
+	s = str_new(0);
+
+	for (i = 0; i < n; i++) {
+		const struct regset_rule *r = &rules[i];
+
+		g_assert(r->min == g->min && r->max == g->max);
+
+		if (r->alone) {
+			int error = regcomp(&g->re[g->count], r->pattern, rs->cflags);
+			g_assert(0 == error);		/* Was checked when added */
+			g->count++;
+			continue;
+		}
+
+		if (combined++ != 0)
+			str_putc(s, '|');
+		str_putc(s, '(');
+		str_cat(s, r->pattern);
+		str_putc(s, ')');
+	}
+
+	/*
+	 * Should the combined expression not compile, which can only happen when
+	 * the regex engine lacks space, compile the expressions separately.
+	 */
+
+	if (
+		combined != 0 &&
+		0 != regcomp(&g->re[g->count], str_2c(s), rs->cflags)
+	) {
+		for (i = 0; i < n; i++) {
+			const struct regset_rule *r = &rules[i];
+
+			if (!r->alone) {
+				int error = regcomp(&g->re[g->count], r->pattern, rs->cflags);
+				g_assert(0 == error);	/* Was checked when added */
+				g->count++;
+			}
+		}
+	} else if (combined != 0) {
+		g->count++;
+	}
+
+	str_destroy_null(&s);
+
+	g_assert(g->count <= n);
+}
+
+/**
+ * Compile the set, once all the regular expressions have been added.
+ */
+void
+regset_compile(regset_t *rs)
+{
+	size_t i, j, nbounds;
+	uint64 *bounds;
+
+	regset_check(rs);
+	g_assert(!rs->compiled);
+
+	/*
+	 * Group the rules having the same interval.
+	 */
+
+	if (rs->count != 0)
+		xqsort(rs->rules, rs->count, sizeof rs->rules[0], regset_rule_cmp);
+
+	HALLOC_ARRAY(rs->groups, MAX(1, rs->count));
+
+	for (i = 0; i < rs->count; i = j) {
+		const struct regset_rule *r = &rs->rules[i];
+
+		for (j = i + 1; j < rs->count; j++) {
+			if (rs->rules[j].min != r->min || rs->rules[j].max != r->max)
+				break;
+		}
+
+		regset_group_compile(rs, &rs->groups[rs->ngroups++], r, j - i);
+	}
+
+	for (i = 0; i < rs->count; i++) {
+		HFREE_NULL(rs->rules[i].pattern);
+	}
+	HFREE_NULL(rs->rules);
+	rs->capacity = 0;
+
+	/*
+	 * Collect the bounds of the buckets: each interval starts a new bucket
+	 * at its minimum and ends it at its maximum.  The first bucket always
+	 * starts at 0.
+	 */
+
+	HALLOC_ARRAY(bounds, 2 * rs->ngroups + 1);
+	nbounds = 0;
+	bounds[nbounds++] = 0;
+
+	for (i = 0; i < rs->ngroups; i++) {
+		const struct regset_group *g = &rs->groups[i];
+
+		bounds[nbounds++] = g->min;
+		if (g->max != MAX_INT_VAL(uint64))
+			bounds[nbounds++] = g->max + 1;
+	}
+
+	xqsort(bounds, nbounds, sizeof bounds[0], regset_uint64_cmp);
+
+	/*
+	 * Create the buckets, with the groups applying to each of them.
+	 */
+
+	HALLOC_ARRAY(rs->buckets, nbounds);
+
+	for (i = 0; i < nbounds; i++) {
+		struct regset_bucket *b;
+		uint64 lo = bounds[i];
+
+		if (i != 0 && lo == bounds[i - 1])
+			continue;
+
+		b = &rs->buckets[rs->nbuckets++];
+		b->lo = lo;
+		b->count = 0;
+		HALLOC_ARRAY(b->groups, MAX(1, rs->ngroups));
+
+		for (j = 0; j < rs->ngroups; j++) {
+			const struct regset_group *g = &rs->groups[j];
+
+			if (g->min <= lo && lo <= g->max)
+				b->groups[b->count++] = j;
+		}
+
+		HREALLOC_ARRAY(b->groups, MAX(1, b->count));
+	}
+
+	HFREE_NULL(bounds);
+	rs->compiled = TRUE;
+}
+
+/**
+ * Free set and nullify its pointer.
+ */
+void
+regset_free_null(regset_t **rs_ptr)
+{
+	regset_t *rs = *rs_ptr;
+
+	if (rs != NULL) {
+		size_t i, j;
+
+		regset_check(rs);
+
+		if (rs->rules != NULL) {
+			for (i = 0; i < rs->count; i++) {
+				HFREE_NULL(rs->rules[i].pattern);
+			}
+			HFREE_NULL(rs->rules);
+		}
+
+		for (i = 0; i < rs->ngroups; i++) {
+			struct regset_group *g = &rs->groups[i];
+
+			for (j = 0; j < g->count; j++) {
+				regfree(&g->re[j]);
+			}
+			HFREE_NULL(g->re);
+		}
+		HFREE_NULL(rs->groups);
+
+		for (i = 0; i < rs->nbuckets; i++) {
+			HFREE_NULL(rs->buckets[i].groups);
+		}
+		HFREE_NULL(rs->buckets);
+
+		rs->magic = 0;
+		WFREE(rs);
+		*rs_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of regular expressions added to the set.
+ */
+size_t
+regset_count(const regset_t *rs)
+{
+	regset_check(rs);
+
+	return rs->count;
+}
+
+/**
+ * @return amount of compiled regular expressions, 0 if not compiled yet.
+ */
+size_t
+regset_regex_count(const regset_t *rs)
+{
+	size_t i, n = 0;
+
+	regset_check(rs);
+
+	for (i = 0; i < rs->ngroups; i++) {
+		n += rs->groups[i].count;
+	}
+
+	return n;
+}
+
+/**
+ * @return amount of value buckets, 0 if not compiled yet.
+ */
+size_t
+regset_bucket_count(const regset_t *rs)
+{
+	regset_check(rs);
+
+	return rs->nbuckets;
+}
+
+/**
+ * Check whether any of the expressions applying to the given value matches
+ * the text.
+ *
+ * @param rs		the compiled set
+ * @param text		the text to match
+ * @param value		the value associated with the text
+ *
+ * @return TRUE if the text matched.
+ */
+bool
+regset_match(const regset_t *rs, const char *text, uint64 value)
+{
+	const struct regset_bucket *b;
+	size_t lo, hi, i;
+
+	regset_check(rs);
+	g_assert(rs->compiled);
+	g_assert(text != NULL);
+
+	if G_UNLIKELY(0 == rs->nbuckets)
+		return FALSE;
+
+	/*
+	 * Locate the last bucket whose lowest value is not greater than
+	 * the value, the first bucket starting at 0.
+	 */
+
+	lo = 0;
+	hi = rs->nbuckets;
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (rs->buckets[mid].lo <= value)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	b = &rs->buckets[lo];
+
+	g_assert(b->lo <= value);
+
+	for (i = 0; i < b->count; i++) {
+		const struct regset_group *g = &rs->groups[b->groups[i]];
+		size_t j;
+
+		for (j = 0; j < g->count; j++) {
+			if (0 == regexec(&g->re[j], text, 0, NULL, 0))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
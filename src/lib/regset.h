@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sets of regular expressions restricted to value intervals.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _regset_h_
+#define _regset_h_
+
+struct regset;
+typedef struct regset regset_t;
+
+/*
+ * Public interface.
+ */
+
+regset_t *regset_make(int cflags);
+bool regset_add(regset_t *rs, const char *pattern,
+	uint64 min, uint64 max, char *ebuf, size_t elen);
+void regset_compile(regset_t *rs);
+void regset_free_null(regset_t **rs_ptr);
+
+size_t regset_count(const regset_t *rs);
+size_t regset_regex_count(const regset_t *rs);
+size_t regset_bucket_count(const regset_t *rs);
+
+bool regset_match(const regset_t *rs, const char *text, uint64 value);
+
+#endif /* _regset_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
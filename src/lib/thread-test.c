@@ -34,6 +34,7 @@
 
 #include "aq.h"
 #include "atomic.h"
+#include "atoms.h"
 #include "barrier.h"
 #include "compat_poll.h"
 #include "compat_sleep_ms.h"
@@ -86,7 +87,7 @@ static void G_GNUC_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-hejsvwxABCDEFIKMNOPQRSVWX] [-a type] [-b size] [-c CPU]\n"
+		"Usage: %s [-hejsvwxABCDEFGIKMNOPQRSVWX] [-a type] [-b size] [-c CPU]\n"
 		"       [-f count] [-n count] [-r percent] [-t ms] [-T secs]\n"
 		"  -a : allocator to exlusively test via -X (see below for type)\n"
 		"  -b : fixed block size to use for memory tests via -X\n"
@@ -108,6 +109,7 @@ usage(void)
 		"  -D : test synchronization dams\n"
 		"  -E : test thread signals\n"
 		"  -F : test thread fork\n"
+		"  -G : test atom table contention\n"
 		"  -I : test inter-thread waiter signaling\n"
 		"  -K : test thread cancellation\n"
 		"  -M : monitors tennis match via waiters\n"
@@ -123,6 +125,8 @@ usage(void)
 		"  -X : exercise concurrent memory allocation\n"
 		"Values given as decimal, hexadecimal (0x), octal (0) or binary (0b)\n"
 		"Allocators: r=random mix, h=halloc, v=vmm_alloc, w=walloc, x=xmalloc\n"
+		"            m=malloc (to compare xmalloc with the system allocator,\n"
+		"              only when xmalloc does not trap malloc)\n"
 		, progname);
 	exit(EXIT_FAILURE);
 }
@@ -1573,6 +1577,7 @@ enum memory_alloc {
 	MEMORY_HALLOC = 1,
 	MEMORY_WALLOC = 2,
 	MEMORY_VMM = 3,
+	MEMORY_MALLOC = 4,
 };
 
 struct memory {
@@ -1667,6 +1672,9 @@ exercise_alloc_memory(struct memory *m)
 	case MEMORY_VMM:
 		m->p = vmm_alloc(m->size);
 		break;
+	case MEMORY_MALLOC:
+		m->p = malloc(m->size);
+		break;
 	default:
 		g_assert_not_reached();
 	}
@@ -1688,6 +1696,9 @@ exercise_free_memory(const struct memory *m)
 	case MEMORY_VMM:
 		vmm_free(m->p, m->size);
 		break;
+	case MEMORY_MALLOC:
+		free(m->p);
+		break;
 	default:
 		g_assert_not_reached();
 	}
@@ -1736,6 +1747,9 @@ exercise_memory(void *arg)
 		case 'x':
 			m->type = MEMORY_XMALLOC;
 			break;
+		case 'm':
+			m->type = MEMORY_MALLOC;
+			break;
 		default:
 			g_assert_not_reached();
 		}
@@ -2119,6 +2133,169 @@ test_evq(unsigned repeat)
 	}
 }
 
+#define ATOM_HOT_GUIDS		64			/* Hot GUID atoms, shared by all */
+#define ATOM_SCAN_BATCH		1024		/* Strings kept before releasing */
+#define ATOM_OPERATIONS		200000		/* Operations per thread */
+
+struct atom_results {
+	size_t amount;
+	ulong us;
+};
+
+static const struct guid *atom_hot[ATOM_HOT_GUIDS];
+
+/*
+ * Thread creating and releasing many distinct string atoms, as the
+ * share thread does during a library rescan.
+ */
+static void *
+atom_scanner(void *arg)
+{
+	const char *batch[ATOM_SCAN_BATCH];
+	struct atom_results *ar;
+	size_t i, n = 0;
+	tm_t start, end;
+	uint id = pointer_to_uint(arg);
+
+	WALLOC0(ar);
+
+	tm_now_exact(&start);
+	for (i = 0; i < ATOM_OPERATIONS; i++) {
+		char name[64];
+
+		str_bprintf(name, sizeof name, "/share/t%u/dir%zu/file-%zu.ogg",
+			id, i / 100, i);
+		batch[n++] = atom_str_get(name);
+
+		if (ATOM_SCAN_BATCH == n) {
+			while (n != 0)
+				atom_str_free(batch[--n]);
+		}
+	}
+	while (n != 0)
+		atom_str_free(batch[--n]);
+	tm_now_exact(&end);
+
+	ar->amount = ATOM_OPERATIONS;
+	ar->us = tm_elapsed_us(&end, &start);
+
+	return ar;
+}
+
+/*
+ * Thread grabbing and releasing references on existing GUID atoms, as
+ * the main thread does when routing messages.
+ */
+static void *
+atom_router(void *unused_arg)
+{
+	struct atom_results *ar;
+	size_t i;
+	tm_t start, end;
+
+	(void) unused_arg;
+
+	WALLOC0(ar);
+
+	tm_now_exact(&start);
+	for (i = 0; i < ATOM_OPERATIONS; i++) {
+		const struct guid *g = atom_guid_get(atom_hot[i % ATOM_HOT_GUIDS]);
+		atom_guid_free(g);
+	}
+	tm_now_exact(&end);
+
+	ar->amount = ATOM_OPERATIONS;
+	ar->us = tm_elapsed_us(&end, &start);
+
+	return ar;
+}
+
+static void
+test_atoms_one(uint scanners, uint routers,
+	struct atom_results *scan, struct atom_results *route)
+{
+	uint i, n = scanners + routers;
+	int *t;
+
+	WALLOC_ARRAY(t, n);
+
+	for (i = 0; i < n; i++) {
+		int r = thread_create(i < scanners ? atom_scanner : atom_router,
+			uint_to_pointer(i), 0, THREAD_STACK_MIN);
+		if (-1 == r)
+			s_error("cannot create thread: %m");
+		t[i] = r;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct atom_results *ar, *total = i < scanners ? scan : route;
+		void *e;
+
+		if (-1 == thread_join(t[i], &e)) {
+			s_error("%s(): could not join with %s: %m",
+				G_STRFUNC, thread_id_name(t[i]));
+		}
+
+		ar = e;
+		total->amount += ar->amount;
+		total->us += ar->us;
+		WFREE(ar);
+	}
+
+	WFREE_ARRAY(t, n);
+}
+
+static void
+test_atoms(unsigned repeat)
+{
+	long cpus = 0 == cpu_count ? getcpucount() : cpu_count;
+	uint i, scanners, routers;
+
+	/*
+	 * One scanner thread for every router thread, with at least one of each.
+	 */
+
+	scanners = MAX(1, cpus / 2);
+	routers = MAX(1, cpus - scanners);
+
+	printf("%s() running %u scanner%s and %u router%s\n", G_STRFUNC,
+		scanners, plural(scanners), routers, plural(routers));
+	fflush(stdout);
+
+	for (i = 0; i < ATOM_HOT_GUIDS; i++) {
+		char g[GUID_RAW_SIZE];
+
+		random_bytes(g, sizeof g);
+		atom_hot[i] = atom_guid_get((const struct guid *) g);
+	}
+
+	for (i = 0; i < repeat; i++) {
+		struct atom_results scan, route;
+		tm_t start, end, elapsed;
+
+		ZERO(&scan);
+		ZERO(&route);
+
+		tm_now_exact(&start);
+		test_atoms_one(scanners, routers, &scan, &route);
+		tm_now_exact(&end);
+
+		tm_elapsed(&elapsed, &end, &start);
+
+		printf("%s() #%d finished! (%f secs, %.3f us/string, %.3f us/guid)\n",
+			G_STRFUNC, i, tm2f(&elapsed),
+			scan.us / (double) scan.amount,
+			route.us / (double) route.amount);
+		fflush(stdout);
+	}
+
+	for (i = 0; i < ATOM_HOT_GUIDS; i++)
+		atom_guid_free_null(&atom_hot[i]);
+
+	printf("%s() done!\n", G_STRFUNC);
+	fflush(stdout);
+}
+
 static unsigned
 get_number(const char *arg, int opt)
 {
@@ -2146,8 +2323,9 @@ main(int argc, char **argv)
 	bool inter = FALSE, forking = FALSE, aqueue = FALSE, rwlock = FALSE;
 	bool signals = FALSE, barrier = FALSE, overflow = FALSE, memory = FALSE;
 	bool stats = FALSE, teq = FALSE, cancel = FALSE, dam = FALSE, evq = FALSE;
+	bool atoms = FALSE;
 	unsigned repeat = 1, play_time = 0;
-	const char options[] = "a:b:c:ef:hjn:r:st:vwxABCDEFIKMNOPQRST:VWX";
+	const char options[] = "a:b:c:ef:hjn:r:st:vwxABCDEFGIKMNOPQRST:VWX";
 
 	mingw_early_init();
 	progname = filepath_basename(argv[0]);
@@ -2176,6 +2354,9 @@ main(int argc, char **argv)
 		case 'F':			/* test thread_fork() */
 			forking = TRUE;
 			break;
+		case 'G':			/* test atom table contention */
+			atoms = TRUE;
+			break;
 		case 'I':			/* test inter-thread signaling */
 			inter = TRUE;
 			break;
@@ -2334,6 +2515,14 @@ main(int argc, char **argv)
 		case 'x':
 			printf("Using xmalloc() for memory tests\n");
 			break;
+		case 'm':
+			if (xmalloc_is_malloc()) {
+				s_warning("xmalloc() traps malloc(), cannot compare with "
+					"the system allocator");
+				exit(EXIT_FAILURE);
+			}
+			printf("Using system malloc() for memory tests\n");
+			break;
 		default:
 			s_warning("unknown allocator '%c', using random mix", allocator);
 			allocator = 'r';
@@ -2357,6 +2546,9 @@ main(int argc, char **argv)
 	if (evq)
 		test_evq(repeat);
 
+	if (atoms)
+		test_atoms(repeat);
+
 	/*
 	 * Print final statistics.
 	 */
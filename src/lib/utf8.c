@@ -69,10 +69,12 @@
 #include "debug.h"
 #include "endian.h"
 #include "halloc.h"
+#include "hashing.h"
 #include "hikset.h"
 #include "htable.h"
 #include "mempcpy.h"
 #include "misc.h"
+#include "mutex.h"
 #include "path.h"
 #include "pslist.h"
 #include "random.h"
@@ -106,6 +108,7 @@ ui_uses_utf8_encoding(void)
 static void unicode_compose_init(void);
 
 static bool unicode_compose_init_passed;
+static bool utf8_ascii_canon_inited;
 static bool locale_init_passed;
 
 void utf8_regression_checks(void);
@@ -355,6 +358,58 @@ static const uint8 utf8len_mark[] = {
 	(CHAR(x) >= UTF8_BYTE_MARK && CHAR(x) <= UTF8_BYTE_MASK)
 #define UTF8_IS_CONTINUED(x)	(CHAR(x) & UTF8_BYTE_MARK)
 
+#if CHAR_BIT == 8
+#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
+#else
+#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
+#endif
+
+/*
+ * Word-at-a-time scanning of ASCII text.
+ *
+ * A word holds only non-NUL ASCII bytes when none of its bytes has the high
+ * bit set and none is zero.  Subtracting 0x01 from each byte sets the high
+ * bit of any zero byte, so ((w - ONES) | w) & HIGHS is zero only for words
+ * made of non-NUL ASCII bytes.  False positives (due to borrows) merely make
+ * us fall back to the byte-wise scanning.
+ *
+ * Words are only read at aligned addresses: such a read never crosses a page
+ * boundary, hence it is safe even if the NUL terminator lies within the word.
+ */
+#define UTF8_WORD_ONES		(((ulong) -1) / 0xff)	/* 0x0101...01 */
+#define UTF8_WORD_HIGHS		(UTF8_WORD_ONES * 0x80)	/* 0x8080...80 */
+#define UTF8_WORD_MASK		(sizeof(ulong) - 1)
+
+/**
+ * Skip the leading run of non-NUL ASCII characters in a string.
+ *
+ * @param s		a NUL-terminated string
+ *
+ * @return pointer to the first non-ASCII character or to the trailing NUL.
+ */
+static inline const char * G_GNUC_PURE
+utf8_ascii_skip(const char *s)
+{
+	while (0 != (pointer_to_ulong(s) & UTF8_WORD_MASK)) {
+		if (!IS_NON_NUL_ASCII(s))
+			return s;
+		s++;
+	}
+
+	for (;;) {
+		ulong w = *(const ulong *) s;
+
+		if (0 != (((w - UTF8_WORD_ONES) | w) & UTF8_WORD_HIGHS))
+			break;
+		s += sizeof w;
+	}
+
+	while (IS_NON_NUL_ASCII(s))
+		s++;
+
+	return s;
+}
+
 #define UTF8_CONT_MASK			(CHAR(0x3f))
 #define UTF8_ACCU_SHIFT			6
 #define UTF8_ACCUMULATE(o,n)	\
@@ -991,15 +1046,23 @@ utf8_char_len_probe(const char *s)
 bool
 utf8_is_valid_string(const char *src)
 {
-	const char *s;
-	uint clen;
+	const char *s = src;
+
+	/*
+	 * ASCII runs are skipped a word at a time, only multi-byte sequences
+	 * need to be decoded.
+	 */
+
+	for (;;) {
+		uint clen;
 
-	for (s = src; '\0' != *s; s += clen) {
+		s = utf8_ascii_skip(s);
+		if ('\0' == *s)
+			return TRUE;
 		if (0 == (clen = utf8_char_len(s)))
 			return FALSE;
+		s += clen;
 	}
-
-	return TRUE;
 }
 
 /**
@@ -1014,6 +1077,20 @@ utf8_is_valid_data(const char *src, size_t len)
 	while (len > 0) {
 		size_t clen;
 
+		/*
+		 * Skip aligned words made of ASCII bytes (NULs included).
+		 */
+
+		if (
+			0 == (pointer_to_ulong(src) & UTF8_WORD_MASK) &&
+			len >= sizeof(ulong) &&
+			0 == (*(const ulong *) src & UTF8_WORD_HIGHS)
+		) {
+			src += sizeof(ulong);
+			len -= sizeof(ulong);
+			continue;
+		}
+
 		clen = utf8_skip(*src);
 		if (clen > len || 0 == utf8_char_len(src))
 			break;
@@ -2664,19 +2741,10 @@ charset_to_utf8(const char *cs, const char *src, size_t src_len)
 	return result;
 }
 
-#if CHAR_BIT == 8
-#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
-#else
-#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
-#endif
-
 bool
 is_ascii_string(const char *s)
 {
-	while (IS_NON_NUL_ASCII(s))
-		++s;
-
-	return '\0' == *s;
+	return '\0' == *utf8_ascii_skip(s);
 }
 
 static inline const char *
@@ -5688,6 +5756,111 @@ utf32_canonize(const uint32 *src0)
 	return dst;
 }
 
+/*
+ * Canonization of ASCII strings.
+ *
+ * For ASCII input, utf32_canonize() boils down to lowercasing followed by
+ * the filtering of utf32_filter(): composition and decomposition leave ASCII
+ * characters untouched and they all belong to the same Unicode block.
+ *
+ * Each ASCII character is therefore classified once, by running it through
+ * utf32_filter_char(), and utf8_canonize_ascii() replays the filtering logic
+ * directly on the bytes, with no UTF-32 conversion.
+ */
+enum utf8_ascii_canon {
+	UTF8_AC_DROP = 0,		/**< Character is skipped */
+	UTF8_AC_KEEP,			/**< Character is kept, ends a separator run */
+	UTF8_AC_PASS,			/**< Character is kept, separator state unchanged */
+	UTF8_AC_SEP				/**< Character is a separator */
+};
+
+static uint8 utf8_ascii_canon_class[0x80];
+static char utf8_ascii_canon_char[0x80];
+
+/**
+ * Build the ASCII canonization tables.
+ *
+ * Must be called after the consistency of the Unicode tables was checked.
+ */
+static G_GNUC_COLD void
+utf8_ascii_canon_init(void)
+{
+	uint32 c;
+	uint block = utf32_block_id(0x0020);
+
+	for (c = 1; c < G_N_ELEMENTS(utf8_ascii_canon_class); c++) {
+		uint32 uc = utf32_lowercase(c), r1, r2;
+		bool s1 = FALSE, s2 = TRUE;
+		enum utf8_ascii_canon class;
+
+		g_assert(uc < 0x80);
+		g_assert(NULL == utf32_special_folding(uc));
+		g_assert(NULL == utf32_decompose_lookup(uc, TRUE));
+		g_assert(block == utf32_block_id(uc));
+
+		r1 = utf32_filter_char(uc, &s1, FALSE);
+		r2 = utf32_filter_char(uc, &s2, FALSE);
+
+		if (0 == r1 && !s1) {
+			class = UTF8_AC_DROP;
+		} else if (0x0020 == r1 && s1 && 0 == r2) {
+			class = UTF8_AC_SEP;
+		} else if (uc == r1 && uc == r2 && !s1) {
+			class = s2 ? UTF8_AC_PASS : UTF8_AC_KEEP;
+		} else {
+			g_assert_not_reached();
+		}
+
+		utf8_ascii_canon_class[c] = class;
+		utf8_ascii_canon_char[c] = uc;
+	}
+
+	utf8_ascii_canon_inited = TRUE;
+}
+
+/**
+ * Canonize an ASCII string, yielding the same result as utf32_canonize().
+ *
+ * @param src	the NUL-terminated ASCII string
+ * @param len	length of the string
+ *
+ * @return canonized string (halloc()-ed).
+ */
+static char *
+utf8_canonize_ascii(const char *src, size_t len)
+{
+	const char *s;
+	char *dst, *p;
+	bool space = TRUE;		/* Prevent adding leading space */
+
+	dst = p = halloc(len + 1);
+
+	for (s = src; '\0' != *s; s++) {
+		uchar c = *s;
+
+		switch (utf8_ascii_canon_class[c]) {
+		case UTF8_AC_KEEP:
+			space = FALSE;
+			/* FALL THROUGH */
+		case UTF8_AC_PASS:
+			*p++ = utf8_ascii_canon_char[c];
+			break;
+		case UTF8_AC_SEP:
+			if (!space && '\0' != s[1])
+				*p++ = ' ';
+			space = TRUE;
+			break;
+		case UTF8_AC_DROP:
+			break;
+		}
+	}
+
+	*p = '\0';
+	g_assert(ptr_diff(p, dst) <= len);
+
+	return dst;
+}
+
 /**
  * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
  */
@@ -5698,6 +5871,17 @@ utf8_canonize(const char *src)
 
 	g_assert(utf8_is_valid_string(src));
 
+	/*
+	 * Pure ASCII strings, the vast majority, take the fast path.
+	 */
+
+	if G_LIKELY(utf8_ascii_canon_inited) {
+		const char *end = utf8_ascii_skip(src);
+
+		if ('\0' == *end)
+			return utf8_canonize_ascii(src, ptr_diff(end, src));
+	}
+
 	{
 		size_t n;
 		uint32 buf[1024];
@@ -5725,6 +5909,89 @@ utf8_canonize(const char *src)
 	return cast_to_char_ptr(dst32);
 }
 
+/*
+ * Cache of recently canonized strings.
+ *
+ * The same query is canonized several times as it is processed (routing,
+ * local matching) and popular queries come back again and again, hence
+ * remembering the last canonized strings avoids the costly UTF-32 conversion
+ * and normalization for non-ASCII queries.  The cache is direct-mapped,
+ * a new string replacing the older one hashing to the same slot.
+ */
+#define UTF8_CANON_CACHE		256		/**< Slots, must be a power of 2 */
+#define UTF8_CANON_CACHE_MAXLEN	256		/**< Longer strings are not cached */
+
+static struct utf8_canon_slot {
+	char *src;					/**< Original string (halloc()-ed) */
+	char *dst;					/**< Canonized string (halloc()-ed) */
+} utf8_canon_cache[UTF8_CANON_CACHE];
+
+static mutex_t utf8_canon_cache_mtx = MUTEX_INIT;
+
+#define UTF8_CANON_CACHE_LOCK	mutex_lock(&utf8_canon_cache_mtx)
+#define UTF8_CANON_CACHE_UNLOCK	mutex_unlock(&utf8_canon_cache_mtx)
+
+/**
+ * Same as utf8_canonize() but remembers the recently canonized strings to
+ * avoid repeating the canonization of identical strings, queries mostly.
+ *
+ * @return the canonized string (halloc()-ed).
+ */
+char *
+utf8_canonize_cached(const char *src)
+{
+	struct utf8_canon_slot *cs;
+	const char *end;
+	char *dst, *osrc, *odst;
+
+	/*
+	 * ASCII strings are cheap to canonize, and so are long strings compared
+	 * to their hashing and comparison: bypass the cache for these.
+	 */
+
+	end = utf8_ascii_skip(src);
+	if ('\0' == *end)
+		return utf8_canonize(src);
+
+	if (strlen(end) + ptr_diff(end, src) > UTF8_CANON_CACHE_MAXLEN)
+		return utf8_canonize(src);
+
+	cs = &utf8_canon_cache[string_mix_hash(src) & (UTF8_CANON_CACHE - 1)];
+
+	UTF8_CANON_CACHE_LOCK;
+
+	if (cs->src != NULL && 0 == strcmp(cs->src, src)) {
+		dst = h_strdup(cs->dst);
+		UTF8_CANON_CACHE_UNLOCK;
+		return dst;
+	}
+
+	UTF8_CANON_CACHE_UNLOCK;
+
+	dst = utf8_canonize(src);
+
+	/*
+	 * Record the new string, superseding the previous slot owner.
+	 */
+
+	{
+		char *nsrc = h_strdup(src);
+		char *ndst = h_strdup(dst);
+
+		UTF8_CANON_CACHE_LOCK;
+		osrc = cs->src;
+		odst = cs->dst;
+		cs->src = nsrc;
+		cs->dst = ndst;
+		UTF8_CANON_CACHE_UNLOCK;
+	}
+
+	HFREE_NULL(osrc);
+	HFREE_NULL(odst);
+
+	return dst;
+}
+
 /**
  * Helper function to sort the lists of ``utf32_compose_roots''.
  */
@@ -5859,6 +6126,8 @@ unicode_compose_init(void)
 	}
 
 	unicode_compose_init_passed = TRUE;
+
+	utf8_ascii_canon_init();
 }
 
 static const char *
@@ -121,7 +121,6 @@
 #include "mutex.h"
 #include "omalloc.h"
 #include "once.h"
-#include "parse.h"
 #include "pow2.h"
 #include "rwlock.h"
 #include "sha1.h"
@@ -302,6 +301,12 @@ static struct vmm_stats {
 	uint64 hole_invalidated;		/**< Times we invalidate cached hole */
 	uint64 hole_updated;			/**< Times we updated the cached hole */
 	uint64 hole_unchanged;			/**< Times we left the cached hole as-is */
+	uint64 huge_allocations;		/**< Regions aligned for huge pages */
+	uint64 huge_freeings;			/**< Huge page regions freed */
+	uint64 huge_advise_failed;		/**< Kernel refused MADV_HUGEPAGE */
+	uint64 huge_trimmed_pages;		/**< Pages trimmed to align regions */
+	size_t huge_regions;			/**< Amount of live huge page regions */
+	size_t huge_memory;				/**< Memory held in huge page regions */
 	size_t user_memory;				/**< Amount of "user" memory allocated */
 	size_t user_pages;				/**< Amount of "user" memory pages used */
 	size_t user_blocks;				/**< Amount of "user" memory blocks */
@@ -395,6 +400,25 @@ static cperiodic_t *vmm_periodic;
 #define VMM_MAGAZINE_PAGEMAX	5	/**< Up to 5 pages */
 static tmalloc_t *vmm_magazine[VMM_MAGAZINE_PAGEMAX];
 
+/*
+ * Large "user" regions, such as the arenas of big hash tables, the QRP tables
+ * or the routing tables, are walked randomly and cause TLB pressure when
+ * backed by regular pages.
+ *
+ * When the kernel supports transparent huge pages, user regions of at least
+ * vmm_huge_threshold bytes are aligned on a huge page boundary and flagged
+ * with madvise(MADV_HUGEPAGE) so that the kernel can back them with huge
+ * pages.  The decision is taken once at initialization time, so that every
+ * large user region freed was necessarily allocated through that path.
+ */
+
+#define VMM_HUGE_SYSFS		"/sys/kernel/mm/transparent_hugepage/"
+#define VMM_HUGE_PAGESIZE	(2 * 1024 * 1024)	/**< Default huge page size */
+
+static size_t vmm_huge_pagesize;			/**< 0 if not using huge pages */
+static size_t vmm_huge_threshold;			/**< Minimum region size */
+static const char *vmm_huge_mode = "unsupported";	/**< Kernel policy */
+
 static bool safe_to_log;			/**< True when we can log */
 static bool stop_freeing;			/**< No longer release memory */
 static uint32 vmm_debug;			/**< Debug level */
@@ -3745,6 +3769,181 @@ vmm_invalidate_pages(void *p, size_t size)
 #endif	/* VMM_INVALIDATE_FREE_PAGES */
 }
 
+/**
+ * Read the first line of a (sysfs) file.
+ *
+ * This is called very early during initialization, so we only rely on
+ * system calls here.
+ *
+ * @return length read, 0 on error.
+ */
+static size_t
+vmm_huge_read(const char *path, char *buf, size_t len)
+{
+	int fd;
+	ssize_t r;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		return 0;
+
+	r = read(fd, buf, len - 1);
+	close(fd);
+
+	if (r <= 0)
+		return 0;
+
+	buf[r] = '\0';
+	return r;
+}
+
+/**
+ * Determine whether we can request transparent huge pages from the kernel,
+ * and the size of these pages.
+ */
+static void
+vmm_huge_init(void)
+{
+#if defined(HAS_MADVISE) && defined(MADV_HUGEPAGE)
+	char buf[128];
+	size_t size = VMM_HUGE_PAGESIZE;
+
+	if (0 == vmm_huge_read(VMM_HUGE_SYSFS "enabled", buf, sizeof buf)) {
+		vmm_huge_mode = "unavailable";
+		return;
+	}
+
+	if (NULL != strstr(buf, "[never]")) {
+		vmm_huge_mode = "never";
+		return;
+	}
+
+	vmm_huge_mode = NULL != strstr(buf, "[always]") ? "always" : "madvise";
+
+	/*
+	 * We are called before the parsing routines can be used: their
+	 * character conversion table is not initialized yet.
+	 */
+
+	if (0 != vmm_huge_read(VMM_HUGE_SYSFS "hpage_pmd_size", buf, sizeof buf)) {
+		const char *p;
+		uint64 v = 0;
+
+		for (p = buf; is_ascii_digit(*p) && v <= 1UL << 30; p++)
+			v = v * 10 + (*p - '0');
+
+		if (IS_POWER_OF_2(v) && v > kernel_pagesize && v <= 1UL << 30)
+			size = v;
+	}
+
+	vmm_huge_pagesize = size;
+	vmm_huge_threshold = size;
+
+	g_assert(vmm_huge_threshold > nsize_fast(VMM_MAGAZINE_PAGEMAX));
+#endif	/* HAS_MADVISE && MADV_HUGEPAGE */
+}
+
+/**
+ * Is a user region of ``size'' bytes laid out for huge pages?
+ */
+static inline bool
+vmm_is_huge(size_t size)
+{
+	return 0 != vmm_huge_pagesize && size >= vmm_huge_threshold;
+}
+
+/**
+ * Allocate a new region, aligned on a huge page boundary, and advise the
+ * kernel to back it with huge pages.
+ *
+ * We over-allocate the region and trim the unaligned head and tail, which
+ * are returned to the kernel and will be reused for subsequent allocations.
+ *
+ * @param size		size of the region, already rounded to the page size
+ *
+ * @return pointer to the new region, which is zeroed by the kernel.
+ */
+static void *
+vmm_huge_alloc(size_t size)
+{
+	size_t total, lead, trail, mask;
+	void *base, *p;
+	bool refused = FALSE;
+
+	g_assert(vmm_is_huge(size));
+	g_assert(round_pagesize_fast(size) == size);
+
+	total = size_saturate_add(size, vmm_huge_pagesize - kernel_pagesize);
+	base = alloc_pages(total, TRUE);
+	if (NULL == base)
+		return NULL;
+
+	mask = vmm_huge_pagesize - 1;
+	p = ulong_to_pointer((pointer_to_ulong(base) + mask) & ~mask);
+	lead = ptr_diff(p, base);
+	trail = total - lead - size;
+
+	g_assert(round_pagesize_fast(lead) == lead);
+	g_assert(round_pagesize_fast(trail) == trail);
+
+	if (lead != 0)
+		free_pages(base, lead, TRUE);
+	if (trail != 0)
+		free_pages(ptr_add_offset(p, size), trail, TRUE);
+
+#if defined(HAS_MADVISE) && defined(MADV_HUGEPAGE)
+	if G_UNLIKELY(-1 == madvise(p, size, MADV_HUGEPAGE)) {
+		refused = TRUE;
+		if (vmm_debugging(0))
+			s_miniwarn("VMM cannot use huge pages for %p: %m", p);
+	}
+#endif
+
+	if (vmm_debugging(1)) {
+		s_minidbg("VMM allocated %zuKiB huge page region at %p "
+			"(trimmed %zuKiB ahead, %zuKiB after)",
+			size / 1024, p, lead / 1024, trail / 1024);
+	}
+
+	VMM_STATS_LOCK;
+	vmm_stats.huge_allocations++;
+	vmm_stats.huge_trimmed_pages += pagecount_fast(lead + trail);
+	vmm_stats.huge_regions++;
+	vmm_stats.huge_memory += size;
+	if G_UNLIKELY(refused)
+		vmm_stats.huge_advise_failed++;
+	VMM_STATS_UNLOCK;
+
+	return p;
+}
+
+/**
+ * Account for the release of ``freed'' bytes at the tail of huge page
+ * region ``p''.
+ *
+ * @param p			start of the region
+ * @param size		size of the whole region
+ * @param freed		amount of bytes being freed at the tail of the region
+ */
+static void
+vmm_huge_freed(const void *p, size_t size, size_t freed)
+{
+	g_assert(vmm_is_huge(size));
+	g_assert_log(0 == (pointer_to_ulong(p) & (vmm_huge_pagesize - 1)),
+		"p=%p, size=%zu", p, size);
+
+	VMM_STATS_LOCK;
+	vmm_stats.huge_memory -= freed;
+	if (freed == size || !vmm_is_huge(size - freed)) {
+		vmm_stats.huge_freeings++;
+		vmm_stats.huge_regions--;
+		vmm_stats.huge_memory -= size - freed;
+	}
+	g_assert(size_is_non_negative(vmm_stats.huge_regions));
+	g_assert(size_is_non_negative(vmm_stats.huge_memory));
+	VMM_STATS_UNLOCK;
+}
+
 /**
  * Allocates a page-aligned memory chunk, possibly returning a cached region
  * and only allocating a new region when necessary.
@@ -3778,6 +3977,18 @@ vmm_alloc_internal(size_t size, bool user_mem, bool zero_mem)
 
 	n = pagecount_fast(size);
 
+	/*
+	 * Large user regions are directly allocated from the kernel, aligned
+	 * for huge pages, since the page cache cannot hold such regions.
+	 */
+
+	if (user_mem && vmm_is_huge(size)) {
+		p = vmm_huge_alloc(size);
+		if (NULL == p)
+			s_error("cannot allocate %zu bytes: out of virtual memory", size);
+		goto allocated;
+	}
+
 	/*
 	 * First look in the page cache to avoid requesting a new memory
 	 * mapping from the kernel.
@@ -3801,6 +4012,10 @@ vmm_alloc_internal(size_t size, bool user_mem, bool zero_mem)
 	if (NULL == p)
 		s_error("cannot allocate %zu bytes: out of virtual memory", size);
 
+	/* FALL THROUGH */
+
+allocated:
+
 	/* Memory allocated by the kernel is already zero-ed */
 
 	assert_vmm_is_allocated(p, size, VMF_NATIVE, FALSE);
@@ -3911,6 +4126,9 @@ vmm_free_internal(void *p, size_t size, bool user_mem)
 
 		assert_vmm_is_allocated(p, size, VMF_NATIVE, FALSE);
 
+		if (user_mem && vmm_is_huge(size))
+			vmm_huge_freed(p, size, size);
+
 		if (vmm_should_cache(p, n)) {
 			size_t m = n;
 			vmm_invalidate_pages(p, size);
@@ -4206,6 +4424,9 @@ vmm_shrink_internal(void *p, size_t size, size_t new_size, bool user_mem)
 
 			g_assert(n >= 1);
 
+			if (user_mem && vmm_is_huge(osize))
+				vmm_huge_freed(p, osize, delta);
+
 			if (vmm_should_cache(q, n)) {
 				size_t m = n;
 				vmm_invalidate_pages(q, delta);
@@ -4779,6 +5000,10 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(hole_invalidated);
 	DUMP(hole_updated);
 	DUMP(hole_unchanged);
+	DUMP(huge_allocations);
+	DUMP(huge_freeings);
+	DUMP(huge_advise_failed);
+	DUMP(huge_trimmed_pages);
 
 #undef DUMP
 #define DUMP(x) log_info(la, "VMM pmap_%s = %s", #x,	\
@@ -4804,6 +5029,8 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	(options & DUMP_OPT_PRETTY) ?					\
 		size_t_to_gstring(stats.x) : size_t_to_string(stats.x))
 
+	DUMP(huge_regions);
+	DUMP(huge_memory);
 	DUMP(user_memory);
 	DUMP(user_pages);
 	DUMP(user_blocks);
@@ -4863,6 +5090,39 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMP
 }
 
+/**
+ * Dump huge page settings and usage to specified logging agent.
+ */
+G_GNUC_COLD void
+vmm_dump_huge_log(logagent_t *la)
+{
+	struct vmm_stats stats;
+
+	VMM_STATS_LOCK;
+	stats = vmm_stats;		/* struct copy under lock protection */
+	VMM_STATS_UNLOCK;
+
+	log_info(la, "VMM transparent huge pages: %s (kernel mode \"%s\")",
+		0 == vmm_huge_pagesize ? "not used" : "used", vmm_huge_mode);
+
+	if (0 == vmm_huge_pagesize)
+		return;
+
+	log_info(la, "VMM huge page size is %zu KiB, "
+		"for regions of at least %zu KiB",
+		vmm_huge_pagesize / 1024, vmm_huge_threshold / 1024);
+	log_info(la, "VMM %zu huge page region%s holding %zu KiB",
+		stats.huge_regions, plural(stats.huge_regions),
+		stats.huge_memory / 1024);
+	log_info(la, "VMM %s allocated, %s freed, %s refused by kernel",
+		uint64_to_string(stats.huge_allocations),
+		uint64_to_string2(stats.huge_freeings),
+		uint64_to_string3(stats.huge_advise_failed));
+	log_info(la, "VMM %s page%s trimmed to align regions",
+		uint64_to_string(stats.huge_trimmed_pages),
+		plural(stats.huge_trimmed_pages));
+}
+
 /**
  * Dump VMM statistics at exit time, along with the current pmap.
  */
@@ -5139,6 +5399,7 @@ vmm_early_init_once(void)
 #endif
 	init_kernel_pagesize();
 	init_stack_shape();
+	vmm_huge_init();
 
 	for (i = 0; i < VMM_CACHE_LINES; i++) {
 		struct page_cache *pc = &page_cache[i];
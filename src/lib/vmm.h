@@ -152,6 +152,7 @@ void vmm_dump_stats_log(struct logagent *la, unsigned options);
 void vmm_dump_usage_log(struct logagent *la, unsigned options);
 void vmm_dump_hole_log(struct logagent *la);
 void vmm_dump_pcache_log(struct logagent *la);
+void vmm_dump_huge_log(struct logagent *la);
 
 struct sha1;
 
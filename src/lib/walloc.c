@@ -47,6 +47,7 @@
 #include "eslist.h"
 #include "evq.h"			/* For evq_is_inited() */
 #include "log.h"
+#include "memprof.h"
 #include "mutex.h"
 #include "once.h"
 #include "pow2.h"
@@ -372,6 +373,8 @@ walloc(size_t size)
 {
 	tmalloc_t *depot;
 	size_t rounded = zalloc_round(size);
+	void *p;
+	bool nested;
 
 	g_assert(size_is_positive(size));
 
@@ -382,10 +385,21 @@ walloc(size_t size)
 
 	depot = walloc_get_magazine(rounded);
 
+	/*
+	 * When walloc() is stopped, walloc_raw() uses xmalloc(), which must
+	 * not sample the allocation as well.
+	 */
+
+	nested = memprof_nest();
+
 	if G_UNLIKELY(NULL == depot)
-		return walloc_raw(size);
+		p = walloc_raw(size);
+	else
+		p = tmalloc(depot);
 
-	return tmalloc(depot);
+	memprof_unnest(nested);
+	memprof_sample(MEMPROF_WALLOC, size);
+	return p;
 }
 
 /**
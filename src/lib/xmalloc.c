@@ -70,6 +70,7 @@
 #include "log.h"
 #include "mem.h"			/* For mem_is_valid_ptr() */
 #include "mempcpy.h"
+#include "memprof.h"
 #include "memusage.h"
 #include "misc.h"			/* For short_size() and clamp_strlen() */
 #include "mutex.h"
@@ -261,15 +262,29 @@ struct xheader {
  * Thread-specific buckets.
  */
 #define XM_THREAD_COUNT			THREAD_MAX
-#define XM_THREAD_MAXSIZE		512		/* Maximum block length */
+#define XM_THREAD_MAXSIZE		1024	/* Maximum block length */
+#define XM_THREAD_SMALLSIZE		512		/* Maximum length for aligned sizes */
+#define XM_THREAD_LARGE_SHIFT	6		/* Spacing of larger size classes */
 #define XM_THREAD_ALLOC_THRESH	4		/* Wait for that many allocations */
+#define XM_THREAD_CROSS_BATCH	16		/* Cross-thread frees batched */
+
+/**
+ * Up to XM_THREAD_SMALLSIZE, thread-specific chunks are available for each
+ * aligned size.  Above, up to XM_THREAD_MAXSIZE, size classes are spaced
+ * by (1 << XM_THREAD_LARGE_SHIFT) bytes, to avoid dedicating pages to
+ * block sizes that are rarely used.
+ */
+#define XMALLOC_CHUNKHEAD_SMALL	(XM_THREAD_SMALLSIZE / XMALLOC_ALIGNBYTES)
+#define XMALLOC_CHUNKHEAD_LARGE	\
+	((XM_THREAD_MAXSIZE - XM_THREAD_SMALLSIZE) >> XM_THREAD_LARGE_SHIFT)
 
 /**
  * This contant defines the total number of buckets in the thread-specific
  * free lists.  There is no block overhead in thread-specific blocks, hence
  * there is no offset correction.
  */
-#define XMALLOC_CHUNKHEAD_COUNT	(XM_THREAD_MAXSIZE / XMALLOC_ALIGNBYTES)
+#define XMALLOC_CHUNKHEAD_COUNT	\
+	(XMALLOC_CHUNKHEAD_SMALL + XMALLOC_CHUNKHEAD_LARGE)
 
 /**
  * Block coalescing options.
@@ -358,6 +373,26 @@ static struct xcross {
 	uint8 dead;				/**< Thread known to be dead */
 } xcross[XM_THREAD_COUNT];
 
+/**
+ * Per-thread batch of blocks freed by the thread but belonging to the
+ * thread-specific pool of another thread.
+ *
+ * To limit contention on the xcross[] locks when a thread frees many blocks
+ * allocated by another (typically a consumer thread in an IPC queue), blocks
+ * are first chained locally, without locking, and then spliced to the list
+ * of the owning thread in one single critical section.
+ *
+ * The batch only holds blocks for one owning thread at a time and is flushed
+ * when XM_THREAD_CROSS_BATCH blocks are held, when a block for another owner
+ * is freed, or when the thread allocates from its own pool.
+ */
+static struct xbatch {
+	void *head;				/**< Head of batched blocks */
+	void *tail;				/**< Tail of batched blocks */
+	unsigned owner;			/**< Thread owning the batched blocks */
+	unsigned count;			/**< Amount of blocks batched */
+} xbatch[XM_THREAD_COUNT];
+
 /**
  * Header for thread-specific chunks (pages).
  *
@@ -488,6 +523,7 @@ static struct xstats {
 	AU64(free_coalesced_vmm);			/**< VMM-freeing of coalesced block */
 	uint64 free_thread_pool;			/**< Freeing a thread-specific block */
 	AU64(free_foreign_thread_pool);		/**< Freeing accross threads */
+	AU64(free_foreign_batches);			/**< Batches of cross-thread frees */
 	uint64 sbrk_alloc_bytes;			/**< Bytes allocated from sbrk() */
 	uint64 sbrk_freed_bytes;			/**< Bytes released via sbrk() */
 	uint64 sbrk_wasted_bytes;			/**< Bytes wasted to align sbrk() */
@@ -1243,11 +1279,18 @@ xmalloc_is_valid_length(const void *p, size_t len)
 static inline G_GNUC_PURE size_t
 xch_block_size_idx(size_t idx)
 {
-	return (idx + 1) << XMALLOC_ALIGNSHIFT;
+	if G_LIKELY(idx < XMALLOC_CHUNKHEAD_SMALL)
+		return (idx + 1) << XMALLOC_ALIGNSHIFT;
+
+	return XM_THREAD_SMALLSIZE +
+		((idx - XMALLOC_CHUNKHEAD_SMALL + 1) << XM_THREAD_LARGE_SHIFT);
 }
 
 /**
  * Find chunk index for a given block size.
+ *
+ * For sizes above XM_THREAD_SMALLSIZE, this is the index of the smallest
+ * size class able to hold the block.
  */
 static inline G_GNUC_PURE size_t
 xch_find_chunkhead_index(size_t len)
@@ -1257,7 +1300,28 @@ xch_find_chunkhead_index(size_t len)
 	g_assert(len <= XM_THREAD_MAXSIZE);
 	g_assert(len >= XMALLOC_ALIGNBYTES);
 
-	return (len >> XMALLOC_ALIGNSHIFT) - 1;
+	if G_LIKELY(len <= XM_THREAD_SMALLSIZE)
+		return (len >> XMALLOC_ALIGNSHIFT) - 1;
+
+	return XMALLOC_CHUNKHEAD_SMALL +
+		((len - XM_THREAD_SMALLSIZE - 1) >> XM_THREAD_LARGE_SHIFT);
+}
+
+/**
+ * Computes the length of the thread-specific block used to satisfy an
+ * allocation of the given size.
+ */
+static inline G_GNUC_PURE size_t
+xch_block_size(size_t size)
+{
+	size_t len = xmalloc_round(size);
+
+	g_assert(len <= XM_THREAD_MAXSIZE);
+
+	if G_LIKELY(len <= XM_THREAD_SMALLSIZE)
+		return MAX(len, XMALLOC_ALIGNBYTES);
+
+	return xch_block_size_idx(xch_find_chunkhead_index(len));
 }
 
 /**
@@ -2576,6 +2640,7 @@ xmalloc_freelist_init_once(void)
 			struct xchunkhead *ch = &xchunkhead[i][j];
 
 			ch->blocksize = xch_block_size_idx(i);
+			g_assert(xch_find_chunkhead_index(ch->blocksize) == i);
 			elist_init(&ch->list, offsetof(struct xchunk, xc_lnk));
 			elist_init(&ch->full, offsetof(struct xchunk, xc_lnk));
 		}
@@ -4058,6 +4123,72 @@ xmalloc_thread_free_deferred(unsigned stid, bool local)
 	}
 }
 
+/**
+ * Hand over the blocks batched by a thread to the thread owning them.
+ *
+ * This must be called from the thread which batched the blocks, or once
+ * that thread is known to be gone.
+ *
+ * @param stid		the thread small ID owning the batch
+ */
+static void
+xmalloc_thread_batch_flush(unsigned stid)
+{
+	struct xbatch *b;
+	struct xcross *xcr;
+
+	g_assert(uint_is_non_negative(stid));
+	g_assert(stid < G_N_ELEMENTS(xbatch));
+
+	b = &xbatch[stid];
+
+	if G_UNLIKELY(0 == b->count)
+		return;
+
+	g_assert(b->owner < G_N_ELEMENTS(xcross));
+	g_assert(b->owner != stid);
+
+	xcr = &xcross[b->owner];
+	XSTATS_INCX(free_foreign_batches);
+
+	/*
+	 * If the owning thread is flagged as "dead", then we're returning
+	 * blocks allocated by a thread that is no longer there, hence we
+	 * can do it safely as long as we hold the lock.
+	 *
+	 * Otherwise, splice the whole batch in front of the deferred list of
+	 * the owning thread, which will free the blocks later on.
+	 */
+
+	spinlock(&xcr->lock);
+	if G_UNLIKELY(xcr->dead) {
+		void *p, *next;
+
+		for (p = b->head; p != NULL; p = next) {
+			struct xchunk *xck = deconstify_pointer(vmm_page_start(p));
+
+			next = *(void **) p;
+			xchunk_check(xck);
+			g_assert(xck->xc_stid == b->owner);
+			xmalloc_chunk_return(xck, p, FALSE);
+		}
+	} else {
+		*(void **) b->tail = xcr->head;
+		xcr->head = b->head;
+		xcr->count += b->count;
+	}
+	spinunlock(&xcr->lock);
+
+	if (xmalloc_debugging(2)) {
+		s_debug("XM %s handed %u deferred block%s over to %s",
+			thread_id_name(stid), b->count, plural(b->count),
+			thread_id_name(b->owner));
+	}
+
+	b->head = b->tail = NULL;
+	b->count = 0;
+}
+
 /**
  * Count chunks used by thread.
  */
@@ -4182,6 +4313,13 @@ xmalloc_thread_ended(unsigned stid)
 
 	xmalloc_thread_free_deferred(stid, FALSE);
 
+	/*
+	 * Likewise, hand over the blocks the thread had batched for others,
+	 * or they would remain held until a new thread re-uses this ID.
+	 */
+
+	xmalloc_thread_batch_flush(stid);
+
 	/*
 	 * Reset thread allocation counts per chunk, which is only useful
 	 * when there is an empty chunk list: if we have unfreed chunks,
@@ -4243,10 +4381,10 @@ xmalloc_thread_alloc(const size_t len)
 	if G_UNLIKELY(stid >= XM_THREAD_COUNT)
 		return NULL;
 
-	idx = (0 == len) ? 0 : xch_find_chunkhead_index(len);
+	idx = xch_find_chunkhead_index(len);
 	ch = &xchunkhead[idx][stid];
 
-	g_assert(MAX(len, XMALLOC_ALIGNBYTES) == ch->blocksize);
+	g_assert(len == ch->blocksize);
 
 	if G_UNLIKELY(ch->allocations < XM_THREAD_ALLOC_THRESH) {
 		ch->allocations++;
@@ -4257,11 +4395,17 @@ xmalloc_thread_alloc(const size_t len)
 	 * Handle pending blocks in the cross-thread free list before allocating,
 	 * in case there is a block that we can reuse immediately, preventing the
 	 * creation of a new chunk.
+	 *
+	 * Also hand over any blocks we batched for another thread: being able
+	 * to allocate here means we are not in the middle of a freeing burst.
 	 */
 
 	if G_UNLIKELY(xcross[stid].count != 0)
 		xmalloc_thread_free_deferred(stid, TRUE);
 
+	if G_UNLIKELY(xbatch[stid].count != 0)
+		xmalloc_thread_batch_flush(stid);
+
 	return xmalloc_chunkhead_alloc(ch, stid);
 }
 
@@ -4343,6 +4487,7 @@ xmalloc_thread_free(void *p)
 	struct xchunk *xck;
 	unsigned stid;
 	struct xchunkhead *ch;
+	struct xbatch *b;
 
 	stid = thread_small_id();
 
@@ -4394,31 +4539,35 @@ xmalloc_thread_free(void *p)
 		XSTATS_INCX(free_foreign_thread_pool);
 
 		/*
-		 * Queue it for the owning thread to free later on by pre-pending it
-		 * to the thread-specific chained list of deferred blocks.
+		 * Queue it for the owning thread to free later on.  Blocks are first
+		 * gathered in our own batch, without locking, and the batch is handed
+		 * over to the owning thread as a whole.
 		 *
-		 * If the thread is flagged as "dead" however, then we're returning
-		 * a block allocated by a thread that is no longer there, hence we
-		 * can do it safely as long as we hold the lock.
+		 * If the batch already holds blocks for another thread, flush it first
+		 * since a batch only refers to one owner.
 		 */
 
-		spinlock(&xcr->lock);
-		if G_UNLIKELY(xcr->dead) {
-			xmalloc_chunk_return(xck, p, FALSE);
-		} else {
-			*(void **) p = xcr->head;
-			xcr->head = p;
-			xcr->count++;
+		b = &xbatch[stid];
+
+		if (b->count != 0 && b->owner != xck->xc_stid)
+			xmalloc_thread_batch_flush(stid);
+
+		if (0 == b->count) {
+			b->owner = xck->xc_stid;
+			b->tail = p;
 		}
-		spinunlock(&xcr->lock);
+		*(void **) p = b->head;
+		b->head = p;
 
 		if (xmalloc_debugging(5)) {
-			/* Count may be wrong since we log outside the critical region */
 			s_debug("XM deferred freeing of %u-byte block %p "
-				"owned by thread #%u (%zu held)",
-				xck->xc_size, p, xck->xc_stid, xcr->count);
+				"owned by thread #%u (%zu held, %u batched)",
+				xck->xc_size, p, xck->xc_stid, xcr->count, b->count + 1);
 		}
 
+		if G_UNLIKELY(++b->count >= XM_THREAD_CROSS_BATCH)
+			xmalloc_thread_batch_flush(stid);
+
 		return TRUE;		/* We handled the block, freeing is just delayed */
 	}
 
@@ -4542,7 +4691,7 @@ xallocate(size_t size, bool can_vmm)
 			once_flag_run(&xmalloc_early_inited, xmalloc_early_init);
 		}
 
-		allocated = xmalloc_round(size);	/* No malloc header */
+		allocated = xch_block_size(size);	/* No malloc header */
 		p = xmalloc_thread_alloc(allocated);
 
 		if G_LIKELY(p != NULL) {
@@ -4664,7 +4813,10 @@ skip_pool:
 void *
 xmalloc(size_t size)
 {
-	return xallocate(size, TRUE);
+	void *p = xallocate(size, TRUE);
+
+	memprof_sample(MEMPROF_XMALLOC, size);
+	return p;
 }
 
 /**
@@ -4946,7 +5098,7 @@ xreallocate(void *p, size_t size)
 
 		XSTATS_INCX(reallocs);
 
-		if (xmalloc_round(size) == xck->xc_size) {
+		if (size <= XM_THREAD_MAXSIZE && xch_block_size(size) == xck->xc_size) {
 			XSTATS_INCX(realloc_noop);
 
 			if (xmalloc_debugging(2)) {
@@ -6547,6 +6699,7 @@ xmalloc_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP64(free_coalesced_vmm);
 	DUMP(free_thread_pool);
 	DUMP64(free_foreign_thread_pool);
+	DUMP64(free_foreign_batches);
 	DUMP(sbrk_alloc_bytes);
 	DUMP(sbrk_freed_bytes);
 	DUMP(sbrk_wasted_bytes);
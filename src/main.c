@@ -73,6 +73,7 @@
 #include "core/http.h"
 #include "core/ignore.h"
 #include "core/inet.h"
+#include "core/ipclass.h"
 #include "core/ipp_cache.h"
 #include "core/local_shell.h"
 #include "core/move.h"
@@ -732,6 +733,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(inet_close);
 	DO(ctl_close);
 	DO(whitelist_close);
+	DO(ipclass_close);	/* After all the classification sources */
 	DO(features_close);
 	DO(clock_close);
 	DO(vmsg_close);
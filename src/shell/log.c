@@ -51,6 +51,47 @@ enum shell_logtoken {
 	SHELL_LOG_ERR
 };
 
+static enum shell_reply
+shell_exec_log_async(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	static const char *modes[] = { "off", "drop", "block" };
+	struct log_async_stats buf;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 2)
+		return REPLY_ERROR;
+
+	if (2 == argc) {
+		uint i;
+
+		for (i = 0; i < G_N_ELEMENTS(modes); i++) {
+			if (0 == ascii_strcasecmp(argv[1], modes[i]))
+				break;
+		}
+
+		if (i >= G_N_ELEMENTS(modes)) {
+			shell_set_formatted(sh, _("Unknown mode \"%s\""), argv[1]);
+			return REPLY_ERROR;
+		}
+
+		log_async_set(i);
+	}
+
+	log_async_stats_get(&buf);
+
+	STATIC_ASSERT(LOG_ASYNC_BLOCK + 1 == G_N_ELEMENTS(modes));
+
+	shell_write(sh, str_smsg("mode: %s\n", modes[log_async_get()]));
+	shell_write(sh, str_smsg("lines: %u, dropped: %u, blocked: %u, "
+		"writes: %u\n", buf.lines, buf.dropped, buf.blocked, buf.writes));
+
+	return REPLY_READY;
+}
+
 static enum shell_reply
 shell_exec_log_cwd(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -260,6 +301,7 @@ shell_exec_log(struct gnutella_shell *sh, int argc, const char *argv[])
 		return shell_exec_log_ ## name(sh, argc - 1, argv + 1); \
 } G_STMT_END
 
+	CMD(async);
 	CMD(cwd);
 	CMD(rename);
 	CMD(reopen);
@@ -283,7 +325,12 @@ shell_help_log(int argc, const char *argv[])
 	g_assert(argc > 0);
 
 	if (argc > 1) {
-		if (0 == ascii_strcasecmp(argv[1], "reopen")) {
+		if (0 == ascii_strcasecmp(argv[1], "async")) {
+			return "log async [off|drop|block]\n"
+				"display or set asynchronous logging of stderr messages\n"
+				"drop: discard lines when buffer is full\n"
+				"block: wait for buffer space when full\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "reopen")) {
 			return "log reopen [out|err|all]\n"
 				"re-opens specified log file (all by default)\n";
 		} else if (0 == ascii_strcasecmp(argv[1], "rename")) {
@@ -301,6 +348,7 @@ shell_help_log(int argc, const char *argv[])
 		}
 	} else {
 		return
+			"log async\n"
 			"log cwd\n"
 			"log rename\n"
 			"log reopen\n"
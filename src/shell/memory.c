@@ -45,10 +45,12 @@
 #include "lib/glib-missing.h"
 #include "lib/halloc.h"
 #include "lib/log.h"
+#include "lib/memprof.h"
 #include "lib/misc.h"
 #include "lib/omalloc.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
+#include "lib/pmsg.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/tmalloc.h"
@@ -313,6 +315,17 @@ shell_exec_memory_show_hole(struct gnutella_shell *sh,
 	return memory_run_shower(sh, vmm_dump_hole_log, "VMM ");
 }
 
+static enum shell_reply
+shell_exec_memory_show_huge(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return memory_run_shower(sh, vmm_dump_huge_log, "VMM ");
+}
+
 static enum shell_reply
 shell_exec_memory_show_magazines(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -396,6 +409,7 @@ shell_exec_memory_show(struct gnutella_shell *sh,
 } G_STMT_END
 
 	CMD(hole);
+	CMD(huge);
 	CMD(magazines);
 	CMD(options);
 	CMD(pcache);
@@ -443,6 +457,16 @@ shell_exec_memory_stats_palloc(struct gnutella_shell *sh,
 	return memory_run_opt_shower(sh, palloc_dump_stats_log, "PALLOC ", opt);
 }
 
+static enum shell_reply
+shell_exec_memory_stats_pmsg(struct gnutella_shell *sh,
+	unsigned opt, unsigned which)
+{
+	if (which & STATS_USAGE)
+		return memory_stats_unsupported(sh, "pmsg", STATS_USAGE_STR);
+
+	return memory_run_opt_shower(sh, pmsg_dump_stats_log, NULL, opt);
+}
+
 static enum shell_reply
 shell_exec_memory_stats_vmm(struct gnutella_shell *sh,
 	unsigned opt, unsigned which)
@@ -530,6 +554,7 @@ shell_exec_memory_stats(struct gnutella_shell *sh,
 
 	CMD(halloc);
 	CMD(palloc);
+	CMD(pmsg);
 	CMD(tmalloc);
 	CMD(vmm);
 	CMD(xmalloc);
@@ -606,6 +631,82 @@ shell_exec_memory_check(struct gnutella_shell *sh,
 	return REPLY_ERROR;
 }
 
+static enum shell_reply
+shell_exec_memory_profile(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *verbose;
+	const option_t options[] = {
+		{ "v", &verbose },		/* show full stack of call sites */
+	};
+	int parsed;
+	size_t value = 0;
+
+	shell_check(sh);
+
+	parsed = shell_options_parse(sh, argv, options, G_N_ELEMENTS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argv += parsed;	/* args[0] is first command argument */
+	argc -= parsed;	/* counts only command arguments now */
+
+	if (argc < 1)
+		return REPLY_ERROR;
+
+	/*
+	 * Optional numeric argument: sampling period or amount of call sites.
+	 */
+
+	if (argc > 1) {
+		const char *endptr;
+		int error;
+
+		value = parse_size(argv[1], &endptr, 10, &error);
+		if (error || '\0' != *endptr) {
+			shell_set_formatted(sh, "Cannot parse number \"%s\"", argv[1]);
+			return REPLY_ERROR;
+		}
+	}
+
+	if (0 == ascii_strcasecmp(argv[0], "on")) {
+		if (argc > 1 && value < 2) {
+			shell_set_formatted(sh, "Sampling period is too small");
+			return REPLY_ERROR;
+		}
+		memprof_set_period(argc > 1 ? value : MEMPROF_PERIOD_DEFAULT);
+		shell_write_linef(sh, REPLY_READY,
+			"Allocation profiling on, sampling every %zu bytes",
+			memprof_get_period());
+	} else if (0 == ascii_strcasecmp(argv[0], "off")) {
+		memprof_set_period(0);
+		shell_write_line(sh, REPLY_READY, "Allocation profiling off");
+	} else if (0 == ascii_strcasecmp(argv[0], "reset")) {
+		memprof_reset();
+		shell_write_line(sh, REPLY_READY, "Allocation profile cleared");
+	} else if (
+		0 == ascii_strcasecmp(argv[0], "show") ||
+		0 == ascii_strcasecmp(argv[0], "pprof")
+	) {
+		logagent_t *la = log_agent_string_make(0, NULL);
+
+		if (0 == ascii_strcasecmp(argv[0], "show"))
+			memprof_dump_log(la, value, verbose != NULL);
+		else
+			memprof_dump_pprof_log(la);
+
+		shell_write(sh, "100~\n");
+		shell_write(sh, log_agent_string_get(la));
+		shell_write(sh, ".\n");
+		log_agent_free_null(&la);
+	} else {
+		shell_set_formatted(sh, "Unknown profiling action \"%s\"", argv[0]);
+		return REPLY_ERROR;
+	}
+
+	return REPLY_READY;
+}
+
 static enum shell_reply
 shell_exec_memory_usage_zone(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -709,6 +810,7 @@ shell_exec_memory(struct gnutella_shell *sh, int argc, const char *argv[])
 	CMD(dump);
 #endif
 	CMD(check);
+	CMD(profile);
 	CMD(show);
 	CMD(stats);
 	CMD(usage);
@@ -744,9 +846,20 @@ shell_help_memory(int argc, const char *argv[])
 				"-s : silent mode, only display summary at the end\n"
 				"-v : verbosely report for each freelist\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "profile")) {
+			return "memory profile [-v] on [PERIOD]|off|reset|show [COUNT]|pprof\n"
+				"sampling allocation profiler, aggregating by call site\n"
+				"on    : start sampling every PERIOD allocated bytes on average\n"
+				"off   : stop sampling, keeping collected samples\n"
+				"reset : discard collected samples\n"
+				"show  : display the COUNT call sites allocating most memory\n"
+				"pprof : dump samples in pprof legacy heap profile format\n"
+				"-v : show the full stack of each call site\n";
+		}
 		else if (0 == ascii_strcasecmp(argv[1], "show")) {
 			return
 				"memory show hole      # display VMM first known hole\n"
+				"memory show huge      # display VMM huge page usage\n"
 				"memory show magazines # display thread magazine information\n"
 				"memory show options   # display memory options\n"
 				"memory show pcache    # display VMM page cache\n"
@@ -756,7 +869,7 @@ shell_help_memory(int argc, const char *argv[])
 				"memory show zones     # display zone usage\n";
 		} else if (0 == ascii_strcasecmp(argv[1], "stats")) {
 			return "memory stats [-pu] "
-				"halloc|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+				"halloc|omalloc|palloc|pmsg|tmalloc|vmm|xmalloc|zalloc\n"
 				"show statistics about specified memory sub-system\n"
 				"-p : pretty-print numbers with thousands separators\n"
 				"-u : show allocation usage statistics, if available\n";
@@ -770,8 +883,9 @@ shell_help_memory(int argc, const char *argv[])
 		"memory dump ADDRESS LENGTH\n"
 #endif
 		"memory check xmalloc\n"
-		"memory show hole|magazines|options|pmap|pools|xmalloc|zones\n"
-		"memory stats [-pu] omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+		"memory profile [-v] on [PERIOD]|off|reset|show [COUNT]|pprof\n"
+		"memory show hole|huge|magazines|options|pmap|pools|xmalloc|zones\n"
+		"memory stats [-pu] omalloc|palloc|pmsg|tmalloc|vmm|xmalloc|zalloc\n"
 		"memory usage zone <size> on|off|show\n"
 		;
 	}
@@ -871,6 +871,8 @@ filter_gui_update_rule_stats(void)
     if (gui_filter_dialog() == NULL || work_filter == NULL)
         return;
 
+	filter_sync_stats(work_filter);
+
     clist = GTK_CLIST(gui_filter_dialog_lookup("clist_filter_rules"));
     gtk_clist_freeze(GTK_CLIST(clist));
 
@@ -921,6 +923,8 @@ filter_gui_update_rule_stats(void)
     if (gui_filter_dialog() == NULL || work_filter == NULL)
         return;
 
+	filter_sync_stats(work_filter);
+
 	gtk_tree_model_foreach(
 		gtk_tree_view_get_model(GTK_TREE_VIEW(
 			gui_filter_dialog_lookup("treeview_filter_rules"))),
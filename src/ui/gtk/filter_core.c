@@ -48,10 +48,13 @@
 #include "lib/atoms.h"
 #include "lib/glib-missing.h"
 #include "lib/halloc.h"
+#include "lib/htable.h"
+#include "lib/mpattern.h"
 #include "lib/parse.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/utf8.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"	/* Must be the last header included */
@@ -101,6 +104,7 @@ struct filter_context {
  */
 void filter_remove_rule(filter_t *f, rule_t *r);
 static void filter_free(filter_t *f);
+static void filter_invalidate(filter_t *f);
 
 /**
  * Public variables.
@@ -332,6 +336,11 @@ shadow_commit(shadow_t *shadow)
         dump_shadow(shadow);
     }
 
+    /*
+     * The ruleset changes, its compiled form is now stale.
+     */
+    filter_invalidate(realf);
+
     /*
      * Free memory for all removed rules
      */
@@ -1383,6 +1392,7 @@ filter_free(filter_t *f)
 	copy = g_list_copy(f->ruleset);
 	G_LIST_FOREACH_SWAPPED(copy, filter_remove_rule, f);
     g_list_free(copy);
+	filter_invalidate(f);
 
     atom_str_free_null(&f->name);
     WFREE(f);
@@ -1474,6 +1484,8 @@ filter_add_rule(filter_t *f, rule_t * const r, filter_add_rule_func_t func)
      * We add the rule to the filter increase the refcount on the target.
      */
 
+    filter_invalidate(f);
+
 #ifdef TRACK_MALLOC
     f->ruleset = (*func)(f->ruleset, r, _WHERE_, __LINE__);
 #else
@@ -1665,8 +1677,10 @@ filter_remove_rule(filter_t *f, rule_t *r)
     if (in_shadow_removed && (shadow != NULL))
        shadow->removed = g_list_remove(shadow->removed, r);
 
-    if (in_filter)
+    if (in_filter) {
+        filter_invalidate(f);
         f->ruleset = g_list_remove(f->ruleset, r);
+    }
 
     /*
      * Now we need to clean up the refcounts that may have been
@@ -2054,6 +2068,862 @@ filter_adapt_order(void)
 #endif /* USE_GTK2 */
 
 
+/*
+ * Compiled rulesets.
+ *
+ * Walking the ruleset of a filter and evaluating each rule in turn is
+ * costly when filters hold thousands of rules, as is typical for SHA1 or
+ * IP blacklists, since every search result is checked against each rule.
+ *
+ * The ruleset is therefore compiled into a program, lazily, the first time
+ * the filter is applied after a change.  Substring and "all words" text
+ * rules are recognized through a single Aho-Corasick automaton per case
+ * sensitivity, size rules are kept sorted by their lower bound, SHA1 rules
+ * are indexed by their hash and IP rules by their masked network address,
+ * one sorted table per prefix length.  Only the rules which cannot be
+ * indexed (negated rules, regular expressions, flags, states, jumps...)
+ * are still evaluated for each record.
+ *
+ * Matching positions are then visited in ruleset order so that the first
+ * rule deciding on a property still wins and evaluation stops exactly where
+ * the linear walk would have stopped.  Failure counts of the rules are not
+ * updated for each record: we only record which rules matched and where
+ * the evaluation stopped, and fold that into the rule counters when they
+ * are needed (display, reset) or when the program is discarded.
+ */
+
+#define FILTER_TEXT_ICASE	0	/**< Index of case-insensitive text rules */
+#define FILTER_TEXT_CASE	1	/**< Index of case-sensitive text rules */
+
+#define FILTER_IP_V4		0	/**< Index of IP rules for IPv4 records */
+#define FILTER_IP_V6		1	/**< Index of IP rules for IPv6 records */
+
+/**
+ * An indexed size rule.
+ */
+struct filter_size_rule {
+	filesize_t lower;		/**< Lower size limit */
+	filesize_t upper;		/**< Upper size limit */
+	guint32 pos;			/**< Rule position in the ruleset */
+};
+
+/**
+ * An indexed IP rule, for a given network type.
+ */
+struct filter_ip_rule {
+	guint8 key[16];			/**< Masked network address */
+	guint8 bits;			/**< Prefix length */
+	guint32 pos;			/**< Rule position in the ruleset */
+};
+
+/**
+ * IP rules indexed for a given network type, sorted by prefix length and
+ * then by masked address, so that all the rules matching an address can be
+ * found with one binary search per distinct prefix length.
+ */
+struct filter_ip_index {
+	struct filter_ip_rule *rules;	/**< Sorted rules */
+	size_t count;					/**< Amount of rules */
+	guint8 bits[129];				/**< Distinct prefix lengths */
+	size_t nbits;					/**< Amount of distinct prefix lengths */
+};
+
+/**
+ * Text rules sharing the same case-sensitivity, recognized by a single
+ * multi-pattern automaton.
+ */
+struct filter_text_index {
+	mpattern_t *mp;			/**< Automaton recognizing all the words */
+	htable_t *seen;			/**< Word -> word index + 1 */
+	gchar **words;			/**< Distinct words, by word index */
+	guint32 *head;			/**< First use of each word + 1 */
+	size_t count;			/**< Amount of distinct words */
+};
+
+/**
+ * A compiled ruleset.
+ */
+struct filter_prog {
+	rule_t **rules;			/**< Rules, in ruleset order */
+	size_t count;			/**< Amount of rules */
+	guint32 *dynamic;		/**< Positions of rules evaluated each time */
+	size_t ndynamic;		/**< Amount of such rules */
+	guint32 *hits;			/**< Positions of rules reported by indices */
+	size_t nhits;			/**< Amount of positions reported */
+	guint32 *matched;		/**< Pending amount of matches, per position */
+	guint32 *stopped;		/**< Pending amount of evaluations, by stop */
+	struct filter_text_index text[2];	/**< Text rule automata */
+	guint32 *slot_pos;		/**< Text rule slot -> rule position */
+	guint32 *slot_need;		/**< Text rule slot -> amount of words */
+	guint32 *slot_have;		/**< Text rule slot -> amount of words found */
+	size_t nslots;			/**< Amount of indexed text rules */
+	guint32 *use_slot;		/**< Word use -> text rule slot */
+	guint32 *use_next;		/**< Word use -> next use of same word + 1 */
+	size_t nuses;			/**< Amount of word uses */
+	struct filter_size_rule *sizes;	/**< Size rules, sorted by lower limit */
+	size_t nsizes;			/**< Amount of size rules */
+	htable_t *sha1;			/**< SHA1 -> first rule position + 1 */
+	guint32 *sha1_next;		/**< Next rule position with same SHA1 + 1 */
+	struct filter_ip_index ip[2];		/**< IP rules, by record network */
+};
+
+/**
+ * Fold the pending match and stop counts of the program into the failure
+ * counters of the rules.
+ *
+ * A rule was evaluated by all the records for which evaluation stopped
+ * after its position, and failed each time it did not match.
+ */
+static void
+filter_prog_sync(struct filter_prog *prog)
+{
+	guint32 visits = 0;
+	size_t i;
+
+	for (i = prog->count; i != 0; i--) {
+		visits += prog->stopped[i];
+		prog->rules[i - 1]->fail_count += visits - prog->matched[i - 1];
+		prog->stopped[i] = 0;
+		prog->matched[i - 1] = 0;
+	}
+	prog->stopped[0] = 0;
+}
+
+static void
+filter_prog_free_word(const void *unused_key, void *value, void *data)
+{
+	struct filter_text_index *ti = data;
+
+	(void) unused_key;
+	hfree(ti->words[pointer_to_uint(value) - 1]);
+}
+
+/**
+ * Free compiled program, after having folded its pending statistics into
+ * the rules, and nullify its pointer.
+ */
+static void
+filter_prog_free_null(struct filter_prog **prog_ptr)
+{
+	struct filter_prog *prog = *prog_ptr;
+	size_t i;
+
+	if (NULL == prog)
+		return;
+
+	filter_prog_sync(prog);
+
+	for (i = 0; i < G_N_ELEMENTS(prog->text); i++) {
+		struct filter_text_index *ti = &prog->text[i];
+
+		if (ti->seen != NULL)
+			htable_foreach(ti->seen, filter_prog_free_word, ti);
+		htable_free_null(&ti->seen);
+		mpattern_free_null(&ti->mp);
+		HFREE_NULL(ti->words);
+		HFREE_NULL(ti->head);
+	}
+	for (i = 0; i < G_N_ELEMENTS(prog->ip); i++)
+		HFREE_NULL(prog->ip[i].rules);
+
+	htable_free_null(&prog->sha1);
+	HFREE_NULL(prog->sha1_next);
+	HFREE_NULL(prog->sizes);
+	HFREE_NULL(prog->use_slot);
+	HFREE_NULL(prog->use_next);
+	HFREE_NULL(prog->slot_pos);
+	HFREE_NULL(prog->slot_need);
+	HFREE_NULL(prog->slot_have);
+	HFREE_NULL(prog->stopped);
+	HFREE_NULL(prog->matched);
+	HFREE_NULL(prog->hits);
+	HFREE_NULL(prog->dynamic);
+	HFREE_NULL(prog->rules);
+	WFREE(prog);
+	*prog_ptr = NULL;
+}
+
+/**
+ * Forget about the compiled program of a filter whose ruleset is changing.
+ */
+static void
+filter_invalidate(filter_t *f)
+{
+	filter_prog_free_null(&f->prog);
+}
+
+/**
+ * Fold pending statistics of the compiled ruleset into the rules of the
+ * filter, so that their match and failure counts are accurate.
+ */
+void
+filter_sync_stats(filter_t *filter)
+{
+	g_assert(filter != NULL);
+
+	if (filter->prog != NULL)
+		filter_prog_sync(filter->prog);
+}
+
+/**
+ * Fill key with the leading "bits" bits of the address, zeroing the others.
+ */
+static void
+filter_ip_mask(guint8 key[16], const host_addr_t addr, guint bits)
+{
+	size_t i;
+
+	memset(key, 0, 16);
+
+	switch (host_addr_net(addr)) {
+	case NET_TYPE_IPV4:
+		poke_be32(key, host_addr_ipv4(addr));
+		break;
+	case NET_TYPE_IPV6:
+		memcpy(key, addr.addr.ipv6, 16);
+		break;
+	case NET_TYPE_LOCAL:
+	case NET_TYPE_NONE:
+		g_assert_not_reached();
+	}
+
+	for (i = 0; i < 16; i++) {
+		if (bits >= 8) {
+			bits -= 8;
+		} else {
+			key[i] &= (0xffU << (8 - bits)) & 0xff;
+			bits = 0;
+		}
+	}
+}
+
+static int
+filter_ip_rule_cmp(const void *a, const void *b)
+{
+	const struct filter_ip_rule *ra = a, *rb = b;
+
+	return ra->bits != rb->bits ? CMP(ra->bits, rb->bits) :
+		memcmp(ra->key, rb->key, sizeof ra->key);
+}
+
+static int
+filter_size_rule_cmp(const void *a, const void *b)
+{
+	const struct filter_size_rule *ra = a, *rb = b;
+
+	return CMP(ra->lower, rb->lower);
+}
+
+static int
+filter_pos_cmp(const void *a, const void *b)
+{
+	const guint32 *pa = a, *pb = b;
+
+	return CMP(*pa, *pb);
+}
+
+/**
+ * Record a word used by an indexed text rule slot.
+ */
+static void
+filter_prog_add_word(struct filter_prog *prog, struct filter_text_index *ti,
+	const gchar *word, guint32 slot)
+{
+	size_t n, u;
+	void *value;
+
+	if (htable_lookup_extended(ti->seen, word, NULL, &value)) {
+		n = pointer_to_uint(value) - 1;
+	} else {
+		n = ti->count++;
+		ti->words[n] = h_strdup(word);
+		ti->head[n] = 0;
+		htable_insert(ti->seen, ti->words[n], uint_to_pointer(n + 1));
+	}
+
+	u = prog->nuses++;
+	prog->use_slot[u] = slot;
+	prog->use_next[u] = ti->head[n];
+	ti->head[n] = u + 1;
+	prog->slot_need[slot]++;
+}
+
+/**
+ * Index a substring or "all words" text rule.
+ *
+ * @return FALSE if the rule cannot be indexed.
+ */
+static gboolean
+filter_prog_add_text(struct filter_prog *prog, const rule_t *r, guint32 pos)
+{
+	struct filter_text_index *ti;
+	guint32 slot;
+
+	switch (r->u.text.type) {
+	case RULE_TEXT_SUBSTR:
+		if (0 == r->u.text.match_len)
+			return FALSE;
+		break;
+	case RULE_TEXT_WORDS:
+		if (NULL == r->u.text.u.words)
+			return FALSE;		/* No words, always matches */
+		break;
+	default:
+		return FALSE;
+	}
+
+	ti = &prog->text[r->u.text.case_sensitive ?
+		FILTER_TEXT_CASE : FILTER_TEXT_ICASE];
+	slot = prog->nslots++;
+	prog->slot_pos[slot] = pos;
+	prog->slot_need[slot] = 0;
+
+	if (RULE_TEXT_SUBSTR == r->u.text.type) {
+		filter_prog_add_word(prog, ti, r->u.text.match, slot);
+	} else {
+		gchar *buf, *s;
+
+		/* Same tokenization as filter_new_text_rule() */
+
+		buf = h_strdup(r->u.text.match);
+		for (s = strtok(buf, " \t\n"); s; s = strtok(NULL, " \t\n"))
+			filter_prog_add_word(prog, ti, s, slot);
+		hfree(buf);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Index an IP rule for records of the given network type.
+ */
+static void
+filter_prog_add_ip(struct filter_prog *prog, const rule_t *r, guint32 pos,
+	enum net_type net)
+{
+	struct filter_ip_index *ii;
+	struct filter_ip_rule *ir;
+	host_addr_t to;
+
+	if (!host_addr_convert(r->u.ip.addr, &to, net))
+		return;			/* Can never match records of this type */
+
+	ii = &prog->ip[NET_TYPE_IPV4 == net ? FILTER_IP_V4 : FILTER_IP_V6];
+	ir = &ii->rules[ii->count++];
+	ir->bits = MIN(r->u.ip.cidr, NET_TYPE_IPV4 == net ? 32 : 128);
+	ir->pos = pos;
+	filter_ip_mask(ir->key, to, ir->bits);
+}
+
+/**
+ * Compile the ruleset of a filter.
+ */
+static struct filter_prog *
+filter_prog_compile(const filter_t *f)
+{
+	struct filter_prog *prog;
+	size_t i, nuses = 0;
+	GList *l;
+
+	WALLOC0(prog);
+	prog->count = g_list_length(f->ruleset);
+
+	HALLOC_ARRAY(prog->rules, prog->count);
+	for (i = 0, l = f->ruleset; l != NULL; l = g_list_next(l), i++) {
+		rule_t *r = l->data;
+
+		prog->rules[i] = r;
+		if (RULE_TEXT == r->type && RULE_TEXT_WORDS == r->u.text.type)
+			nuses += g_list_length(r->u.text.u.words);
+		else if (RULE_TEXT == r->type)
+			nuses++;
+	}
+
+	HALLOC_ARRAY(prog->dynamic, prog->count);
+	HALLOC_ARRAY(prog->hits, prog->count);
+	HALLOC0_ARRAY(prog->matched, prog->count);
+	HALLOC0_ARRAY(prog->stopped, prog->count + 1);
+	HALLOC_ARRAY(prog->slot_pos, prog->count);
+	HALLOC_ARRAY(prog->slot_need, prog->count);
+	HALLOC_ARRAY(prog->slot_have, prog->count);
+	HALLOC_ARRAY(prog->use_slot, nuses);
+	HALLOC_ARRAY(prog->use_next, nuses);
+	HALLOC_ARRAY(prog->sizes, prog->count);
+	HALLOC_ARRAY(prog->sha1_next, prog->count);
+	for (i = 0; i < G_N_ELEMENTS(prog->ip); i++)
+		HALLOC_ARRAY(prog->ip[i].rules, prog->count);
+	for (i = 0; i < G_N_ELEMENTS(prog->text); i++) {
+		prog->text[i].seen = htable_create(HASH_KEY_STRING, 0);
+		HALLOC_ARRAY(prog->text[i].words, nuses);
+		HALLOC_ARRAY(prog->text[i].head, nuses);
+	}
+	prog->sha1 = htable_create_any(sha1_hash, NULL, sha1_eq);
+
+	for (i = 0; i < prog->count; i++) {
+		const rule_t *r = prog->rules[i];
+		gboolean indexed = FALSE;
+
+		/*
+		 * Inactive rules never match: they are simply accounted for
+		 * when folding statistics.  Negated rules are evaluated each time.
+		 */
+
+		if (!RULE_IS_ACTIVE(r))
+			continue;
+
+		if (!RULE_IS_NEGATED(r)) {
+			switch (r->type) {
+			case RULE_TEXT:
+				indexed = filter_prog_add_text(prog, r, i);
+				break;
+			case RULE_SIZE:
+				{
+					struct filter_size_rule *sr = &prog->sizes[prog->nsizes++];
+
+					sr->lower = r->u.size.lower;
+					sr->upper = r->u.size.upper;
+					sr->pos = i;
+					indexed = TRUE;
+				}
+				break;
+			case RULE_SHA1:
+				if (r->u.sha1.hash != NULL) {
+					void *head = htable_lookup(prog->sha1, r->u.sha1.hash);
+
+					prog->sha1_next[i] = pointer_to_uint(head);
+					htable_insert(prog->sha1, r->u.sha1.hash,
+						uint_to_pointer(i + 1));
+					indexed = TRUE;
+				}
+				break;
+			case RULE_IP:
+				switch (host_addr_net(r->u.ip.addr)) {
+				case NET_TYPE_IPV4:
+				case NET_TYPE_IPV6:
+					if (0 == r->u.ip.cidr)
+						break;		/* Matches any address */
+					filter_prog_add_ip(prog, r, i, NET_TYPE_IPV4);
+					filter_prog_add_ip(prog, r, i, NET_TYPE_IPV6);
+					indexed = TRUE;
+					break;
+				case NET_TYPE_LOCAL:
+				case NET_TYPE_NONE:
+					break;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (!indexed)
+			prog->dynamic[prog->ndynamic++] = i;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(prog->text); i++) {
+		struct filter_text_index *ti = &prog->text[i];
+		size_t j;
+
+		if (0 == ti->count)
+			continue;
+
+		ti->mp = mpattern_make(ti->count);
+		for (j = 0; j < ti->count; j++)
+			mpattern_add(ti->mp, ti->words[j], strlen(ti->words[j]), 1);
+		mpattern_compile(ti->mp);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(prog->ip); i++) {
+		struct filter_ip_index *ii = &prog->ip[i];
+		size_t j;
+
+		if (ii->count > 1)
+			vsort(ii->rules, ii->count, sizeof ii->rules[0],
+				filter_ip_rule_cmp);
+
+		for (j = 0; j < ii->count; j++) {
+			if (0 == j || ii->rules[j].bits != ii->rules[j - 1].bits)
+				ii->bits[ii->nbits++] = ii->rules[j].bits;
+		}
+	}
+
+	if (prog->nsizes > 1)
+		vsort(prog->sizes, prog->nsizes, sizeof prog->sizes[0],
+			filter_size_rule_cmp);
+
+	if (GUI_PROPERTY(gui_debug) >= 5) {
+		g_debug("compiled filter \"%s\": %zu rules, %zu evaluated, "
+			"%zu text (%zu+%zu words), %zu size, %zu SHA1, %zu+%zu IP",
+			f->name, prog->count, prog->ndynamic, prog->nslots,
+			prog->text[FILTER_TEXT_ICASE].count,
+			prog->text[FILTER_TEXT_CASE].count, prog->nsizes,
+			htable_count(prog->sha1), prog->ip[FILTER_IP_V4].count,
+			prog->ip[FILTER_IP_V6].count);
+	}
+
+	return prog;
+}
+
+/**
+ * Fill the lazily computed names of the filtering context.
+ */
+static void
+filter_context_names(struct filter_context *ctx)
+{
+	if (NULL == ctx->utf8_name) {
+		ctx->utf8_name = atom_str_get(ctx->rec->utf8_name);
+		ctx->utf8_len = strlen(ctx->utf8_name);
+	}
+
+	if (NULL == ctx->l_name) {
+		gchar *s = utf8_strlower_copy(ctx->utf8_name);
+
+		/*
+		 * Cache for further rules, to avoid costly utf8
+		 * lowercasing transformation for each text-matching
+		 * rule they have configured.
+		 */
+
+		ctx->l_name = atom_str_get(s);
+		ctx->l_len = strlen(ctx->l_name);
+
+		hfree(s);
+	}
+}
+
+/**
+ * Context for filter_prog_word_found().
+ */
+struct filter_word_ctx {
+	struct filter_prog *prog;			/**< Program being run */
+	const struct filter_text_index *ti;	/**< Text index being scanned */
+};
+
+/**
+ * Callback for mpattern_match_each(), invoked for each word found.
+ *
+ * Text rules for which all the words were found are reported as hits.
+ */
+static void
+filter_prog_word_found(size_t idx, void *data)
+{
+	struct filter_word_ctx *wctx = data;
+	struct filter_prog *prog = wctx->prog;
+	guint32 u;
+
+	for (u = wctx->ti->head[idx]; u != 0; u = prog->use_next[u - 1]) {
+		guint32 slot = prog->use_slot[u - 1];
+
+		if (++prog->slot_have[slot] == prog->slot_need[slot])
+			prog->hits[prog->nhits++] = prog->slot_pos[slot];
+	}
+}
+
+/**
+ * Report IP rules matching the address.
+ */
+static void
+filter_prog_lookup_ip(struct filter_prog *prog,
+	const struct filter_ip_index *ii, const host_addr_t addr)
+{
+	size_t i;
+
+	for (i = 0; i < ii->nbits; i++) {
+		struct filter_ip_rule key;
+		size_t lo = 0, hi = ii->count;
+
+		key.bits = ii->bits[i];
+		filter_ip_mask(key.key, addr, key.bits);
+
+		/* Find first rule not sorting before the key */
+
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (filter_ip_rule_cmp(&ii->rules[mid], &key) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (/* empty */; lo < ii->count; lo++) {
+			if (0 != filter_ip_rule_cmp(&ii->rules[lo], &key))
+				break;
+			prog->hits[prog->nhits++] = ii->rules[lo].pos;
+		}
+	}
+}
+
+/**
+ * Look the record up in all the indices of the program, filling the
+ * sorted array of positions of the indexed rules matching the record.
+ */
+static void
+filter_prog_lookup(struct filter_prog *prog, struct filter_context *ctx)
+{
+	const struct record *rec = ctx->rec;
+	size_t i;
+
+	prog->nhits = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(prog->text); i++) {
+		struct filter_word_ctx wctx;
+		const gchar *name;
+		size_t len;
+
+		if (NULL == prog->text[i].mp)
+			continue;
+
+		filter_context_names(ctx);
+		if (FILTER_TEXT_CASE == i) {
+			name = ctx->utf8_name;
+			len = ctx->utf8_len;
+		} else {
+			name = ctx->l_name;
+			len = ctx->l_len;
+		}
+
+		if (0 == len)
+			continue;		/* Nothing to find in an empty name */
+
+		wctx.prog = prog;
+		wctx.ti = &prog->text[i];
+		memset(prog->slot_have, 0, prog->nslots * sizeof prog->slot_have[0]);
+		mpattern_match_each(prog->text[i].mp, name, len, qs_any,
+			filter_prog_word_found, &wctx);
+	}
+
+	for (i = 0; i < prog->nsizes; i++) {
+		const struct filter_size_rule *sr = &prog->sizes[i];
+
+		if (sr->lower > rec->size)
+			break;
+		if (rec->size <= sr->upper)
+			prog->hits[prog->nhits++] = sr->pos;
+	}
+
+	if (rec->sha1 != NULL && 0 != htable_count(prog->sha1)) {
+		guint32 p = pointer_to_uint(htable_lookup(prog->sha1, rec->sha1));
+
+		for (/* empty */; p != 0; p = prog->sha1_next[p - 1])
+			prog->hits[prog->nhits++] = p - 1;
+	}
+
+	switch (host_addr_net(rec->results_set->addr)) {
+	case NET_TYPE_IPV4:
+		filter_prog_lookup_ip(prog, &prog->ip[FILTER_IP_V4],
+			rec->results_set->addr);
+		break;
+	case NET_TYPE_IPV6:
+		filter_prog_lookup_ip(prog, &prog->ip[FILTER_IP_V6],
+			rec->results_set->addr);
+		break;
+	case NET_TYPE_LOCAL:
+	case NET_TYPE_NONE:
+		break;
+	}
+
+	if (prog->nhits > 1)
+		vsort(prog->hits, prog->nhits, sizeof prog->hits[0], filter_pos_cmp);
+}
+
+/**
+ * Evaluate a rule against the record of the filtering context.
+ *
+ * @return whether the rule matches, taking negation into account.
+ */
+static gboolean
+filter_rule_match(const rule_t *r, struct filter_context *ctx,
+	const filter_result_t *res)
+{
+	const struct record *rec = ctx->rec;
+    gboolean match = FALSE;
+	gint i;
+
+    if (GUI_PROPERTY(gui_debug) >= 10)
+        g_debug("trying to match against: %s", filter_rule_to_string(r));
+
+    if (RULE_IS_ACTIVE(r)) {
+        switch (r->type){
+        case RULE_JUMP:
+            match = TRUE;
+            break;
+        case RULE_TEXT: {
+			const gchar *l_name, *utf8_name;
+
+			filter_context_names(ctx);
+			l_name = ctx->l_name;
+			utf8_name = ctx->utf8_name;
+
+            switch (r->u.text.type) {
+            case RULE_TEXT_EXACT:
+                if (
+					0 == strcmp(r->u.text.case_sensitive ?
+						ctx->utf8_name : ctx->l_name, r->u.text.match)
+				)
+                    match = TRUE;
+                break;
+            case RULE_TEXT_PREFIX:
+                if (
+					0 == strncmp(r->u.text.case_sensitive ?
+						ctx->utf8_name : ctx->l_name,
+						r->u.text.match, r->u.text.match_len)
+				)
+                    match = TRUE;
+                break;
+            case RULE_TEXT_WORDS:	/* Contains ALL the words */
+                {
+                    GList *iter;
+					gboolean failed = FALSE;
+
+                    for (
+                        iter = g_list_first(r->u.text.u.words);
+                        iter && !failed;
+                        iter = g_list_next(iter)
+                    ) {
+                        if (
+							NULL == pattern_qsearch(iter->data,
+								r->u.text.case_sensitive ?
+									ctx->utf8_name : ctx->l_name,
+								0, 0, qs_any)
+						)
+                            failed = TRUE;
+                    }
+
+					match = !failed;
+                }
+                break;
+            case RULE_TEXT_SUFFIX: {
+				size_t namelen = r->u.text.case_sensitive ?
+					ctx->utf8_len : ctx->l_len;
+				size_t n;
+                n = r->u.text.match_len;
+				/* FIXME: > is WRONG, isn't that OBVIOUS?!!?!*/
+                if (namelen > n
+                    && strcmp((r->u.text.case_sensitive
+                           ? utf8_name : l_name) + namelen
+                          - n, r->u.text.match) == 0)
+                    match = TRUE;
+			   }
+                break;
+            case RULE_TEXT_SUBSTR:
+                if (
+					NULL != pattern_qsearch(
+						r->u.text.u.pattern,
+						r->u.text.case_sensitive ?
+							ctx->utf8_name : ctx->l_name,
+						0, 0, qs_any)
+				)
+                    match = TRUE;
+                break;
+            case RULE_TEXT_REGEXP:
+                if (
+					0 == (i = regexec(r->u.text.u.re,
+						r->u.text.case_sensitive ?
+							ctx->utf8_name : ctx->l_name, 0, NULL, 0))
+				)
+                    match = TRUE;
+                if (i == REG_ESPACE)
+                    g_warning("%s(): regexp memory overflow", G_STRFUNC);
+                break;
+            default:
+                g_error("%s(): unknown text rule type: %d",
+					G_STRFUNC, r->u.text.type);
+            }
+            break;
+		}
+        case RULE_IP:
+			match = host_addr_matches(rec->results_set->addr,
+						r->u.ip.addr, r->u.ip.cidr);
+            break;
+        case RULE_SIZE:
+            if (rec->size >= r->u.size.lower &&
+                rec->size <= r->u.size.upper)
+                match = TRUE;
+            break;
+        case RULE_SHA1:
+            if (rec->sha1 == r->u.sha1.hash)
+                match = TRUE;
+            else if (rec->sha1 != NULL && r->u.sha1.hash != NULL)
+                if (sha1_eq(rec->sha1, r->u.sha1.hash))
+                    match = TRUE;
+            break;
+        case RULE_FLAG:
+            {
+                gboolean stable_match;
+                gboolean busy_match;
+                gboolean push_match;
+
+                stable_match =
+                    (
+						r->u.flag.busy == RULE_FLAG_SET &&
+						(rec->results_set->status & ST_BUSY)
+					) ||
+                    (
+						r->u.flag.busy == RULE_FLAG_UNSET &&
+						!(rec->results_set->status & ST_BUSY)
+					) ||
+                    r->u.flag.busy == RULE_FLAG_IGNORE;
+
+                busy_match =
+                    (
+						r->u.flag.push == RULE_FLAG_SET &&
+						(rec->results_set->status & ST_FIREWALL)
+					) ||
+                    (
+						(r->u.flag.push == RULE_FLAG_UNSET) &&
+						!(rec->results_set->status & ST_FIREWALL)
+					) ||
+                    r->u.flag.push == RULE_FLAG_IGNORE;
+
+                push_match =
+                    (
+						r->u.flag.stable == RULE_FLAG_SET &&
+						(rec->results_set->status & ST_UPLOADED)
+					) ||
+                    (
+						r->u.flag.stable == RULE_FLAG_UNSET &&
+						!(rec->results_set->status & ST_UPLOADED)
+					) ||
+					r->u.flag.stable == RULE_FLAG_IGNORE;
+
+                match = stable_match && busy_match && push_match;
+            }
+            break;
+        case RULE_STATE:
+            {
+                gboolean display_match;
+                gboolean download_match;
+
+                display_match =
+                    (r->u.state.display == FILTER_PROP_STATE_IGNORE) ||
+                    (res->props[FILTER_PROP_DISPLAY].state
+                        == r->u.state.display);
+
+                download_match =
+                    (r->u.state.download == FILTER_PROP_STATE_IGNORE) ||
+                    (res->props[FILTER_PROP_DOWNLOAD].state
+                        == r->u.state.download);
+
+                match = display_match && download_match;
+            }
+            break;
+        default:
+            g_error("Unknown rule type: %d", r->type);
+            break;
+        }
+    }
+
+    /*
+     * If negate is set, we invert the meaning of match.
+     */
+
+	if (RULE_IS_NEGATED(r) && RULE_IS_ACTIVE(r))
+		match = !match;
+
+	return match;
+}
+
 #define MATCH_RULE(filter, r, res)									\
 do {																\
     (res)->props_set++;												\
@@ -2068,19 +2938,23 @@ do {																\
  * returns the number of properties set with this filter chain.
  * a property which was already set is not set again. The res
  * argument is changed depending on the rules that match.
+ *
+ * Only the rules which cannot be indexed by the compiled ruleset are
+ * evaluated, the others being visited only when the indices report they
+ * match the record.  Rules are visited in ruleset order, and evaluation
+ * stops where a linear walk of the ruleset would have stopped.
  */
 static int
 filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 {
-    GList *list;
+	struct filter_prog *prog;
     gint prop_count = 0;
     gboolean do_abort = FALSE;
-	const struct record *rec;
+	size_t d = 0, h = 0, stop = 0;
 
     g_assert(filter != NULL);
     g_assert(ctx != NULL);
-	rec = ctx->rec;
-	record_check(rec);
+	record_check(ctx->rec);
     g_assert(res != NULL);
 
     /*
@@ -2092,212 +2966,38 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 
     filter->visited = TRUE;
 
-    list = filter->ruleset;
-
-	list = g_list_first(list);
-	while (list != NULL && res->props_set < MAX_FILTER_PROP && !do_abort) {
-        gboolean match = FALSE;
-		rule_t *r;
-		gint i;
-
-        r = list->data;
-        if (GUI_PROPERTY(gui_debug) >= 10)
-            g_debug("trying to match against: %s", filter_rule_to_string(r));
-
-        if (RULE_IS_ACTIVE(r)) {
-            switch (r->type){
-            case RULE_JUMP:
-                match = TRUE;
-                break;
-            case RULE_TEXT: {
-				const gchar *l_name = ctx->l_name;
-				const gchar *utf8_name = ctx->utf8_name;
-
-				if (utf8_name == NULL) {
-					ctx->utf8_name = utf8_name = atom_str_get(rec->utf8_name);
-					ctx->utf8_len = strlen(utf8_name);
-				}
-
-				if (l_name == NULL) {
-					gchar *s = utf8_strlower_copy(utf8_name);
-
-					/*
-					 * Cache for further rules, to avoid costly utf8
-					 * lowercasing transformation for each text-matching
-					 * rule they have configured.
-					 */
-
-					ctx->l_name = atom_str_get(s);
-					ctx->l_len = strlen(ctx->l_name);
-					l_name = ctx->l_name;
-
-					hfree(s);
-				}
-
-                switch (r->u.text.type) {
-                case RULE_TEXT_EXACT:
-                    if (
-						0 == strcmp(r->u.text.case_sensitive ?
-							ctx->utf8_name : ctx->l_name, r->u.text.match)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_PREFIX:
-                    if (
-						0 == strncmp(r->u.text.case_sensitive ?
-							ctx->utf8_name : ctx->l_name,
-							r->u.text.match, r->u.text.match_len)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_WORDS:	/* Contains ALL the words */
-                    {
-                        GList *iter;
-						gboolean failed = FALSE;
-
-                        for (
-                            iter = g_list_first(r->u.text.u.words);
-                            iter && !failed;
-                            iter = g_list_next(iter)
-                        ) {
-                            if (
-								NULL == pattern_qsearch(iter->data,
-									r->u.text.case_sensitive ?
-										ctx->utf8_name : ctx->l_name,
-									0, 0, qs_any)
-							)
-                                failed = TRUE;
-                        }
-
-						match = !failed;
-                    }
-                    break;
-                case RULE_TEXT_SUFFIX: {
-					size_t namelen = r->u.text.case_sensitive ?
-						ctx->utf8_len : ctx->l_len;
-					size_t n;
-                    n = r->u.text.match_len;
-					/* FIXME: > is WRONG, isn't that OBVIOUS?!!?!*/
-                    if (namelen > n
-                        && strcmp((r->u.text.case_sensitive
-                               ? utf8_name : l_name) + namelen
-                              - n, r->u.text.match) == 0)
-                        match = TRUE;
-				   }
-                    break;
-                case RULE_TEXT_SUBSTR:
-                    if (
-						NULL != pattern_qsearch(
-							r->u.text.u.pattern,
-							r->u.text.case_sensitive ?
-								ctx->utf8_name : ctx->l_name,
-							0, 0, qs_any)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_REGEXP:
-                    if (
-						0 == (i = regexec(r->u.text.u.re,
-							r->u.text.case_sensitive ?
-								ctx->utf8_name : ctx->l_name, 0, NULL, 0))
-					)
-                        match = TRUE;
-                    if (i == REG_ESPACE)
-                        g_warning("%s(): regexp memory overflow", G_STRFUNC);
-                    break;
-                default:
-                    g_error("%s(): unknown text rule type: %d",
-						G_STRFUNC, r->u.text.type);
-                }
-                break;
-			}
-            case RULE_IP:
-				match = host_addr_matches(rec->results_set->addr,
-							r->u.ip.addr, r->u.ip.cidr);
-                break;
-            case RULE_SIZE:
-                if (rec->size >= r->u.size.lower &&
-                    rec->size <= r->u.size.upper)
-                    match = TRUE;
-                break;
-            case RULE_SHA1:
-                if (rec->sha1 == r->u.sha1.hash)
-                    match = TRUE;
-                else if (rec->sha1 != NULL && r->u.sha1.hash != NULL)
-                    if (sha1_eq(rec->sha1, r->u.sha1.hash))
-                        match = TRUE;
-                break;
-            case RULE_FLAG:
-                {
-                    gboolean stable_match;
-                    gboolean busy_match;
-                    gboolean push_match;
-
-                    stable_match =
-                        (
-							r->u.flag.busy == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_BUSY)
-						) ||
-                        (
-							r->u.flag.busy == RULE_FLAG_UNSET &&
-							!(rec->results_set->status & ST_BUSY)
-						) ||
-                        r->u.flag.busy == RULE_FLAG_IGNORE;
-
-                    busy_match =
-                        (
-							r->u.flag.push == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_FIREWALL)
-						) ||
-                        (
-							(r->u.flag.push == RULE_FLAG_UNSET) &&
-							!(rec->results_set->status & ST_FIREWALL)
-						) ||
-                        r->u.flag.push == RULE_FLAG_IGNORE;
-
-                    push_match =
-                        (
-							r->u.flag.stable == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_UPLOADED)
-						) ||
-                        (
-							r->u.flag.stable == RULE_FLAG_UNSET &&
-							!(rec->results_set->status & ST_UPLOADED)
-						) ||
-						r->u.flag.stable == RULE_FLAG_IGNORE;
-
-                    match = stable_match && busy_match && push_match;
-                }
-                break;
-            case RULE_STATE:
-                {
-                    gboolean display_match;
-                    gboolean download_match;
+	if (NULL == filter->prog)
+		filter->prog = filter_prog_compile(filter);
 
-                    display_match =
-                        (r->u.state.display == FILTER_PROP_STATE_IGNORE) ||
-                        (res->props[FILTER_PROP_DISPLAY].state
-                            == r->u.state.display);
+	prog = filter->prog;
 
-                    download_match =
-                        (r->u.state.download == FILTER_PROP_STATE_IGNORE) ||
-                        (res->props[FILTER_PROP_DOWNLOAD].state
-                            == r->u.state.download);
+	if (res->props_set < MAX_FILTER_PROP)
+		filter_prog_lookup(prog, ctx);
 
-                    match = display_match && download_match;
-                }
-                break;
-            default:
-                g_error("Unknown rule type: %d", r->type);
-                break;
-            }
-        }
-        /*
-         * If negate is set, we invert the meaning of match.
-         */
+	while (
+		(d < prog->ndynamic || h < prog->nhits) &&
+		res->props_set < MAX_FILTER_PROP && !do_abort
+	) {
+		gboolean match;
+		guint32 pos;
+		rule_t *r;
 
-		if (RULE_IS_NEGATED(r) && RULE_IS_ACTIVE(r))
-			match = !match;
+		/*
+		 * Merge the positions of rules evaluated each time with the ones
+		 * of indexed rules known to match the record.
+		 */
+
+		if (h == prog->nhits || (
+			d < prog->ndynamic && prog->dynamic[d] < prog->hits[h]
+		)) {
+			pos = prog->dynamic[d++];
+			r = prog->rules[pos];
+			match = filter_rule_match(r, ctx, res);
+		} else {
+			pos = prog->hits[h++];
+			r = prog->rules[pos];
+			match = TRUE;
+		}
 
         /*
          * Try to match the builtin rules, but don't act on matches
@@ -2305,6 +3005,9 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
          * defined.
          */
         if (match) {
+			prog->matched[pos]++;
+			stop = pos + 1;		/* In case we stop here */
+
             if (r->target == filter_return) {
                 do_abort = TRUE;
                 r->match_count ++;
@@ -2351,13 +3054,19 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
                 prop_count += filter_apply(r->target, ctx, res);
                 r->match_count ++;
             }
-        } else {
-            r->fail_count ++;
         }
-
-		list = g_list_next(list);
 	}
 
+	/*
+	 * Unless we stopped early, all the rules were visited.  Failure
+	 * counts of the rules are derived from this when statistics are
+	 * synchronized, see filter_prog_sync().
+	 */
+
+	if (!do_abort && res->props_set < MAX_FILTER_PROP)
+		stop = prog->count;
+	prog->stopped[stop]++;
+
     filter->visited = FALSE;
     filter->fail_count += MAX_FILTER_PROP - prop_count;
     filter->match_count += prop_count;
@@ -2496,6 +3205,7 @@ filter_preset_init(const char *name, const char *regexp, filesize_t minsize)
 	filter = filter_find_by_name_in_session(name);
 	if (filter) {
 		/* Remove all rules, we want to keep this filters up-to-date */
+		filter_invalidate(filter);
 		while (NULL != filter->ruleset) {
 			rule_t *rule;
 		
@@ -2621,8 +3331,18 @@ filter_update_targets(void)
 void
 filter_rule_reset_stats(rule_t *rule)
 {
+	GList *l;
+
     g_assert(rule != NULL);
 
+	/*
+	 * Fold pending statistics first, or they would be added back to
+	 * the rule later on.
+	 */
+
+	for (l = filters; l != NULL; l = g_list_next(l))
+		filter_sync_stats(l->data);
+
     rule->match_count = rule->fail_count = 0;
 }
 
@@ -35,6 +35,7 @@
  */
 
 struct record;
+struct filter_prog;
 
 typedef struct filter {
     const gchar *name;
@@ -45,6 +46,7 @@ typedef struct filter {
     guint32 flags;
     guint32 match_count;
     guint32 fail_count;
+    struct filter_prog *prog;	/**< compiled ruleset, NULL if stale */
 } filter_t;
 
 enum {
@@ -174,6 +176,7 @@ gboolean filter_is_builtin(const filter_t *f);
 gboolean filter_is_modifiable(const filter_t *f);
 gboolean filter_is_global(const filter_t *f);
 void filter_reset_stats(filter_t *filter);
+void filter_sync_stats(filter_t *filter);
 void filter_rule_reset_stats(rule_t *rule);
 rule_t *filter_duplicate_rule(const rule_t *rule);
 rule_t *filter_new_ip_rule(const host_addr_t addr,
@@ -1139,7 +1139,7 @@ search_gui_add_record(search_t *sch, record_t *rc, enum gui_color color)
 		} else { /* Add as a parent */
 			gconstpointer key;
 
-			key = atom_sha1_get(rc->sha1);	/* New parent, need new atom ref */
+			key = atom_sha1_ref(rc->sha1);	/* New parent, need new atom ref */
 
 			titles[c_sr_size] = short_size(rc->size, show_metric_units());
 
@@ -1369,7 +1369,7 @@ search_gui_remove_result(struct search *search, GtkCTreeNode *node)
 			 * for the new parent.
 			 */
 			remove_parent_with_sha1(search, rc->sha1);
-			key = atom_sha1_get(rc->sha1);
+			key = atom_sha1_ref(rc->sha1);
 			add_parent_with_sha1(search, key, child_node);
 		} else {
 			/* The row has no children, remove it's sha1 and the row itself */